@@ -0,0 +1,264 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dag_builder.h"
+
+#include <algorithm>
+
+void DagBuilder::ProcessEvent(ProfilerEvent const &event) {
+	if (event.Type == EventType::FrameStart) {
+		OnFrameStart(event);
+		return;
+	}
+	// Warmup iterations, and anything else outside a frame, aren't part of the graph
+	if (!m_inFrame) {
+		return;
+	}
+
+	switch (event.Type) {
+	case EventType::FrameEnd:
+		OnFrameEnd(event);
+		break;
+	case EventType::TaskStart: {
+		uint32_t counter;
+		auto const iter = m_counterIds.find(event.SpanId);
+		if (iter != m_counterIds.end()) {
+			counter = iter->second;
+		} else {
+			// Added before the frame started. The task will be ready at the start of the replay
+			counter = GetCounterForAdd(event.SpanId);
+		}
+		++m_counters[counter].Started;
+
+		FiberTrack &fiber = GetFiber(event.FiberIndex);
+		fiber.Task = StartTask(counter);
+		fiber.RunningSince = event.Timestamp;
+		fiber.Suspended = false;
+		break;
+	}
+	case EventType::TaskEnd: {
+		FiberTrack &fiber = GetFiber(event.FiberIndex);
+		if (fiber.Task != kNoTask) {
+			AddRun(&fiber, event.Timestamp);
+			fiber.LastTask = fiber.Task;
+			fiber.Task = kNoTask;
+		}
+		break;
+	}
+	case EventType::TasksAdded: {
+		uint32_t const counter = GetCounterForAdd(event.SpanId);
+		m_counters[counter].Added += event.NameId;
+
+		FiberTrack &fiber = GetFiber(event.FiberIndex);
+		AddRun(&fiber, event.Timestamp);
+		uint32_t const owner = fiber.Task != kNoTask ? fiber.Task : fiber.LastTask;
+		if (owner == kNoTask) {
+			m_counters[counter].AddedOutsideTasks += event.NameId;
+			break;
+		}
+		m_tasks[owner].Steps.push_back({DagStepKind::Spawn, counter, event.NameId, 0});
+		break;
+	}
+	case EventType::CounterWait:
+		OnCounterWait(event, true);
+		break;
+	case EventType::CounterSatisfied:
+		OnCounterWait(event, false);
+		break;
+	case EventType::FiberSuspend: {
+		FiberTrack &fiber = GetFiber(event.FiberIndex);
+		if (fiber.Task != kNoTask) {
+			fiber.Suspended = true;
+			fiber.SuspendedAt = event.Timestamp;
+		}
+		break;
+	}
+	case EventType::FiberResume:
+		OnFiberResume(event);
+		break;
+	case EventType::SpanStart:
+	case EventType::SpanEnd:
+	case EventType::FrameStart:
+	default:
+		break;
+	}
+}
+
+DagBuilder::FiberTrack &DagBuilder::GetFiber(uint32_t const fiberIndex) {
+	if (fiberIndex >= m_fibers.size()) {
+		m_fibers.resize(fiberIndex + 1);
+	}
+	return m_fibers[fiberIndex];
+}
+
+void DagBuilder::AddRun(FiberTrack *fiber, uint64_t const now) {
+	if (fiber->Task == kNoTask) {
+		return;
+	}
+
+	if (now > fiber->RunningSince) {
+		std::vector<DagStep> &steps = m_tasks[fiber->Task].Steps;
+		uint64_t const ns = now - fiber->RunningSince;
+		if (!steps.empty() && steps.back().Kind == DagStepKind::Run) {
+			steps.back().Ns += ns;
+		} else {
+			steps.push_back({DagStepKind::Run, kNoDagCounter, 0, ns});
+		}
+	}
+	fiber->RunningSince = now;
+}
+
+uint32_t DagBuilder::StartTask(uint32_t const counter) {
+	m_tasks.push_back({counter, {}});
+	return static_cast<uint32_t>(m_tasks.size() - 1);
+}
+
+uint32_t DagBuilder::GetCounterForAdd(uint64_t const address) {
+	auto const iter = m_counterIds.find(address);
+	if (iter != m_counterIds.end() && !m_counters[iter->second].Drained) {
+		return iter->second;
+	}
+
+	m_counters.emplace_back();
+	auto const counter = static_cast<uint32_t>(m_counters.size() - 1);
+	m_counterIds[address] = counter;
+	return counter;
+}
+
+void DagBuilder::OnFrameStart(ProfilerEvent const &event) {
+	m_inFrame = true;
+	m_frameStart = event.Timestamp;
+	m_rootFiber = event.FiberIndex;
+
+	for (FiberTrack &fiber : m_fibers) {
+		fiber = FiberTrack();
+	}
+	m_tasks.clear();
+	m_counters.clear();
+	m_counterIds.clear();
+
+	FiberTrack &root = GetFiber(m_rootFiber);
+	root.Task = StartTask(kNoDagCounter);
+	root.RunningSince = event.Timestamp;
+}
+
+void DagBuilder::OnFrameEnd(ProfilerEvent const &event) {
+	m_inFrame = false;
+	AddRun(&GetFiber(m_rootFiber), event.Timestamp);
+
+	m_frame.Clear();
+	m_frame.RecordedNs = event.Timestamp - m_frameStart;
+
+	// Group the tasks by counter, keeping them in the order they started. The root stays first
+	m_frame.Counters.resize(m_counters.size(), DagCounter{0, 0, 0});
+	for (size_t i = 1; i < m_tasks.size(); ++i) {
+		++m_frame.Counters[m_tasks[i].Counter].TaskCount;
+	}
+	uint32_t nextTask = 1;
+	for (size_t i = 0; i < m_counters.size(); ++i) {
+		DagCounter &counter = m_frame.Counters[i];
+		counter.FirstTask = nextTask;
+		nextTask += counter.TaskCount;
+
+		// Whatever wasn't added by a task of the frame is ready from the start
+		BuildCounter const &built = m_counters[i];
+		uint32_t const addedByTasks = built.Added - built.AddedOutsideTasks;
+		counter.ReadyAtStart = built.Started > addedByTasks ? std::min(built.Started - addedByTasks, counter.TaskCount) : 0;
+	}
+
+	std::vector<uint32_t> order(m_tasks.size());
+	std::vector<uint32_t> placed(m_counters.size(), 0);
+	order[0] = 0;
+	for (size_t i = 1; i < m_tasks.size(); ++i) {
+		uint32_t const counter = m_tasks[i].Counter;
+		order[m_frame.Counters[counter].FirstTask + placed[counter]++] = static_cast<uint32_t>(i);
+	}
+
+	m_frame.Tasks.reserve(m_tasks.size());
+	for (uint32_t const index : order) {
+		BuildTask const &task = m_tasks[index];
+		m_frame.Tasks.push_back({task.Counter, static_cast<uint32_t>(m_frame.Steps.size()), static_cast<uint32_t>(task.Steps.size())});
+		m_frame.Steps.insert(m_frame.Steps.end(), task.Steps.begin(), task.Steps.end());
+	}
+
+	if (!WriteDagFrame(m_file, m_frame)) {
+		m_writeFailed = true;
+	}
+	++m_frameCount;
+}
+
+void DagBuilder::OnCounterWait(ProfilerEvent const &event, bool const suspended) {
+	FiberTrack &fiber = GetFiber(event.FiberIndex);
+	if (fiber.Task == kNoTask) {
+		return;
+	}
+
+	auto const iter = m_counterIds.find(event.SpanId);
+	uint32_t const counter = iter != m_counterIds.end() ? iter->second : kNoDagCounter;
+	if (counter == kNoDagCounter) {
+		// Nothing in the graph to wait for. If the wait didn't suspend, it doesn't matter for the replay either
+		if (!suspended) {
+			return;
+		}
+		++m_unmatchedWaits;
+	}
+
+	AddRun(&fiber, event.Timestamp);
+	std::vector<DagStep> &steps = m_tasks[fiber.Task].Steps;
+	steps.push_back({DagStepKind::Wait, counter, event.NameId, 0});
+
+	uint32_t const drains = counter != kNoDagCounter && event.NameId == 0 ? counter : kNoDagCounter;
+	if (!suspended) {
+		if (drains != kNoDagCounter) {
+			m_counters[drains].Drained = true;
+		}
+		return;
+	}
+
+	fiber.WaitStep = static_cast<uint32_t>(steps.size() - 1);
+	fiber.WaitDrains = drains;
+}
+
+void DagBuilder::OnFiberResume(ProfilerEvent const &event) {
+	FiberTrack &fiber = GetFiber(event.FiberIndex);
+	if (fiber.Task == kNoTask || !fiber.Suspended) {
+		return;
+	}
+
+	uint64_t const blockedNs = event.Timestamp - fiber.SuspendedAt;
+	if (fiber.WaitStep != kNoTask) {
+		m_tasks[fiber.Task].Steps[fiber.WaitStep].Ns = blockedNs;
+		if (fiber.WaitDrains != kNoDagCounter) {
+			m_counters[fiber.WaitDrains].Drained = true;
+		}
+	} else {
+		// Suspended by something other than WaitForCounter(). All we know is how long it took
+		m_tasks[fiber.Task].Steps.push_back({DagStepKind::Wait, kNoDagCounter, 0, blockedNs});
+	}
+
+	fiber.Suspended = false;
+	fiber.WaitStep = kNoTask;
+	fiber.WaitDrains = kNoDagCounter;
+	fiber.RunningSince = event.Timestamp;
+}
@@ -0,0 +1,139 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "profiler.h"
+#include "replay/task_dag.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Rebuilds the task graph of each frame from the events recorded by ProfilerState, and writes it out. See task_dag.h
+ *
+ * Each task becomes a list of steps: the time it ran between scheduler calls, the tasks it added, and the counters it
+ * waited on. The time a task spent suspended isn't part of its cost, since that's what the replay predicts
+ *
+ * Counters are matched up by address. A counter that is added to after it was waited on starts a new DagCounter, so
+ * stack counters that are reused across calls are told apart. Tasks are matched to the adds of their counter in the
+ * order they started. Waits on anything else (e.g. a Fibtex's flag) keep the time they were suspended in the recording
+ */
+class DagBuilder {
+public:
+	/**
+	 * @param file    Where to write the frames. It must stay open until the builder is done
+	 */
+	explicit DagBuilder(FILE *file)
+	        : m_file(file) {
+	}
+
+	DagBuilder(DagBuilder const &) = delete;
+	DagBuilder(DagBuilder &&) noexcept = delete;
+	DagBuilder &operator=(DagBuilder const &) = delete;
+	DagBuilder &operator=(DagBuilder &&) noexcept = delete;
+	~DagBuilder() = default;
+
+private:
+	constexpr static uint32_t kNoTask = 0xFFFFFFFF;
+
+	struct FiberTrack {
+		/* The task running on the fiber, or kNoTask */
+		uint32_t Task{kNoTask};
+		/* The last task that finished on the fiber. Continuations are queued after the task finishes */
+		uint32_t LastTask{kNoTask};
+		/* When the task last started running */
+		uint64_t RunningSince{0};
+		bool Suspended{false};
+		uint64_t SuspendedAt{0};
+		/* The Wait step the fiber is suspended in, if any */
+		uint32_t WaitStep{kNoTask};
+		/* The counter use that the wait finishes, or kNoDagCounter */
+		uint32_t WaitDrains{kNoDagCounter};
+	};
+
+	struct BuildTask {
+		uint32_t Counter;
+		std::vector<DagStep> Steps;
+	};
+
+	struct BuildCounter {
+		uint32_t Added{0};
+		uint32_t Started{0};
+		/* Tasks added by a fiber that wasn't running a task of the frame */
+		uint32_t AddedOutsideTasks{0};
+		/* True once the counter was waited on to 0. The next add starts a new BuildCounter */
+		bool Drained{false};
+	};
+
+	FILE *m_file;
+	bool m_inFrame{false};
+	uint64_t m_frameStart{0};
+	uint32_t m_rootFiber{0};
+
+	std::vector<FiberTrack> m_fibers;
+	std::vector<BuildTask> m_tasks;
+	std::vector<BuildCounter> m_counters;
+	/* The current use of each counter address */
+	std::unordered_map<uint64_t, uint32_t> m_counterIds;
+
+	DagFrame m_frame;
+	uint64_t m_frameCount{0};
+	uint64_t m_unmatchedWaits{0};
+	bool m_writeFailed{false};
+
+public:
+	/**
+	 * Processes the next event
+	 *
+	 * @param event    The event. Events must be given in time order. See ProfilerState::GetEvents()
+	 */
+	void ProcessEvent(ProfilerEvent const &event);
+
+	uint64_t GetFrameCount() const {
+		return m_frameCount;
+	}
+	/* The number of waits on something that wasn't a counter of the frame */
+	uint64_t GetUnmatchedWaitCount() const {
+		return m_unmatchedWaits;
+	}
+	bool WriteFailed() const {
+		return m_writeFailed;
+	}
+
+private:
+	FiberTrack &GetFiber(uint32_t fiberIndex);
+	/* Ends the fiber's current Run step at now */
+	void AddRun(FiberTrack *fiber, uint64_t now);
+	uint32_t StartTask(uint32_t counter);
+	/* Gets the current use of the counter at address. If it has been drained, or never used, a new one is started */
+	uint32_t GetCounterForAdd(uint64_t address);
+
+	void OnFrameStart(ProfilerEvent const &event);
+	void OnFrameEnd(ProfilerEvent const &event);
+	void OnCounterWait(ProfilerEvent const &event, bool suspended);
+	void OnFiberResume(ProfilerEvent const &event);
+};
@@ -22,105 +22,505 @@
  * limitations under the License.
  */
 
+#include "dag_builder.h"
+#include "optick_profiler.h"
 #include "profiler.h"
+#include "workloads/workload.h"
 
-#include "ftl/task_counter.h"
 #include "ftl/task_scheduler.h"
 
-#include <array>
+#include <algorithm>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <thread>
+#include <vector>
 
-void Consumer(ftl::TaskScheduler * /*scheduler*/, void *arg) {
-	PROFILE_SPAN("Test");
+struct SimOptions {
+	/* The workloads to run. Empty means all of them */
+	std::vector<std::string> Workloads;
+	unsigned Threads = std::max(1U, std::thread::hardware_concurrency());
+	unsigned Fibers = 400;
+	unsigned MaxFibers = 4096;
+	ftl::EmptyQueueBehavior Behavior = ftl::EmptyQueueBehavior::Sleep;
+	ftl::ThreadPinning Pinning = ftl::ThreadPinning::None;
+	/* 0 means each workload's default size */
+	unsigned Size = 0;
+	unsigned Iterations = 10;
+	unsigned Warmup = 1;
+	/* Run with 1, 2, 4, ... threads, up to Threads */
+	bool Sweep = false;
+	/* If not empty, record a profile and write it to this file */
+	std::string ProfilePath;
+	/* If not empty, record the task graph of each timed iteration, and write it to this file. See ftl-replay */
+	std::string RecordPath;
+	/* If not empty, capture the timed iterations with Optick, and save the capture to this file */
+	std::string OptickPath;
+};
 
-	auto *globalCounter = reinterpret_cast<std::atomic<unsigned> *>(arg);
+static void PrintUsage(char const *exe) {
+	printf("Usage: %s [options]\n"
+	       "\n"
+	       "Runs each workload, and prints one JSON object per run to stdout\n"
+	       "\n"
+	       "Options:\n"
+	       "  --workload=NAME[,NAME...]  The workloads to run (default: all)\n"
+	       "  --threads=N                The number of worker threads, including the main thread (default: hardware threads)\n"
+	       "  --fibers=N                 The initial fiber pool size (default: 400)\n"
+	       "  --max-fibers=N             The size the fiber pool can grow to (default: 4096)\n"
+	       "  --behavior=spin|yield|sleep  What idle threads do (default: sleep)\n"
+	       "  --pinning=none|physical|smt  How threads are pinned to CPUs (default: none)\n"
+	       "  --size=N                   The problem size (default: per workload, see --list)\n"
+	       "  --iterations=N             The number of timed iterations (default: 10)\n"
+	       "  --warmup=N                 The number of untimed iterations before those (default: 1)\n"
+	       "  --sweep                    Repeat each run with 1, 2, 4, ... threads, up to --threads\n"
+	       "  --profile=PATH             Record a profile of the run, and write it to PATH. Needs a single run\n"
+	       "  --record=PATH              Record the task graph of each timed iteration, and write it to PATH for ftl-replay.\n"
+	       "                             Needs a single run\n"
+	       "  --optick=PATH              Capture the timed iterations with Optick, one frame each, and save the capture to PATH.\n"
+	       "                             .opt is appended if PATH doesn't end in it. Needs a single run, and a build with FTL_SIM_OPTICK\n"
+	       "  --list                     List the workloads\n"
+	       "  --help                     Show this message\n",
+	       exe);
+}
+
+static void PrintWorkloads() {
+	for (WorkloadInfo const &info : WorkloadRegistry::GetWorkloads()) {
+		printf("%-20s %s. Size: %s (default %u)\n", info.Name, info.Description, info.SizeDescription, info.DefaultSize);
+	}
+}
+
+static bool ParseUnsigned(char const *text, unsigned *value, unsigned long minimum = 1) {
+	char *end;
+	unsigned long const parsed = strtoul(text, &end, 10);
+	if (end == text || *end != '\0' || parsed < minimum || parsed > 0xFFFFFFFFUL) {
+		return false;
+	}
+
+	*value = static_cast<unsigned>(parsed);
+	return true;
+}
+
+static bool ParseBehavior(std::string const &text, ftl::EmptyQueueBehavior *behavior) {
+	if (text == "spin") {
+		*behavior = ftl::EmptyQueueBehavior::Spin;
+	} else if (text == "yield") {
+		*behavior = ftl::EmptyQueueBehavior::Yield;
+	} else if (text == "sleep") {
+		*behavior = ftl::EmptyQueueBehavior::Sleep;
+	} else {
+		return false;
+	}
 
-	globalCounter->fetch_add(1);
-	//std::this_thread::sleep_for(std::chrono::microseconds(500));
+	return true;
 }
 
-void Producer(ftl::TaskScheduler *taskScheduler, void *arg) {
-	PROFILE_SPAN("Test");
-	constexpr unsigned kNumConsumerTasks = 50U;
+static bool ParsePinning(std::string const &text, ftl::ThreadPinning *pinning) {
+	if (text == "none") {
+		*pinning = ftl::ThreadPinning::None;
+	} else if (text == "physical") {
+		*pinning = ftl::ThreadPinning::PhysicalCores;
+	} else if (text == "smt") {
+		*pinning = ftl::ThreadPinning::SmtSiblings;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static char const *BehaviorName(ftl::EmptyQueueBehavior const behavior) {
+	switch (behavior) {
+	case ftl::EmptyQueueBehavior::Spin:
+		return "spin";
+	case ftl::EmptyQueueBehavior::Yield:
+		return "yield";
+	case ftl::EmptyQueueBehavior::Sleep:
+	default:
+		return "sleep";
+	}
+}
 
-	auto *tasks = new ftl::Task[kNumConsumerTasks];
-	for (unsigned i = 0; i < kNumConsumerTasks; ++i) {
-		tasks[i] = {Consumer, arg};
+static char const *PinningName(ftl::ThreadPinning const pinning) {
+	switch (pinning) {
+	case ftl::ThreadPinning::PhysicalCores:
+		return "physical";
+	case ftl::ThreadPinning::SmtSiblings:
+		return "smt";
+	case ftl::ThreadPinning::None:
+	default:
+		return "none";
 	}
+}
+
+/**
+ * Parses the command line into options
+ *
+ * @return    0 to run the workloads, 1 if the process should exit successfully (e.g. --help), -1 on errors
+ */
+static int ParseArgs(int argc, char **argv, SimOptions *options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string const arg = argv[i];
+		size_t const equals = arg.find('=');
+		std::string const name = arg.substr(0, equals);
+		std::string const value = equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+
+		bool valid = true;
+		if (name == "--help") {
+			PrintUsage(argv[0]);
+			return 1;
+		} else if (name == "--list") {
+			PrintWorkloads();
+			return 1;
+		} else if (name == "--sweep") {
+			options->Sweep = true;
+		} else if (name == "--workload") {
+			options->Workloads.clear();
+			if (value != "all") {
+				size_t start = 0;
+				while (start <= value.size()) {
+					size_t const comma = std::min(value.find(',', start), value.size());
+					options->Workloads.push_back(value.substr(start, comma - start));
+					start = comma + 1;
+				}
+			}
+		} else if (name == "--threads") {
+			valid = ParseUnsigned(value.c_str(), &options->Threads);
+		} else if (name == "--fibers") {
+			valid = ParseUnsigned(value.c_str(), &options->Fibers);
+		} else if (name == "--max-fibers") {
+			valid = ParseUnsigned(value.c_str(), &options->MaxFibers);
+		} else if (name == "--size") {
+			valid = ParseUnsigned(value.c_str(), &options->Size);
+		} else if (name == "--iterations") {
+			valid = ParseUnsigned(value.c_str(), &options->Iterations);
+		} else if (name == "--warmup") {
+			valid = ParseUnsigned(value.c_str(), &options->Warmup, 0);
+		} else if (name == "--behavior") {
+			valid = ParseBehavior(value, &options->Behavior);
+		} else if (name == "--pinning") {
+			valid = ParsePinning(value, &options->Pinning);
+		} else if (name == "--profile") {
+			options->ProfilePath = value;
+			valid = !value.empty();
+		} else if (name == "--record") {
+			options->RecordPath = value;
+			valid = !value.empty();
+		} else if (name == "--optick") {
+			if (!kOptickAvailable) {
+				fprintf(stderr, "ftl-sim was built without Optick. Reconfigure with -DFTL_SIM_OPTICK=ON\n");
+				return -1;
+			}
+			options->OptickPath = value;
+			// Optick copies the path into a fixed size buffer, with room for the timestamp it may append
+			valid = !value.empty() && value.size() < 400;
+		} else {
+			fprintf(stderr, "Unknown option %s. See --help\n", arg.c_str());
+			return -1;
+		}
 
-	{
-		PROFILE_SPAN("Test", "Producer subsection 1");
-		ftl::TaskCounter counter1(taskScheduler);
-		taskScheduler->AddTasks(kNumConsumerTasks, tasks, ftl::TaskPriority::Low, &counter1);
+		if (!valid) {
+			fprintf(stderr, "Invalid value for %s: '%s'\n", name.c_str(), value.c_str());
+			return -1;
+		}
+	}
 
-		taskScheduler->WaitForCounter(&counter1);
+	for (std::string const &workload : options->Workloads) {
+		if (WorkloadRegistry::Find(workload) == nullptr) {
+			fprintf(stderr, "Unknown workload '%s'. See --list\n", workload.c_str());
+			return -1;
+		}
 	}
 
-	{
-		PROFILE_SPAN("Test", "Producer subsection 2");
+	return 0;
+}
+
+/**
+ * Rebuilds the task graph of each timed iteration from the profiler's events, and writes it to options.RecordPath
+ *
+ * @return    False if the file couldn't be written
+ */
+static bool WriteTaskGraph(WorkloadInfo const &info, SimOptions const &options, unsigned threadCount) {
+	FILE *file = fopen(options.RecordPath.c_str(), "w");
+	if (file == nullptr) {
+		fprintf(stderr, "Failed to open %s\n", options.RecordPath.c_str());
+		return false;
+	}
 
-		ftl::TaskCounter counter2(taskScheduler);
-		taskScheduler->AddTasks(kNumConsumerTasks, tasks, ftl::TaskPriority::Low, &counter2);
+	DagHeader header;
+	header.Workload = info.Name;
+	header.Threads = threadCount;
+	header.Fibers = options.Fibers;
+	header.MaxFibers = options.MaxFibers;
+	header.Behavior = BehaviorName(options.Behavior);
+	WriteDagHeader(file, header);
 
-		taskScheduler->WaitForCounter(&counter2);
+	DagBuilder builder(file);
+	for (ProfilerEvent const &event : GetProfilerEvents()) {
+		builder.ProcessEvent(event);
 	}
 
-	// Cleanup
-	delete[] tasks;
+	bool const success = !builder.WriteFailed() && fclose(file) == 0;
+	if (!success) {
+		fprintf(stderr, "Failed to write %s\n", options.RecordPath.c_str());
+	}
+	return success;
 }
 
-int main() {
+/**
+ * Runs a single workload on a fresh TaskScheduler, and prints the results as one line of JSON
+ *
+ * @return    True if every iteration produced the right result
+ */
+static bool RunWorkload(WorkloadInfo const &info, SimOptions const &options, unsigned threadCount) {
+	bool const recording = !options.RecordPath.empty();
+	// The task graph is rebuilt from the profiler's events
+	bool const profiling = !options.ProfilePath.empty() || recording;
+	bool const optick = !options.OptickPath.empty();
+
 	ftl::TaskScheduler taskScheduler;
-	InitProfiler(&taskScheduler);
-
-	ftl::TaskSchedulerInitOptions options;
-	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
-	options.FiberPoolSize = 200;
-	options.ThreadPoolSize = 12;
-	options.Callbacks.OnFibersCreated = [](void *context, unsigned fiberCount) {
-		RegisterFibers(fiberCount);
-	};
-	options.Callbacks.OnThreadsCreated = [](void *context, unsigned threadCount) {
-		RegisterThreads(threadCount);
-	};
-	options.Callbacks.OnFiberStateChanged = [](void *context, unsigned fiberIndex, ftl::FiberState newState) {
-		switch (newState) {
-		case ftl::FiberState::Attached:
-			FiberResume(fiberIndex);
-			break;
-		case ftl::FiberState::Detached:
-			FiberSuspend(fiberIndex);
-			break;
+	if (profiling) {
+		InitProfiler(&taskScheduler);
+	}
+	if (optick) {
+		InitOptick(&taskScheduler);
+	}
+
+	ftl::TaskSchedulerInitOptions initOptions;
+	initOptions.ThreadPoolSize = threadCount;
+	initOptions.FiberPoolSize = options.Fibers;
+	initOptions.FiberPoolMaxSize = options.MaxFibers;
+	initOptions.Behavior = options.Behavior;
+	initOptions.Pinning = options.Pinning;
+	// Both backends share these. Each one ignores them unless it was initialized
+	if (profiling || optick) {
+		initOptions.Callbacks.OnFibersCreated = [](void * /*context*/, unsigned fiberCount) {
+			RegisterFibers(fiberCount);
+			OptickRegisterFibers(fiberCount);
+		};
+		initOptions.Callbacks.OnThreadsCreated = [](void * /*context*/, unsigned threadCount) {
+			RegisterThreads(threadCount);
+			OptickRegisterThreads(threadCount);
+		};
+		initOptions.Callbacks.OnFiberStateChanged = [](void * /*context*/, unsigned fiberIndex, ftl::FiberState newState) {
+			switch (newState) {
+			case ftl::FiberState::Attached:
+				FiberResume(fiberIndex);
+				OptickFiberAttached(fiberIndex);
+				break;
+			case ftl::FiberState::Detached:
+				OptickFiberDetached(fiberIndex);
+				FiberSuspend(fiberIndex);
+				break;
+			}
+		};
+	}
+	if (optick) {
+		initOptions.Callbacks.OnWorkerThreadStarted = [](void * /*context*/, unsigned threadIndex) {
+			OptickWorkerThreadStarted(threadIndex);
+		};
+		initOptions.Callbacks.OnWorkerThreadEnded = [](void * /*context*/, unsigned threadIndex) {
+			OptickWorkerThreadEnded(threadIndex);
+		};
+	}
+	if (recording) {
+		initOptions.Callbacks.OnTaskStateChanged = [](void * /*context*/, unsigned /*fiberIndex*/, ftl::TaskFunction /*function*/, void const *counter, ftl::TaskState newState) {
+			switch (newState) {
+			case ftl::TaskState::Started:
+				TaskStart(counter);
+				break;
+			case ftl::TaskState::Finished:
+				TaskEnd();
+				break;
+			}
+		};
+		initOptions.Callbacks.OnTasksAdded = [](void * /*context*/, unsigned /*fiberIndex*/, void const *counter, unsigned taskCount) {
+			TasksAdded(counter, taskCount);
+		};
+		initOptions.Callbacks.OnCounterWaitStateChanged = [](void * /*context*/, unsigned /*fiberIndex*/, void const *counter, unsigned targetValue, ftl::CounterWaitState newState) {
+			switch (newState) {
+			case ftl::CounterWaitState::Waiting:
+				CounterWait(counter, targetValue, true);
+				break;
+			case ftl::CounterWaitState::Satisfied:
+				CounterWait(counter, targetValue, false);
+				break;
+			case ftl::CounterWaitState::Resumed:
+				// The profiler's FiberResume already marks when the wait ended
+				break;
+			}
+		};
+	}
+
+	if (taskScheduler.Init(initOptions) < 0) {
+		fprintf(stderr, "TaskScheduler initialization failed\n");
+		return false;
+	}
+
+	unsigned const size = options.Size != 0 ? options.Size : info.DefaultSize;
+	std::unique_ptr<Workload> workload = info.Create();
+	workload->Setup(&taskScheduler, size);
+
+	LatencyRecorder latencies(taskScheduler.GetThreadCount());
+	for (unsigned i = 0; i < options.Warmup; ++i) {
+		workload->Run(&taskScheduler, &latencies);
+	}
+	latencies.Clear();
+
+	bool verified = true;
+	if (optick && !StartOptickCapture()) {
+		fprintf(stderr, "Failed to start the Optick capture\n");
+		verified = false;
+	}
+	std::vector<uint64_t> iterationNs;
+	for (unsigned i = 0; i < options.Iterations; ++i) {
+		if (optick && i != 0) {
+			NextOptickFrame();
+		}
+		if (recording) {
+			FrameStart();
+		}
+		uint64_t const start = NowNs();
+		workload->Run(&taskScheduler, &latencies);
+		iterationNs.push_back(NowNs() - start);
+		if (recording) {
+			FrameEnd();
 		}
-	};
 
-	if (taskScheduler.Init(options) < 0) {
-		printf("TaskScheduler initialization failed");
-		return 1;
+		verified = verified && workload->Verify();
+	}
+	if (optick) {
+		StopOptickCapture();
+	}
+
+	uint64_t totalNs = 0;
+	for (uint64_t const ns : iterationNs) {
+		totalNs += ns;
 	}
+	std::sort(iterationNs.begin(), iterationNs.end());
 
-	constexpr unsigned kNumProducerTasks = 100U;
-	std::array<ftl::Task, kNumProducerTasks> tasks;
+	uint64_t const tasks = latencies.GetSampleCount();
+	double const seconds = static_cast<double>(totalNs) / 1e9;
+	LatencyPercentiles const percentiles = latencies.ComputePercentiles();
+	ftl::FiberPoolStats const fiberStats = taskScheduler.GetFiberPoolStats();
+	ftl::ParkingStats const parkingStats = taskScheduler.GetParkingStats();
+	ftl::StealStats const stealStats = taskScheduler.GetStealStats();
 
-	for (int i = 0; i < 2; ++i) {
-		PROFILE_SPAN("", "Frame");
+	uint64_t steals = 0;
+	for (uint64_t const levelSteals : stealStats.Steals) {
+		steals += levelSteals;
+	}
 
-		std::atomic<unsigned> globalCounter(0U);
-		FTL_VALGRIND_HG_DISABLE_CHECKING(&globalCounter, sizeof(globalCounter));
+	// Everything but Steals and SleepNs is 0 if the scheduler was built without FTL_TELEMETRY
+	ftl::WorkerTelemetry telemetry{};
+	for (unsigned i = 0; i < taskScheduler.GetThreadCount(); ++i) {
+		ftl::WorkerTelemetry const worker = taskScheduler.GetWorkerTelemetry(i);
+		telemetry.StealAttempts += worker.StealAttempts;
+		telemetry.FailedPops += worker.FailedPops;
+		telemetry.FiberSwitches += worker.FiberSwitches;
+		telemetry.HiPriQueueHighWater = std::max(telemetry.HiPriQueueHighWater, worker.HiPriQueueHighWater);
+		telemetry.LoPriQueueHighWater = std::max(telemetry.LoPriQueueHighWater, worker.LoPriQueueHighWater);
+		telemetry.ReadyFibersResumed += worker.ReadyFibersResumed;
+		telemetry.ReadyFiberWaitTotalNs += worker.ReadyFiberWaitTotalNs;
+		telemetry.ReadyFiberWaitMaxNs = std::max(telemetry.ReadyFiberWaitMaxNs, worker.ReadyFiberWaitMaxNs);
+	}
+	uint64_t const readyWaitMeanNs = telemetry.ReadyFibersResumed != 0 ? telemetry.ReadyFiberWaitTotalNs / telemetry.ReadyFibersResumed : 0;
 
-		for (auto &&task : tasks) {
-			task = {Producer, &globalCounter};
+	// The scheduler stats are cumulative, so they include the warmup iterations
+	printf("{\"workload\":\"%s\",\"threads\":%u,\"fibers\":%u,\"max_fibers\":%u,\"behavior\":\"%s\",\"pinning\":\"%s\","
+	       "\"size\":%u,\"iterations\":%u,\"tasks\":%llu,\"seconds\":%.6f,\"tasks_per_second\":%.1f,"
+	       "\"iteration_ms\":{\"min\":%.3f,\"median\":%.3f,\"max\":%.3f},"
+	       "\"latency_ns\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},"
+	       "\"fiber_pool\":{\"allocated\":%u,\"grows\":%llu,\"stalls\":%llu},"
+	       "\"parking\":{\"parks\":%llu,\"wakes\":%llu,\"spurious_wakes\":%llu},"
+	       "\"steals\":{\"total\":%llu,\"attempts\":%llu,\"failed_rounds\":%llu},"
+	       "\"telemetry\":{\"failed_pops\":%llu,\"fiber_switches\":%llu,\"hi_queue_high_water\":%llu,\"lo_queue_high_water\":%llu,"
+	       "\"ready_wait_mean_ns\":%llu,\"ready_wait_max_ns\":%llu},"
+	       "\"verified\":%s}\n",
+	       info.Name, taskScheduler.GetThreadCount(), options.Fibers, options.MaxFibers, BehaviorName(options.Behavior), PinningName(options.Pinning),
+	       size, options.Iterations, static_cast<unsigned long long>(tasks), seconds, seconds > 0.0 ? static_cast<double>(tasks) / seconds : 0.0,
+	       static_cast<double>(iterationNs.front()) / 1e6, static_cast<double>(iterationNs[iterationNs.size() / 2]) / 1e6, static_cast<double>(iterationNs.back()) / 1e6,
+	       static_cast<unsigned long long>(percentiles.P50), static_cast<unsigned long long>(percentiles.P90), static_cast<unsigned long long>(percentiles.P99),
+	       static_cast<unsigned long long>(percentiles.P999), static_cast<unsigned long long>(percentiles.Max),
+	       fiberStats.Allocated, static_cast<unsigned long long>(fiberStats.Grows), static_cast<unsigned long long>(fiberStats.Stalls),
+	       static_cast<unsigned long long>(parkingStats.Parks), static_cast<unsigned long long>(parkingStats.Wakes), static_cast<unsigned long long>(parkingStats.SpuriousWakes),
+	       static_cast<unsigned long long>(steals), static_cast<unsigned long long>(telemetry.StealAttempts), static_cast<unsigned long long>(stealStats.FailedRounds),
+	       static_cast<unsigned long long>(telemetry.FailedPops), static_cast<unsigned long long>(telemetry.FiberSwitches),
+	       static_cast<unsigned long long>(telemetry.HiPriQueueHighWater), static_cast<unsigned long long>(telemetry.LoPriQueueHighWater),
+	       static_cast<unsigned long long>(readyWaitMeanNs), static_cast<unsigned long long>(telemetry.ReadyFiberWaitMaxNs),
+	       verified ? "true" : "false");
+	fflush(stdout);
+
+	if (!options.ProfilePath.empty()) {
+		FILE *file = fopen(options.ProfilePath.c_str(), "w");
+		if (file == nullptr) {
+			fprintf(stderr, "Failed to open %s\n", options.ProfilePath.c_str());
+			verified = false;
+		} else {
+			std::string const profile = DumpProfiler();
+			fwrite(profile.data(), 1, profile.size(), file);
+			fclose(file);
 		}
+	}
+	if (recording) {
+		verified = WriteTaskGraph(info, options, taskScheduler.GetThreadCount()) && verified;
+	}
+	if (profiling) {
+		TermProfiler();
+	}
+	if (optick) {
+		if (!SaveOptickCapture(options.OptickPath.c_str())) {
+			fprintf(stderr, "Failed to write %s\n", options.OptickPath.c_str());
+			verified = false;
+		}
+		TermOptick();
+	}
+
+	if (!verified) {
+		fprintf(stderr, "%s produced the wrong result\n", info.Name);
+	}
+	return verified;
+}
 
-		ftl::TaskCounter counter(&taskScheduler);
-		taskScheduler.AddTasks(kNumProducerTasks, tasks.data(), ftl::TaskPriority::Low, &counter);
-		taskScheduler.WaitForCounter(&counter, true);
+int main(int argc, char **argv) {
+	SimOptions options;
+	int const parseResult = ParseArgs(argc, argv, &options);
+	if (parseResult != 0) {
+		return parseResult > 0 ? 0 : 1;
+	}
 
-		printf("Counter value: %u\n", globalCounter.load());
+	std::vector<WorkloadInfo const *> workloads;
+	if (options.Workloads.empty()) {
+		for (WorkloadInfo const &info : WorkloadRegistry::GetWorkloads()) {
+			workloads.push_back(&info);
+		}
+	} else {
+		for (std::string const &name : options.Workloads) {
+			workloads.push_back(WorkloadRegistry::Find(name));
+		}
+	}
+
+	std::vector<unsigned> threadCounts;
+	if (options.Sweep) {
+		for (unsigned threads = 1; threads < options.Threads; threads *= 2) {
+			threadCounts.push_back(threads);
+		}
+	}
+	threadCounts.push_back(options.Threads);
+
+	if ((!options.ProfilePath.empty() || !options.RecordPath.empty() || !options.OptickPath.empty()) && workloads.size() * threadCounts.size() != 1) {
+		fprintf(stderr, "--profile, --record and --optick need a single workload, and can't be used with --sweep\n");
+		return 1;
+	}
+
+	bool success = true;
+	for (WorkloadInfo const *info : workloads) {
+		for (unsigned const threads : threadCounts) {
+			success = RunWorkload(*info, options, threads) && success;
+		}
 	}
 
-	printf("%s", DumpProfiler().c_str());
-	TermProfiler();
+	return success ? 0 : 1;
 }
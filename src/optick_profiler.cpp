@@ -0,0 +1,288 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "optick_profiler.h"
+
+#if FTL_SIM_OPTICK
+
+#	include "optick.h"
+
+#	include <memory>
+#	include <stdint.h>
+#	include <stdio.h>
+#	include <string>
+
+#	if defined(_WIN32)
+#		define WIN32_LEAN_AND_MEAN
+#		include <windows.h>
+#	else
+#		include <pthread.h>
+#		if defined(__linux__)
+#			include <sys/syscall.h>
+#			include <unistd.h>
+#		elif defined(__FreeBSD__)
+#			include <pthread_np.h>
+#		endif
+#	endif
+
+// Optick doesn't export its thread ids. This has to match Platform::GetThreadID(), so the capture can tie each fiber
+// switch to the right thread
+static uint64_t GetOptickThreadId() {
+#	if defined(_WIN32)
+	return static_cast<uint64_t>(GetCurrentThreadId());
+#	elif defined(__APPLE__)
+	uint64_t id;
+	pthread_threadid_np(pthread_self(), &id);
+	return id;
+#	elif defined(__linux__)
+	return static_cast<uint64_t>(syscall(SYS_gettid));
+#	else
+	return reinterpret_cast<uint64_t>(pthread_self());
+#	endif
+}
+
+class OptickState {
+public:
+	explicit OptickState(ftl::TaskScheduler *taskScheduler)
+	        : m_taskScheduler(taskScheduler) {
+	}
+
+	OptickState(OptickState const &) = delete;
+	OptickState(OptickState &&) noexcept = delete;
+	OptickState &operator=(OptickState const &) = delete;
+	OptickState &operator=(OptickState &&) noexcept = delete;
+	~OptickState() = default;
+
+private:
+	struct alignas(ftl::kCacheLineSize) ThreadSlot {
+		/* See GetOptickThreadId() */
+		uint64_t ThreadId{0};
+		/* The thread's own storage, while a fiber's storage is swapped in. Restored when the fiber is detached */
+		Optick::EventStorage *ThreadStorage{nullptr};
+		/* The storage of the attached fiber, or nullptr if we didn't swap it in */
+		Optick::EventStorage *FiberStorage{nullptr};
+	};
+
+	ftl::TaskScheduler *m_taskScheduler;
+
+	/* Allocated in RegisterThreads(). One per thread */
+	std::unique_ptr<ThreadSlot[]> m_threads;
+	unsigned m_threadCount{0};
+
+	/* Allocated in RegisterFibers(). Optick owns the storages */
+	std::unique_ptr<Optick::EventStorage *[]> m_fiberStorages;
+	unsigned m_fiberCount{0};
+
+public:
+	void RegisterThreads(unsigned threadCount) {
+		m_threads.reset(new ThreadSlot[threadCount]);
+		m_threadCount = threadCount;
+
+		// The main thread doesn't get OnWorkerThreadStarted
+		Optick::RegisterThread("FTL Main Thread");
+		m_threads[0].ThreadId = GetOptickThreadId();
+	}
+
+	void RegisterFibers(unsigned fiberCount) {
+		// The scheduler reports the largest the pool can grow to, so every fiber index has a storage
+		m_fiberStorages.reset(new Optick::EventStorage *[fiberCount]());
+		m_fiberCount = fiberCount;
+
+		for (unsigned i = 0; i < fiberCount; ++i) {
+			Optick::RegisterFiber(i, &m_fiberStorages[i]);
+		}
+	}
+
+	void WorkerThreadStarted(unsigned threadIndex) {
+		char threadName[256];
+		snprintf(threadName, sizeof(threadName), "FTL Worker Thread %u", threadIndex);
+		Optick::RegisterThread(threadName);
+		m_threads[threadIndex].ThreadId = GetOptickThreadId();
+	}
+
+	void FiberAttached(unsigned fiberIndex) {
+		Optick::EventStorage **slot = Optick::GetEventStorageSlotForCurrentThread();
+		// Optick only points the slot at the thread's storage while it's capturing
+		if (*slot == nullptr || fiberIndex >= m_fiberCount) {
+			return;
+		}
+
+		ThreadSlot &thread = m_threads[m_taskScheduler->GetCurrentThreadIndex()];
+		thread.ThreadStorage = *slot;
+		thread.FiberStorage = m_fiberStorages[fiberIndex];
+		*slot = thread.FiberStorage;
+		Optick::FiberSyncData::AttachToThread(thread.FiberStorage, thread.ThreadId);
+	}
+
+	void FiberDetached(unsigned /*fiberIndex*/) {
+		ThreadSlot &thread = m_threads[m_taskScheduler->GetCurrentThreadIndex()];
+		// The capture started while the fiber was attached. Its events so far went to the thread's storage
+		if (thread.FiberStorage == nullptr) {
+			return;
+		}
+
+		Optick::FiberSyncData::DetachFromThread(thread.FiberStorage);
+
+		// If the capture stopped while the fiber was attached, Optick has already cleared the slot. Leave it that way
+		Optick::EventStorage **slot = Optick::GetEventStorageSlotForCurrentThread();
+		if (*slot != nullptr) {
+			*slot = thread.ThreadStorage;
+		}
+		thread.ThreadStorage = nullptr;
+		thread.FiberStorage = nullptr;
+	}
+};
+
+static OptickState *g_optickState;
+
+void InitOptick(ftl::TaskScheduler *taskScheduler) {
+	g_optickState = new OptickState(taskScheduler);
+}
+
+void TermOptick() {
+	delete g_optickState;
+	g_optickState = nullptr;
+}
+
+void OptickRegisterThreads(unsigned threadCount) {
+	if (g_optickState == nullptr) {
+		return;
+	}
+	g_optickState->RegisterThreads(threadCount);
+}
+
+void OptickRegisterFibers(unsigned fiberCount) {
+	if (g_optickState == nullptr) {
+		return;
+	}
+	g_optickState->RegisterFibers(fiberCount);
+}
+
+void OptickWorkerThreadStarted(unsigned threadIndex) {
+	if (g_optickState == nullptr) {
+		return;
+	}
+	g_optickState->WorkerThreadStarted(threadIndex);
+}
+
+void OptickWorkerThreadEnded(unsigned /*threadIndex*/) {
+	// Optick outlives OptickState, so threads still unregister after TermOptick()
+	Optick::UnRegisterThread(false);
+}
+
+void OptickFiberAttached(unsigned fiberIndex) {
+	// The scheduler keeps switching fibers while it shuts down, which can be after TermOptick()
+	if (g_optickState == nullptr) {
+		return;
+	}
+	g_optickState->FiberAttached(fiberIndex);
+}
+
+void OptickFiberDetached(unsigned fiberIndex) {
+	if (g_optickState == nullptr) {
+		return;
+	}
+	g_optickState->FiberDetached(fiberIndex);
+}
+
+bool StartOptickCapture() {
+	// Instrumentation only. Sampling and switch contexts need elevated privileges, which ftl-sim shouldn't ask for
+	return Optick::StartCapture(Optick::Mode::INSTRUMENTATION);
+}
+
+void NextOptickFrame() {
+	Optick::EndFrame();
+	Optick::Update();
+	Optick::BeginFrame();
+}
+
+void StopOptickCapture() {
+	Optick::StopCapture();
+}
+
+bool SaveOptickCapture(char const *path) {
+	// Optick adds a timestamp to paths without the extension. Add just the extension, so the caller knows the name
+	std::string fullPath = path;
+	if (fullPath.size() < 4 || fullPath.compare(fullPath.size() - 4, 4, ".opt") != 0) {
+		fullPath += ".opt";
+	}
+
+	// Optick doesn't report whether it could write the file, so check we can create it first
+	FILE *file = fopen(fullPath.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	fclose(file);
+
+	return Optick::SaveCapture(fullPath.c_str());
+}
+
+void *CreateOptickSpanDescription(char const *category, char const *name, char const *file, int line) {
+	// Optick has a fixed set of categories, so ours become part of the name
+	std::string const label = category[0] == '\0' ? std::string(name) : std::string(category) + "/" + name;
+	return Optick::EventDescription::Create(label.c_str(), file, static_cast<unsigned long>(line), Optick::Color::Null, 0, Optick::EventDescription::COPY_NAME_STRING);
+}
+
+void *OptickSpanStart(void *description) {
+	return Optick::Event::Start(*static_cast<Optick::EventDescription *>(description));
+}
+
+void OptickSpanEnd(void *event) {
+	if (event != nullptr) {
+		Optick::Event::Stop(*static_cast<Optick::EventData *>(event));
+	}
+}
+
+#else
+
+void InitOptick(ftl::TaskScheduler * /*taskScheduler*/) {
+}
+void TermOptick() {
+}
+
+void OptickRegisterThreads(unsigned /*threadCount*/) {
+}
+void OptickRegisterFibers(unsigned /*fiberCount*/) {
+}
+void OptickWorkerThreadStarted(unsigned /*threadIndex*/) {
+}
+void OptickWorkerThreadEnded(unsigned /*threadIndex*/) {
+}
+void OptickFiberAttached(unsigned /*fiberIndex*/) {
+}
+void OptickFiberDetached(unsigned /*fiberIndex*/) {
+}
+
+bool StartOptickCapture() {
+	return false;
+}
+void NextOptickFrame() {
+}
+void StopOptickCapture() {
+}
+bool SaveOptickCapture(char const * /*path*/) {
+	return false;
+}
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/task_scheduler.h"
+
+// Set by CMake when ftl-sim is built with the Optick backend. See FTL_SIM_OPTICK in the top level CMakeLists.txt
+#ifndef FTL_SIM_OPTICK
+#	define FTL_SIM_OPTICK 0
+#endif
+
+constexpr bool kOptickAvailable = FTL_SIM_OPTICK != 0;
+
+/**
+ * Optick backend for ftl-sim
+ *
+ * Each fiber gets its own Optick event storage, which is swapped in for the thread's storage while the fiber is
+ * attached to a thread. So the spans a fiber opens follow it when it's resumed on another thread, and the capture
+ * shows which thread ran each fiber when
+ *
+ * All the functions are no-ops until InitOptick(), and after TermOptick(). If ftl-sim was built without Optick, they
+ * are no-ops, and the capture functions fail
+ */
+void InitOptick(ftl::TaskScheduler *taskScheduler);
+void TermOptick();
+
+// Hooked up to the scheduler's callbacks
+void OptickRegisterThreads(unsigned threadCount);
+void OptickRegisterFibers(unsigned fiberCount);
+void OptickWorkerThreadStarted(unsigned threadIndex);
+void OptickWorkerThreadEnded(unsigned threadIndex);
+void OptickFiberAttached(unsigned fiberIndex);
+void OptickFiberDetached(unsigned fiberIndex);
+
+/**
+ * Starts capturing, and begins the first frame. Call it, NextOptickFrame() and StopOptickCapture() from the fiber that
+ * runs the frames
+ *
+ * NOTE: Captures should start and stop while the workers are idle. Optick switches every thread's storage on and off,
+ * and a worker that's recording events at the same time can lose them
+ *
+ * @return    False if a capture is already running, or ftl-sim was built without Optick
+ */
+bool StartOptickCapture();
+/* Ends the current frame, and begins the next one */
+void NextOptickFrame();
+/* Ends the last frame, and stops capturing */
+void StopOptickCapture();
+/**
+ * Writes the last capture to a file that the Optick GUI can open. Doesn't need a GUI connection
+ *
+ * @param path    The file to write. .opt is appended if it doesn't end in it already
+ * @return        False if the file couldn't be opened, or ftl-sim was built without Optick
+ */
+bool SaveOptickCapture(char const *path);
+
+// Used by PROFILE_SPAN. Compiled out without Optick, so spans only pay for the backends that exist
+#if FTL_SIM_OPTICK
+/**
+ * Creates the Optick description of a span call site. Takes a lock, so PROFILE_SPAN caches the result in a static
+ *
+ * @return    An opaque description, for OptickSpanStart()
+ */
+void *CreateOptickSpanDescription(char const *category, char const *name, char const *file, int line);
+/* Returns nullptr if Optick isn't capturing on this thread */
+void *OptickSpanStart(void *description);
+void OptickSpanEnd(void *event);
+#else
+inline void *CreateOptickSpanDescription(char const * /*category*/, char const * /*name*/, char const * /*file*/, int /*line*/) {
+	return nullptr;
+}
+inline void *OptickSpanStart(void * /*description*/) {
+	return nullptr;
+}
+inline void OptickSpanEnd(void * /*event*/) {
+}
+#endif
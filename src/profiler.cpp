@@ -24,25 +24,26 @@
 
 #include "profiler.h"
 
-#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string.h>
 
 static ProfilerState *g_profilerState;
 
-uint64_t hash(uint64_t x) {
-	x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
-	x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
-	x = x ^ (x >> 31);
-	return x;
-}
+struct SpanName {
+	const char *Category;
+	const char *Name;
+};
 
-inline uint64_t hash_combine(uint64_t seed) {
-	return seed;
-}
+// Span names are interned independently of ProfilerState, so call sites can cache their id across profiler sessions
+static std::mutex g_spanNamesLock;
+static std::vector<SpanName> g_spanNames;
 
-template <typename... Rest>
-inline uint64_t hash_combine(uint64_t seed, const uint64_t &v, Rest... rest) {
-	seed ^= hash(v) + UINT64_C(0x9e3779b9) + (seed << 6) + (seed >> 2);
-	return hash_combine(seed, rest...);
+static uint64_t Now() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
 }
 
 void InitProfiler(ftl::TaskScheduler *taskScheduler) {
@@ -53,98 +54,395 @@ std::string DumpProfiler() {
 	return g_profilerState->Dump();
 }
 
+std::vector<ProfilerEvent> GetProfilerEvents() {
+	return g_profilerState->GetEvents();
+}
+
 void TermProfiler() {
 	delete g_profilerState;
 	g_profilerState = nullptr;
 }
 
 void RegisterThreads(unsigned threadCount) {
+	// The scheduler's callbacks are shared with the Optick backend, which can run without this profiler
+	if (g_profilerState == nullptr) {
+		return;
+	}
 	g_profilerState->RegisterThreads(threadCount);
 }
 
 void RegisterFibers(unsigned fiberCount) {
+	if (g_profilerState == nullptr) {
+		return;
+	}
 	g_profilerState->RegisterFibers(fiberCount);
 }
 
-void SpanStart(const char *category, const char *name) {
-	g_profilerState->SpanStart(category, name);
+uint32_t InternSpanName(const char *category, const char *name) {
+	std::lock_guard<std::mutex> guard(g_spanNamesLock);
+
+	for (size_t i = 0; i < g_spanNames.size(); ++i) {
+		if (strcmp(g_spanNames[i].Category, category) == 0 && strcmp(g_spanNames[i].Name, name) == 0) {
+			return static_cast<uint32_t>(i);
+		}
+	}
+
+	g_spanNames.push_back({category, name});
+	return static_cast<uint32_t>(g_spanNames.size() - 1);
+}
+
+void SpanStart(uint32_t nameId) {
+	// ftl-sim only initializes the profiler when asked to record a profile
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->SpanStart(nameId);
 }
 
 void SpanEnd() {
+	if (g_profilerState == nullptr) {
+		return;
+	}
 	g_profilerState->SpanEnd();
 }
 
 void FiberSuspend(unsigned fiberIndex) {
+	// The scheduler keeps switching fibers while it shuts down, which can be after TermProfiler()
+	if (g_profilerState == nullptr) {
+		return;
+	}
 	g_profilerState->FiberSuspend(fiberIndex);
 }
 
 void FiberResume(unsigned fiberIndex) {
+	// The scheduler keeps switching fibers while it shuts down, which can be after TermProfiler()
+	if (g_profilerState == nullptr) {
+		return;
+	}
 	g_profilerState->FiberResume(fiberIndex);
 }
 
+void TaskStart(void const *counter) {
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->TaskStart(counter);
+}
+
+void TaskEnd() {
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->TaskEnd();
+}
+
+void TasksAdded(void const *counter, unsigned taskCount) {
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->TasksAdded(counter, taskCount);
+}
+
+void CounterWait(void const *counter, unsigned targetValue, bool suspended) {
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->CounterWait(counter, targetValue, suspended);
+}
+
+void FrameStart() {
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->FrameStart();
+}
+
+void FrameEnd() {
+	if (g_profilerState == nullptr) {
+		return;
+	}
+	g_profilerState->FrameEnd();
+}
+
+ProfilerState::~ProfilerState() {
+	for (unsigned i = 0; i < m_threadCount; ++i) {
+		ThreadBuffer &buffer = m_threadBuffers[i];
+		for (EventChunk *chunk : {buffer.Head, buffer.Reserve, buffer.Spares.load(std::memory_order_relaxed)}) {
+			while (chunk != nullptr) {
+				EventChunk *next = chunk->Next.load(std::memory_order_relaxed);
+				delete chunk;
+				chunk = next;
+			}
+		}
+	}
+}
+
 void ProfilerState::RegisterThreads(unsigned threadCount) {
-	m_spanStack.resize(threadCount);
+	m_threadBuffers.reset(new ThreadBuffer[threadCount]);
+	m_threadCount = threadCount;
+
+	// Pre-allocate the first chunk, and a few spares to move on to when it fills up
+	for (unsigned i = 0; i < threadCount; ++i) {
+		m_threadBuffers[i].Head = new EventChunk;
+		m_threadBuffers[i].Tail = m_threadBuffers[i].Head;
+	}
+	RefillSpareChunks();
 }
 
 void ProfilerState::RegisterFibers(unsigned fiberCount) {
-	m_savedSpanStacks.resize(fiberCount);
+	m_fiberSequences.reset(new uint32_t[fiberCount]());
+	m_fiberCount = fiberCount;
 }
 
-void ProfilerState::SpanStart(const char *category, const char *name) {
-	uint64_t tid = m_taskScheduler->GetCurrentThreadIndex();
-	uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+void ProfilerState::RefillSpareChunks() {
+	for (unsigned i = 0; i < m_threadCount; ++i) {
+		ThreadBuffer &buffer = m_threadBuffers[i];
+
+		// Count the chunk before pushing it, so the owning thread can never take SpareCount below 0
+		// Two refills racing can overshoot kSpareChunksPerThread a little, which is harmless
+		for (unsigned spares = buffer.SpareCount.load(std::memory_order_relaxed); spares < kSpareChunksPerThread; ++spares) {
+			auto *chunk = new EventChunk;
+			buffer.SpareCount.fetch_add(1, std::memory_order_relaxed);
+
+			EventChunk *head = buffer.Spares.load(std::memory_order_relaxed);
+			do {
+				chunk->Next.store(head, std::memory_order_relaxed);
+			} while (!buffer.Spares.compare_exchange_weak(head, chunk, std::memory_order_release, std::memory_order_relaxed));
+		}
+	}
+}
 
-	uint64_t spanId = hash_combine(0, tid, now);
-	m_spanStack[tid].push_back(spanId);
+ProfilerState::EventChunk *ProfilerState::TakeSpareChunk(ThreadBuffer *buffer) {
+	// The owning thread takes the whole list, so pushes never race with a pop, and there's no ABA
+	if (buffer->Reserve == nullptr) {
+		buffer->Reserve = buffer->Spares.exchange(nullptr, std::memory_order_acquire);
+	}
+
+	EventChunk *const chunk = buffer->Reserve;
+	if (chunk == nullptr) {
+		// RefillSpareChunks() hasn't kept up. Allocating here is slow, but better than dropping events
+		return new EventChunk;
+	}
 
-	std::lock_guard<std::mutex> guard(m_bufferLock);
-	m_buffer << "SpanStart " << category << " " << name << " threadId: " << tid << " spanId: " << spanId << " now: " << now << "\n";
+	buffer->Reserve = chunk->Next.load(std::memory_order_relaxed);
+	chunk->Next.store(nullptr, std::memory_order_relaxed);
+	buffer->SpareCount.fetch_sub(1, std::memory_order_relaxed);
+	return chunk;
 }
 
-void ProfilerState::SpanEnd() {
-	uint64_t tid = m_taskScheduler->GetCurrentThreadIndex();
-	uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+void ProfilerState::Record(ThreadBuffer *buffer, EventType type, uint64_t spanId, uint32_t nameId) {
+	EventChunk *chunk = buffer->Tail;
+	unsigned count = chunk->Count.load(std::memory_order_relaxed);
+	if (count == kEventsPerChunk) {
+		EventChunk *next = TakeSpareChunk(buffer);
+		chunk->Next.store(next, std::memory_order_release);
+		buffer->Tail = next;
+
+		chunk = next;
+		count = 0;
+	}
 
-	uint64_t spanId = m_spanStack[tid].back();
-	m_spanStack[tid].pop_back();
+	ProfilerEvent &event = chunk->Events[count];
+	event.Timestamp = Now();
+	event.SpanId = spanId;
+	event.NameId = nameId;
+	event.FiberIndex = buffer->CurrentFiberIndex;
+	event.FiberSequence = buffer->CurrentFiberSequence;
+	event.Type = type;
 
-	std::lock_guard<std::mutex> guard(m_bufferLock);
-	m_buffer << "SpanEnd threadId: " << tid << " spanId: " << spanId << " now: " << now << "\n";
+	// Publish the event to Dump()
+	chunk->Count.store(count + 1, std::memory_order_release);
 }
 
-void ProfilerState::FiberSuspend(unsigned fiberIndex) {
-	uint64_t tid = m_taskScheduler->GetCurrentThreadIndex();
+void ProfilerState::SpanStart(uint32_t nameId) {
+	unsigned const tid = m_taskScheduler->GetCurrentThreadIndex();
+	ThreadBuffer *buffer = &m_threadBuffers[tid];
 
-	// Save the stack for resuming later
-	m_savedSpanStacks[fiberIndex] = m_spanStack[tid];
+	// Thread index in the top bits makes the id unique without any cross-thread communication
+	uint64_t const spanId = (static_cast<uint64_t>(tid) << 48) | ++buffer->NextSpanId;
+	Record(buffer, EventType::SpanStart, spanId, nameId);
+}
 
-	// Issue SpanSuspend events for the stack
-	uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+void ProfilerState::SpanEnd() {
+	unsigned const tid = m_taskScheduler->GetCurrentThreadIndex();
 
-	std::lock_guard<std::mutex> guard(m_bufferLock);
-	for (auto iter = m_spanStack[tid].rbegin(); iter != m_spanStack[tid].rend(); ++iter) {
-		m_buffer << "SpanSuspend threadId: " << tid << " spanId: " << *iter << " now: " << now << "\n";
-	}
-	m_spanStack[tid].clear();
+	// We don't track the span stack at runtime. Dump() matches SpanEnd to SpanStart per fiber
+	Record(&m_threadBuffers[tid], EventType::SpanEnd, 0, 0);
+}
+
+void ProfilerState::FiberSuspend(unsigned fiberIndex) {
+	unsigned const tid = m_taskScheduler->GetCurrentThreadIndex();
+	ThreadBuffer *buffer = &m_threadBuffers[tid];
+
+	// The open spans stay with the fiber. Dump() issues the SpanSuspend's for them
+	buffer->CurrentFiberIndex = static_cast<uint32_t>(fiberIndex);
+	Record(buffer, EventType::FiberSuspend, 0, 0);
 }
 
 void ProfilerState::FiberResume(unsigned fiberIndex) {
-	uint64_t tid = m_taskScheduler->GetCurrentThreadIndex();
+	unsigned const tid = m_taskScheduler->GetCurrentThreadIndex();
+	ThreadBuffer *buffer = &m_threadBuffers[tid];
+
+	// The scheduler guarantees the fiber was fully switched away from on its previous thread before we get here
+	// So this isn't racy
+	buffer->CurrentFiberIndex = static_cast<uint32_t>(fiberIndex);
+	buffer->CurrentFiberSequence = ++m_fiberSequences[fiberIndex];
+	Record(buffer, EventType::FiberResume, 0, 0);
+}
 
-	m_spanStack[tid] = m_savedSpanStacks[fiberIndex];
-	m_savedSpanStacks[fiberIndex].clear();
+void ProfilerState::TaskStart(void const *counter) {
+	Record(&m_threadBuffers[m_taskScheduler->GetCurrentThreadIndex()], EventType::TaskStart, reinterpret_cast<uintptr_t>(counter), 0);
+}
 
-	// Issue SpanResume events for the stack
-	uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+void ProfilerState::TaskEnd() {
+	Record(&m_threadBuffers[m_taskScheduler->GetCurrentThreadIndex()], EventType::TaskEnd, 0, 0);
+}
 
-	std::lock_guard<std::mutex> guard(m_bufferLock);
-	for (auto iter = m_spanStack[tid].begin(); iter != m_spanStack[tid].end(); ++iter) {
-		m_buffer << "SpanResume threadId: " << tid << " spanId: " << *iter << " now: " << now << "\n";
+void ProfilerState::TasksAdded(void const *counter, unsigned taskCount) {
+	Record(&m_threadBuffers[m_taskScheduler->GetCurrentThreadIndex()], EventType::TasksAdded, reinterpret_cast<uintptr_t>(counter), taskCount);
+}
+
+void ProfilerState::CounterWait(void const *counter, unsigned targetValue, bool suspended) {
+	EventType const type = suspended ? EventType::CounterWait : EventType::CounterSatisfied;
+	Record(&m_threadBuffers[m_taskScheduler->GetCurrentThreadIndex()], type, reinterpret_cast<uintptr_t>(counter), targetValue);
+}
+
+void ProfilerState::FrameStart() {
+	Record(&m_threadBuffers[m_taskScheduler->GetCurrentThreadIndex()], EventType::FrameStart, 0, 0);
+}
+
+void ProfilerState::FrameEnd() {
+	Record(&m_threadBuffers[m_taskScheduler->GetCurrentThreadIndex()], EventType::FrameEnd, 0, 0);
+
+	// Between frames is off the hot path, so replace the chunks this frame used up
+	RefillSpareChunks();
+}
+
+std::vector<ProfilerState::RawEvent> ProfilerState::GatherEvents() {
+	RefillSpareChunks();
+
+	std::vector<RawEvent> rawEvents;
+	for (unsigned i = 0; i < m_threadCount; ++i) {
+		size_t position = 0;
+		for (EventChunk *chunk = m_threadBuffers[i].Head; chunk != nullptr; chunk = chunk->Next.load(std::memory_order_acquire)) {
+			unsigned const count = chunk->Count.load(std::memory_order_acquire);
+			for (unsigned j = 0; j < count; ++j) {
+				rawEvents.push_back({chunk->Events[j], i, position++});
+			}
+		}
 	}
+
+	// A fiber's events are totally ordered by (FiberSequence, position in the thread buffer)
+	// This lets us rebuild the span stacks without relying on timestamps being unique
+	std::sort(rawEvents.begin(), rawEvents.end(), [](RawEvent const &a, RawEvent const &b) {
+		if (a.Event.FiberIndex != b.Event.FiberIndex) {
+			return a.Event.FiberIndex < b.Event.FiberIndex;
+		}
+		if (a.Event.FiberSequence != b.Event.FiberSequence) {
+			return a.Event.FiberSequence < b.Event.FiberSequence;
+		}
+		if (a.ThreadIndex != b.ThreadIndex) {
+			return a.ThreadIndex < b.ThreadIndex;
+		}
+		return a.Position < b.Position;
+	});
+
+	return rawEvents;
+}
+
+std::vector<ProfilerEvent> ProfilerState::GetEvents() {
+	std::vector<RawEvent> const rawEvents = GatherEvents();
+
+	std::vector<ProfilerEvent> events;
+	events.reserve(rawEvents.size());
+	for (RawEvent const &raw : rawEvents) {
+		events.push_back(raw.Event);
+	}
+
+	// Stable, so a fiber's events stay in order even if their timestamps are equal
+	std::stable_sort(events.begin(), events.end(), [](ProfilerEvent const &a, ProfilerEvent const &b) {
+		return a.Timestamp < b.Timestamp;
+	});
+
+	return events;
 }
 
 std::string ProfilerState::Dump() {
-	std::lock_guard<std::mutex> guard(m_bufferLock);
+	std::vector<SpanName> spanNames;
+	{
+		std::lock_guard<std::mutex> guard(g_spanNamesLock);
+		spanNames = g_spanNames;
+	}
+
+	std::vector<RawEvent> const rawEvents = GatherEvents();
+
+	struct DecodedLine {
+		uint64_t Timestamp;
+		std::string Text;
+	};
+	std::vector<DecodedLine> lines;
+	lines.reserve(rawEvents.size());
+
+	std::vector<uint64_t> spanStack;
+	uint32_t currentFiber = std::numeric_limits<uint32_t>::max();
+	for (RawEvent const &raw : rawEvents) {
+		ProfilerEvent const &event = raw.Event;
+		if (event.FiberIndex != currentFiber) {
+			currentFiber = event.FiberIndex;
+			spanStack.clear();
+		}
+
+		std::ostringstream line;
+		switch (event.Type) {
+		case EventType::SpanStart: {
+			spanStack.push_back(event.SpanId);
+
+			SpanName const &spanName = spanNames[event.NameId];
+			line << "SpanStart " << spanName.Category << " " << spanName.Name << " threadId: " << raw.ThreadIndex << " spanId: " << event.SpanId << " now: " << event.Timestamp << "\n";
+			break;
+		}
+		case EventType::SpanEnd:
+			if (spanStack.empty()) {
+				// The matching SpanStart was recorded before the profiler was initialized
+				continue;
+			}
+
+			line << "SpanEnd threadId: " << raw.ThreadIndex << " spanId: " << spanStack.back() << " now: " << event.Timestamp << "\n";
+			spanStack.pop_back();
+			break;
+		case EventType::FiberSuspend:
+			for (auto iter = spanStack.rbegin(); iter != spanStack.rend(); ++iter) {
+				line << "SpanSuspend threadId: " << raw.ThreadIndex << " spanId: " << *iter << " now: " << event.Timestamp << "\n";
+			}
+			break;
+		case EventType::FiberResume:
+			for (auto iter = spanStack.begin(); iter != spanStack.end(); ++iter) {
+				line << "SpanResume threadId: " << raw.ThreadIndex << " spanId: " << *iter << " now: " << event.Timestamp << "\n";
+			}
+			break;
+		case EventType::TaskStart:
+		case EventType::TaskEnd:
+		case EventType::TasksAdded:
+		case EventType::CounterWait:
+		case EventType::CounterSatisfied:
+		case EventType::FrameStart:
+		case EventType::FrameEnd:
+		default:
+			// Only used for the task graph
+			continue;
+		}
+
+		lines.push_back({event.Timestamp, line.str()});
+	}
+
+	std::stable_sort(lines.begin(), lines.end(), [](DecodedLine const &a, DecodedLine const &b) {
+		return a.Timestamp < b.Timestamp;
+	});
+
+	std::string result;
+	for (DecodedLine const &line : lines) {
+		result += line.Text;
+	}
 
-	return m_buffer.str();
+	return result;
 }
@@ -24,72 +24,224 @@
 
 #pragma once
 
+#include "optick_profiler.h"
+
 #include "ftl/task_scheduler.h"
 
-#include <deque>
-#include <mutex>
-#include <sstream>
+#include <atomic>
+#include <memory>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
-enum class EventType {
+enum class EventType : uint32_t {
 	SpanStart,
 	SpanEnd,
 	FiberSuspend,
 	FiberResume,
+	// The events below are only used to record the task graph. See DagBuilder. Dump() skips them
+	TaskStart,
+	TaskEnd,
+	TasksAdded,
+	CounterWait,
+	CounterSatisfied,
+	FrameStart,
+	FrameEnd,
+};
+
+/**
+ * A single fixed-size binary profiler record
+ *
+ * Records are written by the owning thread only, and are decoded back into text in ProfilerState::Dump()
+ */
+struct ProfilerEvent {
+	/* Nanoseconds since the steady clock epoch */
+	uint64_t Timestamp;
+	/* SpanStart: the id of the new span. TaskStart, TasksAdded, CounterWait, CounterSatisfied: the counter's address */
+	uint64_t SpanId;
+	/* SpanStart: the interned category / name id. See InternSpanName(). TasksAdded: the number of tasks. CounterWait, CounterSatisfied: the target value */
+	uint32_t NameId;
+	/* The fiber that was running on the thread when the event was recorded */
+	uint32_t FiberIndex;
+	/* How many times FiberIndex had been resumed when the event was recorded. Used to order a fiber's events across threads */
+	uint32_t FiberSequence;
+	EventType Type;
 };
 
 class ProfilerState {
 public:
-	ProfilerState(ftl::TaskScheduler *taskScheduler)
-	        : m_taskScheduler(taskScheduler),
-	          m_spanStack(),
-	          m_savedSpanStacks(),
-	          m_buffer(), m_bufferLock() {
+	explicit ProfilerState(ftl::TaskScheduler *taskScheduler)
+	        : m_taskScheduler(taskScheduler) {
 	}
 
+	ProfilerState(ProfilerState const &) = delete;
+	ProfilerState(ProfilerState &&) noexcept = delete;
+	ProfilerState &operator=(ProfilerState const &) = delete;
+	ProfilerState &operator=(ProfilerState &&) noexcept = delete;
+	~ProfilerState();
+
 private:
+	constexpr static unsigned kEventsPerChunk = 16384;
+	/* How many empty chunks RefillSpareChunks() keeps ready for each thread */
+	constexpr static unsigned kSpareChunksPerThread = 2;
+
+	/**
+	 * A block of events. Chunks form a singly linked list per thread. Spare chunks are linked through Next too, until
+	 * they're used
+	 *
+	 * Count is only written by the owning thread. It's atomic so Dump() can read a consistent prefix of the
+	 * chunk without locking, even if the owning thread is still recording
+	 */
+	struct EventChunk {
+		ProfilerEvent Events[kEventsPerChunk];
+		std::atomic<unsigned> Count{0};
+		std::atomic<EventChunk *> Next{nullptr};
+	};
+
+	struct RawEvent {
+		ProfilerEvent Event;
+		unsigned ThreadIndex;
+		size_t Position;
+	};
+
+	struct alignas(ftl::kCacheLineSize) ThreadBuffer {
+		/* The first chunk. Only used by Dump() */
+		EventChunk *Head{nullptr};
+		/* The chunk we are currently writing to */
+		EventChunk *Tail{nullptr};
+		/* Spare chunks the owning thread has taken from Spares, but not used yet. Only touched by the owning thread */
+		EventChunk *Reserve{nullptr};
+		/* Spare chunks pushed by RefillSpareChunks(). The owning thread takes the whole list at once */
+		std::atomic<EventChunk *> Spares{nullptr};
+		/* The number of chunks in Reserve and Spares */
+		std::atomic<unsigned> SpareCount{0};
+
+		/* The fiber currently attached to this thread */
+		uint32_t CurrentFiberIndex{0};
+		/* The sequence number of the current fiber. See ProfilerEvent::FiberSequence */
+		uint32_t CurrentFiberSequence{0};
+
+		/* Per-thread counter for generating span ids */
+		uint64_t NextSpanId{0};
+	};
+
 	ftl::TaskScheduler *m_taskScheduler;
 
-	std::vector<std::deque<uint64_t>> m_spanStack;       // per thread
-	std::vector<std::deque<uint64_t>> m_savedSpanStacks; // per fiber
+	/* Pre-allocated in RegisterThreads(). One per thread */
+	std::unique_ptr<ThreadBuffer[]> m_threadBuffers;
+	unsigned m_threadCount{0};
 
-	std::stringstream m_buffer;
-	std::mutex m_bufferLock;
+	/* The number of times each fiber has been resumed. Only touched by the thread the fiber is being resumed on */
+	std::unique_ptr<uint32_t[]> m_fiberSequences;
+	unsigned m_fiberCount{0};
 
 public:
 	void RegisterThreads(unsigned threadCount);
 	void RegisterFibers(unsigned fiberCount);
 
-	void SpanStart(const char *category, const char *name);
+	void SpanStart(uint32_t nameId);
 	void SpanEnd();
 
 	void FiberSuspend(unsigned fiberIndex);
 	void FiberResume(unsigned fiberIndex);
 
+	void TaskStart(void const *counter);
+	void TaskEnd();
+	void TasksAdded(void const *counter, unsigned taskCount);
+	void CounterWait(void const *counter, unsigned targetValue, bool suspended);
+	void FrameStart();
+	void FrameEnd();
+
+	/**
+	 * Decodes all the recorded events into text
+	 *
+	 * NOTE: Events recorded concurrently with Dump() may or may not be included
+	 *
+	 * @return    One line per event, ordered by timestamp
+	 */
 	std::string Dump();
+
+	/**
+	 * Gets all the recorded events, including the ones Dump() skips
+	 *
+	 * NOTE: Events recorded concurrently with GetEvents() may or may not be included
+	 *
+	 * @return    The events, ordered by timestamp. Each fiber's events are also in the order they were recorded
+	 */
+	std::vector<ProfilerEvent> GetEvents();
+
+private:
+	/* Gathers everything that has been published so far, sorted by fiber, and then by the order the fiber recorded them */
+	std::vector<RawEvent> GatherEvents();
+
+	/**
+	 * Tops up every thread's spare chunks to kSpareChunksPerThread. This allocates, so it's only called off the hot
+	 * path: from RegisterThreads(), FrameEnd(), and when the events are gathered
+	 */
+	void RefillSpareChunks();
+	/**
+	 * Takes a spare chunk for the thread to continue recording into. Only allocates if RefillSpareChunks() hasn't kept up
+	 */
+	static EventChunk *TakeSpareChunk(ThreadBuffer *buffer);
+
+	/**
+	 * Appends an event to the thread's buffer. When the current chunk is full, a spare one is taken. See TakeSpareChunk()
+	 */
+	static void Record(ThreadBuffer *buffer, EventType type, uint64_t spanId, uint32_t nameId);
 };
 
 void InitProfiler(ftl::TaskScheduler *taskScheduler);
 std::string DumpProfiler();
+std::vector<ProfilerEvent> GetProfilerEvents();
 void TermProfiler();
 
 void RegisterThreads(unsigned threadCount);
 void RegisterFibers(unsigned fiberCount);
 
-void SpanStart(const char *category, const char *name);
+/**
+ * Interns a category / name pair, returning a small id that can be stored in a ProfilerEvent
+ *
+ * This takes a lock, so it should be called once per call site. PROFILE_SPAN caches the result in a static
+ *
+ * @param category    The span category. Must outlive the profiler
+ * @param name        The span name. Must outlive the profiler
+ * @return            The interned id
+ */
+uint32_t InternSpanName(const char *category, const char *name);
+
+void SpanStart(uint32_t nameId);
 void SpanEnd();
 void FiberSuspend(unsigned fiberIndex);
 void FiberResume(unsigned fiberIndex);
 
+// Task graph recording. Hooked up to the scheduler's task and counter wait callbacks
+void TaskStart(void const *counter);
+void TaskEnd();
+void TasksAdded(void const *counter, unsigned taskCount);
+void CounterWait(void const *counter, unsigned targetValue, bool suspended);
+/* Called from the main fiber around each timed Workload::Run(). Everything in between is one frame of the task graph */
+void FrameStart();
+void FrameEnd();
+
+/**
+ * Records a span to every profiler backend that's running. See InitProfiler() and StartOptickCapture()
+ */
 class ProfileSpan {
 public:
-	ProfileSpan(const char *category, const char *name) {
-		SpanStart(category, name);
+	ProfileSpan(uint32_t nameId, void *optickDescription)
+	        : m_optickEvent(OptickSpanStart(optickDescription)) {
+		SpanStart(nameId);
 	}
+	ProfileSpan(ProfileSpan const &) = delete;
+	ProfileSpan &operator=(ProfileSpan const &) = delete;
 	~ProfileSpan() {
 		SpanEnd();
+		OptickSpanEnd(m_optickEvent);
 	}
+
+private:
+	/* Optick keeps the event where it started, so it can end on another thread */
+	void *m_optickEvent;
 };
 
 // General utility macro
@@ -97,14 +249,12 @@ public:
 #define PP_EXPAND(...) __VA_ARGS__
 
 // Macro overloading feature support
-#define PP_VA_ARG_SIZE(...) PP_EXPAND(PP_APPLY_ARG_N((PP_ZERO_ARGS_DETECT(__VA_ARGS__), PP_RSEQ_N)))
-
-#define PP_ZERO_ARGS_DETECT(...) PP_EXPAND(PP_ZERO_ARGS_DETECT_PREFIX_##__VA_ARGS__##_ZERO_ARGS_DETECT_SUFFIX)
-#define PP_ZERO_ARGS_DETECT_PREFIX__ZERO_ARGS_DETECT_SUFFIX , , , , , , , , , , , 0
+// The leading dummy argument and ', ##' let the zero argument case work on GCC / Clang as well as MSVC
+#define PP_VA_ARG_SIZE(...) PP_EXPAND(PP_APPLY_ARG_N((_, ##__VA_ARGS__, PP_RSEQ_N)))
 
 #define PP_APPLY_ARG_N(ARGS) PP_EXPAND(PP_ARG_N ARGS)
 #define PP_ARG_N(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, N, ...) N
-#define PP_RSEQ_N 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+#define PP_RSEQ_N 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
 
 #define PP_OVERLOAD_SELECT(NAME, NUM) PP_CAT(NAME##_, NUM)
 #define PP_MACRO_OVERLOAD(NAME, ...)                      \
@@ -113,14 +263,19 @@ public:
 
 #define CONCAT_(x, y) x##y
 #define CONCAT(x, y) CONCAT_(x, y)
-#define UNIQUE_SPAN_NAME() CONCAT(span_, __COUNTER__)
+#define UNIQUE_SPAN_NAME() CONCAT(span_, __LINE__)
+#define UNIQUE_SPAN_NAME_ID() CONCAT(spanNameId_, __LINE__)
+#define UNIQUE_SPAN_OPTICK_DESCRIPTION() CONCAT(spanOptickDescription_, __LINE__)
 
 #define PROFILE_SPAN(...) PP_MACRO_OVERLOAD(PROFILE_SPAN, __VA_ARGS__)
 
 #define PROFILE_SPAN_0() \
-	ProfileSpan UNIQUE_SPAN_NAME()("", __func__)
+	PROFILE_SPAN_2("", __func__)
 #define PROFILE_SPAN_1(category) \
-	ProfileSpan UNIQUE_SPAN_NAME()(category, __func__)
+	PROFILE_SPAN_2(category, __func__)
 
-#define PROFILE_SPAN_2(category, name) \
-	ProfileSpan UNIQUE_SPAN_NAME()(category, name)
+// The name is interned once per call site. After that, starting a span never takes a lock
+#define PROFILE_SPAN_2(category, name)                                                                                       \
+	static const uint32_t UNIQUE_SPAN_NAME_ID() = InternSpanName(category, name);                                              \
+	static void *const UNIQUE_SPAN_OPTICK_DESCRIPTION() = CreateOptickSpanDescription(category, name, __FILE__, __LINE__); \
+	ProfileSpan UNIQUE_SPAN_NAME()(UNIQUE_SPAN_NAME_ID(), UNIQUE_SPAN_OPTICK_DESCRIPTION())
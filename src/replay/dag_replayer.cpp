@@ -0,0 +1,346 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "replay/dag_replayer.h"
+
+#include <algorithm>
+#include <functional>
+
+DagReplayer::DagReplayer(ReplayOptions const &options)
+        : m_options(options) {
+	m_options.Cores = std::max(1U, m_options.Cores);
+	m_options.FiberPoolSize = std::max(m_options.Cores, m_options.FiberPoolSize);
+}
+
+FrameReplayResult DagReplayer::Replay(DagFrame const &frame) {
+	Reset(frame);
+
+	// The main fiber runs the root on core 0. The other cores start out idle
+	m_cores[0].Task = 0;
+	m_cores[0].Idle = false;
+	Schedule(0, 0, kNone, EventKind::CoreReady);
+	for (uint32_t i = m_options.Cores - 1; i > 0; --i) {
+		m_idleCores.push_back(i);
+	}
+
+	for (uint32_t i = 0; i < frame.Counters.size(); ++i) {
+		if (frame.Counters[i].ReadyAtStart != 0) {
+			Release(i, frame.Counters[i].ReadyAtStart, 0, 0);
+		}
+	}
+
+	uint64_t now = 0;
+	while (!m_rootDone && !m_events.empty()) {
+		std::pop_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+		Event const event = m_events.back();
+		m_events.pop_back();
+
+		now = event.Time;
+		switch (event.Kind) {
+		case EventKind::CoreReady:
+			RunCore(event.Core, now);
+			break;
+		case EventKind::ExternalWaitDone:
+			ReadyFiber(event.Task, event.Core, now);
+			break;
+		}
+	}
+
+	if (!m_rootDone) {
+		m_result.Deadlocked = true;
+		m_result.MakespanNs = now;
+	}
+	return m_result;
+}
+
+void DagReplayer::Reset(DagFrame const &frame) {
+	m_frame = &frame;
+
+	m_cores.resize(m_options.Cores);
+	for (Core &core : m_cores) {
+		core.Task = kNone;
+		core.Tasks.Clear();
+		core.ReadyFibers.Clear();
+		core.Idle = true;
+	}
+
+	m_counters.assign(frame.Counters.size(), CounterState{0, 0, kNone});
+	m_waiters.clear();
+	m_nextStep.assign(frame.Tasks.size(), 0);
+	m_events.clear();
+	m_nextSequence = 0;
+	m_idleCores.clear();
+	m_stalledCores.clear();
+
+	m_queuedTasks = 0;
+	m_readyFibers = 0;
+	m_suspendedTasks = 0;
+	m_rootDone = false;
+	m_result = FrameReplayResult{};
+	m_result.PeakFibers = m_options.Cores;
+}
+
+void DagReplayer::Schedule(uint64_t const time, uint32_t const core, uint32_t const task, EventKind const kind) {
+	m_events.push_back({time, m_nextSequence++, core, task, kind});
+	std::push_heap(m_events.begin(), m_events.end(), std::greater<Event>());
+}
+
+bool DagReplayer::Advance(uint32_t const core, uint64_t *now, uint64_t const delay) {
+	// If nothing else happens first, there's no need to go through the event queue
+	if (delay == 0 || m_events.empty() || *now + delay < m_events.front().Time) {
+		*now += delay;
+		return true;
+	}
+
+	Schedule(*now + delay, core, kNone, EventKind::CoreReady);
+	return false;
+}
+
+void DagReplayer::RunCore(uint32_t const core, uint64_t now) {
+	while (!m_rootDone) {
+		uint32_t const task = m_cores[core].Task;
+		if (task == kNone) {
+			uint64_t delay;
+			if (!FindWork(core, now, &delay) || !Advance(core, &now, delay)) {
+				return;
+			}
+			continue;
+		}
+
+		DagTask const &info = m_frame->Tasks[task];
+		uint32_t &nextStep = m_nextStep[task];
+		if (nextStep == info.StepCount) {
+			m_cores[core].Task = kNone;
+			FinishTask(task, core, now);
+			continue;
+		}
+
+		DagStep const &step = m_frame->Steps[info.FirstStep + nextStep];
+		++nextStep;
+		switch (step.Kind) {
+		case DagStepKind::Run:
+			m_result.WorkNs += step.Ns;
+			if (!Advance(core, &now, step.Ns)) {
+				return;
+			}
+			break;
+		case DagStepKind::Spawn:
+			Release(step.Counter, step.Value, core, now);
+			break;
+		case DagStepKind::Wait: {
+			if (step.Counter != kNone) {
+				CounterState &counter = m_counters[step.Counter];
+				if (counter.Released - counter.Finished == step.Value) {
+					break;
+				}
+
+				m_waiters.push_back({task, step.Value, counter.FirstWaiter});
+				counter.FirstWaiter = static_cast<uint32_t>(m_waiters.size() - 1);
+			} else {
+				// All we know is how long it took in the recording
+				Schedule(now + step.Ns, core, task, EventKind::ExternalWaitDone);
+			}
+
+			// Suspend the task, and switch to a fresh fiber
+			m_cores[core].Task = kNone;
+			++m_suspendedTasks;
+			++m_result.FiberSwitches;
+			unsigned const fibersInUse = m_options.Cores + m_suspendedTasks;
+			m_result.PeakFibers = std::max(m_result.PeakFibers, std::min(fibersInUse, m_options.FiberPoolSize));
+			if (fibersInUse > m_options.FiberPoolSize) {
+				++m_result.FiberStalls;
+				m_stalledCores.push_back(core);
+				return;
+			}
+
+			if (!Advance(core, &now, m_options.FiberSwitchNs)) {
+				return;
+			}
+			break;
+		}
+		}
+	}
+}
+
+bool DagReplayer::FindWork(uint32_t const core, uint64_t const now, uint64_t *delay) {
+	Core &self = m_cores[core];
+
+	// Ready fibers first, like the scheduler
+	if (!self.ReadyFibers.Empty()) {
+		self.Task = self.ReadyFibers.PopBack();
+		--m_readyFibers;
+		ResumeSuspended(now);
+
+		++m_result.FiberSwitches;
+		*delay = m_options.FiberSwitchNs;
+		return true;
+	}
+
+	if (!self.Tasks.Empty()) {
+		self.Task = self.Tasks.PopBack();
+		--m_queuedTasks;
+		*delay = m_options.TaskStartNs;
+		return true;
+	}
+
+	if (StealWork(core, now, delay)) {
+		return true;
+	}
+
+	self.Idle = true;
+	m_idleCores.push_back(core);
+	return false;
+}
+
+bool DagReplayer::StealWork(uint32_t const core, uint64_t const now, uint64_t *delay) {
+	Core &self = m_cores[core];
+	uint32_t const coreCount = m_options.Cores;
+
+	if (m_readyFibers != 0) {
+		for (uint32_t i = 1; i < coreCount; ++i) {
+			Core &victim = m_cores[(core + i) % coreCount];
+			if (victim.ReadyFibers.Empty()) {
+				continue;
+			}
+
+			self.Task = victim.ReadyFibers.PopFront();
+			--m_readyFibers;
+			ResumeSuspended(now);
+
+			++m_result.Steals;
+			++m_result.FiberSwitches;
+			*delay = m_options.StealNs + m_options.FiberSwitchNs;
+			return true;
+		}
+	}
+
+	if (m_queuedTasks != 0) {
+		for (uint32_t i = 1; i < coreCount; ++i) {
+			Core &victim = m_cores[(core + i) % coreCount];
+			if (victim.Tasks.Empty()) {
+				continue;
+			}
+
+			// Take the oldest task, and up to half of what's left, like WaitFreeQueue::StealBatch()
+			self.Task = victim.Tasks.PopFront();
+			--m_queuedTasks;
+			size_t const extra = std::min<size_t>(kMaxStealBatchSize - 1, victim.Tasks.Size() / 2);
+			for (size_t j = 0; j < extra; ++j) {
+				self.Tasks.PushBack(victim.Tasks.PopFront());
+			}
+
+			++m_result.Steals;
+			*delay = m_options.StealNs + m_options.TaskStartNs;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void DagReplayer::NotifyWork(unsigned count, uint64_t const now) {
+	bool const sleeping = m_options.Behavior == ReplayIdleBehavior::Sleep;
+	while (count > 0 && !m_idleCores.empty()) {
+		uint32_t const core = m_idleCores.back();
+		m_idleCores.pop_back();
+		m_cores[core].Idle = false;
+
+		if (sleeping) {
+			++m_result.Wakes;
+		}
+		Schedule(now + (sleeping ? m_options.WakeNs : 0), core, kNone, EventKind::CoreReady);
+		--count;
+	}
+}
+
+void DagReplayer::Release(uint32_t const counter, uint32_t const count, uint32_t const core, uint64_t const now) {
+	DagCounter const &info = m_frame->Counters[counter];
+	CounterState &state = m_counters[counter];
+
+	// A recording can't add more tasks than ran, but be robust to it anyway
+	uint32_t const released = std::min(count, info.TaskCount - state.Released);
+	for (uint32_t i = 0; i < released; ++i) {
+		m_cores[core].Tasks.PushBack(info.FirstTask + state.Released + i);
+	}
+	state.Released += released;
+	m_queuedTasks += released;
+
+	if (released != 0) {
+		CheckWaiters(counter, core, now);
+		NotifyWork(released, now);
+	}
+}
+
+void DagReplayer::FinishTask(uint32_t const task, uint32_t const core, uint64_t const now) {
+	if (task == 0) {
+		m_rootDone = true;
+		m_result.MakespanNs = now;
+		return;
+	}
+
+	uint32_t const counter = m_frame->Tasks[task].Counter;
+	++m_counters[counter].Finished;
+	CheckWaiters(counter, core, now);
+}
+
+void DagReplayer::CheckWaiters(uint32_t const counter, uint32_t const core, uint64_t const now) {
+	CounterState &state = m_counters[counter];
+	uint32_t const value = state.Released - state.Finished;
+
+	uint32_t *link = &state.FirstWaiter;
+	while (*link != kNone) {
+		Waiter const waiter = m_waiters[*link];
+		if (waiter.Target == value) {
+			*link = waiter.Next;
+			ReadyFiber(waiter.Task, core, now);
+		} else {
+			link = &m_waiters[*link].Next;
+		}
+	}
+}
+
+void DagReplayer::ReadyFiber(uint32_t const task, uint32_t const core, uint64_t const now) {
+	m_cores[core].ReadyFibers.PushBack(task);
+	++m_readyFibers;
+
+	if (!m_cores[core].Idle) {
+		NotifyWork(1, now);
+		return;
+	}
+
+	// The core it was queued on is idle, so wake that one rather than making another core steal it
+	m_idleCores.erase(std::find(m_idleCores.begin(), m_idleCores.end(), core));
+	m_idleCores.push_back(core);
+	NotifyWork(1, now);
+}
+
+void DagReplayer::ResumeSuspended(uint64_t const now) {
+	--m_suspendedTasks;
+
+	if (!m_stalledCores.empty()) {
+		uint32_t const core = m_stalledCores.back();
+		m_stalledCores.pop_back();
+		Schedule(now + m_options.FiberSwitchNs, core, kNone, EventKind::CoreReady);
+	}
+}
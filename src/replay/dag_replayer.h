@@ -0,0 +1,240 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "replay/task_dag.h"
+
+#include <stdint.h>
+#include <vector>
+
+enum class ReplayIdleBehavior {
+	// Idle cores keep looking for work, so they see new work right away
+	Spin,
+	// Same as Spin in the model. Yielding only matters when there are more threads than cores
+	Yield,
+	// Idle cores sleep, and take ReplayOptions::WakeNs to start looking for work once they are woken
+	Sleep,
+};
+
+struct ReplayOptions {
+	unsigned Cores = 1;
+	/* The time for an idle core to take work from another core's queue */
+	uint64_t StealNs = 200;
+	/* With ReplayIdleBehavior::Sleep, the time between a core being woken, and it looking for work */
+	uint64_t WakeNs = 10000;
+	/* The time to switch fibers. Paid when a task suspends, and again when it resumes */
+	uint64_t FiberSwitchNs = 100;
+	/* The scheduler's own time to start a task, on top of the task's recorded cost */
+	uint64_t TaskStartNs = 0;
+	/**
+	 * Every core holds a fiber, and so does every suspended task. A core that can't get a fiber to switch to stalls
+	 * Like the scheduler, there must be at least one fiber per core. DagReplayer raises smaller pools to Cores
+	 */
+	unsigned FiberPoolSize = 4096;
+	ReplayIdleBehavior Behavior = ReplayIdleBehavior::Sleep;
+};
+
+struct FrameReplayResult {
+	/* The predicted frame time. If Deadlocked, only the time of the last event, which isn't a frame time */
+	uint64_t MakespanNs;
+	/* The time spent running tasks. Doesn't depend on the options */
+	uint64_t WorkNs;
+	uint64_t Steals;
+	/* The number of times a sleeping core was woken. Only with ReplayIdleBehavior::Sleep */
+	uint64_t Wakes;
+	uint64_t FiberSwitches;
+	/* The number of times a core had to wait for a fiber */
+	uint64_t FiberStalls;
+	/* The most fibers in use at once. Never more than FiberPoolSize. Stalled cores wait without one */
+	unsigned PeakFibers;
+	/* True if the replay stopped before the root task finished. e.g. because the fiber pool was too small */
+	bool Deadlocked;
+};
+
+/**
+ * Replays recorded task graphs on virtual cores, in virtual time
+ *
+ * The model follows the scheduler: every core has a LIFO queue of tasks and a queue of ready fibers, which take
+ * priority. Idle cores steal from the other end of other cores' queues, taking up to half of the tasks at once. Tasks run
+ * for their recorded cost, and suspend on waits until the counter reaches the target value. The fiber that resumes a
+ * task is queued on the core that finished the counter's last task
+ *
+ * Replays are deterministic: the same frame and options always give the same result. The replayer keeps its storage
+ * between frames, so after the first few frames a replay doesn't allocate
+ */
+class DagReplayer {
+public:
+	explicit DagReplayer(ReplayOptions const &options);
+
+	DagReplayer(DagReplayer const &) = delete;
+	DagReplayer(DagReplayer &&) noexcept = delete;
+	DagReplayer &operator=(DagReplayer const &) = delete;
+	DagReplayer &operator=(DagReplayer &&) noexcept = delete;
+	~DagReplayer() = default;
+
+private:
+	constexpr static uint32_t kNone = 0xFFFFFFFF;
+	constexpr static uint32_t kMaxStealBatchSize = 32;
+
+	/* A double ended queue of task indices. The owner works on the back, thieves take from the front */
+	struct TaskQueue {
+		std::vector<uint32_t> Items;
+		size_t Head = 0;
+
+		bool Empty() const {
+			return Head == Items.size();
+		}
+		size_t Size() const {
+			return Items.size() - Head;
+		}
+		void PushBack(uint32_t const task) {
+			Items.push_back(task);
+		}
+		uint32_t PopBack() {
+			uint32_t const task = Items.back();
+			Items.pop_back();
+			Reset();
+			return task;
+		}
+		uint32_t PopFront() {
+			uint32_t const task = Items[Head++];
+			Reset();
+			return task;
+		}
+		void Clear() {
+			Items.clear();
+			Head = 0;
+		}
+
+	private:
+		void Reset() {
+			if (Head == Items.size()) {
+				Clear();
+			}
+		}
+	};
+
+	struct Core {
+		/* The task the core is running, or kNone */
+		uint32_t Task;
+		TaskQueue Tasks;
+		TaskQueue ReadyFibers;
+		bool Idle;
+	};
+
+	struct CounterState {
+		uint32_t Released;
+		uint32_t Finished;
+		/* The head of the counter's list in m_waiters */
+		uint32_t FirstWaiter;
+	};
+
+	struct Waiter {
+		uint32_t Task;
+		uint32_t Target;
+		uint32_t Next;
+	};
+
+	enum class EventKind {
+		// The core finished what it was doing, and continues with its task, or looks for another one
+		CoreReady,
+		// A task that waited on something outside the graph is ready to resume
+		ExternalWaitDone,
+	};
+
+	struct Event {
+		uint64_t Time;
+		/* Breaks ties, so the replay is deterministic */
+		uint64_t Sequence;
+		uint32_t Core;
+		uint32_t Task;
+		EventKind Kind;
+
+		bool operator>(Event const &other) const {
+			return Time != other.Time ? Time > other.Time : Sequence > other.Sequence;
+		}
+	};
+
+	ReplayOptions m_options;
+	DagFrame const *m_frame{nullptr};
+
+	std::vector<Core> m_cores;
+	std::vector<CounterState> m_counters;
+	std::vector<Waiter> m_waiters;
+	/* The next step of each task */
+	std::vector<uint32_t> m_nextStep;
+	/* A min-heap, kept with std::push_heap / std::pop_heap */
+	std::vector<Event> m_events;
+	uint64_t m_nextSequence{0};
+	std::vector<uint32_t> m_idleCores;
+	std::vector<uint32_t> m_stalledCores;
+
+	size_t m_queuedTasks{0};
+	size_t m_readyFibers{0};
+	unsigned m_suspendedTasks{0};
+	bool m_rootDone{false};
+	FrameReplayResult m_result{};
+
+public:
+	/**
+	 * Replays one frame
+	 *
+	 * @param frame    The frame. Must have been read by DagReader, or be equally consistent
+	 * @return         The predicted timing of the frame
+	 */
+	FrameReplayResult Replay(DagFrame const &frame);
+
+private:
+	void Reset(DagFrame const &frame);
+	void Schedule(uint64_t time, uint32_t core, uint32_t task, EventKind kind);
+
+	/**
+	 * Lets delay pass on a core
+	 *
+	 * @return    True if the core can carry on at *now + delay, because nothing else happens before then. Otherwise, a
+	 *            CoreReady event is queued, and the core has to stop
+	 */
+	bool Advance(uint32_t core, uint64_t *now, uint64_t delay);
+	/* Runs the core until it has to wait for other cores, or has nothing to do */
+	void RunCore(uint32_t core, uint64_t now);
+	/**
+	 * Finds the next thing for a core to do, and makes it the core's task
+	 *
+	 * @param delay    Filled with the time it takes to get it. e.g. the cost of stealing it
+	 * @return         False if there was nothing. The core is marked idle
+	 */
+	bool FindWork(uint32_t core, uint64_t now, uint64_t *delay);
+	bool StealWork(uint32_t core, uint64_t now, uint64_t *delay);
+	/* Wakes up to count idle cores, for work that was just queued */
+	void NotifyWork(unsigned count, uint64_t now);
+
+	void Release(uint32_t counter, uint32_t count, uint32_t core, uint64_t now);
+	void FinishTask(uint32_t task, uint32_t core, uint64_t now);
+	/* Readies the waiters of counter whose target value it has reached, on core */
+	void CheckWaiters(uint32_t counter, uint32_t core, uint64_t now);
+	void ReadyFiber(uint32_t task, uint32_t core, uint64_t now);
+	/* Takes a task back from being suspended. Lets a stalled core continue, now that there's a fiber for it */
+	void ResumeSuspended(uint64_t now);
+};
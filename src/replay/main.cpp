@@ -0,0 +1,430 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "replay/dag_replayer.h"
+#include "replay/task_dag.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+struct ReplayArgs {
+	/* The task graph written by ftl-sim --record. "-" reads stdin */
+	std::string InputPath;
+	/* Each combination of these is replayed. Empty means what the graph was recorded with */
+	std::vector<unsigned> Cores;
+	std::vector<unsigned> FiberPoolSizes;
+	std::vector<ReplayIdleBehavior> Behaviors;
+	/* The costs. Also replayed in every combination. Empty means the ReplayOptions default */
+	std::vector<uint64_t> StealNs;
+	std::vector<uint64_t> WakeNs;
+	std::vector<uint64_t> FiberSwitchNs;
+	std::vector<uint64_t> TaskStartNs;
+	/* The most frames to replay. 0 means all of them */
+	unsigned MaxFrames = 0;
+};
+
+/**
+ * The results of one configuration, over all the frames
+ *
+ * A deadlocked frame never finished, so it has no frame time. MakespansNs and the per frame counters only cover the
+ * frames that finished. FiberStalls and PeakFibers cover all of them, since they're what explains a deadlock
+ */
+struct ConfigResults {
+	ReplayOptions Options;
+	std::unique_ptr<DagReplayer> Replayer;
+	std::vector<uint64_t> MakespansNs;
+	uint64_t WorkNs = 0;
+	uint64_t Steals = 0;
+	uint64_t Wakes = 0;
+	uint64_t FiberSwitches = 0;
+	uint64_t FiberStalls = 0;
+	unsigned PeakFibers = 0;
+	uint64_t DeadlockedFrames = 0;
+};
+
+static void PrintUsage(char const *exe) {
+	printf("Usage: %s [options] GRAPH\n"
+	       "\n"
+	       "Predicts how a workload recorded with ftl-sim --record would run with a different number of cores, or scheduler\n"
+	       "settings, by replaying its task graph in virtual time. GRAPH can be - to read stdin\n"
+	       "Prints one JSON object per configuration, followed by a summary\n"
+	       "\n"
+	       "Options:\n"
+	       "  --cores=N[,N...]           The number of cores to replay on (default: the recorded thread count)\n"
+	       "  --fibers=N[,N...]          The size of the fiber pool (default: the recorded --max-fibers). Configurations with\n"
+	       "                             fewer fibers than cores are skipped\n"
+	       "  --behavior=B[,B...]        What idle cores do: spin, yield or sleep (default: the recorded behavior)\n"
+	       "  --steal-ns=N[,N...]        The time to steal work from another core (default: 200)\n"
+	       "  --wake-ns=N[,N...]         The time for a sleeping core to wake up (default: 10000)\n"
+	       "  --switch-ns=N[,N...]       The time to switch fibers (default: 100)\n"
+	       "  --task-ns=N[,N...]         The scheduler's time to start a task, on top of its recorded cost (default: 0)\n"
+	       "                             For a graph recorded with 1 thread, the summary suggests a value\n"
+	       "  --frames=N                 The most frames to replay (default: all)\n"
+	       "  --help                     Show this message\n",
+	       exe);
+}
+
+static bool ParseUnsigned(std::string const &text, unsigned long long const minimum, unsigned long long const maximum, unsigned long long *value) {
+	char *end;
+	unsigned long long const parsed = strtoull(text.c_str(), &end, 10);
+	if (end == text.c_str() || *end != '\0' || text[0] == '-' || parsed < minimum || parsed > maximum) {
+		return false;
+	}
+
+	*value = parsed;
+	return true;
+}
+
+static bool ParseBehavior(std::string const &text, ReplayIdleBehavior *behavior) {
+	if (text == "spin") {
+		*behavior = ReplayIdleBehavior::Spin;
+	} else if (text == "yield") {
+		*behavior = ReplayIdleBehavior::Yield;
+	} else if (text == "sleep") {
+		*behavior = ReplayIdleBehavior::Sleep;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static char const *BehaviorName(ReplayIdleBehavior const behavior) {
+	switch (behavior) {
+	case ReplayIdleBehavior::Spin:
+		return "spin";
+	case ReplayIdleBehavior::Yield:
+		return "yield";
+	case ReplayIdleBehavior::Sleep:
+	default:
+		return "sleep";
+	}
+}
+
+static std::vector<std::string> SplitList(std::string const &value) {
+	std::vector<std::string> items;
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t const comma = std::min(value.find(',', start), value.size());
+		items.push_back(value.substr(start, comma - start));
+		start = comma + 1;
+	}
+	return items;
+}
+
+template <typename T>
+static bool ParseUnsignedList(std::string const &value, unsigned long long const minimum, unsigned long long const maximum, std::vector<T> *list) {
+	list->clear();
+	for (std::string const &item : SplitList(value)) {
+		unsigned long long parsed;
+		if (!ParseUnsigned(item, minimum, maximum, &parsed)) {
+			return false;
+		}
+		list->push_back(static_cast<T>(parsed));
+	}
+	return true;
+}
+
+static std::vector<uint64_t> OrDefault(std::vector<uint64_t> const &values, uint64_t const fallback) {
+	return values.empty() ? std::vector<uint64_t>{fallback} : values;
+}
+
+/**
+ * Replaces each of the options with one copy per value
+ *
+ * @param options    The options so far
+ * @param values     The values to sweep over
+ * @param set        A callable with the signature void(ReplayOptions *, Value), which sets the value
+ */
+template <typename Value, typename Setter>
+static void AddSweep(std::vector<ReplayOptions> *options, std::vector<Value> const &values, Setter set) {
+	std::vector<ReplayOptions> combined;
+	combined.reserve(options->size() * values.size());
+	for (ReplayOptions const &option : *options) {
+		for (Value const &value : values) {
+			combined.push_back(option);
+			set(&combined.back(), value);
+		}
+	}
+	options->swap(combined);
+}
+
+/**
+ * Parses the command line
+ *
+ * @return    0 to run the replay, 1 if the process should exit successfully (e.g. --help), -1 on errors
+ */
+static int ParseArgs(int argc, char **argv, ReplayArgs *args) {
+	for (int i = 1; i < argc; ++i) {
+		std::string const arg = argv[i];
+		if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+			if (!args->InputPath.empty()) {
+				fprintf(stderr, "Only one task graph can be replayed at a time\n");
+				return -1;
+			}
+			args->InputPath = arg;
+			continue;
+		}
+
+		size_t const equals = arg.find('=');
+		std::string const name = arg.substr(0, equals);
+		std::string const value = equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+
+		bool valid = true;
+		unsigned long long parsed = 0;
+		if (name == "--help") {
+			PrintUsage(argv[0]);
+			return 1;
+		} else if (name == "--cores") {
+			valid = ParseUnsignedList(value, 1, 0xFFFFFFFFULL, &args->Cores);
+		} else if (name == "--fibers") {
+			valid = ParseUnsignedList(value, 1, 0xFFFFFFFFULL, &args->FiberPoolSizes);
+		} else if (name == "--behavior") {
+			args->Behaviors.clear();
+			for (std::string const &item : SplitList(value)) {
+				ReplayIdleBehavior behavior;
+				valid = valid && ParseBehavior(item, &behavior);
+				args->Behaviors.push_back(behavior);
+			}
+		} else if (name == "--steal-ns") {
+			valid = ParseUnsignedList(value, 0, ~0ULL, &args->StealNs);
+		} else if (name == "--wake-ns") {
+			valid = ParseUnsignedList(value, 0, ~0ULL, &args->WakeNs);
+		} else if (name == "--switch-ns") {
+			valid = ParseUnsignedList(value, 0, ~0ULL, &args->FiberSwitchNs);
+		} else if (name == "--task-ns") {
+			valid = ParseUnsignedList(value, 0, ~0ULL, &args->TaskStartNs);
+		} else if (name == "--frames") {
+			valid = ParseUnsigned(value, 1, 0xFFFFFFFFULL, &parsed);
+			args->MaxFrames = static_cast<unsigned>(parsed);
+		} else {
+			fprintf(stderr, "Unknown option %s. See --help\n", arg.c_str());
+			return -1;
+		}
+
+		if (!valid) {
+			fprintf(stderr, "Invalid value for %s: '%s'\n", name.c_str(), value.c_str());
+			return -1;
+		}
+	}
+
+	if (args->InputPath.empty()) {
+		fprintf(stderr, "No task graph given. See --help\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t Percentile(std::vector<uint64_t> const &sorted, double const fraction) {
+	size_t const index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * static_cast<double>(sorted.size())));
+	return sorted[index];
+}
+
+static void PrintConfig(ConfigResults *config, uint64_t const recordedFrames, uint64_t const recordedTotalNs) {
+	ReplayOptions const &options = config->Options;
+	printf("{\"cores\":%u,\"fibers\":%u,\"behavior\":\"%s\",\"steal_ns\":%llu,\"wake_ns\":%llu,\"switch_ns\":%llu,\"task_ns\":%llu,\"frames\":%zu,"
+	       "\"deadlocked_frames\":%llu,\"recorded_frame_ms\":%.4f,",
+	       options.Cores, options.FiberPoolSize, BehaviorName(options.Behavior), static_cast<unsigned long long>(options.StealNs),
+	       static_cast<unsigned long long>(options.WakeNs), static_cast<unsigned long long>(options.FiberSwitchNs),
+	       static_cast<unsigned long long>(options.TaskStartNs), config->MakespansNs.size(), static_cast<unsigned long long>(config->DeadlockedFrames),
+	       static_cast<double>(recordedTotalNs) / static_cast<double>(recordedFrames) / 1e6);
+
+	std::vector<uint64_t> &makespans = config->MakespansNs;
+	if (makespans.empty()) {
+		// Every frame deadlocked. There's nothing to predict from
+		printf("\"predicted_frame_ms\":null,\"work_ms\":null,\"speedup\":null,\"utilization\":null,\"steals_per_frame\":null,\"wakes_per_frame\":null,"
+		       "\"fiber_switches_per_frame\":null,");
+	} else {
+		auto const frames = static_cast<double>(makespans.size());
+		uint64_t totalNs = 0;
+		for (uint64_t const ns : makespans) {
+			totalNs += ns;
+		}
+		std::sort(makespans.begin(), makespans.end());
+
+		double const meanNs = static_cast<double>(totalNs) / frames;
+		double const work = static_cast<double>(config->WorkNs);
+		printf("\"predicted_frame_ms\":{\"mean\":%.4f,\"p50\":%.4f,\"p90\":%.4f,\"max\":%.4f},\"work_ms\":%.4f,\"speedup\":%.3f,\"utilization\":%.3f,"
+		       "\"steals_per_frame\":%.1f,\"wakes_per_frame\":%.1f,\"fiber_switches_per_frame\":%.1f,",
+		       meanNs / 1e6, static_cast<double>(Percentile(makespans, 0.5)) / 1e6, static_cast<double>(Percentile(makespans, 0.9)) / 1e6,
+		       static_cast<double>(makespans.back()) / 1e6, work / frames / 1e6, totalNs != 0 ? work / static_cast<double>(totalNs) : 0.0,
+		       totalNs != 0 ? work / (static_cast<double>(totalNs) * options.Cores) : 0.0, static_cast<double>(config->Steals) / frames,
+		       static_cast<double>(config->Wakes) / frames, static_cast<double>(config->FiberSwitches) / frames);
+	}
+
+	printf("\"fiber_stalls\":%llu,\"peak_fibers\":%u}\n", static_cast<unsigned long long>(config->FiberStalls), config->PeakFibers);
+
+	if (config->DeadlockedFrames != 0) {
+		fprintf(stderr, "Warning: %llu of %llu frames deadlocked with cores=%u fibers=%u behavior=%s. They're left out of the predictions\n",
+		        static_cast<unsigned long long>(config->DeadlockedFrames), static_cast<unsigned long long>(recordedFrames), options.Cores,
+		        options.FiberPoolSize, BehaviorName(options.Behavior));
+	}
+}
+
+int main(int argc, char **argv) {
+	ReplayArgs args;
+	int const parseResult = ParseArgs(argc, argv, &args);
+	if (parseResult != 0) {
+		return parseResult > 0 ? 0 : 1;
+	}
+
+	FILE *input = args.InputPath == "-" ? stdin : fopen(args.InputPath.c_str(), "r");
+	if (input == nullptr) {
+		fprintf(stderr, "Failed to open %s\n", args.InputPath.c_str());
+		return 1;
+	}
+
+	DagReader reader(input);
+	DagHeader header;
+	if (!reader.ReadHeader(&header)) {
+		fprintf(stderr, "Failed to read %s: %s\n", args.InputPath.c_str(), reader.GetError().c_str());
+		if (input != stdin) {
+			fclose(input);
+		}
+		return 1;
+	}
+
+	if (args.Cores.empty()) {
+		args.Cores.push_back(std::max(1U, header.Threads));
+	}
+	if (args.FiberPoolSizes.empty()) {
+		args.FiberPoolSizes.push_back(std::max(1U, header.MaxFibers));
+	}
+	if (args.Behaviors.empty()) {
+		ReplayIdleBehavior behavior = ReplayIdleBehavior::Sleep;
+		ParseBehavior(header.Behavior, &behavior);
+		args.Behaviors.push_back(behavior);
+	}
+
+	// The scheduler can't run with fewer fibers than threads. Every thread needs a fiber of its own
+	for (unsigned const fibers : args.FiberPoolSizes) {
+		for (unsigned const cores : args.Cores) {
+			if (fibers < cores) {
+				fprintf(stderr, "Skipping cores=%u fibers=%u: there must be at least one fiber per core\n", cores, fibers);
+			}
+		}
+	}
+
+	ReplayOptions const defaults;
+	std::vector<ReplayOptions> sweep(1);
+	AddSweep(&sweep, args.Behaviors, [](ReplayOptions *options, ReplayIdleBehavior const value) { options->Behavior = value; });
+	AddSweep(&sweep, args.FiberPoolSizes, [](ReplayOptions *options, unsigned const value) { options->FiberPoolSize = value; });
+	AddSweep(&sweep, args.Cores, [](ReplayOptions *options, unsigned const value) { options->Cores = value; });
+	AddSweep(&sweep, OrDefault(args.StealNs, defaults.StealNs), [](ReplayOptions *options, uint64_t const value) { options->StealNs = value; });
+	AddSweep(&sweep, OrDefault(args.WakeNs, defaults.WakeNs), [](ReplayOptions *options, uint64_t const value) { options->WakeNs = value; });
+	AddSweep(&sweep, OrDefault(args.FiberSwitchNs, defaults.FiberSwitchNs), [](ReplayOptions *options, uint64_t const value) { options->FiberSwitchNs = value; });
+	AddSweep(&sweep, OrDefault(args.TaskStartNs, defaults.TaskStartNs), [](ReplayOptions *options, uint64_t const value) { options->TaskStartNs = value; });
+
+	std::vector<ConfigResults> configs;
+	for (ReplayOptions const &options : sweep) {
+		if (options.FiberPoolSize < options.Cores) {
+			continue;
+		}
+
+		ConfigResults config;
+		config.Options = options;
+		config.Replayer.reset(new DagReplayer(config.Options));
+		configs.push_back(std::move(config));
+	}
+
+	if (configs.empty()) {
+		fprintf(stderr, "No configurations to replay. See --help\n");
+		if (input != stdin) {
+			fclose(input);
+		}
+		return 1;
+	}
+
+	// Each frame is read once, and replayed with every configuration, so the file is streamed
+	auto const start = std::chrono::steady_clock::now();
+	DagFrame frame;
+	uint64_t frames = 0;
+	uint64_t tasks = 0;
+	uint64_t recordedTotalNs = 0;
+	// The time spent running tasks, over all the frames. It's the same for every configuration
+	uint64_t workNs = 0;
+	while ((args.MaxFrames == 0 || frames < args.MaxFrames) && reader.ReadFrame(&frame)) {
+		++frames;
+		tasks += frame.Tasks.size();
+		recordedTotalNs += frame.RecordedNs;
+
+		for (DagStep const &step : frame.Steps) {
+			if (step.Kind == DagStepKind::Run) {
+				workNs += step.Ns;
+			}
+		}
+
+		for (ConfigResults &config : configs) {
+			FrameReplayResult const result = config.Replayer->Replay(frame);
+			config.FiberStalls += result.FiberStalls;
+			config.PeakFibers = std::max(config.PeakFibers, result.PeakFibers);
+			if (result.Deadlocked) {
+				++config.DeadlockedFrames;
+				continue;
+			}
+
+			config.MakespansNs.push_back(result.MakespanNs);
+			config.WorkNs += result.WorkNs;
+			config.Steals += result.Steals;
+			config.Wakes += result.Wakes;
+			config.FiberSwitches += result.FiberSwitches;
+		}
+	}
+	double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	bool const success = reader.GetError().empty();
+	if (!success) {
+		fprintf(stderr, "Failed to read %s: %s\n", args.InputPath.c_str(), reader.GetError().c_str());
+	}
+	if (input != stdin) {
+		fclose(input);
+	}
+
+	if (frames != 0) {
+		for (ConfigResults &config : configs) {
+			PrintConfig(&config, frames, recordedTotalNs);
+		}
+	}
+
+	// With a single thread, whatever the recorded frames took beyond the tasks' own time is the scheduler's overhead
+	// Fiber switches are part of it, but they're rare enough that it's still a useful starting point for --task-ns
+	long long suggestedTaskNs = -1;
+	if (header.Threads == 1 && tasks != 0 && recordedTotalNs > workNs) {
+		suggestedTaskNs = static_cast<long long>((recordedTotalNs - workNs) / tasks);
+	}
+
+	printf("{\"workload\":\"%s\",\"recorded_threads\":%u,\"recorded_behavior\":\"%s\",\"frames\":%llu,\"tasks_per_frame\":%.1f,\"suggested_task_ns\":%lld,"
+	       "\"configurations\":%zu,\"replay_seconds\":%.3f,\"frame_replays_per_second\":%.1f}\n",
+	       header.Workload.c_str(), header.Threads, header.Behavior.c_str(), static_cast<unsigned long long>(frames),
+	       frames != 0 ? static_cast<double>(tasks) / static_cast<double>(frames) : 0.0, suggestedTaskNs, configs.size(), seconds,
+	       seconds > 0.0 ? static_cast<double>(frames * configs.size()) / seconds : 0.0);
+
+	return success ? 0 : 1;
+}
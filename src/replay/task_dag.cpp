@@ -0,0 +1,302 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "replay/task_dag.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr static int kDagFormatVersion = 1;
+constexpr static size_t kMaxLineSize = 512;
+
+static void WriteCounter(FILE *file, uint32_t const counter) {
+	if (counter == kNoDagCounter) {
+		fputs(" -", file);
+	} else {
+		fprintf(file, " %" PRIu32, counter);
+	}
+}
+
+bool WriteDagHeader(FILE *file, DagHeader const &header) {
+	fprintf(file, "FtlTaskDag %d workload: %s threads: %u fibers: %u max_fibers: %u behavior: %s\n", kDagFormatVersion, header.Workload.c_str(), header.Threads,
+	        header.Fibers, header.MaxFibers, header.Behavior.c_str());
+	return ferror(file) == 0;
+}
+
+bool WriteDagFrame(FILE *file, DagFrame const &frame) {
+	fprintf(file, "Frame recorded_ns: %" PRIu64 " tasks: %zu counters: %zu steps: %zu\n", frame.RecordedNs, frame.Tasks.size(), frame.Counters.size(), frame.Steps.size());
+	for (DagCounter const &counter : frame.Counters) {
+		fprintf(file, "C %" PRIu32 " %" PRIu32 "\n", counter.TaskCount, counter.ReadyAtStart);
+	}
+
+	for (DagTask const &task : frame.Tasks) {
+		fputs("T", file);
+		WriteCounter(file, task.Counter);
+		fprintf(file, " %" PRIu32 "\n", task.StepCount);
+
+		for (uint32_t i = task.FirstStep; i < task.FirstStep + task.StepCount; ++i) {
+			DagStep const &step = frame.Steps[i];
+			switch (step.Kind) {
+			case DagStepKind::Run:
+				fprintf(file, "R %" PRIu64 "\n", step.Ns);
+				break;
+			case DagStepKind::Spawn:
+				fprintf(file, "S %" PRIu32 " %" PRIu32 "\n", step.Counter, step.Value);
+				break;
+			case DagStepKind::Wait:
+				fputs("W", file);
+				WriteCounter(file, step.Counter);
+				fprintf(file, " %" PRIu32 " %" PRIu64 "\n", step.Value, step.Ns);
+				break;
+			}
+		}
+	}
+
+	fputs("End\n", file);
+	return ferror(file) == 0;
+}
+
+/**
+ * Parses "<label><unsigned>", skipping any spaces before the number. label can be empty
+ *
+ * @return    False if the text doesn't match. *cursor is left somewhere undefined
+ */
+static bool ParseUnsignedField(char const **cursor, char const *label, uint64_t *value) {
+	size_t const labelSize = strlen(label);
+	if (strncmp(*cursor, label, labelSize) != 0) {
+		return false;
+	}
+	*cursor += labelSize;
+	while (**cursor == ' ') {
+		++*cursor;
+	}
+
+	if (**cursor < '0' || **cursor > '9') {
+		return false;
+	}
+	char *end;
+	*value = strtoull(*cursor, &end, 10);
+	*cursor = end;
+	return true;
+}
+
+/* Parses a counter index, or '-' for kNoDagCounter */
+static bool ParseCounterField(char const **cursor, uint32_t const counterCount, uint32_t *counter) {
+	while (**cursor == ' ') {
+		++*cursor;
+	}
+	if (**cursor == '-') {
+		++*cursor;
+		*counter = kNoDagCounter;
+		return true;
+	}
+
+	uint64_t value;
+	if (!ParseUnsignedField(cursor, "", &value) || value >= counterCount) {
+		return false;
+	}
+	*counter = static_cast<uint32_t>(value);
+	return true;
+}
+
+/* Parses "<label><word>", where the word ends at the next space or the end of the line */
+static bool ParseWordField(char const **cursor, char const *label, std::string *value) {
+	size_t const labelSize = strlen(label);
+	if (strncmp(*cursor, label, labelSize) != 0) {
+		return false;
+	}
+	*cursor += labelSize;
+
+	char const *end = *cursor;
+	while (*end != ' ' && *end != '\0') {
+		++end;
+	}
+	value->assign(*cursor, static_cast<size_t>(end - *cursor));
+	*cursor = end;
+	return true;
+}
+
+static bool AtEnd(char const *cursor) {
+	return *cursor == '\0';
+}
+
+static bool FitsIn32Bits(uint64_t const value) {
+	return value <= 0xFFFFFFFFULL;
+}
+
+bool DagReader::ReadLine(char *buffer, size_t const size) {
+	if (fgets(buffer, static_cast<int>(size), m_file) == nullptr) {
+		return false;
+	}
+	++m_lineNumber;
+
+	size_t length = strlen(buffer);
+	while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == '\r')) {
+		buffer[--length] = '\0';
+	}
+	return true;
+}
+
+bool DagReader::Fail(char const *message) {
+	m_error = "line " + std::to_string(m_lineNumber) + ": " + message;
+	return false;
+}
+
+bool DagReader::ReadHeader(DagHeader *header) {
+	char line[kMaxLineSize];
+	if (!ReadLine(line, sizeof(line))) {
+		return Fail("missing header");
+	}
+
+	char const *cursor = line;
+	uint64_t version;
+	uint64_t threads;
+	uint64_t fibers;
+	uint64_t maxFibers;
+	if (!ParseUnsignedField(&cursor, "FtlTaskDag ", &version)) {
+		return Fail("not a task graph file");
+	}
+	if (version != kDagFormatVersion) {
+		return Fail("unsupported task graph version");
+	}
+	if (!ParseWordField(&cursor, " workload: ", &header->Workload) || !ParseUnsignedField(&cursor, " threads: ", &threads) ||
+	    !ParseUnsignedField(&cursor, " fibers: ", &fibers) || !ParseUnsignedField(&cursor, " max_fibers: ", &maxFibers) ||
+	    !ParseWordField(&cursor, " behavior: ", &header->Behavior) || !AtEnd(cursor) || !FitsIn32Bits(threads) || !FitsIn32Bits(fibers) ||
+	    !FitsIn32Bits(maxFibers)) {
+		return Fail("malformed header");
+	}
+
+	header->Threads = static_cast<unsigned>(threads);
+	header->Fibers = static_cast<unsigned>(fibers);
+	header->MaxFibers = static_cast<unsigned>(maxFibers);
+	return true;
+}
+
+bool DagReader::ReadFrame(DagFrame *frame) {
+	frame->Clear();
+	m_error.clear();
+
+	char line[kMaxLineSize];
+	if (!ReadLine(line, sizeof(line))) {
+		// The end of the file
+		return false;
+	}
+
+	char const *cursor = line;
+	uint64_t taskCount;
+	uint64_t counterCount;
+	uint64_t stepCount;
+	if (!ParseUnsignedField(&cursor, "Frame recorded_ns: ", &frame->RecordedNs) || !ParseUnsignedField(&cursor, " tasks: ", &taskCount) ||
+	    !ParseUnsignedField(&cursor, " counters: ", &counterCount) || !ParseUnsignedField(&cursor, " steps: ", &stepCount) || !AtEnd(cursor)) {
+		return Fail("malformed frame header");
+	}
+	if (taskCount == 0 || !FitsIn32Bits(taskCount) || counterCount >= kNoDagCounter || !FitsIn32Bits(stepCount)) {
+		return Fail("frame is too large, or has no root task");
+	}
+	auto const counters = static_cast<uint32_t>(counterCount);
+
+	// The counters' tasks follow the root, in counter order
+	uint32_t nextTask = 1;
+	frame->Counters.reserve(counters);
+	for (uint32_t i = 0; i < counters; ++i) {
+		uint64_t tasks;
+		uint64_t readyAtStart;
+		cursor = line;
+		if (!ReadLine(line, sizeof(line)) || !ParseUnsignedField(&cursor, "C", &tasks) || !ParseUnsignedField(&cursor, "", &readyAtStart) || !AtEnd(cursor) ||
+		    readyAtStart > tasks || tasks > taskCount - nextTask) {
+			return Fail("malformed counter");
+		}
+
+		frame->Counters.push_back({nextTask, static_cast<uint32_t>(tasks), static_cast<uint32_t>(readyAtStart)});
+		nextTask += static_cast<uint32_t>(tasks);
+	}
+	if (nextTask != taskCount) {
+		return Fail("the counters don't add up to the task count");
+	}
+
+	frame->Tasks.reserve(taskCount);
+	frame->Steps.reserve(stepCount);
+	// Tasks are listed in the same order as their counters
+	uint32_t expectedCounter = 0;
+	for (uint64_t i = 0; i < taskCount; ++i) {
+		uint32_t counter;
+		uint64_t steps;
+		if (!ReadLine(line, sizeof(line)) || line[0] != 'T') {
+			return Fail("malformed task");
+		}
+		cursor = line + 1;
+		if (!ParseCounterField(&cursor, counters, &counter) || !ParseUnsignedField(&cursor, "", &steps) || !AtEnd(cursor) || steps > stepCount - frame->Steps.size()) {
+			return Fail("malformed task");
+		}
+
+		if (i != 0) {
+			while (i >= frame->Counters[expectedCounter].FirstTask + frame->Counters[expectedCounter].TaskCount) {
+				++expectedCounter;
+			}
+		}
+		if (counter != (i == 0 ? kNoDagCounter : expectedCounter)) {
+			return Fail("task is out of order");
+		}
+
+		frame->Tasks.push_back({counter, static_cast<uint32_t>(frame->Steps.size()), static_cast<uint32_t>(steps)});
+		for (uint64_t j = 0; j < steps; ++j) {
+			if (!ReadLine(line, sizeof(line))) {
+				return Fail("unexpected end of file");
+			}
+
+			DagStep step{DagStepKind::Run, kNoDagCounter, 0, 0};
+			uint64_t value = 0;
+			cursor = line + 1;
+			bool valid = false;
+			switch (line[0]) {
+			case 'R':
+				valid = ParseUnsignedField(&cursor, "", &step.Ns);
+				break;
+			case 'S':
+				step.Kind = DagStepKind::Spawn;
+				valid = ParseCounterField(&cursor, counters, &step.Counter) && step.Counter != kNoDagCounter && ParseUnsignedField(&cursor, "", &value);
+				break;
+			case 'W':
+				step.Kind = DagStepKind::Wait;
+				valid = ParseCounterField(&cursor, counters, &step.Counter) && ParseUnsignedField(&cursor, "", &value) && ParseUnsignedField(&cursor, "", &step.Ns);
+				break;
+			default:
+				break;
+			}
+			if (!valid || !AtEnd(cursor) || !FitsIn32Bits(value)) {
+				return Fail("malformed step");
+			}
+
+			step.Value = static_cast<uint32_t>(value);
+			frame->Steps.push_back(step);
+		}
+	}
+
+	if (frame->Steps.size() != stepCount || !ReadLine(line, sizeof(line)) || strcmp(line, "End") != 0) {
+		return Fail("frame doesn't end where its header says");
+	}
+
+	return true;
+}
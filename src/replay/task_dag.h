@@ -0,0 +1,155 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/* The root task's counter, and the counter of waits on something that isn't a counter of the frame. e.g. a Fibtex */
+constexpr uint32_t kNoDagCounter = 0xFFFFFFFF;
+
+enum class DagStepKind : uint32_t {
+	// The task ran for Ns
+	Run,
+	// The task added Value tasks to Counter
+	Spawn,
+	// The task waited for Counter to reach Value. Ns is how long it was suspended in the recorded run
+	Wait,
+};
+
+struct DagStep {
+	DagStepKind Kind;
+	uint32_t Counter;
+	uint32_t Value;
+	uint64_t Ns;
+};
+
+struct DagTask {
+	/* The counter the task decrements when it finishes. kNoDagCounter for the root */
+	uint32_t Counter;
+	/* The task's steps are Steps[FirstStep, FirstStep + StepCount) */
+	uint32_t FirstStep;
+	uint32_t StepCount;
+};
+
+/**
+ * One use of a TaskCounter: the tasks added to it up until it was waited on. A counter that is reused after a
+ * wait gets a new DagCounter
+ */
+struct DagCounter {
+	/* The counter's tasks are Tasks[FirstTask, FirstTask + TaskCount), in the order they started in the recorded run */
+	uint32_t FirstTask;
+	uint32_t TaskCount;
+	/* The number of tasks that are ready when the frame starts, because no recorded task added them */
+	uint32_t ReadyAtStart;
+};
+
+/* The tasks run by one Workload::Run() */
+struct DagFrame {
+	/* How long the frame took in the recorded run */
+	uint64_t RecordedNs = 0;
+	/* Tasks[0] is the root: the main fiber, from the start to the end of the frame */
+	std::vector<DagTask> Tasks;
+	std::vector<DagCounter> Counters;
+	std::vector<DagStep> Steps;
+
+	void Clear() {
+		RecordedNs = 0;
+		Tasks.clear();
+		Counters.clear();
+		Steps.clear();
+	}
+};
+
+/* How the recording was made */
+struct DagHeader {
+	std::string Workload;
+	unsigned Threads = 0;
+	unsigned Fibers = 0;
+	unsigned MaxFibers = 0;
+	/* spin, yield or sleep */
+	std::string Behavior;
+};
+
+/**
+ * The task graph file is text, so it can be inspected by hand. After the header, each frame is
+ *
+ *   Frame recorded_ns: N tasks: T counters: C steps: S
+ *   C <task count> <ready at start>            C times
+ *   T <counter> <step count>                   T times, each followed by its steps:
+ *   R <ns>                                     Run
+ *   S <counter> <task count>                   Spawn
+ *   W <counter> <target value> <blocked ns>    Wait
+ *   End
+ *
+ * Counters are indices into the frame's counters, or '-' for kNoDagCounter
+ */
+bool WriteDagHeader(FILE *file, DagHeader const &header);
+bool WriteDagFrame(FILE *file, DagFrame const &frame);
+
+/**
+ * Reads a task graph file one frame at a time, so it can be replayed without loading the whole file
+ */
+class DagReader {
+public:
+	/**
+	 * @param file    The file to read. It must stay open for as long as the reader is used
+	 */
+	explicit DagReader(FILE *file)
+	        : m_file(file) {
+	}
+
+	DagReader(DagReader const &) = delete;
+	DagReader(DagReader &&) noexcept = delete;
+	DagReader &operator=(DagReader const &) = delete;
+	DagReader &operator=(DagReader &&) noexcept = delete;
+	~DagReader() = default;
+
+private:
+	FILE *m_file;
+	uint64_t m_lineNumber{0};
+	std::string m_error;
+
+public:
+	/* Must be called once, before ReadFrame() */
+	bool ReadHeader(DagHeader *header);
+	/**
+	 * Reads the next frame
+	 *
+	 * @param frame    Filled with the frame. Its storage is reused, so reading many frames doesn't allocate
+	 * @return         False at the end of the file, or if the file is malformed. See GetError()
+	 */
+	bool ReadFrame(DagFrame *frame);
+	/* Empty unless the last read failed because of a malformed file */
+	std::string const &GetError() const {
+		return m_error;
+	}
+
+private:
+	bool ReadLine(char *buffer, size_t size);
+	bool Fail(char const *message);
+};
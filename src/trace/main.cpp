@@ -0,0 +1,230 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace/trace_analyzer.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+struct TraceOptions {
+	/* The profile written by ftl-sim --profile. "-" reads stdin */
+	std::string InputPath;
+	/* If not empty, write a Chrome trace / Perfetto JSON file here */
+	std::string ChromePath;
+	std::string FrameName = "Frame";
+	/* The most critical path steps to print */
+	unsigned PathSteps = 100;
+};
+
+static void PrintUsage(char const *exe) {
+	printf("Usage: %s [options] PROFILE\n"
+	       "\n"
+	       "Analyzes a profile written by ftl-sim --profile. PROFILE can be - to read stdin\n"
+	       "Prints one JSON object per span name, followed by a summary, and the critical path of the slowest frame\n"
+	       "\n"
+	       "Options:\n"
+	       "  --frame=NAME               The name of the span that marks a frame (default: Frame)\n"
+	       "  --chrome=PATH              Write a Chrome trace / Perfetto JSON file to PATH\n"
+	       "  --path-steps=N             The most critical path steps to print (default: 100)\n"
+	       "  --help                     Show this message\n",
+	       exe);
+}
+
+/**
+ * Parses the command line
+ *
+ * @return    0 to run the analysis, 1 if the process should exit successfully (e.g. --help), -1 on errors
+ */
+static int ParseArgs(int argc, char **argv, TraceOptions *options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string const arg = argv[i];
+		if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+			if (!options->InputPath.empty()) {
+				fprintf(stderr, "Only one profile can be analyzed at a time\n");
+				return -1;
+			}
+			options->InputPath = arg;
+			continue;
+		}
+
+		size_t const equals = arg.find('=');
+		std::string const name = arg.substr(0, equals);
+		std::string const value = equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+
+		bool valid = true;
+		if (name == "--help") {
+			PrintUsage(argv[0]);
+			return 1;
+		} else if (name == "--frame") {
+			options->FrameName = value;
+			valid = !value.empty();
+		} else if (name == "--chrome") {
+			options->ChromePath = value;
+			valid = !value.empty();
+		} else if (name == "--path-steps") {
+			char *end;
+			unsigned long const parsed = strtoul(value.c_str(), &end, 10);
+			valid = end != value.c_str() && *end == '\0' && parsed <= 0xFFFFFFFFUL;
+			options->PathSteps = static_cast<unsigned>(parsed);
+		} else {
+			fprintf(stderr, "Unknown option %s. See --help\n", arg.c_str());
+			return -1;
+		}
+
+		if (!valid) {
+			fprintf(stderr, "Invalid value for %s: '%s'\n", name.c_str(), value.c_str());
+			return -1;
+		}
+	}
+
+	if (options->InputPath.empty()) {
+		fprintf(stderr, "No profile given. See --help\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void PrintJsonString(std::string const &text) {
+	putchar('"');
+	for (char const c : text) {
+		if (c == '"' || c == '\\') {
+			putchar('\\');
+			putchar(c);
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			printf("\\u%04x", static_cast<unsigned>(c));
+		} else {
+			putchar(c);
+		}
+	}
+	putchar('"');
+}
+
+static char const *StepKindName(CriticalPathStepKind kind) {
+	switch (kind) {
+	case CriticalPathStepKind::Running:
+		return "running";
+	case CriticalPathStepKind::WaitingToStart:
+		return "waiting_to_start";
+	case CriticalPathStepKind::WaitingToResume:
+		return "waiting_to_resume";
+	case CriticalPathStepKind::Blocked:
+	default:
+		return "blocked";
+	}
+}
+
+static void PrintResults(TraceAnalyzer const &analyzer, TraceOptions const &options) {
+	for (SpanNameStats const &stats : analyzer.GetSpanNameStats()) {
+		printf("{\"span\":");
+		PrintJsonString(stats.Name);
+		printf(",\"category\":");
+		PrintJsonString(stats.Category);
+		printf(",\"count\":%llu,\"wall_ns\":{\"total\":%llu,\"mean\":%llu,\"max\":%llu},\"cpu_ns\":%llu,\"suspended_ns\":%llu,"
+		       "\"suspensions\":%llu,\"migrations\":%llu,\"critical_ns\":%llu}\n",
+		       static_cast<unsigned long long>(stats.Count), static_cast<unsigned long long>(stats.WallTotalNs),
+		       static_cast<unsigned long long>(stats.Count != 0 ? stats.WallTotalNs / stats.Count : 0), static_cast<unsigned long long>(stats.WallMaxNs),
+		       static_cast<unsigned long long>(stats.CpuTotalNs), static_cast<unsigned long long>(stats.SuspendedTotalNs),
+		       static_cast<unsigned long long>(stats.Suspensions), static_cast<unsigned long long>(stats.Migrations), static_cast<unsigned long long>(stats.CriticalTotalNs));
+	}
+
+	uint64_t const frames = analyzer.GetFrameCount();
+	printf("{\"lines\":%llu,\"malformed_lines\":%llu,\"unmatched_events\":%llu,\"unfinished_spans\":%llu,\"peak_open_spans\":%llu,\"peak_frame_spans\":%llu,"
+	       "\"frames\":%llu,\"frame_mean_ns\":%llu}\n",
+	       static_cast<unsigned long long>(analyzer.GetLineCount()), static_cast<unsigned long long>(analyzer.GetMalformedLineCount()),
+	       static_cast<unsigned long long>(analyzer.GetUnmatchedEventCount()), static_cast<unsigned long long>(analyzer.GetUnfinishedSpanCount()),
+	       static_cast<unsigned long long>(analyzer.GetPeakOpenSpanCount()), static_cast<unsigned long long>(analyzer.GetPeakFrameSpanCount()),
+	       static_cast<unsigned long long>(frames), static_cast<unsigned long long>(frames != 0 ? analyzer.GetFrameWallTotalNs() / frames : 0));
+
+	if (frames == 0) {
+		return;
+	}
+
+	FrameSummary const &frame = analyzer.GetSlowestFrame();
+	size_t const printed = std::min<size_t>(frame.CriticalPath.size(), options.PathSteps);
+	printf("{\"slowest_frame\":{\"span_id\":%llu,\"wall_ns\":%llu,\"omitted_steps\":%llu,\"critical_path\":[", static_cast<unsigned long long>(frame.SpanId),
+	       static_cast<unsigned long long>(frame.WallNs), static_cast<unsigned long long>(frame.CriticalPath.size() - printed));
+	for (size_t i = 0; i < printed; ++i) {
+		CriticalPathStep const &step = frame.CriticalPath[i];
+		printf("%s{\"span\":", i == 0 ? "" : ",");
+		PrintJsonString(analyzer.GetNameStats(step.NameId).Name);
+		printf(",\"span_id\":%llu,\"kind\":\"%s\",\"ns\":%llu}", static_cast<unsigned long long>(step.SpanId), StepKindName(step.Kind), static_cast<unsigned long long>(step.Ns));
+	}
+	printf("]}}\n");
+}
+
+int main(int argc, char **argv) {
+	TraceOptions options;
+	int const parseResult = ParseArgs(argc, argv, &options);
+	if (parseResult != 0) {
+		return parseResult > 0 ? 0 : 1;
+	}
+
+	FILE *input = options.InputPath == "-" ? stdin : fopen(options.InputPath.c_str(), "r");
+	if (input == nullptr) {
+		fprintf(stderr, "Failed to open %s\n", options.InputPath.c_str());
+		return 1;
+	}
+
+	FILE *chromeFile = nullptr;
+	if (!options.ChromePath.empty()) {
+		chromeFile = fopen(options.ChromePath.c_str(), "w");
+		if (chromeFile == nullptr) {
+			fprintf(stderr, "Failed to open %s\n", options.ChromePath.c_str());
+			if (input != stdin) {
+				fclose(input);
+			}
+			return 1;
+		}
+	}
+
+	std::unique_ptr<ChromeTraceWriter> writer;
+	if (chromeFile != nullptr) {
+		writer.reset(new ChromeTraceWriter(chromeFile));
+	}
+
+	TraceAnalyzer analyzer(options.FrameName, writer.get());
+	bool success = analyzer.ProcessFile(input);
+	if (!success) {
+		fprintf(stderr, "Failed to read %s\n", options.InputPath.c_str());
+	}
+
+	PrintResults(analyzer, options);
+	if (writer) {
+		writer->Finish();
+	}
+
+	if (input != stdin) {
+		fclose(input);
+	}
+	if (chromeFile != nullptr && fclose(chromeFile) != 0) {
+		fprintf(stderr, "Failed to write %s\n", options.ChromePath.c_str());
+		success = false;
+	}
+
+	return success ? 0 : 1;
+}
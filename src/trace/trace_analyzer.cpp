@@ -0,0 +1,527 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace/trace_analyzer.h"
+
+#include <algorithm>
+#include <stddef.h>
+#include <string.h>
+#include <utility>
+
+static void WriteJsonString(FILE *file, std::string const &text) {
+	fputc('"', file);
+	for (char const c : text) {
+		if (c == '"' || c == '\\') {
+			fputc('\\', file);
+			fputc(c, file);
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			fprintf(file, "\\u%04x", static_cast<unsigned>(c));
+		} else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+ChromeTraceWriter::ChromeTraceWriter(FILE *file)
+        : m_file(file) {
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", m_file);
+}
+
+void ChromeTraceWriter::BeginEvent() {
+	if (!m_firstEvent) {
+		fputc(',', m_file);
+	}
+	fputc('\n', m_file);
+	m_firstEvent = false;
+}
+
+void ChromeTraceWriter::NameThread(unsigned threadIndex) {
+	if (threadIndex < m_namedThreads.size() && m_namedThreads[threadIndex]) {
+		return;
+	}
+	if (threadIndex >= m_namedThreads.size()) {
+		m_namedThreads.resize(threadIndex + 1, false);
+	}
+	m_namedThreads[threadIndex] = true;
+
+	BeginEvent();
+	fprintf(m_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Worker %u\"}}", threadIndex, threadIndex);
+}
+
+double ChromeTraceWriter::ToMicroseconds(uint64_t ns) {
+	return static_cast<double>(ns >= m_baseNs ? ns - m_baseNs : 0) / 1000.0;
+}
+
+void ChromeTraceWriter::Slice(std::string const &category, std::string const &name, unsigned threadIndex, uint64_t spanId, uint64_t startNs, uint64_t endNs) {
+	NameThread(threadIndex);
+
+	BeginEvent();
+	fputs("{\"name\":", m_file);
+	WriteJsonString(m_file, name);
+	fputs(",\"cat\":", m_file);
+	WriteJsonString(m_file, category);
+	fprintf(m_file, ",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"span\":%llu}}", threadIndex, ToMicroseconds(startNs),
+	        static_cast<double>(endNs >= startNs ? endNs - startNs : 0) / 1000.0, static_cast<unsigned long long>(spanId));
+}
+
+uint64_t ChromeTraceWriter::Flow(unsigned fromThread, uint64_t fromNs, unsigned toThread, uint64_t toNs) {
+	uint64_t const id = m_nextFlowId++;
+	NameThread(fromThread);
+	NameThread(toThread);
+
+	// A flow start binds to the slice that encloses it. The suspended slice ends exactly at fromNs, so step back into it
+	uint64_t const flowStartNs = fromNs > m_baseNs ? fromNs - 1 : fromNs;
+
+	BeginEvent();
+	fprintf(m_file, "{\"name\":\"migration\",\"cat\":\"ftl\",\"ph\":\"s\",\"id\":%llu,\"pid\":0,\"tid\":%u,\"ts\":%.3f}", static_cast<unsigned long long>(id), fromThread,
+	        ToMicroseconds(flowStartNs));
+	BeginEvent();
+	fprintf(m_file, "{\"name\":\"migration\",\"cat\":\"ftl\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%llu,\"pid\":0,\"tid\":%u,\"ts\":%.3f}", static_cast<unsigned long long>(id), toThread,
+	        ToMicroseconds(toNs));
+
+	return id;
+}
+
+void ChromeTraceWriter::Finish() {
+	fputs("\n]}\n", m_file);
+}
+
+TraceAnalyzer::TraceAnalyzer(std::string frameName, ChromeTraceWriter *writer)
+        : m_frameName(std::move(frameName)),
+          m_writer(writer) {
+}
+
+// Parses "<label><unsigned number>", and advances text past it
+static bool ParseField(char const **text, char const *end, char const *label, uint64_t *value) {
+	size_t const labelSize = strlen(label);
+	if (static_cast<size_t>(end - *text) < labelSize || memcmp(*text, label, labelSize) != 0) {
+		return false;
+	}
+
+	char const *c = *text + labelSize;
+	if (c == end || *c < '0' || *c > '9') {
+		return false;
+	}
+
+	uint64_t parsed = 0;
+	for (; c != end && *c >= '0' && *c <= '9'; ++c) {
+		parsed = parsed * 10 + static_cast<uint64_t>(*c - '0');
+	}
+
+	*value = parsed;
+	*text = c;
+	return true;
+}
+
+static bool StartsWith(char const *text, size_t size, char const *prefix) {
+	size_t const prefixSize = strlen(prefix);
+	return size >= prefixSize && memcmp(text, prefix, prefixSize) == 0;
+}
+
+bool TraceAnalyzer::ProcessLine(char const *line, size_t size) {
+	++m_lineCount;
+
+	// Tolerate files with Windows line endings
+	if (size > 0 && line[size - 1] == '\r') {
+		--size;
+	}
+	if (size == 0) {
+		return true;
+	}
+
+	// Every event ends with " threadId: T spanId: S now: N". Names can contain spaces, so search from the back
+	static char const kThreadLabel[] = " threadId: ";
+	size_t const threadLabelSize = sizeof(kThreadLabel) - 1;
+	char const *end = line + size;
+	char const *fields = nullptr;
+	for (size_t i = size >= threadLabelSize ? size - threadLabelSize + 1 : 0; i > 0; --i) {
+		if (memcmp(line + i - 1, kThreadLabel, threadLabelSize) == 0) {
+			fields = line + i - 1;
+			break;
+		}
+	}
+
+	uint64_t threadIndex;
+	uint64_t spanId;
+	uint64_t now;
+	char const *c = fields;
+	if (fields == nullptr || !ParseField(&c, end, kThreadLabel, &threadIndex) || !ParseField(&c, end, " spanId: ", &spanId) || !ParseField(&c, end, " now: ", &now) || c != end) {
+		++m_malformedLines;
+		return false;
+	}
+
+	if (!m_sawEvent) {
+		// Dump() sorts the events by time, so the first one is the earliest
+		m_sawEvent = true;
+		if (m_writer != nullptr) {
+			m_writer->SetStartTime(now);
+		}
+	}
+
+	auto const thread = static_cast<unsigned>(threadIndex);
+	size_t const head = static_cast<size_t>(fields - line);
+	if (StartsWith(line, head, "SpanStart ")) {
+		// "SpanStart <category> <name>". The category is empty for PROFILE_SPAN("", name), so there are two spaces
+		char const *category = line + strlen("SpanStart ");
+		char const *space = static_cast<char const *>(memchr(category, ' ', static_cast<size_t>(fields - category)));
+		if (space == nullptr) {
+			++m_malformedLines;
+			return false;
+		}
+
+		uint32_t const nameId = InternName(category, static_cast<size_t>(space - category), space + 1, static_cast<size_t>(fields - space - 1));
+		OnSpanStart(nameId, thread, spanId, now);
+	} else if (head == strlen("SpanEnd") && StartsWith(line, head, "SpanEnd")) {
+		OnSpanEnd(thread, spanId, now);
+	} else if (head == strlen("SpanSuspend") && StartsWith(line, head, "SpanSuspend")) {
+		OnSpanSuspend(thread, spanId, now);
+	} else if (head == strlen("SpanResume") && StartsWith(line, head, "SpanResume")) {
+		OnSpanResume(thread, spanId, now);
+	} else {
+		++m_malformedLines;
+		return false;
+	}
+
+	return true;
+}
+
+bool TraceAnalyzer::ProcessFile(FILE *file) {
+	// Lines are short, so a fixed buffer is enough. Longer lines are skipped as malformed
+	char buffer[4096];
+	bool skipping = false;
+	while (fgets(buffer, sizeof(buffer), file) != nullptr) {
+		size_t size = strlen(buffer);
+		bool const complete = size > 0 && buffer[size - 1] == '\n';
+		if (complete) {
+			--size;
+		}
+
+		if (skipping) {
+			// The tail of an overlong line
+			skipping = !complete;
+			continue;
+		}
+		if (!complete && !feof(file)) {
+			++m_lineCount;
+			++m_malformedLines;
+			skipping = true;
+			continue;
+		}
+
+		ProcessLine(buffer, size);
+	}
+
+	return ferror(file) == 0;
+}
+
+std::vector<SpanNameStats> TraceAnalyzer::GetSpanNameStats() const {
+	std::vector<SpanNameStats> stats = m_nameStats;
+	std::stable_sort(stats.begin(), stats.end(), [](SpanNameStats const &a, SpanNameStats const &b) {
+		return a.CpuTotalNs > b.CpuTotalNs;
+	});
+
+	return stats;
+}
+
+uint32_t TraceAnalyzer::InternName(char const *category, size_t categorySize, char const *name, size_t nameSize) {
+	std::string key(category, categorySize);
+	key += '\n';
+	key.append(name, nameSize);
+
+	auto const iter = m_nameIds.find(key);
+	if (iter != m_nameIds.end()) {
+		return iter->second;
+	}
+
+	auto const nameId = static_cast<uint32_t>(m_nameStats.size());
+	m_nameIds.emplace(std::move(key), nameId);
+
+	SpanNameStats stats{};
+	stats.Category.assign(category, categorySize);
+	stats.Name.assign(name, nameSize);
+	m_nameStats.push_back(stats);
+
+	if (m_frameNameId == kInvalidNameId && stats.Name == m_frameName) {
+		m_frameNameId = nameId;
+	}
+
+	return nameId;
+}
+
+std::vector<uint64_t> &TraceAnalyzer::GetThreadStack(unsigned threadIndex) {
+	if (threadIndex >= m_threadStacks.size()) {
+		m_threadStacks.resize(threadIndex + 1);
+	}
+	return m_threadStacks[threadIndex];
+}
+
+void TraceAnalyzer::RemoveFromStack(std::vector<uint64_t> *stack, uint64_t spanId) {
+	// Almost always the innermost span
+	for (size_t i = stack->size(); i > 0; --i) {
+		if ((*stack)[i - 1] == spanId) {
+			stack->erase(stack->begin() + static_cast<ptrdiff_t>(i - 1));
+			return;
+		}
+	}
+}
+
+static uint64_t Elapsed(uint64_t begin, uint64_t end) {
+	// Timestamps from different threads can be very slightly out of order
+	return end > begin ? end - begin : 0;
+}
+
+void TraceAnalyzer::OnSpanStart(uint32_t nameId, unsigned threadIndex, uint64_t spanId, uint64_t now) {
+	std::vector<uint64_t> &stack = GetThreadStack(threadIndex);
+	bool const topLevel = stack.empty();
+	stack.push_back(spanId);
+
+	if (nameId == m_frameNameId && m_openFrameId == 0) {
+		m_openFrameId = spanId;
+		m_frameSpans.clear();
+	}
+
+	OpenSpan &span = m_openSpans[spanId];
+	span.NameId = nameId;
+	span.ThreadIndex = threadIndex;
+	span.StartNs = now;
+	span.TransitionNs = now;
+	span.Suspended = false;
+	span.TopLevel = topLevel;
+	span.Retained = m_openFrameId != 0;
+	span.CpuNs = 0;
+	span.SuspendedNs = 0;
+	span.SuspensionCount = 0;
+	span.Migrations = 0;
+	span.Suspensions.clear();
+
+	m_peakOpenSpans = std::max(m_peakOpenSpans, m_openSpans.size());
+}
+
+void TraceAnalyzer::OnSpanSuspend(unsigned /*threadIndex*/, uint64_t spanId, uint64_t now) {
+	auto const iter = m_openSpans.find(spanId);
+	if (iter == m_openSpans.end() || iter->second.Suspended) {
+		++m_unmatchedEvents;
+		return;
+	}
+
+	OpenSpan &span = iter->second;
+	span.CpuNs += Elapsed(span.TransitionNs, now);
+	WriteSlice(span, spanId, now);
+
+	span.TransitionNs = now;
+	span.Suspended = true;
+	++span.SuspensionCount;
+	if (span.Retained && m_openFrameId != 0) {
+		span.Suspensions.push_back({now, now});
+	}
+
+	RemoveFromStack(&GetThreadStack(span.ThreadIndex), spanId);
+}
+
+void TraceAnalyzer::OnSpanResume(unsigned threadIndex, uint64_t spanId, uint64_t now) {
+	auto const iter = m_openSpans.find(spanId);
+	if (iter == m_openSpans.end() || !iter->second.Suspended) {
+		++m_unmatchedEvents;
+		return;
+	}
+
+	OpenSpan &span = iter->second;
+	span.SuspendedNs += Elapsed(span.TransitionNs, now);
+	if (threadIndex != span.ThreadIndex) {
+		++span.Migrations;
+		if (m_writer != nullptr) {
+			m_writer->Flow(span.ThreadIndex, span.TransitionNs, threadIndex, now);
+		}
+	}
+	if (!span.Suspensions.empty()) {
+		span.Suspensions.back().ResumeNs = now;
+	}
+
+	span.TransitionNs = now;
+	span.Suspended = false;
+	span.ThreadIndex = threadIndex;
+	GetThreadStack(threadIndex).push_back(spanId);
+}
+
+void TraceAnalyzer::OnSpanEnd(unsigned /*threadIndex*/, uint64_t spanId, uint64_t now) {
+	auto const iter = m_openSpans.find(spanId);
+	if (iter == m_openSpans.end()) {
+		++m_unmatchedEvents;
+		return;
+	}
+
+	OpenSpan &span = iter->second;
+	if (span.Suspended) {
+		// Shouldn't happen, since a span can only end on its own fiber. Count the rest as suspended
+		++m_unmatchedEvents;
+		span.SuspendedNs += Elapsed(span.TransitionNs, now);
+	} else {
+		span.CpuNs += Elapsed(span.TransitionNs, now);
+		WriteSlice(span, spanId, now);
+		RemoveFromStack(&GetThreadStack(span.ThreadIndex), spanId);
+	}
+
+	SpanNameStats &stats = m_nameStats[span.NameId];
+	uint64_t const wallNs = Elapsed(span.StartNs, now);
+	++stats.Count;
+	stats.WallTotalNs += wallNs;
+	stats.WallMaxNs = std::max(stats.WallMaxNs, wallNs);
+	stats.CpuTotalNs += span.CpuNs;
+	stats.SuspendedTotalNs += span.SuspendedNs;
+	stats.Suspensions += span.SuspensionCount;
+	stats.Migrations += span.Migrations;
+
+	// Only top level spans can release the counter another span waits on. Nested spans end before their task does
+	bool const isFrame = spanId == m_openFrameId;
+	if (m_openFrameId != 0 && span.Retained && (span.TopLevel || isFrame)) {
+		m_frameSpans.push_back({spanId, span.NameId, span.StartNs, now, std::move(span.Suspensions)});
+		m_peakFrameSpans = std::max(m_peakFrameSpans, m_frameSpans.size());
+	}
+	m_openSpans.erase(iter);
+
+	if (isFrame) {
+		FinishFrame(m_frameSpans.back());
+		m_openFrameId = 0;
+		m_frameSpans.clear();
+	}
+}
+
+void TraceAnalyzer::WriteSlice(OpenSpan const &span, uint64_t spanId, uint64_t endNs) {
+	if (m_writer == nullptr) {
+		return;
+	}
+
+	SpanNameStats const &name = m_nameStats[span.NameId];
+	m_writer->Slice(name.Category, name.Name, span.ThreadIndex, spanId, span.TransitionNs, endNs);
+}
+
+size_t TraceAnalyzer::FindBlocker(uint64_t beginNs, uint64_t endNs) const {
+	// Spans are added as they end, so m_frameSpans is sorted by EndNs. The frame itself is last, and never a blocker
+	size_t const count = m_frameSpans.size() - 1;
+	auto const first = m_frameSpans.begin();
+	auto const last = first + static_cast<ptrdiff_t>(count);
+	auto const upper = std::upper_bound(first, last, endNs, [](uint64_t ns, RetainedSpan const &span) {
+		return ns < span.EndNs;
+	});
+
+	if (upper == first || (upper - 1)->EndNs < beginNs) {
+		return m_frameSpans.size();
+	}
+	return static_cast<size_t>(upper - 1 - first);
+}
+
+void TraceAnalyzer::FinishFrame(RetainedSpan const &frame) {
+	struct PathCursor {
+		size_t SpanIndex;
+		/* The suspensions before this index haven't been visited yet */
+		size_t RemainingSuspensions;
+		/* The path has been explained from here to the end of the frame */
+		uint64_t TimeNs;
+	};
+
+	std::vector<CriticalPathStep> steps;
+	auto const addStep = [&steps, this](size_t spanIndex, CriticalPathStepKind kind, uint64_t ns) {
+		if (ns == 0) {
+			return;
+		}
+		RetainedSpan const &span = m_frameSpans[spanIndex];
+		steps.push_back({span.NameId, span.SpanId, kind, ns});
+	};
+
+	// Walk backwards from the end of the frame. Each span is entered at most once, so this always terminates
+	std::vector<bool> visited(m_frameSpans.size(), false);
+	std::vector<PathCursor> path;
+	size_t const frameIndex = m_frameSpans.size() - 1;
+	path.push_back({frameIndex, frame.Suspensions.size(), frame.EndNs});
+	visited[frameIndex] = true;
+
+	while (!path.empty()) {
+		PathCursor &cursor = path.back();
+		RetainedSpan const &span = m_frameSpans[cursor.SpanIndex];
+
+		// Suspensions that ended after the path left this span overlapped with another part of the path
+		while (cursor.RemainingSuspensions > 0 && span.Suspensions[cursor.RemainingSuspensions - 1].ResumeNs > cursor.TimeNs) {
+			--cursor.RemainingSuspensions;
+		}
+
+		if (cursor.RemainingSuspensions == 0) {
+			// Back to where the span started. Continue in whatever was waiting on it
+			addStep(cursor.SpanIndex, CriticalPathStepKind::Running, Elapsed(span.StartNs, cursor.TimeNs));
+			uint64_t const startNs = span.StartNs;
+			path.pop_back();
+
+			if (!path.empty()) {
+				PathCursor &waiter = path.back();
+				if (startNs > waiter.TimeNs) {
+					// The waiter suspended before the span it waited on started
+					addStep(waiter.SpanIndex, CriticalPathStepKind::WaitingToStart, startNs - waiter.TimeNs);
+				} else {
+					waiter.TimeNs = startNs;
+				}
+			}
+			continue;
+		}
+
+		Suspension const &suspension = span.Suspensions[--cursor.RemainingSuspensions];
+		addStep(cursor.SpanIndex, CriticalPathStepKind::Running, Elapsed(suspension.ResumeNs, cursor.TimeNs));
+		cursor.TimeNs = suspension.SuspendNs;
+
+		size_t const blocker = FindBlocker(suspension.SuspendNs, suspension.ResumeNs);
+		if (blocker == m_frameSpans.size() || visited[blocker]) {
+			addStep(cursor.SpanIndex, CriticalPathStepKind::Blocked, Elapsed(suspension.SuspendNs, suspension.ResumeNs));
+			continue;
+		}
+
+		RetainedSpan const &blockerSpan = m_frameSpans[blocker];
+		addStep(cursor.SpanIndex, CriticalPathStepKind::WaitingToResume, Elapsed(blockerSpan.EndNs, suspension.ResumeNs));
+		visited[blocker] = true;
+		// NOTE: This invalidates cursor
+		path.push_back({blocker, blockerSpan.Suspensions.size(), blockerSpan.EndNs});
+	}
+
+	// The steps were found backwards. Put them in time order, and merge the adjacent ones
+	FrameSummary summary{};
+	summary.SpanId = frame.SpanId;
+	summary.StartNs = frame.StartNs;
+	summary.WallNs = Elapsed(frame.StartNs, frame.EndNs);
+	for (auto iter = steps.rbegin(); iter != steps.rend(); ++iter) {
+		m_nameStats[iter->NameId].CriticalTotalNs += iter->Ns;
+
+		if (!summary.CriticalPath.empty()) {
+			CriticalPathStep &previous = summary.CriticalPath.back();
+			if (previous.SpanId == iter->SpanId && previous.Kind == iter->Kind) {
+				previous.Ns += iter->Ns;
+				continue;
+			}
+		}
+		summary.CriticalPath.push_back(*iter);
+	}
+
+	++m_frameCount;
+	m_frameWallTotalNs += summary.WallNs;
+	if (m_frameCount == 1 || summary.WallNs > m_slowestFrame.WallNs) {
+		m_slowestFrame = std::move(summary);
+	}
+}
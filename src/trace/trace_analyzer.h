@@ -0,0 +1,309 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Writes Chrome trace event JSON (https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU)
+ * This can be opened in chrome://tracing or https://ui.perfetto.dev
+ *
+ * Events are written as soon as they are added, so the writer only keeps the set of threads it has named
+ */
+class ChromeTraceWriter {
+public:
+	/**
+	 * @param file    The file to write to. It must stay open until Finish()
+	 */
+	explicit ChromeTraceWriter(FILE *file);
+
+	ChromeTraceWriter(ChromeTraceWriter const &) = delete;
+	ChromeTraceWriter(ChromeTraceWriter &&) noexcept = delete;
+	ChromeTraceWriter &operator=(ChromeTraceWriter const &) = delete;
+	ChromeTraceWriter &operator=(ChromeTraceWriter &&) noexcept = delete;
+	~ChromeTraceWriter() = default;
+
+private:
+	FILE *m_file;
+	bool m_firstEvent{true};
+	/* Timestamps are written relative to this. See SetStartTime() */
+	uint64_t m_baseNs{0};
+	std::vector<bool> m_namedThreads;
+	uint64_t m_nextFlowId{1};
+
+public:
+	/**
+	 * Sets the time that is written as 0. Slices and flows must not start before it
+	 *
+	 * @param ns    The time, in nanoseconds
+	 */
+	void SetStartTime(uint64_t ns) {
+		m_baseNs = ns;
+	}
+	/**
+	 * Adds a slice of a span that ran on a single thread without being suspended
+	 *
+	 * @param category       The span category. May be empty
+	 * @param name           The span name
+	 * @param threadIndex    The thread the slice ran on
+	 * @param spanId         The id of the span. Written to the slice's args, so every slice of a span can be found
+	 * @param startNs        When the slice started
+	 * @param endNs          When the slice ended
+	 */
+	void Slice(std::string const &category, std::string const &name, unsigned threadIndex, uint64_t spanId, uint64_t startNs, uint64_t endNs);
+	/**
+	 * Adds an arrow from the slice that ended at fromNs on fromThread, to the slice that starts at toNs on toThread
+	 * Used to show a span resuming on a different thread
+	 *
+	 * @return    The id of the flow
+	 */
+	uint64_t Flow(unsigned fromThread, uint64_t fromNs, unsigned toThread, uint64_t toNs);
+	/**
+	 * Closes the JSON. No more events can be added after this
+	 */
+	void Finish();
+
+private:
+	void BeginEvent();
+	void NameThread(unsigned threadIndex);
+	double ToMicroseconds(uint64_t ns);
+};
+
+/* Per span name totals. All times are in nanoseconds */
+struct SpanNameStats {
+	std::string Category;
+	std::string Name;
+	/* The number of finished spans */
+	uint64_t Count;
+	/* From SpanStart to SpanEnd */
+	uint64_t WallTotalNs;
+	uint64_t WallMaxNs;
+	/* The time the span was running on a thread. Includes the time spent in nested spans */
+	uint64_t CpuTotalNs;
+	/* The time the span's fiber was suspended in WaitForCounter() */
+	uint64_t SuspendedTotalNs;
+	uint64_t Suspensions;
+	/* The number of times the span resumed on a different thread than the one it was suspended on */
+	uint64_t Migrations;
+	/* The time the span spent on the critical path of a frame. See TraceAnalyzer */
+	uint64_t CriticalTotalNs;
+};
+
+enum class CriticalPathStepKind : int {
+	// The span was running
+	Running,
+	// The span was suspended, and the span it was waiting on hadn't started yet
+	WaitingToStart,
+	// The span it was waiting on had finished, but the span hadn't resumed yet
+	WaitingToResume,
+	// The span was suspended, and no span finished while it waited. e.g. it waited on work without a profile span
+	Blocked,
+};
+
+struct CriticalPathStep {
+	uint32_t NameId;
+	uint64_t SpanId;
+	CriticalPathStepKind Kind;
+	uint64_t Ns;
+};
+
+struct FrameSummary {
+	uint64_t SpanId;
+	uint64_t StartNs;
+	uint64_t WallNs;
+	/* In time order. Adjacent steps of the same span and kind are merged. The steps add up to WallNs */
+	std::vector<CriticalPathStep> CriticalPath;
+};
+
+/**
+ * Rebuilds spans from the text written by ProfilerState::Dump(), one line at a time
+ *
+ * Each span is tracked across SpanSuspend / SpanResume, including resumes on another thread. Its stats are folded
+ * into the per name totals as soon as it ends. So memory is bounded by the number of spans open at once, plus the
+ * spans inside the frame that is currently open, rather than by the length of the capture
+ *
+ * A frame is a span with the frame name. Its critical path is found by walking backwards from the frame's end:
+ * whenever a span on the path was suspended, the path continues through the top level span that finished last
+ * before it resumed. That's the span whose task most likely released the counter it was waiting on
+ */
+class TraceAnalyzer {
+public:
+	/**
+	 * @param frameName    The name of the span that marks a frame. Frames can't nest
+	 * @param writer       If not null, every span slice is written to this as it is found
+	 */
+	explicit TraceAnalyzer(std::string frameName, ChromeTraceWriter *writer = nullptr);
+
+	TraceAnalyzer(TraceAnalyzer const &) = delete;
+	TraceAnalyzer(TraceAnalyzer &&) noexcept = delete;
+	TraceAnalyzer &operator=(TraceAnalyzer const &) = delete;
+	TraceAnalyzer &operator=(TraceAnalyzer &&) noexcept = delete;
+	~TraceAnalyzer() = default;
+
+private:
+	constexpr static uint32_t kInvalidNameId = 0xFFFFFFFF;
+
+	struct Suspension {
+		uint64_t SuspendNs;
+		uint64_t ResumeNs;
+	};
+
+	struct OpenSpan {
+		uint32_t NameId;
+		unsigned ThreadIndex;
+		uint64_t StartNs;
+		/* When the span last started running, or was suspended */
+		uint64_t TransitionNs;
+		bool Suspended;
+		/* True if no other span was running on the thread when this one started */
+		bool TopLevel;
+		/* Only kept for spans inside a frame. Needed for the critical path */
+		bool Retained;
+		uint64_t CpuNs;
+		uint64_t SuspendedNs;
+		uint32_t SuspensionCount;
+		uint32_t Migrations;
+		std::vector<Suspension> Suspensions;
+	};
+
+	/* A finished span that may be part of the current frame's critical path */
+	struct RetainedSpan {
+		uint64_t SpanId;
+		uint32_t NameId;
+		uint64_t StartNs;
+		uint64_t EndNs;
+		std::vector<Suspension> Suspensions;
+	};
+
+	std::string m_frameName;
+	ChromeTraceWriter *m_writer;
+
+	/* Interned "category\nname" strings */
+	std::unordered_map<std::string, uint32_t> m_nameIds;
+	std::vector<SpanNameStats> m_nameStats;
+	uint32_t m_frameNameId{kInvalidNameId};
+
+	std::unordered_map<uint64_t, OpenSpan> m_openSpans;
+	/* The spans currently running on each thread, innermost last */
+	std::vector<std::vector<uint64_t>> m_threadStacks;
+
+	/* The frame that is currently open, or 0 */
+	uint64_t m_openFrameId{0};
+	std::vector<RetainedSpan> m_frameSpans;
+
+	bool m_sawEvent{false};
+	uint64_t m_lineCount{0};
+	uint64_t m_malformedLines{0};
+	uint64_t m_unmatchedEvents{0};
+	size_t m_peakOpenSpans{0};
+	size_t m_peakFrameSpans{0};
+
+	uint64_t m_frameCount{0};
+	uint64_t m_frameWallTotalNs{0};
+	FrameSummary m_slowestFrame{};
+
+public:
+	/**
+	 * Processes a single line of the profile
+	 *
+	 * @param line    The line, without the trailing newline. Doesn't need to be null terminated
+	 * @param size    The length of the line
+	 * @return        False if the line couldn't be parsed. It's skipped, and counted in GetMalformedLineCount()
+	 */
+	bool ProcessLine(char const *line, size_t size);
+
+	/**
+	 * Reads and processes every line in a file
+	 *
+	 * @param file    The file to read
+	 * @return        False if the file couldn't be read. Malformed lines don't count as errors
+	 */
+	bool ProcessFile(FILE *file);
+
+	/* Sorted by CpuTotalNs, largest first */
+	std::vector<SpanNameStats> GetSpanNameStats() const;
+	/* The number of spans that started, but never ended. e.g. because the capture was cut short */
+	size_t GetUnfinishedSpanCount() const {
+		return m_openSpans.size();
+	}
+	uint64_t GetLineCount() const {
+		return m_lineCount;
+	}
+	uint64_t GetMalformedLineCount() const {
+		return m_malformedLines;
+	}
+	/* The number of SpanEnd / SpanSuspend / SpanResume lines for spans that weren't open */
+	uint64_t GetUnmatchedEventCount() const {
+		return m_unmatchedEvents;
+	}
+	/* The most spans that were open, or kept for a frame, at once. This is what bounds the memory usage */
+	size_t GetPeakOpenSpanCount() const {
+		return m_peakOpenSpans;
+	}
+	size_t GetPeakFrameSpanCount() const {
+		return m_peakFrameSpans;
+	}
+	uint64_t GetFrameCount() const {
+		return m_frameCount;
+	}
+	uint64_t GetFrameWallTotalNs() const {
+		return m_frameWallTotalNs;
+	}
+	/* The longest frame. Only valid if GetFrameCount() > 0 */
+	FrameSummary const &GetSlowestFrame() const {
+		return m_slowestFrame;
+	}
+	SpanNameStats const &GetNameStats(uint32_t nameId) const {
+		return m_nameStats[nameId];
+	}
+
+private:
+	uint32_t InternName(char const *category, size_t categorySize, char const *name, size_t nameSize);
+	std::vector<uint64_t> &GetThreadStack(unsigned threadIndex);
+	static void RemoveFromStack(std::vector<uint64_t> *stack, uint64_t spanId);
+
+	void OnSpanStart(uint32_t nameId, unsigned threadIndex, uint64_t spanId, uint64_t now);
+	void OnSpanEnd(unsigned threadIndex, uint64_t spanId, uint64_t now);
+	void OnSpanSuspend(unsigned threadIndex, uint64_t spanId, uint64_t now);
+	void OnSpanResume(unsigned threadIndex, uint64_t spanId, uint64_t now);
+
+	void WriteSlice(OpenSpan const &span, uint64_t spanId, uint64_t endNs);
+	/**
+	 * Finds the critical path of the frame that just ended, and adds it to the stats
+	 *
+	 * @param frame    The frame span. It must also be the last entry in m_frameSpans
+	 */
+	void FinishFrame(RetainedSpan const &frame);
+	/**
+	 * Finds the top level span in the current frame that ended last, in [beginNs, endNs]
+	 *
+	 * @return    The index of the span in m_frameSpans, or m_frameSpans.size() if none ended in that range
+	 */
+	size_t FindBlocker(uint64_t beginNs, uint64_t endNs) const;
+};
@@ -0,0 +1,75 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/deep_nesting.h"
+
+#include "ftl/task_counter.h"
+
+#include <algorithm>
+
+REGISTER_WORKLOAD(DeepNestingWorkload, "deep-nesting", "Chains of tasks, each waiting on the next", "chain depth", 128);
+
+static void ChainLink(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies, unsigned depth, std::atomic<unsigned> *leaves) {
+	if (depth == 0) {
+		leaves->fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTask(MakeTimedTask(latencies, [depth, leaves](ftl::TaskScheduler *scheduler, LatencyRecorder *recorder) {
+		                       ChainLink(scheduler, recorder, depth - 1, leaves);
+	                       }),
+	                       ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+}
+
+void DeepNestingWorkload::Setup(ftl::TaskScheduler *taskScheduler, unsigned size) {
+	m_depth = size;
+
+	// Leave half the pool for the fibers that are running or being recycled, so the chains can't exhaust it
+	unsigned const maxChains = taskScheduler->GetFiberCount() / (2 * (size + 1));
+	m_chains = std::max(1U, std::min(taskScheduler->GetThreadCount(), maxChains));
+}
+
+void DeepNestingWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	m_leaves.store(0, std::memory_order_relaxed);
+
+	unsigned const depth = m_depth;
+	std::atomic<unsigned> *const leaves = &m_leaves;
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	    m_chains,
+	    [latencies, depth, leaves](unsigned) {
+		    return MakeTimedTask(latencies, [depth, leaves](ftl::TaskScheduler *scheduler, LatencyRecorder *recorder) {
+			    ChainLink(scheduler, recorder, depth, leaves);
+		    });
+	    },
+	    ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+}
+
+bool DeepNestingWorkload::Verify() const {
+	return m_leaves.load(std::memory_order_relaxed) == m_chains;
+}
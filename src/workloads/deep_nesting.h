@@ -0,0 +1,48 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "workloads/workload.h"
+
+#include <atomic>
+
+/**
+ * Chains of tasks where each link spawns the next and waits for it with WaitForCounter(). Every link holds a suspended
+ * fiber until the end of its chain finishes, so a chain of depth `size` needs `size` fibers at once
+ *
+ * One chain is started per thread, as long as the fiber pool has room for them. This measures the cost of suspending
+ * and resuming fibers, and how the fiber pool copes with many of them waiting at the same time
+ */
+class DeepNestingWorkload : public Workload {
+public:
+	void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) override;
+	void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) override;
+	bool Verify() const override;
+
+private:
+	unsigned m_depth{0};
+	unsigned m_chains{0};
+	std::atomic<unsigned> m_leaves{0};
+};
@@ -0,0 +1,75 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/fan_out.h"
+
+#include "ftl/task_counter.h"
+
+REGISTER_WORKLOAD(FanOutWorkload, "fan-out", "Wide fan-out of small tasks, joined on a single counter", "tasks", 100000);
+
+constexpr unsigned FanOutWorkload::kWorkIterations;
+
+uint64_t FanOutWorkload::DoWork(uint64_t const seed) {
+	uint64_t x = seed + 1;
+	for (unsigned i = 0; i < kWorkIterations; ++i) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+
+	return x;
+}
+
+void FanOutWorkload::Setup(ftl::TaskScheduler * /*taskScheduler*/, unsigned size) {
+	m_results.assign(size, 0);
+
+	m_expectedSum = 0;
+	for (unsigned i = 0; i < size; ++i) {
+		m_expectedSum += DoWork(i);
+	}
+}
+
+void FanOutWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	uint64_t *const results = m_results.data();
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	    static_cast<unsigned>(m_results.size()),
+	    [results, latencies](unsigned const i) {
+		    return MakeTimedTask(latencies, [results, i](ftl::TaskScheduler * /*scheduler*/, LatencyRecorder * /*recorder*/) {
+			    results[i] = DoWork(i);
+		    });
+	    },
+	    ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+
+	m_sum = 0;
+	for (uint64_t const result : m_results) {
+		m_sum += result;
+	}
+}
+
+bool FanOutWorkload::Verify() const {
+	return m_sum == m_expectedSum;
+}
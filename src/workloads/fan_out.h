@@ -0,0 +1,51 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "workloads/workload.h"
+
+#include <vector>
+
+/**
+ * One task fans out `size` small, independent tasks in a single batch, and joins them on one counter
+ *
+ * This stresses batched submission, stealing from a single deep queue, and many tasks decrementing the same counter
+ */
+class FanOutWorkload : public Workload {
+public:
+	void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) override;
+	void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) override;
+	bool Verify() const override;
+
+	/* The number of xorshift rounds each task does. About a microsecond of work */
+	constexpr static unsigned kWorkIterations = 512;
+
+	static uint64_t DoWork(uint64_t seed);
+
+private:
+	std::vector<uint64_t> m_results;
+	uint64_t m_expectedSum{0};
+	uint64_t m_sum{0};
+};
@@ -23,3 +23,51 @@
  */
 
 #include "workloads/fibonacci.h"
+
+#include "ftl/task_counter.h"
+
+REGISTER_WORKLOAD(FibonacciWorkload, "fibonacci", "Recursive fork-join, one task per call", "n", 25);
+
+static void Fibonacci(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies, unsigned n, uint64_t *result) {
+	if (n < 2) {
+		*result = n;
+		return;
+	}
+
+	uint64_t a;
+	uint64_t b;
+
+	ftl::TaskCounter counter(taskScheduler);
+	uint64_t *const aPtr = &a;
+	taskScheduler->AddTask(MakeTimedTask(latencies, [n, aPtr](ftl::TaskScheduler *scheduler, LatencyRecorder *recorder) {
+		                       Fibonacci(scheduler, recorder, n - 1, aPtr);
+	                       }),
+	                       ftl::TaskPriority::High, &counter);
+
+	Fibonacci(taskScheduler, latencies, n - 2, &b);
+	taskScheduler->WaitForCounter(&counter);
+
+	*result = a + b;
+}
+
+void FibonacciWorkload::Setup(ftl::TaskScheduler * /*taskScheduler*/, unsigned size) {
+	m_n = size;
+
+	uint64_t previous = 0;
+	uint64_t current = 1;
+	for (unsigned i = 0; i < size; ++i) {
+		uint64_t const next = previous + current;
+		previous = current;
+		current = next;
+	}
+	m_expected = previous;
+}
+
+void FibonacciWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	m_result = 0;
+	Fibonacci(taskScheduler, latencies, m_n, &m_result);
+}
+
+bool FibonacciWorkload::Verify() const {
+	return m_result == m_expected;
+}
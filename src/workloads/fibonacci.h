@@ -23,3 +23,22 @@
  */
 
 #pragma once
+
+#include "workloads/workload.h"
+
+/**
+ * Recursive fork-join fibonacci. Each call spawns fib(n - 1) as a task, computes fib(n - 2) itself, then waits
+ *
+ * Almost all the time goes into task creation, counter waits and fiber switches, so this measures the scheduler overhead
+ */
+class FibonacciWorkload : public Workload {
+public:
+	void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) override;
+	void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) override;
+	bool Verify() const override;
+
+private:
+	unsigned m_n{0};
+	uint64_t m_expected{0};
+	uint64_t m_result{0};
+};
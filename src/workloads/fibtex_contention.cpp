@@ -0,0 +1,76 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/fibtex_contention.h"
+
+#include "ftl/task_counter.h"
+
+#include <mutex>
+
+REGISTER_WORKLOAD(FibtexContentionWorkload, "fibtex-contention", "Short critical sections, all on the same Fibtex", "tasks", 20000);
+
+constexpr unsigned FibtexContentionWorkload::kInsideWork;
+constexpr unsigned FibtexContentionWorkload::kOutsideWork;
+
+static uint64_t Mix(uint64_t x, unsigned const rounds) {
+	for (unsigned i = 0; i < rounds; ++i) {
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	}
+
+	return x;
+}
+
+void FibtexContentionWorkload::Setup(ftl::TaskScheduler *taskScheduler, unsigned size) {
+	m_tasks = size;
+	m_lock.reset(new ftl::Fibtex(taskScheduler));
+}
+
+void FibtexContentionWorkload::LockedTask() {
+	uint64_t const local = Mix(m_tasks, kOutsideWork);
+
+	std::lock_guard<ftl::Fibtex> guard(*m_lock);
+	m_protectedState = Mix(m_protectedState ^ local, kInsideWork);
+	++m_protectedCount;
+}
+
+void FibtexContentionWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	m_protectedCount = 0;
+
+	FibtexContentionWorkload *const self = this;
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	    m_tasks,
+	    [self, latencies](unsigned) {
+		    return MakeTimedTask(latencies, [self](ftl::TaskScheduler * /*scheduler*/, LatencyRecorder * /*recorder*/) {
+			    self->LockedTask();
+		    });
+	    },
+	    ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+}
+
+bool FibtexContentionWorkload::Verify() const {
+	// A lost update would mean two tasks were in the critical section at once
+	return m_protectedCount == m_tasks;
+}
@@ -0,0 +1,59 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "workloads/workload.h"
+
+#include "ftl/fibtex.h"
+
+#include <memory>
+
+/**
+ * `size` tasks each take the same Fibtex for a short critical section, with a little work outside the lock
+ *
+ * With more than a couple of threads, most lock attempts find the Fibtex held, so this measures how well contended
+ * waiters are parked and handed the lock
+ */
+class FibtexContentionWorkload : public Workload {
+public:
+	void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) override;
+	void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) override;
+	bool Verify() const override;
+
+	/* Rounds of work done while holding the lock */
+	constexpr static unsigned kInsideWork = 64;
+	/* Rounds of work done before taking the lock */
+	constexpr static unsigned kOutsideWork = 256;
+
+private:
+	void LockedTask();
+
+	unsigned m_tasks{0};
+	std::unique_ptr<ftl::Fibtex> m_lock;
+
+	/* Only touched while holding m_lock */
+	uint64_t m_protectedCount{0};
+	uint64_t m_protectedState{0};
+};
@@ -0,0 +1,81 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/memory_bound.h"
+
+#include "ftl/task_counter.h"
+
+#include <algorithm>
+
+REGISTER_WORKLOAD(MemoryBoundWorkload, "memory-bound", "STREAM triad over arrays much larger than the caches", "KiB elements per array", 2048);
+
+constexpr size_t MemoryBoundWorkload::kBlockSize;
+constexpr double MemoryBoundWorkload::kScalar;
+
+void MemoryBoundWorkload::Setup(ftl::TaskScheduler * /*taskScheduler*/, unsigned size) {
+	size_t const elements = static_cast<size_t>(size) * 1024;
+	m_a.assign(elements, 0.0);
+	m_b.resize(elements);
+	m_c.resize(elements);
+	for (size_t i = 0; i < elements; ++i) {
+		m_b[i] = static_cast<double>(i % 1000);
+		m_c[i] = static_cast<double>(i % 7);
+	}
+}
+
+void MemoryBoundWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	std::fill(m_a.begin(), m_a.end(), 0.0);
+
+	MemoryBoundWorkload *const self = this;
+	size_t const blocks = (m_a.size() + kBlockSize - 1) / kBlockSize;
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	    static_cast<unsigned>(blocks),
+	    [self, latencies](unsigned const block) {
+		    return MakeTimedTask(latencies, [self, block](ftl::TaskScheduler * /*scheduler*/, LatencyRecorder * /*recorder*/) {
+			    size_t const begin = block * kBlockSize;
+			    size_t const end = std::min(begin + kBlockSize, self->m_a.size());
+
+			    double *const a = self->m_a.data();
+			    double const *const b = self->m_b.data();
+			    double const *const c = self->m_c.data();
+			    for (size_t i = begin; i < end; ++i) {
+				    a[i] = b[i] + kScalar * c[i];
+			    }
+		    });
+	    },
+	    ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+}
+
+bool MemoryBoundWorkload::Verify() const {
+	for (size_t i = 0; i < m_a.size(); ++i) {
+		if (m_a[i] != m_b[i] + kScalar * m_c[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
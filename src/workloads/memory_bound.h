@@ -0,0 +1,51 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "workloads/workload.h"
+
+#include <vector>
+
+/**
+ * The STREAM triad, a[i] = b[i] + scalar * c[i], split into one task per kBlockSize elements
+ *
+ * The arrays are sized to be much larger than the caches, so throughput is bounded by memory bandwidth. This shows
+ * whether the scheduler overhead, or the thread placement, gets in the way of bandwidth-bound loops
+ */
+class MemoryBoundWorkload : public Workload {
+public:
+	void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) override;
+	void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) override;
+	bool Verify() const override;
+
+	/* Elements per task. 128 KiB of each array */
+	constexpr static size_t kBlockSize = 16384;
+	constexpr static double kScalar = 3.0;
+
+private:
+	std::vector<double> m_a;
+	std::vector<double> m_b;
+	std::vector<double> m_c;
+};
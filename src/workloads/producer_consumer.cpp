@@ -0,0 +1,92 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/producer_consumer.h"
+
+#include "profiler.h"
+
+#include "ftl/task_counter.h"
+
+REGISTER_WORKLOAD(ProducerConsumerWorkload, "producer-consumer", "Producers that each wait on two rounds of consumers", "producers", 100);
+
+constexpr unsigned ProducerConsumerWorkload::kConsumersPerRound;
+
+static void Consumer(std::atomic<unsigned> *consumed) {
+	PROFILE_SPAN("Test");
+
+	consumed->fetch_add(1);
+}
+
+static void Producer(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies, std::atomic<unsigned> *consumed) {
+	PROFILE_SPAN("Test");
+
+	auto const makeConsumer = [latencies, consumed](unsigned) {
+		return MakeTimedTask(latencies, [consumed](ftl::TaskScheduler * /*scheduler*/, LatencyRecorder * /*recorder*/) {
+			Consumer(consumed);
+		});
+	};
+
+	{
+		PROFILE_SPAN("Test", "Producer subsection 1");
+		ftl::TaskCounter counter1(taskScheduler);
+		taskScheduler->AddTasks(ProducerConsumerWorkload::kConsumersPerRound, makeConsumer, ftl::TaskPriority::Low, &counter1);
+
+		taskScheduler->WaitForCounter(&counter1);
+	}
+
+	{
+		PROFILE_SPAN("Test", "Producer subsection 2");
+
+		ftl::TaskCounter counter2(taskScheduler);
+		taskScheduler->AddTasks(ProducerConsumerWorkload::kConsumersPerRound, makeConsumer, ftl::TaskPriority::Low, &counter2);
+
+		taskScheduler->WaitForCounter(&counter2);
+	}
+}
+
+void ProducerConsumerWorkload::Setup(ftl::TaskScheduler * /*taskScheduler*/, unsigned size) {
+	m_producers = size;
+}
+
+void ProducerConsumerWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	PROFILE_SPAN("", "Frame");
+
+	m_consumed.store(0);
+	std::atomic<unsigned> *const consumed = &m_consumed;
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	    m_producers,
+	    [latencies, consumed](unsigned) {
+		    return MakeTimedTask(latencies, [consumed](ftl::TaskScheduler *scheduler, LatencyRecorder *recorder) {
+			    Producer(scheduler, recorder, consumed);
+		    });
+	    },
+	    ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter, true);
+}
+
+bool ProducerConsumerWorkload::Verify() const {
+	return m_consumed.load() == m_producers * 2 * kConsumersPerRound;
+}
@@ -0,0 +1,112 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/unbalanced_tree.h"
+
+#include <vector>
+
+REGISTER_WORKLOAD(UnbalancedTreeWorkload, "unbalanced-tree", "Binomial tree with a heavy-tailed subtree size, one task per node", "children of the root", 4000);
+
+constexpr unsigned UnbalancedTreeWorkload::kBranchFactor;
+constexpr uint64_t UnbalancedTreeWorkload::kBranchThreshold;
+
+uint64_t UnbalancedTreeWorkload::ChildHash(uint64_t const parent, unsigned const index) {
+	// splitmix64 finalizer
+	uint64_t z = parent + (index + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+unsigned UnbalancedTreeWorkload::ChildCount(uint64_t const hash) {
+	return (hash >> 32) < kBranchThreshold ? kBranchFactor : 0;
+}
+
+void UnbalancedTreeWorkload::Setup(ftl::TaskScheduler * /*taskScheduler*/, unsigned size) {
+	m_rootChildren = size;
+
+	// Walk the tree serially, so we know how many nodes the parallel traversal should visit
+	std::vector<uint64_t> stack;
+	uint64_t nodes = 1;
+	for (unsigned i = 0; i < size; ++i) {
+		stack.push_back(ChildHash(0, i));
+	}
+	while (!stack.empty()) {
+		uint64_t const hash = stack.back();
+		stack.pop_back();
+		++nodes;
+
+		unsigned const children = ChildCount(hash);
+		for (unsigned i = 0; i < children; ++i) {
+			stack.push_back(ChildHash(hash, i));
+		}
+	}
+	m_expectedNodes = nodes;
+}
+
+void UnbalancedTreeWorkload::VisitNode(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies, uint64_t const hash) {
+	m_visitedNodes.fetch_add(1, std::memory_order_relaxed);
+
+	unsigned const children = ChildCount(hash);
+	if (children == 0) {
+		return;
+	}
+
+	// The children are added to the root counter before this task finishes, so the counter can't reach zero early
+	UnbalancedTreeWorkload *const self = this;
+	taskScheduler->AddTasks(
+	    children,
+	    [self, latencies, hash](unsigned const i) {
+		    uint64_t const child = ChildHash(hash, i);
+		    return MakeTimedTask(latencies, [self, child](ftl::TaskScheduler *scheduler, LatencyRecorder *recorder) {
+			    self->VisitNode(scheduler, recorder, child);
+		    });
+	    },
+	    ftl::TaskPriority::Low, m_counter);
+}
+
+void UnbalancedTreeWorkload::Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) {
+	m_visitedNodes.store(1, std::memory_order_relaxed);
+
+	ftl::TaskCounter counter(taskScheduler);
+	m_counter = &counter;
+
+	UnbalancedTreeWorkload *const self = this;
+	taskScheduler->AddTasks(
+	    m_rootChildren,
+	    [self, latencies](unsigned const i) {
+		    uint64_t const child = ChildHash(0, i);
+		    return MakeTimedTask(latencies, [self, child](ftl::TaskScheduler *scheduler, LatencyRecorder *recorder) {
+			    self->VisitNode(scheduler, recorder, child);
+		    });
+	    },
+	    ftl::TaskPriority::Low, &counter);
+
+	taskScheduler->WaitForCounter(&counter);
+	m_counter = nullptr;
+}
+
+bool UnbalancedTreeWorkload::Verify() const {
+	return m_visitedNodes.load(std::memory_order_relaxed) == m_expectedNodes;
+}
@@ -0,0 +1,63 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "workloads/workload.h"
+
+#include "ftl/task_counter.h"
+
+#include <atomic>
+
+/**
+ * A binomial tree in the style of the Unbalanced Tree Search benchmark. The root has `size` children, and every other
+ * node has kBranchFactor children with probability kBranchProbability. The expected subtree size is small, but its
+ * variance is huge, so most of the work ends up in a few deep subtrees that have to be stolen to be balanced
+ *
+ * All the nodes share the root's counter, instead of waiting on their children. So this stresses stealing and shared
+ * counter traffic, rather than fiber switching
+ */
+class UnbalancedTreeWorkload : public Workload {
+public:
+	void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) override;
+	void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) override;
+	bool Verify() const override;
+
+	constexpr static unsigned kBranchFactor = 4;
+	/* In units of 1 / 2^32. 0.24 * kBranchFactor gives 0.96 expected children per node */
+	constexpr static uint64_t kBranchThreshold = 1030792151ULL;
+
+	/* The hash of the index'th child of the node with hash parent */
+	static uint64_t ChildHash(uint64_t parent, unsigned index);
+	/* How many children the (non-root) node with this hash has */
+	static unsigned ChildCount(uint64_t hash);
+
+private:
+	void VisitNode(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies, uint64_t hash);
+
+	unsigned m_rootChildren{0};
+	uint64_t m_expectedNodes{0};
+	std::atomic<uint64_t> m_visitedNodes{0};
+	ftl::TaskCounter *m_counter{nullptr};
+};
@@ -0,0 +1,106 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "workloads/workload.h"
+
+#include <algorithm>
+
+LatencyRecorder::LatencyRecorder(unsigned threadCount)
+        : m_threadSamples(new ThreadSamples[threadCount]),
+          m_threadCount(threadCount) {
+}
+
+uint64_t LatencyRecorder::GetSampleCount() const {
+	uint64_t count = 0;
+	for (unsigned i = 0; i < m_threadCount; ++i) {
+		count += m_threadSamples[i].Samples.size();
+	}
+
+	return count;
+}
+
+LatencyPercentiles LatencyRecorder::ComputePercentiles() const {
+	std::vector<uint64_t> samples;
+	samples.reserve(GetSampleCount());
+	for (unsigned i = 0; i < m_threadCount; ++i) {
+		samples.insert(samples.end(), m_threadSamples[i].Samples.begin(), m_threadSamples[i].Samples.end());
+	}
+
+	if (samples.empty()) {
+		return LatencyPercentiles{0, 0, 0, 0, 0};
+	}
+
+	// Each nth_element() leaves everything after the nth element unsorted, but >= it
+	// So the next, higher, percentile only has to look at that tail
+	auto begin = samples.begin();
+	auto const select = [&samples, &begin](double const percentile) {
+		auto const nth = samples.begin() + static_cast<std::ptrdiff_t>(percentile * static_cast<double>(samples.size() - 1));
+		std::nth_element(begin, nth, samples.end());
+		begin = nth;
+		return *nth;
+	};
+
+	LatencyPercentiles result;
+	result.P50 = select(0.5);
+	result.P90 = select(0.9);
+	result.P99 = select(0.99);
+	result.P999 = select(0.999);
+	result.Max = *std::max_element(begin, samples.end());
+
+	return result;
+}
+
+void LatencyRecorder::Clear() {
+	for (unsigned i = 0; i < m_threadCount; ++i) {
+		m_threadSamples[i].Samples.clear();
+	}
+}
+
+void WorkloadRegistry::Register(WorkloadInfo const &info) {
+	std::vector<WorkloadInfo> &workloads = Workloads();
+	auto const position = std::lower_bound(workloads.begin(), workloads.end(), info, [](WorkloadInfo const &a, WorkloadInfo const &b) {
+		return std::string(a.Name) < b.Name;
+	});
+	workloads.insert(position, info);
+}
+
+std::vector<WorkloadInfo> const &WorkloadRegistry::GetWorkloads() {
+	return Workloads();
+}
+
+WorkloadInfo const *WorkloadRegistry::Find(std::string const &name) {
+	for (WorkloadInfo const &info : Workloads()) {
+		if (name == info.Name) {
+			return &info;
+		}
+	}
+
+	return nullptr;
+}
+
+std::vector<WorkloadInfo> &WorkloadRegistry::Workloads() {
+	// A function local static, so registrars in other translation units can't run before it is constructed
+	static std::vector<WorkloadInfo> workloads;
+	return workloads;
+}
@@ -0,0 +1,189 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2020
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/task_scheduler.h"
+
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Nanoseconds since the steady clock epoch */
+inline uint64_t NowNs() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct LatencyPercentiles {
+	uint64_t P50;
+	uint64_t P90;
+	uint64_t P99;
+	uint64_t P999;
+	uint64_t Max;
+};
+
+/**
+ * Collects per-task latencies, measured from the task being submitted to it starting to run
+ *
+ * Each thread appends to its own buffer, so recording never contends. The buffers keep their capacity across Clear(),
+ * so after the first iteration of a workload, recording doesn't allocate either
+ */
+class LatencyRecorder {
+public:
+	explicit LatencyRecorder(unsigned threadCount);
+
+	LatencyRecorder(LatencyRecorder const &) = delete;
+	LatencyRecorder(LatencyRecorder &&) noexcept = delete;
+	LatencyRecorder &operator=(LatencyRecorder const &) = delete;
+	LatencyRecorder &operator=(LatencyRecorder &&) noexcept = delete;
+	~LatencyRecorder() = default;
+
+private:
+	struct alignas(ftl::kCacheLineSize) ThreadSamples {
+		std::vector<uint64_t> Samples;
+	};
+
+	std::unique_ptr<ThreadSamples[]> m_threadSamples;
+	unsigned m_threadCount;
+
+public:
+	/**
+	 * Records the latency of the task currently running on this thread
+	 *
+	 * @param taskScheduler    The scheduler running the task
+	 * @param submitNs         When the task was submitted. See NowNs()
+	 */
+	void Record(ftl::TaskScheduler *taskScheduler, uint64_t submitNs) {
+		uint64_t const now = NowNs();
+		m_threadSamples[taskScheduler->GetCurrentThreadIndex()].Samples.push_back(now - submitNs);
+	}
+
+	/* The number of latencies recorded since the last Clear(). Only call this while no tasks are running */
+	uint64_t GetSampleCount() const;
+	/* Merges the samples from all the threads. Only call this while no tasks are running */
+	LatencyPercentiles ComputePercentiles() const;
+	void Clear();
+};
+
+/**
+ * Wraps a task body so the task records its latency before running
+ *
+ * The body is called as body(ftl::TaskScheduler *, LatencyRecorder *), so it can submit timed tasks of its own.
+ * With a body that captures at most 16 bytes, the whole task fits in TaskBundle's inline storage
+ */
+template <typename Body>
+struct TimedTask {
+	uint64_t SubmitNs;
+	LatencyRecorder *Latencies;
+	Body Function;
+
+	void operator()(ftl::TaskScheduler *taskScheduler) {
+		Latencies->Record(taskScheduler, SubmitNs);
+		Function(taskScheduler, Latencies);
+	}
+};
+
+template <typename Body>
+TimedTask<Body> MakeTimedTask(LatencyRecorder *latencies, Body body) {
+	return TimedTask<Body>{NowNs(), latencies, body};
+}
+
+/**
+ * A benchmark shape for ftl-sim. Workloads are created fresh for each run, with their own TaskScheduler
+ *
+ * Setup() and Verify() are not timed. Run() is called once per iteration from the main fiber, and must not return
+ * until all the tasks it submitted have finished
+ */
+class Workload {
+public:
+	Workload() = default;
+	Workload(Workload const &) = delete;
+	Workload(Workload &&) noexcept = delete;
+	Workload &operator=(Workload const &) = delete;
+	Workload &operator=(Workload &&) noexcept = delete;
+	virtual ~Workload() = default;
+
+	/**
+	 * Prepares the inputs, and anything needed to verify the result
+	 *
+	 * @param taskScheduler    The scheduler Run() will use. Already initialized
+	 * @param size             The problem size. What this means is up to the workload. See WorkloadInfo::SizeDescription
+	 */
+	virtual void Setup(ftl::TaskScheduler *taskScheduler, unsigned size) = 0;
+	/**
+	 * Runs one iteration of the workload. Every task should be submitted with MakeTimedTask(), so the latencies
+	 * also count the tasks that were run
+	 */
+	virtual void Run(ftl::TaskScheduler *taskScheduler, LatencyRecorder *latencies) = 0;
+	/* Checks the result of the last Run() */
+	virtual bool Verify() const = 0;
+};
+
+struct WorkloadInfo {
+	/* The name used to select the workload on the command line */
+	char const *Name;
+	/* What the workload is meant to stress */
+	char const *Description;
+	/* What the size parameter controls */
+	char const *SizeDescription;
+	unsigned DefaultSize;
+	std::unique_ptr<Workload> (*Create)();
+};
+
+class WorkloadRegistry {
+public:
+	static void Register(WorkloadInfo const &info);
+	/* All the registered workloads, sorted by name */
+	static std::vector<WorkloadInfo> const &GetWorkloads();
+	/* Returns nullptr if there is no workload with that name */
+	static WorkloadInfo const *Find(std::string const &name);
+
+private:
+	static std::vector<WorkloadInfo> &Workloads();
+};
+
+struct WorkloadRegistrar {
+	explicit WorkloadRegistrar(WorkloadInfo const &info) {
+		WorkloadRegistry::Register(info);
+	}
+};
+
+template <typename T>
+std::unique_ptr<Workload> CreateWorkload() {
+	return std::unique_ptr<Workload>(new T());
+}
+
+/**
+ * Adds a workload to the registry at static initialization time. Use this once, in the workload's .cpp file
+ *
+ * @param type               The Workload subclass. Must be default constructible
+ * @param name               See WorkloadInfo::Name
+ * @param description        See WorkloadInfo::Description
+ * @param sizeDescription    See WorkloadInfo::SizeDescription
+ * @param defaultSize        The size used if none is given on the command line
+ */
+#define REGISTER_WORKLOAD(type, name, description, sizeDescription, defaultSize) \
+	static WorkloadRegistrar g_##type##Registrar({name, description, sizeDescription, defaultSize, CreateWorkload<type>})
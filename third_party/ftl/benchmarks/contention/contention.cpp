@@ -0,0 +1,249 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/channel.h"
+#include "ftl/fiber_semaphore.h"
+#include "ftl/fibtex.h"
+#include "ftl/shared_fibtex.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "nonius/nonius.hpp"
+
+#include <mutex>
+#include <stdint.h>
+
+// Constants
+constexpr static unsigned kNumContendingTasks = 256U;
+constexpr static unsigned kLocksPerTask = 100U;
+// For the read-mostly benchmarks, one in this many lock operations is a write
+constexpr static unsigned kWriteInterval = 10U;
+constexpr static unsigned kSemaphoreUnits = 4U;
+constexpr static unsigned kChannelCapacity = 64U;
+
+/* The data the locks protect. Big enough that the critical section isn't free */
+struct ProtectedData {
+	uint64_t Values[16] = {};
+
+	void Write(unsigned const seed) {
+		for (uint64_t &value : Values) {
+			value += seed;
+		}
+	}
+
+	uint64_t Read() const {
+		uint64_t sum = 0;
+		for (uint64_t const value : Values) {
+			sum += value;
+		}
+		return sum;
+	}
+};
+
+/**
+ * Runs kNumContendingTasks tasks that each call lockedOperation(taskIndex, i) kLocksPerTask times
+ */
+template <typename Operation>
+static void RunContendingTasks(ftl::TaskScheduler *taskScheduler, Operation &lockedOperation) {
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	        kNumContendingTasks,
+	        [&lockedOperation](unsigned const taskIndex) {
+		        return [&lockedOperation, taskIndex](ftl::TaskScheduler *) {
+			        for (unsigned i = 0; i < kLocksPerTask; ++i) {
+				        lockedOperation(taskIndex, i);
+			        }
+		        };
+	        },
+	        ftl::TaskPriority::Low, &counter);
+
+	taskScheduler->WaitForCounter(&counter);
+}
+
+static void InitScheduler(ftl::TaskScheduler *taskScheduler) {
+	ftl::TaskSchedulerInitOptions options;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	taskScheduler->Init(options);
+}
+
+NONIUS_BENCHMARK("Contention Fibtex", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	ftl::Fibtex lock(&taskScheduler);
+	ProtectedData data;
+	auto operation = [&lock, &data](unsigned const taskIndex, unsigned) {
+		std::lock_guard<ftl::Fibtex> guard(lock);
+		data.Write(taskIndex);
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&data);
+})
+
+NONIUS_BENCHMARK("Contention Fibtex Spin", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	ftl::Fibtex lock(&taskScheduler);
+	ProtectedData data;
+	auto operation = [&lock, &data](unsigned const taskIndex, unsigned) {
+		ftl::LockWrapper wrapper(lock, ftl::FibtexLockBehavior::Spin);
+		std::lock_guard<ftl::LockWrapper> guard(wrapper);
+		data.Write(taskIndex);
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&data);
+})
+
+NONIUS_BENCHMARK("Contention SharedFibtex", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	ftl::SharedFibtex lock(&taskScheduler);
+	ProtectedData data;
+	auto operation = [&lock, &data](unsigned const taskIndex, unsigned) {
+		std::lock_guard<ftl::SharedFibtex> guard(lock);
+		data.Write(taskIndex);
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&data);
+})
+
+NONIUS_BENCHMARK("Contention std::mutex", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	// Blocks the whole worker thread while it waits
+	std::mutex lock;
+	ProtectedData data;
+	auto operation = [&lock, &data](unsigned const taskIndex, unsigned) {
+		std::lock_guard<std::mutex> guard(lock);
+		data.Write(taskIndex);
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&data);
+})
+
+NONIUS_BENCHMARK("Read Mostly Fibtex", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	ftl::Fibtex lock(&taskScheduler);
+	ProtectedData data;
+	uint64_t sum = 0;
+	auto operation = [&lock, &data, &sum](unsigned const taskIndex, unsigned const i) {
+		std::lock_guard<ftl::Fibtex> guard(lock);
+		if (i % kWriteInterval == 0) {
+			data.Write(taskIndex);
+		} else {
+			sum += data.Read();
+		}
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&sum);
+})
+
+NONIUS_BENCHMARK("Read Mostly SharedFibtex", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	ftl::SharedFibtex lock(&taskScheduler);
+	ProtectedData data;
+	std::atomic<uint64_t> sum(0);
+	auto operation = [&lock, &data, &sum](unsigned const taskIndex, unsigned const i) {
+		if (i % kWriteInterval == 0) {
+			std::lock_guard<ftl::SharedFibtex> guard(lock);
+			data.Write(taskIndex);
+		} else {
+			lock.lock_shared();
+			uint64_t const value = data.Read();
+			lock.unlock_shared();
+			sum.fetch_add(value, std::memory_order_relaxed);
+		}
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&sum);
+})
+
+NONIUS_BENCHMARK("Read Mostly std::mutex", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	std::mutex lock;
+	ProtectedData data;
+	uint64_t sum = 0;
+	auto operation = [&lock, &data, &sum](unsigned const taskIndex, unsigned const i) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (i % kWriteInterval == 0) {
+			data.Write(taskIndex);
+		} else {
+			sum += data.Read();
+		}
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&sum);
+})
+
+NONIUS_BENCHMARK("Contention FiberSemaphore", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	ftl::FiberSemaphore semaphore(&taskScheduler, kSemaphoreUnits);
+	ProtectedData data[kSemaphoreUnits];
+	auto operation = [&semaphore, &data](unsigned const taskIndex, unsigned const i) {
+		semaphore.acquire();
+		// Not a real resource pool, so the writes may race. They only stand in for the work done with the unit
+		nonius::keep_memory(&data[(taskIndex + i) % kSemaphoreUnits]);
+		semaphore.release();
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+})
+
+NONIUS_BENCHMARK("Channel Pipeline", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	InitScheduler(&taskScheduler);
+
+	// Half the tasks send kLocksPerTask values each, and the other half receive them
+	ftl::Channel<uint64_t> channel(&taskScheduler, kChannelCapacity);
+	std::atomic<uint64_t> sum(0);
+	auto operation = [&channel, &sum](unsigned const taskIndex, unsigned const i) {
+		if (taskIndex % 2 == 0) {
+			channel.Send(i);
+		} else {
+			uint64_t value = 0;
+			channel.Receive(&value);
+			sum.fetch_add(value, std::memory_order_relaxed);
+		}
+	};
+
+	meter.measure([&taskScheduler, &operation] { RunContendingTasks(&taskScheduler, operation); });
+	nonius::keep_memory(&sum);
+})
@@ -63,7 +63,7 @@ NONIUS_BENCHMARK("ProducerConsumer", [](nonius::chronometer meter) {
 	meter.measure([&taskScheduler, tasks] {
 		for (unsigned i = 0; i < kNumIterations; ++i) {
 			ftl::TaskCounter counter(&taskScheduler);
-			taskScheduler.AddTasks(kNumProducerTasks, tasks, ftl::TaskPriority::Low);
+			taskScheduler.AddTasks(kNumProducerTasks, tasks, ftl::TaskPriority::Low, &counter);
 
 			taskScheduler.WaitForCounter(&counter);
 		}
@@ -0,0 +1,83 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "nonius/nonius.hpp"
+
+// Constants
+constexpr static unsigned kNumTasks = 65000;
+constexpr static unsigned kNumLookupsPerTask = 4;
+
+void ThreadIndexBenchmarkTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *sink = static_cast<std::atomic<unsigned> *>(arg);
+
+	// Emulate a task that touches a few ThreadLocal<T>'s
+	unsigned sum = 0;
+	for (unsigned i = 0; i < kNumLookupsPerTask; ++i) {
+		sum += taskScheduler->GetCurrentThreadIndex();
+	}
+	sink->fetch_add(sum, std::memory_order_relaxed);
+}
+
+/**
+ * Measures the cost of running kNumTasks tasks. The scheduler itself looks up the current thread index several times
+ * per task, so this scales directly with the cost of GetCurrentThreadIndex()
+ */
+static void ThreadIndexBenchmark(nonius::chronometer &meter, unsigned const threadCount) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = threadCount;
+	// 64 threads will usually oversubscribe the machine. Yield so the spinning threads don't starve the ones doing work
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	taskScheduler.Init(options);
+
+	std::atomic<unsigned> sink(0);
+	auto *tasks = new ftl::Task[kNumTasks];
+	for (unsigned i = 0; i < kNumTasks; ++i) {
+		tasks[i] = {ThreadIndexBenchmarkTask, &sink};
+	}
+
+	meter.measure([&taskScheduler, tasks] {
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(kNumTasks, tasks, ftl::TaskPriority::Low, &counter);
+
+		taskScheduler.WaitForCounter(&counter);
+	});
+
+	// Cleanup
+	delete[] tasks;
+}
+
+NONIUS_BENCHMARK("ThreadIndex 4 Threads", [](nonius::chronometer meter) {
+	ThreadIndexBenchmark(meter, 4);
+})
+
+NONIUS_BENCHMARK("ThreadIndex 16 Threads", [](nonius::chronometer meter) {
+	ThreadIndexBenchmark(meter, 16);
+})
+
+NONIUS_BENCHMARK("ThreadIndex 64 Threads", [](nonius::chronometer meter) {
+	ThreadIndexBenchmark(meter, 64);
+})
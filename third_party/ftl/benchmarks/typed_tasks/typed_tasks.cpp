@@ -0,0 +1,178 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/parallel_for.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "nonius/main.hpp"
+#include "nonius/nonius.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Count every heap allocation, so we can check the typed task paths don't allocate
+// This is why these benchmarks are built as their own executable, ftl-typed-tasks-benchmark
+static std::atomic<uint64_t> g_heapAllocations(0);
+
+void *operator new(size_t size) {
+	g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *const memory = std::malloc(size == 0 ? 1 : size)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void *memory, size_t /*size*/) noexcept {
+	std::free(memory);
+}
+
+// Constants
+constexpr static unsigned kNumProducerTasks = 100U;
+constexpr static unsigned kNumConsumerTasks = 1000U;
+constexpr static size_t kNumParallelForElements = 1000000;
+
+/* The heap allocations made by one benchmark's measured runs, summed over all its samples */
+struct AllocationStats {
+	char const *Name;
+	uint64_t Allocations;
+	uint64_t Runs;
+};
+
+enum AllocationBenchmark : unsigned {
+	kTypedProducerConsumer,
+	kParallelFor,
+	kParallelReduce,
+	kNumAllocationBenchmarks,
+};
+
+static AllocationStats g_allocationStats[kNumAllocationBenchmarks] = {
+        {"TypedProducerConsumer", 0, 0},
+        {"ParallelFor", 0, 0},
+        {"ParallelReduce", 0, 0},
+};
+
+/**
+ * Runs the measured function once to warm up the fiber pool and task arenas, and then counts how many heap
+ * allocations the measured runs made. main() reports them once the benchmarks have finished
+ */
+template <typename Function>
+static void MeasureWithAllocations(nonius::chronometer &meter, AllocationBenchmark const benchmark, Function &&function) {
+	function();
+
+	uint64_t const allocationsBefore = g_heapAllocations.load(std::memory_order_relaxed);
+	meter.measure(function);
+	uint64_t const allocations = g_heapAllocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+	g_allocationStats[benchmark].Allocations += allocations;
+	g_allocationStats[benchmark].Runs += static_cast<uint64_t>(meter.runs());
+}
+
+NONIUS_BENCHMARK("TypedProducerConsumer", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	taskScheduler.Init(options);
+
+	std::atomic<unsigned> consumed(0);
+	MeasureWithAllocations(meter, kTypedProducerConsumer, [&taskScheduler, &consumed] {
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(
+		        kNumProducerTasks,
+		        [&consumed](unsigned) {
+			        return [&consumed](ftl::TaskScheduler *scheduler) {
+				        ftl::TaskCounter consumerCounter(scheduler);
+				        scheduler->AddTasks(
+				                kNumConsumerTasks,
+				                [&consumed](unsigned) {
+					                return [&consumed](ftl::TaskScheduler *) { consumed.fetch_add(1, std::memory_order_relaxed); };
+				                },
+				                ftl::TaskPriority::Low, &consumerCounter);
+				        scheduler->WaitForCounter(&consumerCounter);
+			        };
+		        },
+		        ftl::TaskPriority::Low, &counter);
+
+		taskScheduler.WaitForCounter(&counter);
+	});
+})
+
+NONIUS_BENCHMARK("ParallelFor", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	taskScheduler.Init(options);
+
+	std::vector<float> values(kNumParallelForElements, 1.0f);
+	MeasureWithAllocations(meter, kParallelFor, [&taskScheduler, &values] {
+		ftl::ParallelFor(
+		        &taskScheduler, 0, values.size(), [&values](size_t const i) { values[i] = values[i] * 0.5f + 1.0f; }, 1024);
+	});
+})
+
+NONIUS_BENCHMARK("ParallelReduce", [](nonius::chronometer meter) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	taskScheduler.Init(options);
+
+	std::vector<float> values(kNumParallelForElements, 1.0f);
+	MeasureWithAllocations(meter, kParallelReduce, [&taskScheduler, &values] {
+		double const sum = ftl::ParallelReduce(
+		        &taskScheduler, 0, values.size(), 0.0, [&values](double const partial, size_t const i) { return partial + values[i]; },
+		        [](double const a, double const b) { return a + b; }, 1024);
+		nonius::keep_memory(&sum);
+	});
+})
+
+int main(int argc, char **argv) {
+	int const result = nonius::main(argc, argv);
+	if (result != 0) {
+		return result;
+	}
+
+	// In steady state, the typed task paths must not allocate at all
+	bool allocated = false;
+	for (AllocationStats const &stats : g_allocationStats) {
+		if (stats.Runs == 0) {
+			continue;
+		}
+
+		printf("%s: %llu heap allocations in %llu runs\n", stats.Name, static_cast<unsigned long long>(stats.Allocations), static_cast<unsigned long long>(stats.Runs));
+		allocated = allocated || stats.Allocations != 0;
+	}
+
+	if (allocated) {
+		fprintf(stderr, "FAILED: the typed task paths allocated in steady state\n");
+		return 1;
+	}
+	return 0;
+}
@@ -48,6 +48,7 @@ function(AddCompilerFlags)
 		Check_And_Add_Flag(${TARGET} -Wuseless-cast)
 		Check_And_Add_Flag(${TARGET} -Wno-unknown-pragmas)
 		Check_And_Add_Flag(${TARGET} -Wno-aligned-new)
+		Check_And_Add_Flag(${TARGET} -Wno-interference-size)
 		if(("${CMAKE_CXX_COMPILER_ID}" STREQUAL "GNU") AND (CMAKE_CXX_COMPILER_VERSION VERSION_LESS 5.0))
 			# Useless flag that hits a bunch of valid code
 			Check_And_Add_Flag(${TARGET} -Wno-missing-field-initializers)
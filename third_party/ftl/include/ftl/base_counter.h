@@ -24,6 +24,8 @@
 
 #pragma once
 
+#include "ftl/sync_spin_lock.h"
+
 #include <atomic>
 #include <limits>
 
@@ -32,15 +34,10 @@ namespace ftl {
 class TaskScheduler;
 
 /**
- * This value defines how many fibers can simultaneously wait on a counter
- * If a user tries to have more fibers wait on a counter, the fiber will not be tracked,
- * which will cause WaitForCounter() to infinitely sleep. This will probably cause a hang.
- *
- * Do NOT set this by definition either in your build or before you include the header.
- * This macro must be the same value throughout the whole build. Update the value within
- * cmake using the following:
+ * The default for the (now unused) fiberSlots constructor argument of the counter classes
  *
- * set(FTL_NUM_WAITING_FIBER_SLOTS <value> CACHE STRING "Number of slots within ftl::TaskCounter for fibers to wait" FORCE)
+ * Counters used to have a fixed number of waiting slots. They now keep an unbounded list of waiting fibers,
+ * so this is only kept for source compatibility
  */
 #ifndef NUM_WAITING_FIBER_SLOTS
 #	define NUM_WAITING_FIBER_SLOTS 4
@@ -55,6 +52,11 @@ class TaskScheduler;
 class BaseCounter {
 
 public:
+	/**
+	 * @param taskScheduler    The TaskScheduler that will wait on this counter
+	 * @param initialValue     The starting value of the counter
+	 * @param fiberSlots       Unused. Any number of fibers can wait on a counter
+	 */
 	explicit BaseCounter(TaskScheduler *taskScheduler, unsigned initialValue = 0, unsigned fiberSlots = NUM_WAITING_FIBER_SLOTS);
 
 	BaseCounter(BaseCounter const &) = delete;
@@ -64,35 +66,18 @@ public:
 	~BaseCounter();
 
 protected:
-	/* The TaskScheduler this counter is associated with */
-	TaskScheduler *m_taskScheduler;
-	/* The atomic counter holding our data */
-	std::atomic<unsigned> m_value;
-	/* An atomic counter to ensure the instance can't be destroyed while other threads are still inside a function */
-	std::atomic<unsigned> m_lock;
 	/**
-	 * An array that signals which slots in m_waitingFibers are free to be used
-	 * True: Free
-	 * False: Full
+	 * A node in the list of fibers waiting on a counter
 	 *
-	 * We can't use a vector for m_freeSlots because std::atomic<t> is non-copyable and
-	 * non-moveable. std::vector constructor, push_back, and emplace_back all use either
-	 * copy or move
+	 * The nodes are intrusive. The TaskScheduler owns one per fiber, since a fiber can only wait on one counter at a time.
+	 * So adding a waiter never allocates
 	 *
-	 * We use Small Vector Optimization in order to avoid allocations for most cases
+	 * Continuations use the same list. Their node is the base of a TaskScheduler::ContinuationBundle, and has a
+	 * nullptr FiberBundle. So do threads the scheduler doesn't own, which block in WaitForCounter() instead of
+	 * switching fibers. Their node is a TaskScheduler::BlockedThreadBundle, and has BlocksThread set
 	 */
-	std::atomic<bool> *m_freeSlots;
-	std::atomic<bool> m_freeSlotsStorage[NUM_WAITING_FIBER_SLOTS];
-
 	struct WaitingFiberBundle {
-		WaitingFiberBundle();
-
-		/**
-		 * A bundle is "InUse" when it's being filled with data, or when it's being removed
-		 * The wait checking code uses this atomic to prevent multiple threads from modifying the same slot
-		 */
-		std::atomic<bool> InUse;
-		/* The fiber bundle that's waiting */
+		/* The fiber bundle that's waiting. nullptr if this node is a continuation or a blocked thread */
 		void *FiberBundle{nullptr};
 		/* The value the fiber is waiting for */
 		unsigned TargetValue{0};
@@ -100,23 +85,28 @@ protected:
 		 * The index of the thread this fiber is pinned to
 		 * If the fiber *isn't* pinned, this will equal std::numeric_limits<unsigned>::max()
 		 */
-		unsigned PinnedThreadIndex;
+		unsigned PinnedThreadIndex{std::numeric_limits<unsigned>::max()};
+		/* True if a thread is blocked on this node, rather than a fiber or a continuation */
+		bool BlocksThread{false};
+		/* The next waiting fiber. Protected by m_waitingFibersLock */
+		WaitingFiberBundle *Next{nullptr};
 	};
-	/**
-	 * The storage for the fibers waiting on this counter
-	 *
-	 * We again can't use a vector because WaitingFiberBundle contains a std::atomic<t>, which is is non-copyable and
-	 * non-moveable. std::vector constructor, push_back, and emplace_back all use either copy or move
-	 *
-	 * We also use Small Vector Optimization in order to avoid allocations for most cases
-	 */
-	WaitingFiberBundle *m_waitingFibers;
-	WaitingFiberBundle m_waitingFibersStorage[NUM_WAITING_FIBER_SLOTS];
 
+	/* The TaskScheduler this counter is associated with */
+	TaskScheduler *m_taskScheduler;
+	/* The atomic counter holding our data */
+	std::atomic<unsigned> m_value;
+	/* An atomic counter to ensure the instance can't be destroyed while other threads are still inside a function */
+	std::atomic<unsigned> m_lock;
 	/**
-	 * The number of elements in m_freeSlots and m_waitingFibers
+	 * The head of the list of fibers waiting on this counter. nullptr if no fibers are waiting
+	 *
+	 * The list is only modified with m_waitingFibersLock held. But the head is atomic, so CheckWaitingFibers() can
+	 * check for an empty list without taking the lock. This keeps the common case of nobody waiting to a single load
 	 */
-	unsigned m_fiberSlots;
+	std::atomic<WaitingFiberBundle *> m_waitingFibers;
+	/* A spinlock protecting the structure of m_waitingFibers. It's only held for a few pointer updates */
+	SyncSpinLock m_waitingFibersLock;
 
 	/**
 	 * We friend TaskScheduler so we can keep AddFiberToWaitingList() private
@@ -130,22 +120,28 @@ protected:
 	 *
 	 * NOTE: Called by TaskScheduler from inside WaitForCounter
 	 *
-	 * WARNING: The end-user must guarantee that the number of simultaneous waiting fibers is
-	 * less than or equal to NUM_WAITING_FIBER_SLOTS. If a user tries to have more fibers wait
-	 * on a counter, the fiber will not be tracked, which will cause WaitForCounter() to
-	 * infinitely sleep. This will probably cause a hang
-	 *
-	 * @param targetValue          The target value the fiber is waiting for
+	 * @param waitingFiber         The list node to use for this fiber. It must stay valid until the fiber is resumed
 	 * @param fiberBundle          The fiber that is waiting
+	 * @param targetValue          The target value the fiber is waiting for
 	 * @param pinnedThreadIndex    The index of the thread this fiber is pinned to. If == std::numeric_limits<unsigned>::max(), the fiber can be resumed on any thread
 	 * @return                     True: The counter value changed to equal targetValue while we were adding the fiber to the wait list
 	 */
-	bool AddFiberToWaitingList(void *fiberBundle, unsigned targetValue, unsigned pinnedThreadIndex = std::numeric_limits<unsigned>::max());
+	bool AddFiberToWaitingList(WaitingFiberBundle *waitingFiber, void *fiberBundle, unsigned targetValue, unsigned pinnedThreadIndex = std::numeric_limits<unsigned>::max());
+	/**
+	 * Add a node to the waiting list. The node's fields must already be filled in
+	 *
+	 * NOTE: Called by TaskScheduler from inside AddContinuation, and by AddFiberToWaitingList()
+	 *
+	 * @param node    The node to add. It must stay valid until CheckWaitingFibers() unlinks it
+	 * @return        True: The counter value changed to equal node->TargetValue while we were adding the node. It was
+	 *                taken back out of the list, so the caller has to act on it itself
+	 */
+	bool AddToWaitingList(WaitingFiberBundle *node);
 
 	/**
-	 * Checks all the waiting fibers in the list to see if value == targetValue
-	 * If it finds one, it removes it from the list, and signals the
-	 * TaskScheduler to add it to its ready task list
+	 * Checks all the waiting fibers and continuations in the list to see if value == targetValue
+	 * If it finds any, it removes them from the list, and signals the
+	 * TaskScheduler to add them to its ready fiber list, or its task queues, or to wake the blocked thread
 	 *
 	 * @param value    The value to check
 	 */
@@ -24,6 +24,8 @@
 
 #pragma once
 
+#include "ftl/task.h"
+
 namespace ftl {
 
 enum class FiberState : int {
@@ -38,6 +40,42 @@ using FiberCreationCallback = void (*)(void *context, unsigned fiberCount);
 using ThreadEventCallback = void (*)(void *context, unsigned threadIndex);
 using FiberEventCallback = void (*)(void *context, unsigned fiberIndex, FiberState newState);
 
+enum class TaskState : int {
+	// The task is about to run
+	Started,
+	// The task returned. Its counter hasn't been decremented yet
+	Finished
+};
+
+enum class CounterWaitState : int {
+	// The fiber is about to be suspended, because the counter hasn't reached the target value yet
+	Waiting,
+	// The counter reached the target value, and the fiber is running again
+	Resumed,
+	// The counter was already at the target value, so the fiber didn't need to wait
+	Satisfied
+};
+
+/**
+ * A task keeps the same fiber from start to finish, even if it waits and resumes on another thread. So fiberIndex can
+ * be used to pair Started and Finished. For typed tasks, function is the scheduler's entry point for the callable type
+ * counter is the counter the task decrements when it finishes, or nullptr if it has none
+ */
+using TaskEventCallback = void (*)(void *context, unsigned fiberIndex, TaskFunction function, void const *counter, TaskState newState);
+/**
+ * Called by the fiber that adds the tasks, before any of them can start. Continuations are reported when they are
+ * queued, by the fiber that brought their counter to the target value
+ *
+ * Threads the scheduler doesn't own have no fiber, so they pass std::numeric_limits<unsigned>::max() as fiberIndex.
+ * The same goes for CounterWaitCallback
+ */
+using TasksAddedCallback = void (*)(void *context, unsigned fiberIndex, void const *counter, unsigned taskCount);
+/**
+ * Waiting and Resumed are only called when WaitForCounter() actually suspends the fiber. A wait that finds the counter
+ * already done only gets Satisfied
+ */
+using CounterWaitCallback = void (*)(void *context, unsigned fiberIndex, void const *counter, unsigned targetValue, CounterWaitState newState);
+
 struct EventCallbacks {
 	void *Context = nullptr;
 
@@ -48,6 +86,10 @@ struct EventCallbacks {
 	ThreadEventCallback OnWorkerThreadEnded = nullptr;
 
 	FiberEventCallback OnFiberStateChanged = nullptr;
+
+	TaskEventCallback OnTaskStateChanged = nullptr;
+	TasksAddedCallback OnTasksAdded = nullptr;
+	CounterWaitCallback OnCounterWaitStateChanged = nullptr;
 };
 
 } // End of namespace ftl
@@ -0,0 +1,302 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/assert.h"
+#include "ftl/sync_wait_queue.h"
+#include "ftl/task_scheduler.h"
+
+#include <mutex>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+namespace ftl {
+
+/**
+ * A bounded, multi-producer multi-consumer channel. Fibers that send to a full channel, or receive from an empty one,
+ * are parked rather than blocking their thread
+ *
+ * Values are handed off directly: a sender that finds a parked receiver moves its value straight into the receiver's
+ * output, and a receiver that makes room moves the oldest parked sender's value into the buffer. Either way, the
+ * woken fiber's operation has already completed when it resumes
+ *
+ * @tparam T    The type of the values. Must be default constructible and movable
+ */
+template <typename T>
+class Channel {
+public:
+	/**
+	 * @param taskScheduler    ftl::TaskScheduler that will be using this channel
+	 * @param capacity         The most values the channel can hold before Send() waits. Must be > 0
+	 */
+	Channel(TaskScheduler *taskScheduler, size_t capacity)
+	        : m_taskScheduler(taskScheduler), m_spinner(taskScheduler->GetThreadCount() > 1), m_buffer(capacity) {
+		FTL_ASSERT("Channel capacity must be > 0", capacity > 0);
+	}
+
+	Channel(Channel const &) = delete;
+	Channel(Channel &&) noexcept = delete;
+	Channel &operator=(Channel const &) = delete;
+	Channel &operator=(Channel &&) noexcept = delete;
+	~Channel() {
+		FTL_ASSERT("Channel destroyed with fibers still waiting on it", m_senders.IsEmpty() && m_receivers.IsEmpty());
+	}
+
+private:
+	enum class TryResult {
+		Done,
+		WouldBlock,
+		Closed,
+	};
+
+	TaskScheduler *m_taskScheduler;
+	AdaptiveSpinner m_spinner;
+
+	/* Protects everything below */
+	SyncSpinLock m_stateLock;
+	/* A ring buffer of m_size values, starting at m_head */
+	std::vector<T> m_buffer;
+	size_t m_head{0};
+	size_t m_size{0};
+	bool m_closed{false};
+	/* Senders waiting for room. Their Data points to the value they're sending */
+	SyncWaitQueue m_senders;
+	/* Receivers waiting for a value. Their Data points to where the value goes. Only non-empty while m_size == 0 */
+	SyncWaitQueue m_receivers;
+
+public:
+	/**
+	 * Sends a value. If the channel is full, spins for a while, then parks the fiber until there's room
+	 *
+	 * @param value                The value to send
+	 * @param pinToThread          If the fiber should resume on the same thread as it started on
+	 * @param maxSpinIterations    The most times to retry before parking. 0 parks right away
+	 * @return                     False if the channel was closed before the value could be sent
+	 */
+	bool Send(T value, bool const pinToThread = false, unsigned const maxSpinIterations = kDefaultSyncSpinIterations) {
+		TryResult result = TryResult::WouldBlock;
+		if (m_spinner.Spin(maxSpinIterations, [this, &value, &result]() {
+			    result = TrySendInternal(value);
+			    return result != TryResult::WouldBlock;
+		    })) {
+			return result == TryResult::Done;
+		}
+
+		SyncWaiter waiter(m_taskScheduler, 0, &value);
+		SyncWaiter *receiver = nullptr;
+		bool parked = false;
+		{
+			std::lock_guard<SyncSpinLock> guard(m_stateLock);
+			if (m_closed) {
+				return false;
+			}
+			if (m_size == m_buffer.size() && m_receivers.IsEmpty()) {
+				m_senders.Push(&waiter);
+				parked = true;
+			} else {
+				receiver = Push(value);
+			}
+		}
+
+		if (!parked) {
+			WakeAll(receiver);
+			return true;
+		}
+
+		// A receiver moves the value into the buffer before waking us. Or Close() wakes us with Succeeded = false
+		waiter.Wait(pinToThread);
+		return waiter.Succeeded;
+	}
+
+	/**
+	 * Sends a value, if there is room. Never waits
+	 *
+	 * @param value    The value to send. Only moved from if this succeeds
+	 * @return         True if the value was sent
+	 */
+	bool TrySend(T &&value) {
+		return TrySendInternal(value) == TryResult::Done;
+	}
+
+	/**
+	 * Receives a value. If the channel is empty, spins for a while, then parks the fiber until a value arrives
+	 *
+	 * @param value                Filled with the oldest value in the channel
+	 * @param pinToThread          If the fiber should resume on the same thread as it started on
+	 * @param maxSpinIterations    The most times to retry before parking. 0 parks right away
+	 * @return                     False if the channel was closed, and all the values in it were received
+	 */
+	bool Receive(T *const value, bool const pinToThread = false, unsigned const maxSpinIterations = kDefaultSyncSpinIterations) {
+		TryResult result = TryResult::WouldBlock;
+		if (m_spinner.Spin(maxSpinIterations, [this, value, &result]() {
+			    result = TryReceiveInternal(value);
+			    return result != TryResult::WouldBlock;
+		    })) {
+			return result == TryResult::Done;
+		}
+
+		SyncWaiter waiter(m_taskScheduler, 0, value);
+		SyncWaiter *sender = nullptr;
+		bool parked = false;
+		{
+			std::lock_guard<SyncSpinLock> guard(m_stateLock);
+			if (m_size != 0) {
+				sender = Pop(value);
+			} else if (m_closed) {
+				return false;
+			} else {
+				m_receivers.Push(&waiter);
+				parked = true;
+			}
+		}
+
+		if (!parked) {
+			WakeAll(sender);
+			return true;
+		}
+
+		// A sender moves its value into *value before waking us. Or Close() wakes us with Succeeded = false
+		waiter.Wait(pinToThread);
+		return waiter.Succeeded;
+	}
+
+	/**
+	 * Receives a value, if there is one. Never waits
+	 *
+	 * @param value    Filled with the oldest value in the channel, if there is one
+	 * @return         True if a value was received
+	 */
+	bool TryReceive(T *const value) {
+		return TryReceiveInternal(value) == TryResult::Done;
+	}
+
+	/**
+	 * Closes the channel. Values that were already sent can still be received. Parked senders are woken, and their
+	 * Send() returns false. Parked receivers are woken, and their Receive() returns false
+	 */
+	void Close() {
+		SyncWaiter *wake = nullptr;
+		{
+			std::lock_guard<SyncSpinLock> guard(m_stateLock);
+			m_closed = true;
+			m_senders.PopAll(&wake);
+			m_receivers.PopAll(&wake);
+		}
+
+		for (SyncWaiter *waiter = wake; waiter != nullptr; waiter = waiter->Next) {
+			waiter->Succeeded = false;
+		}
+		WakeAll(wake);
+	}
+
+	bool IsClosed() {
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		return m_closed;
+	}
+
+	size_t GetCapacity() const {
+		return m_buffer.size();
+	}
+
+	/**
+	 * @return    The number of values in the channel. Only a snapshot, since other fibers may send or receive concurrently
+	 */
+	size_t GetSize() {
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		return m_size;
+	}
+
+private:
+	TryResult TrySendInternal(T &value) {
+		SyncWaiter *receiver;
+		{
+			std::lock_guard<SyncSpinLock> guard(m_stateLock);
+			if (m_closed) {
+				return TryResult::Closed;
+			}
+			if (m_size == m_buffer.size() && m_receivers.IsEmpty()) {
+				return TryResult::WouldBlock;
+			}
+			receiver = Push(value);
+		}
+
+		WakeAll(receiver);
+		return TryResult::Done;
+	}
+
+	TryResult TryReceiveInternal(T *const value) {
+		SyncWaiter *sender;
+		{
+			std::lock_guard<SyncSpinLock> guard(m_stateLock);
+			if (m_size == 0) {
+				return m_closed ? TryResult::Closed : TryResult::WouldBlock;
+			}
+			sender = Pop(value);
+		}
+
+		WakeAll(sender);
+		return TryResult::Done;
+	}
+
+	/**
+	 * Gives a value to the oldest parked receiver, or adds it to the buffer. m_stateLock must be held, and there
+	 * must be room in the buffer, or a parked receiver
+	 *
+	 * @return    The receiver to wake, once m_stateLock is released. Or nullptr
+	 */
+	SyncWaiter *Push(T &value) {
+		SyncWaiter *const receiver = m_receivers.Pop();
+		if (receiver != nullptr) {
+			*static_cast<T *>(receiver->Data) = std::move(value);
+			return receiver;
+		}
+
+		m_buffer[(m_head + m_size) % m_buffer.size()] = std::move(value);
+		++m_size;
+		return nullptr;
+	}
+
+	/**
+	 * Takes the oldest value from the buffer. Then refills the slot from the oldest parked sender, if there is one
+	 * m_stateLock must be held, and the buffer must not be empty
+	 *
+	 * @return    The sender to wake, once m_stateLock is released. Or nullptr
+	 */
+	SyncWaiter *Pop(T *const value) {
+		*value = std::move(m_buffer[m_head]);
+		m_head = (m_head + 1) % m_buffer.size();
+		--m_size;
+
+		SyncWaiter *const sender = m_senders.Pop();
+		if (sender != nullptr) {
+			m_buffer[(m_head + m_size) % m_buffer.size()] = std::move(*static_cast<T *>(sender->Data));
+			++m_size;
+		}
+		return sender;
+	}
+};
+
+} // End of namespace ftl
@@ -32,6 +32,12 @@
 #	endif
 #endif
 
+// Per-worker scheduler counters. See TaskScheduler::GetWorkerTelemetry()
+// This changes the layout of TaskScheduler, so it has to be the same everywhere ftl is used. The CMake option sets it publicly
+#ifndef FTL_TELEMETRY
+#	define FTL_TELEMETRY 0
+#endif
+
 // Determine the OS
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32)
 #	define FTL_OS_WINDOWS
@@ -0,0 +1,96 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace ftl {
+
+/* A logical CPU (hardware thread), and the hardware it shares with the other CPUs */
+struct LogicalCpu {
+	/* The OS index of the CPU. This is what SetCurrentThreadAffinity() takes */
+	unsigned Id;
+	/* The physical core. CPUs with the same CoreId are SMT siblings. This is the lowest Id of the siblings */
+	unsigned CoreId;
+	/* The last level cache. CPUs with the same CacheId share it. This is the lowest Id of the CPUs sharing it */
+	unsigned CacheId;
+	/* The NUMA node */
+	unsigned NumaNode;
+};
+
+/* How close two CPUs are. Threads steal from the closest level first */
+enum class StealLevel : unsigned {
+	// SMT siblings on the same physical core
+	Core = 0,
+	// Different cores that share the last level cache
+	Cache = 1,
+	// Different caches on the same NUMA node
+	NumaNode = 2,
+	// Everything else. Also used when the topology is unknown
+	Remote = 3
+};
+
+constexpr static unsigned kNumStealLevels = 4;
+
+/**
+ * Reads the topology of the online CPUs from Linux sysfs
+ *
+ * On other platforms, or if sysfs isn't mounted, this returns false and leaves cpus empty
+ *
+ * @param cpus         Filled with the online CPUs, sorted by Id
+ * @param sysfsRoot    The sysfs cpu directory. Only useful for testing
+ * @return             True if the topology was read successfully
+ */
+bool ReadCpuTopology(std::vector<LogicalCpu> *cpus, char const *sysfsRoot = "/sys/devices/system/cpu");
+
+/**
+ * Removes the CPUs the current thread isn't allowed to run on, e.g. because of taskset or cgroups
+ * Does nothing on platforms without an affinity API
+ *
+ * @param cpus    The CPUs to filter
+ */
+void RemoveDisallowedCpus(std::vector<LogicalCpu> *cpus);
+
+/**
+ * Orders CPUs for assigning threads to them. CPUs are grouped by NUMA node, then last level cache, then core. So
+ * consecutive threads share as much hardware as possible
+ *
+ * @param cpus                   The CPUs to order
+ * @param physicalCoresFirst     If true, the first SMT sibling of every core comes before any second sibling. Otherwise,
+ *                               all the siblings of a core are next to each other
+ * @return                       Indices into cpus
+ */
+std::vector<unsigned> OrderCpusForPinning(std::vector<LogicalCpu> const &cpus, bool physicalCoresFirst);
+
+/**
+ * Gets how close two CPUs are
+ *
+ * @param a    The first CPU
+ * @param b    The second CPU
+ * @return     The closest level the CPUs share
+ */
+StealLevel GetStealLevel(LogicalCpu const &a, LogicalCpu const &b);
+
+} // End of namespace ftl
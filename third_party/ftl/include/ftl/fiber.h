@@ -33,17 +33,22 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
 // ReSharper restore CppUnusedIncludeDirective
 
-#if defined(FTL_FIBER_STACK_GUARD_PAGES)
-#	if defined(FTL_OS_LINUX) || defined(FTL_OS_MAC) || defined(FTL_iOS)
-#		include <sys/mman.h>
-#		include <unistd.h>
-#	elif defined(FTL_OS_WINDOWS)
+#if defined(FTL_OS_LINUX) || defined(FTL_OS_MAC) || defined(FTL_iOS)
+#	include <sys/mman.h>
+#	include <unistd.h>
+#elif defined(FTL_OS_WINDOWS)
+#	ifndef WIN32_LEAN_AND_MEAN
 #		define WIN32_LEAN_AND_MEAN
+#	endif
+#	ifndef NOMINMAX
 #		define NOMINMAX
-#		include <Windows.h>
 #	endif
+#	include <Windows.h>
 #endif
 
 namespace ftl {
@@ -53,10 +58,22 @@ inline void MemoryGuardRelease(void *memory, size_t bytes);
 inline size_t SystemPageSize();
 inline void *AlignedAlloc(size_t size, size_t alignment);
 inline void AlignedFree(void *block);
+inline size_t VirtualPageSize();
+inline void *ReserveStackMemory(size_t size);
+inline void ReleaseStackMemory(void *memory, size_t size);
+inline bool QueryResidentStackBytes(void *stackBottom, size_t stackSize, size_t *residentBytes);
 inline size_t RoundUp(size_t numToRound, size_t multiple);
 
 using FiberStartRoutine = void (*)(void *arg);
 
+enum class FiberStackAllocation {
+	// Allocate the stack from the heap
+	Heap,
+	// Reserve the stack directly from the OS. Physical pages are only assigned when the fiber first touches them
+	// On Windows, the whole stack is still committed up front, so it counts against the commit limit
+	DemandPaged,
+};
+
 class Fiber {
 public:
 	/**
@@ -67,28 +84,48 @@ public:
 	/**
 	 * Allocates a stack and sets it up to start executing 'startRoutine' when first switched to
 	 *
-	 * @param stackSize        The stack size for the fiber. If guard pages are being used, this will be rounded up to
-	 * the next multiple of the system page size
-	 * @param startRoutine     The function to run when the fiber first starts
-	 * @param arg              The argument to pass to 'startRoutine'
+	 * @param stackSize          The stack size for the fiber. If guard pages are being used, or allocation is
+	 *                           DemandPaged, this will be rounded up to the next multiple of the system page size
+	 * @param startRoutine       The function to run when the fiber first starts
+	 * @param arg                The argument to pass to 'startRoutine'
+	 * @param allocation         Where to allocate the stack from
+	 * @param trackStackUsage    If true, GetStackUsage() will report how much of the stack has been used.
+	 *                           For Heap stacks (and DemandPaged on Windows, which has no resident page query)
+	 *                           this fills the stack with a pattern, which touches the whole stack up front
 	 */
-	Fiber(size_t const stackSize, FiberStartRoutine const startRoutine, void *const arg)
-	        : m_arg(arg) {
+	Fiber(size_t const stackSize, FiberStartRoutine const startRoutine, void *const arg,
+	      FiberStackAllocation const allocation = FiberStackAllocation::Heap, bool const trackStackUsage = false)
+	        : m_arg(arg), m_allocation(allocation), m_trackStackUsage(trackStackUsage) {
 #if defined(FTL_FIBER_STACK_GUARD_PAGES)
 		m_systemPageSize = SystemPageSize();
 #else
 		m_systemPageSize = 0;
 #endif
 
-		m_stackSize = RoundUp(stackSize, m_systemPageSize);
-		// We add a guard page both the top and the bottom of the stack
-		m_stack = AlignedAlloc(m_systemPageSize + m_stackSize + m_systemPageSize, m_systemPageSize);
-		m_context = boost_context::make_fcontext(static_cast<char *>(m_stack) + m_systemPageSize + stackSize, stackSize, startRoutine);
+		if (allocation == FiberStackAllocation::DemandPaged) {
+			m_stackSize = RoundUp(stackSize, VirtualPageSize());
+			// Guard pages are already page-aligned in the reservation
+			m_stack = ReserveStackMemory(m_systemPageSize + m_stackSize + m_systemPageSize);
+		} else {
+			m_stackSize = RoundUp(stackSize, m_systemPageSize);
+			// We add a guard page both the top and the bottom of the stack
+			m_stack = AlignedAlloc(m_systemPageSize + m_stackSize + m_systemPageSize, m_systemPageSize);
+		}
 
-		FTL_VALGRIND_REGISTER(static_cast<char *>(m_stack) + m_systemPageSize, static_cast<char *>(m_stack) + m_systemPageSize + stackSize);
+		if (trackStackUsage) {
+			size_t residentBytes;
+			m_stackPainted = allocation == FiberStackAllocation::Heap || !QueryResidentStackBytes(StackBottom(), m_stackSize, &residentBytes);
+			if (m_stackPainted) {
+				memset(StackBottom(), kStackPaintByte, m_stackSize);
+			}
+		}
+
+		m_context = boost_context::make_fcontext(StackBottom() + m_stackSize, m_stackSize, startRoutine);
+
+		FTL_VALGRIND_REGISTER(StackBottom(), StackBottom() + m_stackSize);
 #if defined(FTL_FIBER_STACK_GUARD_PAGES)
 		MemoryGuard(static_cast<char *>(m_stack), m_systemPageSize);
-		MemoryGuard(static_cast<char *>(m_stack) + m_systemPageSize + stackSize, m_systemPageSize);
+		MemoryGuard(StackBottom() + m_stackSize, m_systemPageSize);
 #endif
 	}
 
@@ -131,20 +168,30 @@ public:
 		if (m_stack != nullptr) {
 			if (m_systemPageSize != 0) {
 				MemoryGuardRelease(static_cast<char *>(m_stack), m_systemPageSize);
-				MemoryGuardRelease(static_cast<char *>(m_stack) + m_systemPageSize + m_stackSize, m_systemPageSize);
+				MemoryGuardRelease(StackBottom() + m_stackSize, m_systemPageSize);
 			}
 			FTL_VALGRIND_DEREGISTER();
 
-			AlignedFree(m_stack);
+			if (m_allocation == FiberStackAllocation::DemandPaged) {
+				ReleaseStackMemory(m_stack, m_systemPageSize + m_stackSize + m_systemPageSize);
+			} else {
+				AlignedFree(m_stack);
+			}
 		}
 	}
 
 private:
+	constexpr static unsigned char kStackPaintByte = 0xCD;
+
 	void *m_stack{nullptr};
 	size_t m_systemPageSize{0};
 	size_t m_stackSize{0};
 	boost_context::fcontext_t m_context{nullptr};
 	void *m_arg{nullptr};
+	FiberStackAllocation m_allocation{FiberStackAllocation::Heap};
+	bool m_trackStackUsage{false};
+	/* True if the stack was filled with kStackPaintByte. Otherwise, usage is measured from the resident pages */
+	bool m_stackPainted{false};
 	FTL_VALGRIND_ID
 
 public:
@@ -169,11 +216,53 @@ public:
 	 * @return
 	 */
 	void Reset(FiberStartRoutine const startRoutine, void *const arg) {
-		m_context = boost_context::make_fcontext(static_cast<char *>(m_stack) + m_stackSize, m_stackSize, startRoutine);
+		m_context = boost_context::make_fcontext(StackBottom() + m_stackSize, m_stackSize, startRoutine);
 		m_arg = arg;
 	}
 
+	/**
+	 * Gets the usable size of the stack, after rounding
+	 *
+	 * @return    The stack size in bytes. 0 for a default constructed fiber
+	 */
+	size_t GetStackSize() const {
+		return m_stackSize;
+	}
+
+	/**
+	 * Gets the high-water mark of the stack. AKA, the most stack this fiber has used since it was created
+	 *
+	 * NOTE: This reads the stack memory without synchronization. For an exact value, the fiber should not be running
+	 *
+	 * @return    The number of bytes used, rounded up to the page size for DemandPaged stacks. 0 if the fiber wasn't
+	 *            created with trackStackUsage
+	 */
+	size_t GetStackUsage() const {
+		if (m_stack == nullptr || !m_trackStackUsage) {
+			return 0;
+		}
+
+		if (!m_stackPainted) {
+			size_t residentBytes = 0;
+			QueryResidentStackBytes(StackBottom(), m_stackSize, &residentBytes);
+			return residentBytes;
+		}
+
+		// The stack grows down, so the first byte that doesn't match the paint is the deepest the stack has reached
+		char const *const bottom = StackBottom();
+		size_t untouched = 0;
+		while (untouched < m_stackSize && static_cast<unsigned char>(bottom[untouched]) == kStackPaintByte) {
+			++untouched;
+		}
+
+		return m_stackSize - untouched;
+	}
+
 private:
+	char *StackBottom() const {
+		return static_cast<char *>(m_stack) + m_systemPageSize;
+	}
+
 	/**
 	 * Helper function for the move operators
 	 * Swaps all the member variables
@@ -189,6 +278,9 @@ private:
 		swap(first.m_stackSize, second.m_stackSize);
 		swap(first.m_context, second.m_context);
 		swap(first.m_arg, second.m_arg);
+		swap(first.m_allocation, second.m_allocation);
+		swap(first.m_trackStackUsage, second.m_trackStackUsage);
+		swap(first.m_stackPainted, second.m_stackPainted);
 	}
 };
 
@@ -286,6 +378,87 @@ inline void AlignedFree(void *const block) {
 }
 #endif
 
+#if defined(FTL_OS_LINUX) || defined(FTL_OS_MAC) || defined(FTL_iOS)
+inline size_t VirtualPageSize() {
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+inline void *ReserveStackMemory(size_t const size) {
+	// MAP_NORESERVE so the stacks don't count against overcommit limits until they are touched
+	void *const memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	FTL_ASSERT("mmap", memory != MAP_FAILED);
+#	if defined(MADV_NOHUGEPAGE)
+	// Transparent huge pages would commit 2MB at a time, which defeats the point
+	madvise(memory, size, MADV_NOHUGEPAGE);
+#	endif
+
+	return memory;
+}
+
+inline void ReleaseStackMemory(void *const memory, size_t const size) {
+	int const result = munmap(memory, size);
+	FTL_ASSERT("munmap", !result);
+#	if defined(NDEBUG)
+	// Void out the result for release, so the compiler doesn't get cranky about an unused variable
+	(void)result;
+#	endif
+}
+
+inline bool QueryResidentStackBytes(void *const stackBottom, size_t const stackSize, size_t *const residentBytes) {
+#	if defined(FTL_OS_LINUX)
+	using MincoreVecType = unsigned char;
+#	else
+	using MincoreVecType = char;
+#	endif
+
+	size_t const pageSize = VirtualPageSize();
+	size_t const numPages = stackSize / pageSize;
+	std::vector<MincoreVecType> residency(numPages);
+	if (mincore(stackBottom, stackSize, residency.data()) != 0) {
+		return false;
+	}
+
+	// The stack grows down, so the lowest resident page is the deepest the stack has reached
+	size_t page = 0;
+	while (page < numPages && (residency[page] & 1) == 0) {
+		++page;
+	}
+
+	*residentBytes = (numPages - page) * pageSize;
+	return true;
+}
+#elif defined(FTL_OS_WINDOWS)
+inline size_t VirtualPageSize() {
+	SYSTEM_INFO sysInfo;
+	GetSystemInfo(&sysInfo);
+	return sysInfo.dwPageSize;
+}
+
+inline void *ReserveStackMemory(size_t const size) {
+	// Reserve and commit in one go. This is lazy physical paging only, not lazy commit: the whole stack is charged
+	// against the commit limit immediately, but physical pages are still only assigned when they are first touched
+	void *const memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	FTL_ASSERT("VirtualAlloc", memory != nullptr);
+
+	return memory;
+}
+
+inline void ReleaseStackMemory(void *const memory, size_t const /*size*/) {
+	BOOL const result = VirtualFree(memory, 0, MEM_RELEASE);
+	FTL_ASSERT("VirtualFree", result);
+#	if defined(NDEBUG)
+	(void)result;
+#	endif
+}
+
+inline bool QueryResidentStackBytes(void *const /*stackBottom*/, size_t const /*stackSize*/, size_t *const /*residentBytes*/) {
+	// Windows always measures the stack by painting it. Fiber() sees the false and falls back to that
+	return false;
+}
+#else
+#	error "Need a way to reserve memory for this platform".
+#endif
+
 inline size_t RoundUp(size_t const numToRound, size_t const multiple) {
 	if (multiple == 0) {
 		return numToRound;
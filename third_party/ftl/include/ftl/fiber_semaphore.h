@@ -0,0 +1,90 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/sync_wait_queue.h"
+
+namespace ftl {
+
+class TaskScheduler;
+
+/**
+ * A fiber aware counting semaphore. Waiting fibers are parked, rather than blocking their thread
+ *
+ * release() hands units directly to the oldest waiters, so a woken fiber always owns its unit, and newcomers can't
+ * barge in ahead of fibers that are already waiting. Methods follow the naming of C++20's std::counting_semaphore
+ */
+class FiberSemaphore {
+public:
+	/**
+	 * @param taskScheduler    ftl::TaskScheduler that will be using this semaphore
+	 * @param initialCount     The number of units available to start with
+	 */
+	FiberSemaphore(TaskScheduler *taskScheduler, unsigned initialCount);
+
+	FiberSemaphore(FiberSemaphore const &) = delete;
+	FiberSemaphore(FiberSemaphore &&) noexcept = delete;
+	FiberSemaphore &operator=(FiberSemaphore const &) = delete;
+	FiberSemaphore &operator=(FiberSemaphore &&) noexcept = delete;
+	~FiberSemaphore() = default;
+
+private:
+	TaskScheduler *m_taskScheduler;
+	AdaptiveSpinner m_spinner;
+
+	/* Protects everything below */
+	SyncSpinLock m_stateLock;
+	unsigned m_count;
+	SyncWaitQueue m_waiters;
+
+public:
+	/**
+	 * Takes a unit. Spins for a while, then parks the fiber until a unit is handed to it
+	 *
+	 * @param pinToThread          If the fiber should resume on the same thread as it started on
+	 * @param maxSpinIterations    The most times to retry before parking. 0 parks right away
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	void acquire(bool pinToThread = false, unsigned maxSpinIterations = kDefaultSyncSpinIterations);
+	/**
+	 * @return    True if a unit was available, and nobody was waiting for it
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	bool try_acquire();
+	/**
+	 * Returns units. Each one is handed to a waiting fiber, if there is one
+	 *
+	 * @param count    The number of units to return
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	void release(unsigned count = 1);
+
+	/**
+	 * @return    The number of units available. Only a snapshot, since other fibers may acquire or release concurrently
+	 */
+	unsigned GetCount();
+};
+
+} // End of namespace ftl
@@ -39,7 +39,7 @@ public:
 	 * All Fibtex's have to be aware of the task scheduler in order to yield.
 	 *
 	 * @param taskScheduler    ftl::TaskScheduler that will be using this mutex.
-	 * @param fiberSlots       How many fibers can simultaneously wait on the mutex
+	 * @param fiberSlots       Unused. Any number of fibers can wait on the mutex
 	 */
 	explicit Fibtex(TaskScheduler *taskScheduler, unsigned fiberSlots = NUM_WAITING_FIBER_SLOTS)
 	        : m_ableToSpin(taskScheduler->GetThreadCount() > 1), m_taskScheduler(taskScheduler),
@@ -0,0 +1,227 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/config.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+#include <thread>
+
+namespace ftl {
+
+namespace detail {
+
+/**
+ * The shared state of a ParallelFor() / ParallelReduce()
+ *
+ * Instead of splitting the range up front, each worker task claims chunks from the front of the range until it's
+ * empty. Chunks start large, and shrink as the range runs out (guided scheduling). So early chunks have little
+ * overhead, and late chunks even out the load when some iterations, or some threads, are slower than others
+ */
+struct ParallelRange {
+	std::atomic<size_t> Next;
+	size_t End;
+	size_t GrainSize;
+	size_t NumWorkers;
+};
+
+/**
+ * Claims the next chunk of the range
+ * The chunk size depends on how much of the range is left, so this is a compare-exchange loop rather than a fetch_add
+ *
+ * @param range         The shared range
+ * @param chunkBegin    Filled with the first index of the chunk
+ * @param chunkEnd      Filled with one past the last index of the chunk
+ * @return              False if the range is empty
+ */
+inline bool ClaimChunk(ParallelRange *range, size_t *chunkBegin, size_t *chunkEnd) {
+	size_t begin = range->Next.load(std::memory_order_relaxed);
+	while (begin < range->End) {
+		size_t const remaining = range->End - begin;
+		size_t const chunkSize = std::min(remaining, std::max(range->GrainSize, remaining / (2 * range->NumWorkers)));
+
+		if (range->Next.compare_exchange_weak(begin, begin + chunkSize, std::memory_order_relaxed)) {
+			*chunkBegin = begin;
+			*chunkEnd = begin + chunkSize;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Runs worker on numWorkers tasks, including one on the calling fiber, and waits for them all to finish
+ * The tasks are published with a single AddTasks()
+ */
+template <typename Worker>
+void RunWorkers(TaskScheduler *taskScheduler, size_t const numWorkers, Worker const &worker, TaskPriority const priority) {
+	// Only captures a pointer, so it's stored inline in the task queue
+	Worker const *const workerPtr = &worker;
+	auto const task = [workerPtr](TaskScheduler *) {
+		(*workerPtr)();
+	};
+
+	TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(
+	        static_cast<unsigned>(numWorkers - 1), [&task](unsigned) { return task; }, priority, &counter);
+
+	// Help out, instead of just waiting
+	worker();
+
+	taskScheduler->WaitForCounter(&counter);
+}
+
+/* Picks how many tasks to split a range of count iterations into */
+inline size_t NumParallelWorkers(TaskScheduler *taskScheduler, size_t const count, size_t const grainSize) {
+	size_t const maxChunks = (count + grainSize - 1) / grainSize;
+	return std::min<size_t>(taskScheduler->GetThreadCount(), maxChunks);
+}
+
+} // End of namespace detail
+
+/**
+ * Calls body(i) for every i in [begin, end), in parallel, and waits for them all to finish
+ *
+ * The range is shared by one task per thread, which claim chunks of it as they go. See detail::ParallelRange
+ * All the tasks are submitted at once, and store their arguments inline, so this doesn't allocate
+ *
+ * This can be called from any thread. Threads the scheduler doesn't own submit through the shared list, which heap
+ * allocates a batch, and block until the tasks finish. See TaskScheduler::AddTask() and WaitForCounter()
+ *
+ * @param taskScheduler    The scheduler to run on
+ * @param begin            The first index
+ * @param end              One past the last index
+ * @param body             A callable with the signature void(size_t index)
+ * @param grainSize        The smallest number of iterations worth running as one chunk. Increase this if body is very cheap
+ * @param priority         The priority of the tasks
+ */
+template <typename Body>
+void ParallelFor(TaskScheduler *taskScheduler, size_t const begin, size_t const end, Body const &body, size_t grainSize = 1,
+                 TaskPriority const priority = TaskPriority::High) {
+	if (begin >= end) {
+		return;
+	}
+	grainSize = std::max<size_t>(grainSize, 1);
+
+	size_t const numWorkers = detail::NumParallelWorkers(taskScheduler, end - begin, grainSize);
+	if (numWorkers <= 1) {
+		// Not worth a task
+		for (size_t i = begin; i < end; ++i) {
+			body(i);
+		}
+		return;
+	}
+
+	detail::ParallelRange range;
+	range.Next.store(begin, std::memory_order_relaxed);
+	range.End = end;
+	range.GrainSize = grainSize;
+	range.NumWorkers = numWorkers;
+
+	auto const worker = [&range, &body]() {
+		size_t chunkBegin;
+		size_t chunkEnd;
+		while (detail::ClaimChunk(&range, &chunkBegin, &chunkEnd)) {
+			for (size_t i = chunkBegin; i < chunkEnd; ++i) {
+				body(i);
+			}
+		}
+	};
+	detail::RunWorkers(taskScheduler, numWorkers, worker, priority);
+}
+
+/**
+ * Reduces [begin, end) in parallel. Each task folds the iterations it claims into a partial result with
+ * body(partial, i), starting from identity. The partial results are then combined with combine(a, b)
+ *
+ * The order iterations are grouped and combined in isn't deterministic, so combine must be associative and commutative
+ *
+ * This can be called from any thread. Threads the scheduler doesn't own submit through the shared list, which heap
+ * allocates a batch, and block until the tasks finish. See TaskScheduler::AddTask() and WaitForCounter()
+ *
+ * @param taskScheduler    The scheduler to run on
+ * @param begin            The first index
+ * @param end              One past the last index
+ * @param identity         The identity of combine. For example, 0 for a sum
+ * @param body             A callable with the signature T(T partial, size_t index)
+ * @param combine          A callable with the signature T(T a, T b)
+ * @param grainSize        The smallest number of iterations worth running as one chunk. Increase this if body is very cheap
+ * @param priority         The priority of the tasks
+ * @return                 The combined result
+ */
+template <typename T, typename Body, typename Combine>
+T ParallelReduce(TaskScheduler *taskScheduler, size_t const begin, size_t const end, T const &identity, Body const &body, Combine const &combine,
+                 size_t grainSize = 1, TaskPriority const priority = TaskPriority::High) {
+	if (begin >= end) {
+		return identity;
+	}
+	grainSize = std::max<size_t>(grainSize, 1);
+
+	size_t const numWorkers = detail::NumParallelWorkers(taskScheduler, end - begin, grainSize);
+	if (numWorkers <= 1) {
+		T result = identity;
+		for (size_t i = begin; i < end; ++i) {
+			result = body(result, i);
+		}
+		return result;
+	}
+
+	detail::ParallelRange range;
+	range.Next.store(begin, std::memory_order_relaxed);
+	range.End = end;
+	range.GrainSize = grainSize;
+	range.NumWorkers = numWorkers;
+
+	// Each worker only takes the lock once, to fold in its partial result. So a simple spin lock is plenty
+	T result = identity;
+	std::atomic<bool> resultLock(false);
+
+	auto const worker = [&range, &identity, &body, &combine, &result, &resultLock]() {
+		T partial = identity;
+		size_t chunkBegin;
+		size_t chunkEnd;
+		while (detail::ClaimChunk(&range, &chunkBegin, &chunkEnd)) {
+			for (size_t i = chunkBegin; i < chunkEnd; ++i) {
+				partial = body(partial, i);
+			}
+		}
+
+		while (resultLock.exchange(true, std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+		result = combine(result, partial);
+		resultLock.store(false, std::memory_order_release);
+	};
+	detail::RunWorkers(taskScheduler, numWorkers, worker, priority);
+
+	return result;
+}
+
+} // End of namespace ftl
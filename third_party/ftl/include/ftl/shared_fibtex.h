@@ -0,0 +1,111 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/sync_wait_queue.h"
+
+namespace ftl {
+
+class TaskScheduler;
+
+/**
+ * A fiber aware reader-writer lock. Waiting fibers are parked, rather than blocking their thread
+ *
+ * Waiters are served in FIFO order, so a stream of readers can't starve a writer. When the lock is released, it's
+ * handed directly to the next writer, or to the next run of readers. They resume already holding it
+ *
+ * Methods follow the C++ named requirements Lockable and SharedLockable, so std::lock_guard, std::unique_lock and
+ * std::shared_lock work, like they do with Fibtex
+ */
+class SharedFibtex {
+public:
+	/**
+	 * @param taskScheduler    ftl::TaskScheduler that will be using this lock
+	 */
+	explicit SharedFibtex(TaskScheduler *taskScheduler);
+
+	SharedFibtex(SharedFibtex const &) = delete;
+	SharedFibtex(SharedFibtex &&) noexcept = delete;
+	SharedFibtex &operator=(SharedFibtex const &) = delete;
+	SharedFibtex &operator=(SharedFibtex &&) noexcept = delete;
+	~SharedFibtex() = default;
+
+private:
+	constexpr static unsigned kExclusiveRequest = 1;
+	constexpr static unsigned kSharedRequest = 0;
+
+	TaskScheduler *m_taskScheduler;
+	AdaptiveSpinner m_spinner;
+
+	/* Protects everything below */
+	SyncSpinLock m_stateLock;
+	/* The number of fibers holding the lock in shared mode */
+	unsigned m_readers{0};
+	bool m_writer{false};
+	SyncWaitQueue m_waiters;
+
+public:
+	/**
+	 * Locks for exclusive access. Spins for a while, then parks the fiber until the lock is handed to it
+	 *
+	 * @param pinToThread          If the fiber should resume on the same thread as it started on
+	 * @param maxSpinIterations    The most times to retry before parking. 0 parks right away
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	void lock(bool pinToThread = false, unsigned maxSpinIterations = kDefaultSyncSpinIterations);
+	/**
+	 * @return    True if the lock was free, and nobody was waiting for it
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	bool try_lock();
+	// ReSharper disable once CppInconsistentNaming
+	void unlock();
+
+	/**
+	 * Locks for shared access. Spins for a while, then parks the fiber until the lock is handed to it
+	 *
+	 * @param pinToThread          If the fiber should resume on the same thread as it started on
+	 * @param maxSpinIterations    The most times to retry before parking. 0 parks right away
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	void lock_shared(bool pinToThread = false, unsigned maxSpinIterations = kDefaultSyncSpinIterations);
+	/**
+	 * @return    True if no writer held the lock, and nobody was waiting for it
+	 */
+	// ReSharper disable once CppInconsistentNaming
+	bool try_lock_shared();
+	// ReSharper disable once CppInconsistentNaming
+	void unlock_shared();
+
+private:
+	/**
+	 * Hands the lock to as many waiters at the front of the queue as possible. m_stateLock must be held
+	 *
+	 * @return    The waiters to wake, once m_stateLock is released. See WakeAll()
+	 */
+	SyncWaiter *HandOff();
+};
+
+} // End of namespace ftl
@@ -0,0 +1,67 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <atomic>
+
+namespace ftl {
+
+/**
+ * A tiny spinlock for the internal state of the counters and the fiber synchronization primitives. It's only ever held
+ * for a few instructions, and never while a fiber is suspended. Methods follow the BasicLockable naming, like Fibtex
+ */
+class SyncSpinLock {
+public:
+	SyncSpinLock() = default;
+
+	SyncSpinLock(SyncSpinLock const &) = delete;
+	SyncSpinLock(SyncSpinLock &&) noexcept = delete;
+	SyncSpinLock &operator=(SyncSpinLock const &) = delete;
+	SyncSpinLock &operator=(SyncSpinLock &&) noexcept = delete;
+	~SyncSpinLock() = default;
+
+private:
+	std::atomic<bool> m_locked{false};
+
+public:
+	// ReSharper disable once CppInconsistentNaming
+	void lock() {
+		if (!m_locked.exchange(true, std::memory_order_acquire)) {
+			return;
+		}
+		LockSlow();
+	}
+
+	// ReSharper disable once CppInconsistentNaming
+	void unlock() {
+		m_locked.store(false, std::memory_order_release);
+	}
+
+private:
+	void LockSlow();
+};
+
+} // End of namespace ftl
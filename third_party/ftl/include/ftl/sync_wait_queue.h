@@ -0,0 +1,229 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/atomic_counter.h"
+#include "ftl/config.h"
+#include "ftl/sync_spin_lock.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace ftl {
+
+class TaskScheduler;
+
+/**
+ * A fiber parked on a synchronization primitive. Lives on the waiting fiber's stack
+ *
+ * Waking is a direct handoff: the waker updates the primitive's state on the waiter's behalf (e.g. gives it the lock,
+ * or moves a value into Data) before it calls Wake(). So only that one fiber is resumed, and it never has to retry
+ */
+struct SyncWaiter {
+	/**
+	 * @param taskScheduler    The scheduler the waiting fiber runs on
+	 * @param request          See Request
+	 * @param data             See Data
+	 */
+	explicit SyncWaiter(TaskScheduler *taskScheduler, unsigned request = 0, void *data = nullptr)
+	        : Scheduler(taskScheduler), Flag(taskScheduler, 1), Request(request), Data(data) {
+	}
+
+	SyncWaiter(SyncWaiter const &) = delete;
+	SyncWaiter(SyncWaiter &&) noexcept = delete;
+	SyncWaiter &operator=(SyncWaiter const &) = delete;
+	SyncWaiter &operator=(SyncWaiter &&) noexcept = delete;
+	~SyncWaiter() = default;
+
+	TaskScheduler *Scheduler;
+	/* Set while the fiber is parked. Cleared by Wake(). Waiting on it goes through the scheduler's waiting list */
+	AtomicFlag Flag;
+	/* The next waiter in the SyncWaitQueue */
+	SyncWaiter *Next{nullptr};
+	/* Primitive specific. e.g. the number of semaphore units, or if a SharedFibtex waiter wants exclusive access */
+	unsigned Request;
+	/* Primitive specific. e.g. where a Channel moves a value to or from */
+	void *Data;
+	/* Set by the waker. False if the wait failed, e.g. because the Channel was closed */
+	bool Succeeded{true};
+
+	/**
+	 * Suspends the calling fiber until Wake() is called. Returns immediately if it already was
+	 *
+	 * @param pinToThread    If the fiber should resume on the same thread as it started on
+	 */
+	void Wait(bool pinToThread);
+	/**
+	 * Resumes the waiting fiber. The waiter must already have been popped from its queue
+	 * Everything the waker wrote to the waiter, or to the primitive, is visible to the waiter when it resumes
+	 *
+	 * NOTE: The waiter may be destroyed as soon as this is called, so call it without holding the primitive's lock,
+	 * and don't touch the waiter afterwards
+	 */
+	void Wake();
+};
+
+/**
+ * An intrusive FIFO of SyncWaiters. It doesn't lock itself. The owning primitive protects it with its SyncSpinLock
+ */
+class SyncWaitQueue {
+public:
+	SyncWaitQueue() = default;
+
+	SyncWaitQueue(SyncWaitQueue const &) = delete;
+	SyncWaitQueue(SyncWaitQueue &&) noexcept = delete;
+	SyncWaitQueue &operator=(SyncWaitQueue const &) = delete;
+	SyncWaitQueue &operator=(SyncWaitQueue &&) noexcept = delete;
+	~SyncWaitQueue() = default;
+
+private:
+	SyncWaiter *m_head{nullptr};
+	SyncWaiter *m_tail{nullptr};
+
+public:
+	bool IsEmpty() const {
+		return m_head == nullptr;
+	}
+
+	SyncWaiter *Front() const {
+		return m_head;
+	}
+
+	void Push(SyncWaiter *waiter) {
+		waiter->Next = nullptr;
+		if (m_tail == nullptr) {
+			m_head = waiter;
+		} else {
+			m_tail->Next = waiter;
+		}
+		m_tail = waiter;
+	}
+
+	/**
+	 * @return    The oldest waiter, or nullptr if the queue is empty
+	 */
+	SyncWaiter *Pop() {
+		SyncWaiter *const waiter = m_head;
+		if (waiter != nullptr) {
+			m_head = waiter->Next;
+			if (m_head == nullptr) {
+				m_tail = nullptr;
+			}
+			waiter->Next = nullptr;
+		}
+		return waiter;
+	}
+
+	/**
+	 * Moves every waiter in this queue onto a list of waiters to wake. See WakeAll()
+	 *
+	 * @param list    The head of the list. The waiters are added to the front, so their order is reversed
+	 */
+	void PopAll(SyncWaiter **list) {
+		while (SyncWaiter *const waiter = Pop()) {
+			waiter->Next = *list;
+			*list = waiter;
+		}
+	}
+};
+
+/**
+ * Wakes every waiter in a list built with SyncWaiter::Next. Call it after releasing the primitive's lock
+ *
+ * @param list    The head of the list. May be nullptr
+ */
+inline void WakeAll(SyncWaiter *list) {
+	while (list != nullptr) {
+		// Read Next first. The waiter can be destroyed as soon as it's woken
+		SyncWaiter *const next = list->Next;
+		list->Wake();
+		list = next;
+	}
+}
+
+/**
+ * Decides how long to spin before parking, based on how long it took to acquire the primitive recently
+ *
+ * When spinning keeps succeeding, the limit grows to about twice the usual wait. When it keeps failing, the limit
+ * shrinks, so contended primitives park quickly instead of burning the CPU. Similar to glibc's adaptive mutex
+ */
+class AdaptiveSpinner {
+public:
+	/* The spin limit never drops below this, so the spinner can notice when waits get short again */
+	constexpr static unsigned kMinSpinIterations = 16;
+
+	/**
+	 * @param enabled    If false, Spin() never spins. Spinning is pointless with a single thread
+	 */
+	explicit AdaptiveSpinner(bool enabled)
+	        : m_enabled(enabled) {
+	}
+
+	AdaptiveSpinner(AdaptiveSpinner const &) = delete;
+	AdaptiveSpinner(AdaptiveSpinner &&) noexcept = delete;
+	AdaptiveSpinner &operator=(AdaptiveSpinner const &) = delete;
+	AdaptiveSpinner &operator=(AdaptiveSpinner &&) noexcept = delete;
+	~AdaptiveSpinner() = default;
+
+private:
+	bool m_enabled;
+	/* A running average of the spins it took to succeed. Racy updates are fine, it's only a heuristic */
+	std::atomic<unsigned> m_averageSpins{kMinSpinIterations};
+
+public:
+	/**
+	 * Calls tryAcquire until it succeeds, or the spin limit is reached
+	 *
+	 * @param maxIterations    The most iterations to spin, regardless of the history
+	 * @param tryAcquire       A callable with the signature bool(). Returns true if it acquired the primitive
+	 * @return                 True if tryAcquire succeeded
+	 */
+	template <typename TryFunction>
+	bool Spin(unsigned maxIterations, TryFunction tryAcquire) {
+		if (!m_enabled || maxIterations == 0) {
+			return false;
+		}
+
+		unsigned const average = m_averageSpins.load(std::memory_order_relaxed);
+		unsigned const limit = std::min(maxIterations, average * 2 + kMinSpinIterations);
+		for (unsigned i = 0; i < limit; ++i) {
+			if (tryAcquire()) {
+				// Move an eighth of the way towards this sample
+				m_averageSpins.store(average - average / 8 + i / 8, std::memory_order_relaxed);
+				return true;
+			}
+			FTL_PAUSE();
+		}
+
+		// Spinning didn't help. Back off, so the next waiter parks sooner
+		m_averageSpins.store(average / 2, std::memory_order_relaxed);
+		return false;
+	}
+};
+
+/* The default for the maxSpinIterations argument of the fiber synchronization primitives. The same as Fibtex::lock_spin() */
+constexpr static unsigned kDefaultSyncSpinIterations = 1000;
+
+} // End of namespace ftl
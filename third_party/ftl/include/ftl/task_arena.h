@@ -0,0 +1,137 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/assert.h"
+
+#include <atomic>
+#include <cstddef>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ftl {
+
+/**
+ * A per-thread bump allocator for task arguments that are too big to store inline in the task queues
+ *
+ * Only the owning thread allocates, but any thread can free. Memory comes from large blocks. A block is reused as soon
+ * as every allocation in it has been freed, so once the arena has grown to fit the working set, it stops allocating
+ * from the heap entirely
+ */
+class TaskArena {
+public:
+	/* The payload size of each block. Allocations bigger than half of this get a dedicated heap allocation */
+	constexpr static size_t kBlockSize = 64 * 1024;
+
+	TaskArena() = default;
+
+	TaskArena(TaskArena const &) = delete;
+	TaskArena(TaskArena &&) noexcept = delete;
+	TaskArena &operator=(TaskArena const &) = delete;
+	TaskArena &operator=(TaskArena &&) noexcept = delete;
+	/* Frees all the blocks */
+	~TaskArena();
+
+private:
+	struct Block {
+		TaskArena *Owner;
+		/* The next block in m_allBlocks */
+		Block *NextAllocated;
+		/* The next block in m_freeBlocks or m_spareBlocks */
+		Block *NextFree;
+		/* The payload capacity */
+		size_t Size;
+		/* The number of payload bytes handed out. Only touched by the owner */
+		size_t Used;
+		/* The number of live allocations, plus kRetiredBit once the owner has moved on to another block */
+		std::atomic<uint64_t> State;
+		/* True if this block holds a single oversized allocation. It's freed instead of reused */
+		bool Dedicated;
+
+		unsigned char *Payload() {
+			return reinterpret_cast<unsigned char *>(this + 1);
+		}
+	};
+
+	constexpr static uint64_t kRetiredBit = uint64_t(1) << 63;
+
+	/* The block we're currently bumping through */
+	Block *m_current{nullptr};
+	/* Every (non-dedicated) block we own. Used to free them in the destructor */
+	Block *m_allBlocks{nullptr};
+	/* Free blocks that only the owner can see. Refilled from m_freeBlocks */
+	Block *m_spareBlocks{nullptr};
+	/* Blocks that other threads finished with. A lock-free stack that only the owner pops from, all at once, so there's no ABA */
+	std::atomic<Block *> m_freeBlocks{nullptr};
+
+	/* The number of allocations. Only written by the owner */
+	std::atomic<uint64_t> m_allocations{0};
+	/* The number of times a block or a dedicated allocation came from the heap. Only written by the owner */
+	std::atomic<uint64_t> m_heapAllocations{0};
+
+public:
+	/**
+	 * Allocates memory for a task's arguments. Can only be called from the owning thread
+	 *
+	 * @param size         The number of bytes
+	 * @param alignment    The alignment. Must be a power of 2, and <= alignof(std::max_align_t)
+	 * @return             The memory
+	 */
+	void *Allocate(size_t size, size_t alignment);
+
+	/**
+	 * Frees memory from Allocate(). This can be called from any thread, including threads that don't own the arena
+	 *
+	 * @param allocation    The memory to free
+	 */
+	static void Free(void *allocation);
+
+	/**
+	 * Gets the number of calls to Allocate(). This can be called from any thread
+	 *
+	 * @return    The number of allocations
+	 */
+	uint64_t GetAllocationCount() const {
+		return m_allocations.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Gets the number of times the arena had to go to the heap. This stops growing once the arena has enough blocks
+	 * This can be called from any thread
+	 *
+	 * @return    The number of heap allocations
+	 */
+	uint64_t GetHeapAllocationCount() const {
+		return m_heapAllocations.load(std::memory_order_relaxed);
+	}
+
+private:
+	Block *NewBlock(size_t size, bool dedicated);
+	Block *AcquireBlock();
+	void RetireCurrentBlock();
+	void PushFreeBlock(Block *block);
+};
+
+} // End of namespace ftl
@@ -0,0 +1,121 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "ftl/task.h"
+#include "ftl/task_counter.h"
+
+#include <deque>
+#include <vector>
+
+namespace ftl {
+
+class TaskScheduler;
+
+/**
+ * A DAG of tasks, built once and submitted as a whole
+ *
+ * Each node with predecessors is queued as a continuation on a counter of its unfinished predecessors. So a node
+ * is only queued when it can run, and nothing ever waits on a fiber. Fiber pool demand doesn't grow with the depth of
+ * the graph
+ *
+ * The graph can be submitted again once the previous submission has finished, e.g. once per frame. Submitting
+ * doesn't allocate, other than the continuations, which come from the per-thread TaskArenas
+ */
+class TaskGraph {
+public:
+	explicit TaskGraph(TaskScheduler *taskScheduler);
+
+	TaskGraph(TaskGraph const &) = delete;
+	TaskGraph(TaskGraph &&) noexcept = delete;
+	TaskGraph &operator=(TaskGraph const &) = delete;
+	TaskGraph &operator=(TaskGraph &&) noexcept = delete;
+	~TaskGraph() = default;
+
+private:
+	struct Node {
+		Node(TaskScheduler *taskScheduler, Task task, TaskPriority priority)
+		        : TaskToExecute(task), Priority(priority), UnfinishedPredecessors(taskScheduler) {
+		}
+
+		Task TaskToExecute;
+		TaskPriority Priority;
+		/* Counts down to 0 as the predecessors finish. The node is a continuation on this */
+		TaskCounter UnfinishedPredecessors;
+		unsigned PredecessorCount{0};
+		std::vector<Node *> Successors;
+	};
+
+	TaskScheduler *m_taskScheduler;
+	/* A deque, so adding nodes never moves the existing ones */
+	std::deque<Node> m_nodes;
+	/* The nodes without predecessors, split by priority, so Submit() can queue them in one batch each */
+	std::vector<Task> m_hiPriRoots;
+	std::vector<Task> m_loPriRoots;
+	bool m_rootsDirty{true};
+
+public:
+	/**
+	 * Adds a node to the graph
+	 *
+	 * @param task        The task to run. The arg must stay valid for as long as the graph is submitted
+	 * @param priority    Which priority queue to put the task in, once it's ready
+	 * @return            The index of the node, for AddDependency()
+	 */
+	unsigned AddNode(Task task, TaskPriority priority = TaskPriority::High);
+	/**
+	 * Makes after wait for before to finish. The graph must not have cycles. Nodes in a cycle would never run
+	 *
+	 * @param before    The index of the node that has to finish first
+	 * @param after     The index of the node that waits for it
+	 */
+	void AddDependency(unsigned before, unsigned after);
+
+	/**
+	 * Queues the whole graph. Nodes become ready as their predecessors finish
+	 *
+	 * This can be called from any thread. See TaskScheduler::AddTask() and AddContinuation()
+	 *
+	 * @param counter    An atomic counter for the graph as a whole. It's incremented by the number of nodes, and reaches
+	 *                   0 again once they've all finished. The graph must not be modified, submitted again, or destroyed
+	 *                   until then
+	 */
+	void Submit(TaskCounter *counter);
+	/**
+	 * Submits the graph, and waits for it to finish
+	 *
+	 * @param pinToCurrentThread  If true, the task invoking this call will not resume on a different thread
+	 */
+	void Run(bool pinToCurrentThread = false);
+
+	unsigned GetNodeCount() const {
+		return static_cast<unsigned>(m_nodes.size());
+	}
+
+private:
+	static void NodeEntry(TaskScheduler *taskScheduler, void *arg);
+};
+
+} // End of namespace ftl
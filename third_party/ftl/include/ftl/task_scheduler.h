@@ -24,20 +24,28 @@
 
 #pragma once
 
+#include "ftl/base_counter.h"
 #include "ftl/callbacks.h"
+#include "ftl/cpu_topology.h"
 #include "ftl/fiber.h"
 #include "ftl/task.h"
+#include "ftl/task_arena.h"
 #include "ftl/thread_abstraction.h"
 #include "ftl/wait_free_queue.h"
 
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
 #include <mutex>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace ftl {
 
-class BaseCounter;
 class TaskCounter;
 class AtomicFlag;
 class FullAtomicCounter;
@@ -52,17 +60,154 @@ enum class EmptyQueueBehavior {
 	// ReSharper restore CppInconsistentNaming
 };
 
+enum class ThreadPinning {
+	// Don't pin the worker threads. The main thread is pinned to CPU 0
+	None,
+	// Spread the threads across physical cores. SMT siblings are only used once every core has a thread
+	PhysicalCores,
+	// Fill all the SMT siblings of a core before moving to the next core
+	SmtSiblings
+};
+
 struct TaskSchedulerInitOptions {
 	/* The size of the fiber pool.The fiber pool is used to run new tasks when the current task is waiting on a counter */
 	unsigned FiberPoolSize = 400;
+	/**
+	 * The maximum size the fiber pool can grow to. If the pool runs out of free fibers, new fibers will be created on
+	 * demand, up to this limit. A value <= FiberPoolSize disables growth
+	 */
+	unsigned FiberPoolMaxSize = 0;
+	/* The stack size of each fiber in the pool. Rounded up to the page size if guard pages or DemandPaged stacks are used */
+	size_t FiberStackSize = 524288;
+	/**
+	 * Where to allocate the fiber stacks from. DemandPaged reserves each stack from the OS, but only commits the pages the
+	 * fiber actually touches. This allows large stacks and fiber pools without paying for the memory up front
+	 * On Windows, DemandPaged stacks are committed in full when they are created. Only the physical pages are lazy, so
+	 * the stacks still count against the commit limit
+	 */
+	FiberStackAllocation StackAllocation = FiberStackAllocation::Heap;
+	/**
+	 * If true, the fibers track their stack high-water mark. See GetFiberStackUsage()
+	 * This is cheap for DemandPaged stacks on POSIX. Otherwise, each stack is filled with a pattern when it is created,
+	 * which commits the whole stack
+	 */
+	bool TrackFiberStackUsage = false;
 	/* The size of the thread pool to run. 0 corresponds to NumHardwareThreads() */
 	unsigned ThreadPoolSize = 0;
 	/* The behavior of the threads after they have no work to do */
 	EmptyQueueBehavior Behavior = EmptyQueueBehavior::Spin;
+	/**
+	 * How to pin the threads to CPUs. If the CPU topology can be read (Linux only), pinned threads also steal from
+	 * the closest threads first. See StealLevel
+	 */
+	ThreadPinning Pinning = ThreadPinning::None;
 	/* Callbacks to run at various points to allow for e.g. hooking a profiler to fiber states */
 	EventCallbacks Callbacks;
 };
 
+/**
+ * A snapshot of the fiber pool usage. See TaskScheduler::GetFiberPoolStats()
+ *
+ * The counters are summed from all the threads without any synchronization, so they are only approximate while tasks are running
+ */
+struct FiberPoolStats {
+	/* The maximum number of fibers the pool can hold */
+	unsigned Capacity;
+	/* The number of fibers that have been created. If this reaches Capacity, consider increasing FiberPoolSize */
+	unsigned Allocated;
+	/* The number of fibers currently running or waiting */
+	unsigned InUse;
+
+	/* The total number of times a fiber was taken from the pool */
+	uint64_t Acquires;
+	/* The number of acquires that were served by the acquiring thread's local cache */
+	uint64_t CacheHits;
+	/* The number of fibers created after Init() because the pool was empty */
+	uint64_t Grows;
+	/* The number of acquires that found the pool empty and had to wait for a fiber to be released */
+	uint64_t Stalls;
+	/* The total time spent in acquires that missed the local cache, in nanoseconds */
+	uint64_t SlowAcquireTotalNs;
+	/* The longest single acquire, in nanoseconds */
+	uint64_t SlowAcquireMaxNs;
+};
+
+/**
+ * A snapshot of how the worker threads sleep and wake with EmptyQueueBehavior::Sleep. See TaskScheduler::GetParkingStats()
+ *
+ * Like FiberPoolStats, these are summed from all the threads without synchronization
+ */
+struct ParkingStats {
+	/* The number of times a thread went to sleep */
+	uint64_t Parks;
+	/* The number of times a thread was about to sleep, but found work while registering as idle */
+	uint64_t AbortedParks;
+	/* The number of times a sleeping thread was woken */
+	uint64_t Wakes;
+	/* The number of wakes after which the thread found nothing to do before going back to sleep */
+	uint64_t SpuriousWakes;
+	/* The total time from a thread being signalled to it running again, in nanoseconds */
+	uint64_t WakeLatencyTotalNs;
+	/* The longest single wake latency, in nanoseconds */
+	uint64_t WakeLatencyMaxNs;
+	/* The total time threads spent asleep, in nanoseconds */
+	uint64_t SleepTotalNs;
+};
+
+/**
+ * A snapshot of where the worker threads stole work from. See TaskScheduler::GetStealStats()
+ *
+ * Like FiberPoolStats, these are summed from all the threads without synchronization
+ */
+struct StealStats {
+	/* The number of successful steals, indexed by StealLevel */
+	uint64_t Steals[kNumStealLevels];
+	/* The number of times a thread searched all the other threads and found nothing to steal */
+	uint64_t FailedRounds;
+};
+
+/**
+ * A snapshot of the memory used by typed tasks. See TaskScheduler::GetTaskArenaStats()
+ *
+ * Like FiberPoolStats, these are summed from all the threads without synchronization
+ */
+struct TaskArenaStats {
+	/* The number of typed tasks whose callable didn't fit inline in the task queue, and was stored in a TaskArena */
+	uint64_t Allocations;
+	/* The number of times a TaskArena had to allocate from the heap. This stops growing in steady state */
+	uint64_t HeapAllocations;
+};
+
+/**
+ * A snapshot of a single worker thread's counters. See TaskScheduler::GetWorkerTelemetry()
+ *
+ * Steals and SleepNs come from the always-on steal / parking stats. Everything else is only counted if FTL_TELEMETRY
+ * is enabled, and is 0 otherwise
+ */
+struct WorkerTelemetry {
+	/* The number of tasks this thread ran, by priority */
+	uint64_t HiPriTasksRun;
+	uint64_t LoPriTasksRun;
+	/* The number of other threads' queues this thread tried to steal from */
+	uint64_t StealAttempts;
+	/* The number of those attempts that got something */
+	uint64_t Steals;
+	/* The number of times this thread looked for a task or ready fiber, and found nothing. With EmptyQueueBehavior::Sleep, enough of these in a row put the thread to sleep */
+	uint64_t FailedPops;
+	/* The number of fiber switches on this thread */
+	uint64_t FiberSwitches;
+	/* The total time this thread spent asleep, in nanoseconds */
+	uint64_t SleepNs;
+	/* The deepest this thread's task queues have been, as seen when pushing */
+	uint64_t HiPriQueueHighWater;
+	uint64_t LoPriQueueHighWater;
+	/* The number of waiting fibers this thread resumed */
+	uint64_t ReadyFibersResumed;
+	/* The total and longest time those fibers spent ready, but not yet resumed, in nanoseconds */
+	uint64_t ReadyFiberWaitTotalNs;
+	uint64_t ReadyFiberWaitMaxNs;
+};
+
 /**
  * A class that enables task-based multithreading.
  *
@@ -88,6 +233,9 @@ private:
 		ToWaiting = 2,
 	};
 
+	/* The size of TaskBundle::InlineArgs. Chosen so a bundle fills one cache line */
+	constexpr static size_t kInlineTaskArgsSize = 32;
+
 	/**
 	 * Holds a task that is ready to to be executed by the worker threads
 	 * Counter is the counter for the task(group). It will be decremented when the task completes
@@ -95,16 +243,166 @@ private:
 	struct TaskBundle {
 		Task TaskToExecute;
 		TaskCounter *Counter;
+		/* If true, the task is called with a pointer to InlineArgs instead of TaskToExecute.ArgData. See AddTask(Function &&) */
+		bool HasInlineArgs;
+		/* Storage for small typed tasks. The bundle is copied around by the queues, so only trivially copyable types can live here */
+		alignas(std::max_align_t) unsigned char InlineArgs[kInlineTaskArgsSize];
 	};
 
+	/* True if a typed task's callable can be stored in TaskBundle::InlineArgs */
+	template <typename FunctionType>
+	struct FitsInline : std::integral_constant<bool, sizeof(FunctionType) <= kInlineTaskArgsSize && alignof(FunctionType) <= alignof(std::max_align_t) &&
+	                                                     std::is_trivially_copyable<FunctionType>::value> {};
+
 	struct ReadyFiberBundle {
 		ReadyFiberBundle() = default;
 
 		// The fiber
 		unsigned FiberIndex;
-		// A flag used to signal if the fiber has been successfully switched out of and "cleaned up". See @CleanUpOldFiber()
-		std::atomic<bool> FiberIsSwitched;
+		// The thread the fiber is pinned to, or kNoThreadPinning
+		unsigned PinnedThreadIndex;
+		/**
+		 * A waiting fiber can only be resumed once two things have happened:
+		 * 1. The counter reached the target value. See @AddReadyFiber()
+		 * 2. The fiber has been switched out of and "cleaned up". See @CleanUpOldFiber()
+		 *
+		 * These happen on different threads, in either order. Each one increments this. Whoever brings it to 2 hands
+		 * the fiber to a ready fiber queue. So a fiber is never queued before it can actually be resumed
+		 */
+		std::atomic<unsigned> ResumeConditions;
+		// The node used to add the fiber to a counter's waiting list. See BaseCounter::AddFiberToWaitingList()
+		BaseCounter::WaitingFiberBundle WaitingFiber;
+		// The next fiber in m_injectedReadyFibers, if a thread we don't own readied this one. See SatisfyResumeCondition()
+		ReadyFiberBundle *NextInjected{nullptr};
+#if FTL_TELEMETRY
+		// When the fiber was queued to be resumed, in steady_clock nanoseconds. See WorkerTelemetry::ReadyFiberWaitTotalNs
+		int64_t ReadyTimeNs{0};
+#endif
+	};
+
+	/**
+	 * A task waiting in a counter's waiting list. See AddContinuation()
+	 *
+	 * Allocated from the TaskArena of the thread that added it, or the heap if the scheduler doesn't own that thread.
+	 * It's freed by whichever thread brings the counter to the target value, as soon as the task has been queued
+	 */
+	struct ContinuationBundle : BaseCounter::WaitingFiberBundle {
+		TaskBundle Bundle;
+		TaskPriority Priority;
+		/* True if the continuation was allocated with new, instead of from a TaskArena */
+		bool OnHeap{false};
+	};
+
+	/**
+	 * Tasks added by a thread the scheduler doesn't own. See InjectTasks()
+	 *
+	 * Such threads have no task queues of their own, so each call allocates one of these, and pushes it onto
+	 * m_injectedHiPriTasks or m_injectedLoPriTasks. A worker takes the whole list at once, copies the tasks into its own
+	 * queue, and frees the batches
+	 *
+	 * The tasks follow the header in the same allocation, so each call makes a single heap allocation. See Create()
+	 */
+	struct alignas(alignof(TaskBundle)) InjectedTaskBatch {
+		/* The next batch in the list. Set by InjectTasks() */
+		InjectedTaskBatch *Next;
+		unsigned NumTasks;
+
+		TaskBundle *Tasks() {
+			return reinterpret_cast<TaskBundle *>(this + 1);
+		}
+
+		/**
+		 * Allocates a batch with room for numTasks tasks
+		 *
+		 * @param numTasks    The number of tasks. Must be > 0
+		 * @return            The batch. Free it with Destroy()
+		 */
+		static InjectedTaskBatch *Create(unsigned numTasks);
+		static void Destroy(InjectedTaskBatch *batch);
+	};
+
+	/**
+	 * A thread the scheduler doesn't own, waiting in WaitForCounter(). It has no fibers to switch to, so it sleeps on
+	 * CV until WakeBlockedThread(). Lives on the waiting thread's stack
+	 */
+	struct BlockedThreadBundle : BaseCounter::WaitingFiberBundle {
+		std::mutex Lock;
+		std::condition_variable CV;
+		bool Signaled{false};
+	};
+
+	/**
+	 * Fiber pool counters for a single thread. Only written by the owning thread. They're atomics so
+	 * GetFiberPoolStats() can read them from any thread
+	 */
+	struct FiberPoolThreadStats {
+		std::atomic<uint64_t> Acquires{0};
+		std::atomic<uint64_t> CacheHits{0};
+		std::atomic<uint64_t> Grows{0};
+		std::atomic<uint64_t> Stalls{0};
+		std::atomic<uint64_t> SlowAcquireTotalNs{0};
+		std::atomic<uint64_t> SlowAcquireMaxNs{0};
+	};
+
+	/* Parking counters for a single thread. Like FiberPoolThreadStats, only written by the owning thread */
+	struct ParkingThreadStats {
+		std::atomic<uint64_t> Parks{0};
+		std::atomic<uint64_t> AbortedParks{0};
+		std::atomic<uint64_t> Wakes{0};
+		std::atomic<uint64_t> SpuriousWakes{0};
+		std::atomic<uint64_t> WakeLatencyTotalNs{0};
+		std::atomic<uint64_t> WakeLatencyMaxNs{0};
+		std::atomic<uint64_t> SleepTotalNs{0};
+	};
+
+	/* Steal counters for a single thread. Like FiberPoolThreadStats, only written by the owning thread */
+	struct StealThreadStats {
+		std::atomic<uint64_t> Steals[kNumStealLevels];
+		std::atomic<uint64_t> FailedRounds{0};
+
+		StealThreadStats() {
+			for (auto &steals : Steals) {
+				steals.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	/**
+	 * The wait slot a thread sleeps on with EmptyQueueBehavior::Sleep. Each thread has its own, so a
+	 * waker can signal exactly the threads it wants, without touching a shared lock
+	 */
+	struct ParkingSlot {
+		std::mutex Lock;
+		std::condition_variable CV;
+		/* Set by the waker. Protected by Lock */
+		bool Signaled{false};
+		/* When the waker signalled this slot, in steady_clock nanoseconds. Used to measure wake latency */
+		std::atomic<int64_t> SignalTimeNs{0};
+	};
+
+#if FTL_TELEMETRY
+	/**
+	 * Telemetry counters for a single thread. Like FiberPoolThreadStats, only written by the owning thread
+	 * On their own cache lines, so GetWorkerTelemetry() doesn't disturb the fields the owner uses to schedule
+	 */
+	struct alignas(kCacheLineSize) TelemetryThreadCounters {
+		std::atomic<uint64_t> HiPriTasksRun{0};
+		std::atomic<uint64_t> LoPriTasksRun{0};
+		std::atomic<uint64_t> StealAttempts{0};
+		std::atomic<uint64_t> FailedPops{0};
+		std::atomic<uint64_t> FiberSwitches{0};
+		std::atomic<uint64_t> HiPriQueueHighWater{0};
+		std::atomic<uint64_t> LoPriQueueHighWater{0};
+		std::atomic<uint64_t> ReadyFibersResumed{0};
+		std::atomic<uint64_t> ReadyFiberWaitTotalNs{0};
+		std::atomic<uint64_t> ReadyFiberWaitMaxNs{0};
 	};
+#endif
+
+	/* The maximum number of free fibers a thread can keep for itself */
+	constexpr static unsigned kMaxFiberCacheSize = 16;
+	/* The maximum number of low priority tasks a thread will steal from another thread at once */
+	constexpr static unsigned kMaxStealBatchSize = 32;
 
 	struct alignas(kCacheLineSize) ThreadLocalStorage {
 		ThreadLocalStorage()
@@ -114,14 +412,20 @@ private:
 	public:
 		// NOTE: The order of these variables may seem odd / jumbled. However, it is to optimize the padding required
 
-		/* The queue of high priority waiting tasks. This also contains the ready waiting fibers, which are differentiated by the Task function == ReadyFiberDummyTask */
-		WaitFreeQueue<TaskBundle> HiPriTaskQueue;
 		/* The queue of high priority waiting tasks */
+		WaitFreeQueue<TaskBundle> HiPriTaskQueue;
+		/* The queue of low priority waiting tasks */
 		WaitFreeQueue<TaskBundle> LoPriTaskQueue;
+		/**
+		 * The queue of waiting fibers that are ready to resume, and aren't pinned. Other threads can steal from it
+		 * Everything in here can be switched to immediately
+		 */
+		WaitFreeQueue<unsigned> ReadyFibers;
 
-		std::atomic<bool> *OldFiberStoredFlag{nullptr};
+		/* The bundle of the fiber we just switched away from to wait. See CleanUpOldFiber() */
+		ReadyFiberBundle *OldFiberBundle{nullptr};
 
-		/* The queue of ready waiting Fibers that were pinned to this thread */
+		/* The queue of ready waiting Fibers that were pinned to this thread. Like ReadyFibers, they can be resumed immediately */
 		std::vector<ReadyFiberBundle *> PinnedReadyFibers;
 
 		/**
@@ -137,6 +441,8 @@ private:
 
 		/* Lock protecting access to PinnedReadyFibers */
 		std::mutex PinnedReadyFibersLock;
+		/* The size of PinnedReadyFibers. Lets the owner skip taking the lock when the list is empty */
+		std::atomic<unsigned> PinnedReadyFiberCount{0};
 
 		/* The index of the current fiber in m_fibers */
 		unsigned CurrentFiberIndex;
@@ -145,12 +451,46 @@ private:
 		/* Where OldFiber should be stored when we call CleanUpPoolAndWaiting() */
 		FiberDestination OldFiberDestination{FiberDestination::None};
 
-		/* The last high priority queue that we successfully stole from. This is an offset index from the current thread index */
-		unsigned HiPriLastSuccessfulSteal{1};
-		/* The last low priority queue that we successfully stole from. This is an offset index from the current thread index */
-		unsigned LoPriLastSuccessfulSteal{1};
+		/* The last high priority queue that we successfully stole from. This is a position in StealOrder */
+		unsigned HiPriLastSuccessfulSteal{0};
+		/* The last low priority queue that we successfully stole from. This is a position in StealOrder */
+		unsigned LoPriLastSuccessfulSteal{0};
+		/* The last ready fiber queue that we successfully stole from. This is a position in StealOrder */
+		unsigned ReadyFiberLastSuccessfulSteal{0};
 
 		unsigned FailedQueuePopAttempts{0};
+		/* True if this thread was woken, and hasn't found any work since. Used to count spurious wakes */
+		bool WokenWithoutWork{false};
+
+		/**
+		 * Free fibers owned by this thread. Acquiring and releasing a fiber only touches the global free list
+		 * when this is empty / full. FiberCacheCount is atomic so GetFiberPoolStats() can read it.
+		 */
+		unsigned FiberCache[kMaxFiberCacheSize];
+		std::atomic<unsigned> FiberCacheCount{0};
+
+		FiberPoolThreadStats FiberPoolStats;
+
+		/* Scratch space for WaitFreeQueue::StealBatch() in GetNextLoPriTask() */
+		TaskBundle StealBuffer[kMaxStealBatchSize - 1];
+
+		ParkingSlot Parking;
+		ParkingThreadStats ParkingStats;
+
+		/* Storage for typed tasks that don't fit inline. See AddTask(Function &&) */
+		TaskArena Arena;
+
+		/**
+		 * The other threads, closest first. StealLevelEnd[level] is the end of each StealLevel's range in StealOrder
+		 * Without topology information, all the threads are in the Remote range
+		 */
+		std::vector<unsigned> StealOrder;
+		unsigned StealLevelEnd[kNumStealLevels];
+		StealThreadStats StealStats;
+
+#if FTL_TELEMETRY
+		TelemetryThreadCounters Telemetry;
+#endif
 	};
 
 private:
@@ -163,16 +503,39 @@ private:
 
 	unsigned m_numThreads{0};
 	ThreadType *m_threads{nullptr};
+	/* The CPU each thread is pinned to, or kInvalidIndex if it isn't pinned */
+	std::vector<unsigned> m_threadCpus;
 
+	/* The maximum number of fibers in the pool. m_fibers, m_freeFiberNext, and m_readyFiberBundles are all this size */
 	unsigned m_fiberPoolSize{0};
+	size_t m_fiberStackSize{0};
+	FiberStackAllocation m_fiberStackAllocation{FiberStackAllocation::Heap};
+	bool m_trackFiberStackUsage{false};
+	/**
+	 * The number of slots in m_fibers that have been claimed. Fibers past this index are default constructed
+	 * GrowFiberPool() claims a slot before it creates the fiber, so this doesn't say the fiber is ready. See m_fiberCreated
+	 */
+	std::atomic<unsigned> m_allocatedFibers{0};
+	/**
+	 * One per slot in m_fibers. Stored with release once the fiber has been created, so other threads can read the
+	 * fiber after an acquire load. See GetFiberStackUsage()
+	 */
+	std::atomic<bool> *m_fiberCreated{nullptr};
 	/* The backing storage for the fiber pool */
 	Fiber *m_fibers{nullptr};
 	/**
-	 * An array of atomics, which signify if a fiber is available to be used. The indices of m_waitingFibers
-	 * correspond 1 to 1 with m_fibers. So, if m_freeFibers[i] == true, then m_fibers[i] can be used.
-	 * Each atomic acts as a lock to ensure that threads do not try to use the same fiber at the same time
+	 * The global free fiber list. This is a lock-free stack of fiber indices, linked through m_freeFiberNext
+	 * The low 32 bits are the index of the top fiber. The high 32 bits are a tag that's incremented on every
+	 * modification to prevent ABA
 	 */
-	std::atomic<bool> *m_freeFibers{nullptr};
+	std::atomic<uint64_t> m_freeFiberHead{0};
+	std::atomic<unsigned> *m_freeFiberNext{nullptr};
+	/* The number of fibers in the global free list */
+	std::atomic<unsigned> m_freeFiberCount{0};
+	/* The number of fibers each thread is allowed to cache. See ThreadLocalStorage::FiberCache */
+	unsigned m_fiberCacheSize{0};
+	/* The number of threads that are waiting for a free fiber. If non-zero, threads return their cached fibers to the global list */
+	std::atomic<unsigned> m_fiberPoolStarvedThreads{0};
 	/**
 	 * An array of ReadyFiberBundle which is used by @WaitForCounter()
 	 *
@@ -195,11 +558,23 @@ private:
 
 	std::atomic<EmptyQueueBehavior> m_emptyQueueBehavior{EmptyQueueBehavior::Spin};
 	/**
-	* This lock is used with the CV below to put threads to sleep when there
-	* is no work to do.
-	*/
-	std::mutex ThreadSleepLock;
-	std::condition_variable ThreadSleepCV;
+	 * The registry of sleeping threads. Bit (i % 64) of word (i / 64) is set while thread i is asleep, or about
+	 * to go to sleep. A waker claims a thread by clearing its bit, and then signals the thread's ParkingSlot
+	 */
+	std::atomic<uint64_t> *m_idleThreadMask{nullptr};
+	unsigned m_idleThreadMaskWords{0};
+	/* The number of bits set in m_idleThreadMask. Lets wakers skip the scan when no one is asleep */
+	std::atomic<unsigned> m_idleThreadCount{0};
+
+	/**
+	 * Work handed to the workers by threads the scheduler doesn't own. See InjectTasks() and SatisfyResumeCondition()
+	 *
+	 * Each is a lock-free stack. Any thread can push with a CAS, but workers only ever take the whole stack with an
+	 * exchange, so there's no ABA. Workers check them after their own queues, and before stealing
+	 */
+	std::atomic<InjectedTaskBatch *> m_injectedHiPriTasks{nullptr};
+	std::atomic<InjectedTaskBatch *> m_injectedLoPriTasks{nullptr};
+	std::atomic<ReadyFiberBundle *> m_injectedReadyFibers{nullptr};
 
 	/**
 	 * c++ Thread Local Storage is, by definition, static/global. This poses some problems, such as multiple
@@ -221,7 +596,8 @@ public:
 	/**
 	 * Initializes the TaskScheduler and binds the current thread as the "main" thread
 	 *
-	 * TaskScheduler functions can *only* be called from this thread or inside tasks on the worker threads
+	 * Tasks can be added, and counters waited on, from any thread. But other threads don't have task queues of their
+	 * own, so they go through a slower, shared path. See AddTask()
 	 *
 	 * @param options    The configuration options for the TaskScheduler. See the struct defintion for more details
 	 * @return           0 on sucess. One of the following error code on failure:
@@ -233,7 +609,9 @@ public:
 	/**
 	 * Adds a task to the internal queue.
 	 *
-	 * NOTE: This can *only* be called from the main thread or inside tasks on the worker threads
+	 * This can be called from any thread. The main thread and the worker threads push to their own queue. Other
+	 * threads, like I/O threads, heap allocate a batch and push it onto a shared lock-free list. Workers take the whole
+	 * list at once when they run out of their own tasks, so batch your submissions with AddTasks() where you can
 	 *
 	 * @param task        The task to queue
 	 * @param priority    Which priority queue to put the task in
@@ -244,7 +622,7 @@ public:
 	/**
 	 * Adds a group of tasks to the internal queue
 	 *
-	 * NOTE: This can *only* be called from the main thread or inside tasks on the worker threads
+	 * This can be called from any thread. See AddTask()
 	 *
 	 * @param numTasks    The number of tasks
 	 * @param tasks       The tasks to queue
@@ -254,16 +632,151 @@ public:
 	 */
 	void AddTasks(unsigned numTasks, Task const *tasks, TaskPriority priority, TaskCounter *counter = nullptr);
 
+	/**
+	 * Adds a task that calls function(taskScheduler)
+	 *
+	 * Small, trivially copyable callables, like lambdas that capture a few pointers or integers, are stored inline in
+	 * the task queue. Anything else is stored in the current thread's TaskArena, and destroyed after it runs. Either
+	 * way, no heap allocations are needed once the arenas have warmed up
+	 *
+	 * This can be called from any thread. Threads the scheduler doesn't own have no TaskArena, so callables that don't
+	 * fit inline are heap allocated instead. See AddTask(Task, ...)
+	 *
+	 * @param function    A callable with the signature void(TaskScheduler *)
+	 * @param priority    Which priority queue to put the task in
+	 * @param counter     An atomic counter corresponding to this task. Initially it will be incremented by 1. When the task
+	 *                    completes, it will be decremented.
+	 */
+	template <typename Function, typename = typename std::enable_if<!std::is_convertible<Function, Task>::value>::type>
+	void AddTask(Function &&function, TaskPriority priority, TaskCounter *counter = nullptr) {
+		ThreadLocalStorage *const tls = BeginAddTasks(1, counter);
+		if (tls == nullptr) {
+			InjectedTaskBatch *const batch = InjectedTaskBatch::Create(1);
+			MakeTaskBundle(std::forward<Function>(function), counter, nullptr, batch->Tasks());
+			InjectTasks(batch, priority);
+			return;
+		}
+
+		TaskBundle bundle;
+		MakeTaskBundle(std::forward<Function>(function), counter, &tls->Arena, &bundle);
+		size_t queueDepth;
+		if (priority == TaskPriority::High) {
+			queueDepth = tls->HiPriTaskQueue.Push(bundle);
+		} else {
+			queueDepth = tls->LoPriTaskQueue.Push(bundle);
+		}
+
+		EndAddTasks(*tls, 1, priority, queueDepth);
+	}
+	/**
+	 * Adds a group of typed tasks. See AddTask(Function &&)
+	 * Like AddTasks(unsigned, Task const *, ...), all the tasks are published to the queue at once
+	 *
+	 * This can be called from any thread. See AddTask(Function &&)
+	 *
+	 * @param numTasks     The number of tasks
+	 * @param generator    A callable with the signature Function(unsigned index). It's called once for each task, in order,
+	 *                     and returns the callable for that task
+	 * @param priority     Which priority queue to put the tasks in
+	 * @param counter      An atomic counter corresponding to the task group as a whole. Initially it will be incremented by
+	 *                     numTasks. When each task completes, it will be decremented.
+	 */
+	template <typename Generator, typename = typename std::enable_if<!std::is_convertible<Generator, Task const *>::value>::type>
+	void AddTasks(unsigned numTasks, Generator &&generator, TaskPriority priority, TaskCounter *counter = nullptr) {
+		ThreadLocalStorage *const tls = BeginAddTasks(numTasks, counter);
+		if (tls == nullptr) {
+			InjectedTaskBatch *const batch = InjectedTaskBatch::Create(numTasks);
+			for (unsigned i = 0; i < numTasks; ++i) {
+				MakeTaskBundle(generator(i), counter, nullptr, &batch->Tasks()[i]);
+			}
+			InjectTasks(batch, priority);
+			return;
+		}
+
+		TaskArena *const arena = &tls->Arena;
+		WaitFreeQueue<TaskBundle> &queue = priority == TaskPriority::High ? tls->HiPriTaskQueue : tls->LoPriTaskQueue;
+		size_t const queueDepth = queue.PushBatch(numTasks, [&generator, counter, arena](size_t const i) {
+			TaskBundle bundle;
+			MakeTaskBundle(generator(static_cast<unsigned>(i)), counter, arena, &bundle);
+			return bundle;
+		});
+
+		EndAddTasks(*tls, numTasks, priority, queueDepth);
+	}
+
+	/**
+	 * Adds a task that is queued once counter == 0. Unlike WaitForCounter(), nothing waits in the meantime, so no
+	 * fiber is used until the task actually runs
+	 *
+	 * If counter is already 0, the task is queued right away. The counter must not be destroyed while the continuation
+	 * is still waiting on it
+	 *
+	 * This can be called from any thread. See AddTask()
+	 *
+	 * @param counter                The counter to wait for
+	 * @param task                   The task to queue
+	 * @param priority               Which priority queue to put the task in
+	 * @param continuationCounter    An atomic counter corresponding to the continuation. It's incremented by 1 right
+	 *                               away, and decremented when the continuation completes
+	 */
+	void AddContinuation(TaskCounter *counter, Task task, TaskPriority priority, TaskCounter *continuationCounter = nullptr);
+	/**
+	 * Adds a task that is queued once counter == value. See AddContinuation(TaskCounter *, ...)
+	 *
+	 * @param counter                The counter to wait for
+	 * @param value                  The value to wait for
+	 * @param task                   The task to queue
+	 * @param priority               Which priority queue to put the task in
+	 * @param continuationCounter    An atomic counter corresponding to the continuation. It's incremented by 1 right
+	 *                               away, and decremented when the continuation completes
+	 */
+	void AddContinuation(FullAtomicCounter *counter, unsigned value, Task task, TaskPriority priority, TaskCounter *continuationCounter = nullptr);
+	/**
+	 * Adds a typed task that is queued once counter == 0. See AddContinuation(TaskCounter *, Task, ...) and
+	 * AddTask(Function &&)
+	 *
+	 * @param counter                The counter to wait for
+	 * @param function               A callable with the signature void(TaskScheduler *)
+	 * @param priority               Which priority queue to put the task in
+	 * @param continuationCounter    An atomic counter corresponding to the continuation. It's incremented by 1 right
+	 *                               away, and decremented when the continuation completes
+	 */
+	template <typename Function, typename = typename std::enable_if<!std::is_convertible<Function, Task>::value>::type>
+	void AddContinuation(TaskCounter *counter, Function &&function, TaskPriority priority, TaskCounter *continuationCounter = nullptr) {
+		ContinuationBundle *const continuation = BeginAddContinuation(priority, continuationCounter);
+		MakeTaskBundle(std::forward<Function>(function), continuationCounter, GetCurrentThreadArena(), &continuation->Bundle);
+		EndAddContinuation(counter, continuation);
+	}
+	/**
+	 * Adds a typed task that is queued once counter == value. See AddContinuation(TaskCounter *, Function &&, ...)
+	 *
+	 * @param counter                The counter to wait for
+	 * @param value                  The value to wait for
+	 * @param function               A callable with the signature void(TaskScheduler *)
+	 * @param priority               Which priority queue to put the task in
+	 * @param continuationCounter    An atomic counter corresponding to the continuation. It's incremented by 1 right
+	 *                               away, and decremented when the continuation completes
+	 */
+	template <typename Function, typename = typename std::enable_if<!std::is_convertible<Function, Task>::value>::type>
+	void AddContinuation(FullAtomicCounter *counter, unsigned value, Function &&function, TaskPriority priority, TaskCounter *continuationCounter = nullptr) {
+		ContinuationBundle *const continuation = BeginAddContinuation(priority, continuationCounter);
+		MakeTaskBundle(std::forward<Function>(function), continuationCounter, GetCurrentThreadArena(), &continuation->Bundle);
+		EndAddContinuation(counter, value, continuation);
+	}
+
 	/**
 	 * Yields execution to another task until counter == 0
 	 *
+	 * Threads the scheduler doesn't own have no fibers to switch to. They block on a condition variable instead, until
+	 * the thread that brings the counter to the target value wakes them. pinToCurrentThread is ignored for them
+	 *
 	 * @param counter             The counter to check
 	 * @param pinToCurrentThread  If true, the task invoking this call will not resume on a different thread
 	 */
 	void WaitForCounter(TaskCounter *counter, bool pinToCurrentThread = false);
 
 	/**
-	 * Yields execution to another task until counter == 0
+	 * Yields execution to another task until counter == 0. See WaitForCounter(TaskCounter *, bool)
 	 *
 	 * @param counter             The counter to check
 	 * @param pinToCurrentThread  If true, the task invoking this call will not resume on a different thread
@@ -271,7 +784,7 @@ public:
 	void WaitForCounter(AtomicFlag *counter, bool pinToCurrentThread = false);
 
 	/**
-	 * Yields execution to another task until counter == value
+	 * Yields execution to another task until counter == value. See WaitForCounter(TaskCounter *, bool)
 	 *
 	 * @param counter             The counter to check
 	 * @param value               The value to wait for
@@ -283,19 +796,20 @@ public:
 	 * Gets the 0-based index of the current thread
 	 * This is useful for m_tls[GetCurrentThreadIndex()]
 	 *
-	 * NOTE: This can *only* be called from the main thread or inside tasks on the worker threads
+	 * Threads owned by the scheduler cache their index in a thread_local, so this is O(1). Other threads fall back to
+	 * a linear search of m_threads, and will get kInvalidIndex
 	 *
 	 * We force no-inline because inlining seems to cause some tls-type caching on max optimization levels
 	 * Discovered by @cwfitzgerald. Documented in issue #57
 	 *
-	 * @return    The index of the current thread
+	 * @return    The index of the current thread, or std::numeric_limits<unsigned>::max() if the scheduler doesn't own it
 	 */
 	FTL_NOINLINE unsigned GetCurrentThreadIndex() const;
 
 	/**
 	* Gets the 0-based index of the current fiber.
 	* 
-	* NOTE: main fiber index is 0
+	* NOTE: main fiber index is 0. Threads the scheduler doesn't own get std::numeric_limits<unsigned>::max()
 	*/
 	unsigned GetCurrentFiberIndex() const;
 
@@ -309,7 +823,8 @@ public:
 	}
 
 	/**
-	 * Gets the amount of fibers in the fiber pool.
+	 * Gets the maximum amount of fibers in the fiber pool.
+	 * If the pool is allowed to grow, fibers with an index >= the initial FiberPoolSize may not have been created yet
 	 *
 	 * @return    Fiber pool size
 	 */
@@ -317,29 +832,258 @@ public:
 		return m_fiberPoolSize;
 	}
 
+	/**
+	 * Gets a snapshot of the fiber pool usage. This can be called from any thread
+	 *
+	 * @return    The fiber pool stats
+	 */
+	FiberPoolStats GetFiberPoolStats() const;
+
+	/**
+	 * Gets the stack high-water mark of a fiber in the pool. Requires TaskSchedulerInitOptions::TrackFiberStackUsage
+	 *
+	 * NOTE: The stack is read without synchronization, so the value is only approximate if the fiber is running
+	 *
+	 * @param fiberIndex    The index of the fiber. Must be < GetFiberCount()
+	 * @return              The number of stack bytes the fiber has used. 0 if the fiber hasn't been created, or tracking is disabled
+	 */
+	size_t GetFiberStackUsage(unsigned fiberIndex) const;
+
+	/**
+	 * Gets the largest stack high-water mark of all the fibers in the pool. Useful for tuning FiberStackSize
+	 *
+	 * @return    The number of stack bytes used by the deepest fiber. 0 if tracking is disabled
+	 */
+	size_t GetMaxFiberStackUsage() const;
+
 	/**
 	 * Set the behavior for how worker threads handle an empty queue
+	 * Switching away from EmptyQueueBehavior::Sleep wakes any sleeping threads
 	 *
 	 * @param behavior
 	 * @return
 	 */
-	void SetEmptyQueueBehavior(EmptyQueueBehavior const behavior) {
-		m_emptyQueueBehavior.store(behavior, std::memory_order_relaxed);
-	}
+	void SetEmptyQueueBehavior(EmptyQueueBehavior behavior);
+
+	/**
+	 * Gets a snapshot of the sleep / wake counters of the worker threads. This can be called from any thread
+	 *
+	 * @return    The parking stats
+	 */
+	ParkingStats GetParkingStats() const;
+
+	/**
+	 * Gets a snapshot of the memory used by typed tasks. This can be called from any thread
+	 *
+	 * @return    The task arena stats
+	 */
+	TaskArenaStats GetTaskArenaStats() const;
+
+	/**
+	 * Gets a snapshot of where the worker threads stole work from. This can be called from any thread
+	 *
+	 * @return    The steal stats
+	 */
+	StealStats GetStealStats() const;
+
+	/**
+	 * Gets a snapshot of one worker thread's counters. This can be called from any thread
+	 *
+	 * The counters are read without synchronization, so they are only approximate while tasks are running
+	 *
+	 * @param threadIndex    The index of the thread. Must be < GetThreadCount()
+	 * @return               The thread's counters. See WorkerTelemetry for which ones need FTL_TELEMETRY
+	 */
+	WorkerTelemetry GetWorkerTelemetry(unsigned threadIndex) const;
+
+	/**
+	 * Gets the CPU a thread was pinned to. See TaskSchedulerInitOptions::Pinning
+	 *
+	 * @param threadIndex    The index of the thread. Must be < GetThreadCount()
+	 * @return               The OS index of the CPU, or std::numeric_limits<unsigned>::max() if the thread isn't pinned
+	 */
+	unsigned GetThreadCpu(unsigned threadIndex) const;
 
 private:
+	/**
+	 * Finds the index of the current thread by searching m_threads
+	 *
+	 * @return    The index of the current thread, or kInvalidIndex if the thread isn't owned by this scheduler
+	 */
+	unsigned FindCurrentThreadIndex() const;
+	/**
+	 * Caches threadIndex as the current thread's index, so GetCurrentThreadIndex() doesn't have to search
+	 *
+	 * @param threadIndex    The index of the current thread in m_threads
+	 */
+	void BindCurrentThread(unsigned threadIndex);
+
+	/**
+	 * Adds numTasks to counter, and gets the current thread's storage. The first half of the typed AddTask()s
+	 *
+	 * @param numTasks    The number of tasks that will be added
+	 * @param counter     The counter for the tasks. Can be nullptr
+	 * @return            The current thread's storage, or nullptr if the scheduler doesn't own the thread. The caller
+	 *                    should use InjectTasks() instead of EndAddTasks() then
+	 */
+	ThreadLocalStorage *BeginAddTasks(unsigned numTasks, TaskCounter *counter);
+	/**
+	 * Wakes threads for newly added tasks, if needed. The second half of the typed AddTask()s
+	 *
+	 * @param tls           The storage returned by BeginAddTasks()
+	 * @param numTasks      The number of tasks that were added
+	 * @param priority      The queue the tasks were added to
+	 * @param queueDepth    The size of that queue after the push. See WaitFreeQueue::Push()
+	 */
+	void EndAddTasks(ThreadLocalStorage &tls, unsigned numTasks, TaskPriority priority, size_t queueDepth);
+
+	/**
+	 * Hands tasks from a thread the scheduler doesn't own to the workers, and wakes threads for them if needed
+	 * The counter and OnTasksAdded must already have been taken care of
+	 *
+	 * @param batch       The tasks. Ownership passes to the worker that takes them
+	 * @param priority    Which priority queue the tasks will be put in
+	 */
+	void InjectTasks(InjectedTaskBatch *batch, TaskPriority priority);
+	/**
+	 * Moves every injected task of one priority into the current thread's queue, and pops one of them
+	 *
+	 * @param tls         The current thread's storage
+	 * @param priority    Which priority to take
+	 * @param nextTask    Filled with a task, on success
+	 * @return            True if a task was popped. False if there weren't any, or the others stole them all first
+	 */
+	bool TakeInjectedTasks(ThreadLocalStorage &tls, TaskPriority priority, TaskBundle *nextTask);
+	/**
+	 * Moves every fiber readied by a thread we don't own into the current thread's ReadyFibers
+	 *
+	 * @param tls    The current thread's storage
+	 * @return       True if there were any
+	 */
+	bool TakeInjectedReadyFibers(ThreadLocalStorage &tls);
+
+	/**
+	 * Gets the current thread's arena, for typed tasks
+	 *
+	 * @return    The arena, or nullptr if the scheduler doesn't own the thread
+	 */
+	TaskArena *GetCurrentThreadArena() const;
+
+	/**
+	 * Allocates a continuation from the current thread's arena, and adds 1 to its counter. The first half of
+	 * AddContinuation(). The caller fills in the Bundle
+	 *
+	 * @param priority               Which priority queue the continuation will be put in
+	 * @param continuationCounter    The counter for the continuation. Can be nullptr
+	 * @return                       The new continuation
+	 */
+	ContinuationBundle *BeginAddContinuation(TaskPriority priority, TaskCounter *continuationCounter);
+	/**
+	 * Adds the continuation to counter's waiting list, or queues it right away if counter already equals value.
+	 * The second half of AddContinuation()
+	 *
+	 * These are overloaded, rather than taking a BaseCounter, since the counter types are incomplete in this header
+	 *
+	 * @param counter         The counter to wait for
+	 * @param value           The value to wait for
+	 * @param continuation    The continuation from BeginAddContinuation()
+	 */
+	void EndAddContinuation(TaskCounter *counter, ContinuationBundle *continuation);
+	void EndAddContinuation(FullAtomicCounter *counter, unsigned value, ContinuationBundle *continuation);
+	void EndAddContinuationInternal(BaseCounter *counter, unsigned value, ContinuationBundle *continuation);
+
+	/**
+	 * Fills in a bundle for a typed task. See AddTask(Function &&)
+	 *
+	 * @param function    The callable
+	 * @param counter     The counter for the task. Can be nullptr
+	 * @param arena       The current thread's arena. Used if the callable doesn't fit inline. If nullptr, the callable is
+	 *                    heap allocated instead
+	 * @param bundle      The bundle to fill
+	 */
+	template <typename Function>
+	static void MakeTaskBundle(Function &&function, TaskCounter *counter, TaskArena *arena, TaskBundle *bundle) {
+		using FunctionType = typename std::decay<Function>::type;
+
+		bundle->Counter = counter;
+		StoreTaskFunction<FunctionType>(std::forward<Function>(function), arena, bundle, FitsInline<FunctionType>());
+	}
+
+	template <typename FunctionType, typename Function>
+	static void StoreTaskFunction(Function &&function, TaskArena * /*arena*/, TaskBundle *bundle, std::true_type /*fitsInline*/) {
+		new (bundle->InlineArgs) FunctionType(std::forward<Function>(function));
+		bundle->TaskToExecute = {InlineTaskEntry<FunctionType>, nullptr};
+		bundle->HasInlineArgs = true;
+	}
+
+	template <typename FunctionType, typename Function>
+	static void StoreTaskFunction(Function &&function, TaskArena *arena, TaskBundle *bundle, std::false_type /*fitsInline*/) {
+		static_assert(alignof(FunctionType) <= alignof(std::max_align_t), "Typed tasks can't be over-aligned");
+
+		if (arena == nullptr) {
+			bundle->TaskToExecute = {HeapTaskEntry<FunctionType>, new FunctionType(std::forward<Function>(function))};
+			bundle->HasInlineArgs = false;
+			return;
+		}
+
+		void *const memory = arena->Allocate(sizeof(FunctionType), alignof(FunctionType));
+		new (memory) FunctionType(std::forward<Function>(function));
+		bundle->TaskToExecute = {ArenaTaskEntry<FunctionType>, memory};
+		bundle->HasInlineArgs = false;
+	}
+
+	template <typename FunctionType>
+	static void InlineTaskEntry(TaskScheduler *taskScheduler, void *arg) {
+		(*static_cast<FunctionType *>(arg))(taskScheduler);
+	}
+
+	template <typename FunctionType>
+	static void ArenaTaskEntry(TaskScheduler *taskScheduler, void *arg) {
+		auto *const function = static_cast<FunctionType *>(arg);
+		(*function)(taskScheduler);
+
+		function->~FunctionType();
+		TaskArena::Free(function);
+	}
+
+	template <typename FunctionType>
+	static void HeapTaskEntry(TaskScheduler *taskScheduler, void *arg) {
+		auto *const function = static_cast<FunctionType *>(arg);
+		(*function)(taskScheduler);
+
+		delete function;
+	}
+
+	/**
+	 * Decides which CPU each thread runs on, and the order each thread steals from the others in
+	 *
+	 * @param pinning    How to pin the threads
+	 */
+	void InitThreadPinning(ThreadPinning pinning);
+	/**
+	 * Tries to steal from the other threads, closest first. Within a StealLevel, the search starts from the last
+	 * successful steal, and goes round-robin
+	 *
+	 * @param tls                    The current thread's storage
+	 * @param lastSuccessfulSteal    The position in StealOrder of the last successful steal. Updated on success
+	 * @param steal                  A callable with the signature bool(ThreadLocalStorage &victim)
+	 * @return                       True if steal succeeded for any thread
+	 */
+	template <typename StealFunction>
+	bool StealFromOtherThreads(ThreadLocalStorage &tls, unsigned *lastSuccessfulSteal, StealFunction steal);
+
 	/**
 	 * Pops the next task off the high priority queue into nextTask. If there are no tasks in the
 	 * the queue, it will return false.
 	 *
-	 * @param nextTask      If the queue is not empty, will be filled with the next task
-	 * @param taskBuffer    An empty buffer the function can use
-	 * @return              True: Successfully popped a task out of the queue
+	 * @param nextTask    If the queue is not empty, will be filled with the next task
+	 * @return            True: Successfully popped a task out of the queue
 	 */
-	bool GetNextHiPriTask(TaskBundle *nextTask, std::vector<TaskBundle> *taskBuffer);
+	bool GetNextHiPriTask(TaskBundle *nextTask);
 	/**
 	 * Pops the next task off the low priority queue into nextTask. If there are no tasks in the
 	 * the queue, it will return false.
+	 * When stealing from another thread, up to half of its tasks are moved to our queue in one go
 	 *
 	 * @param nextTask    If the queue is not empty, will be filled with the next task
 	 * @return            True: Successfully popped a task out of the queue
@@ -347,39 +1091,159 @@ private:
 	bool GetNextLoPriTask(TaskBundle *nextTask);
 
 	/**
-	 * Checks if the Task is ready to execute
-	 * "Real" tasks are always ready. ReadyFiber dummy tasks may be still waiting for the fiber to be switched
-	 * away from.
+	 * Gets the next fiber that is ready to resume. Checks this thread's pinned fibers, then its own ready fiber queue,
+	 * and then steals from the other threads' queues
 	 *
-	 * @param bundle    The task bundle to check
-	 * @return          True: task bundle is a "real" task or a ReadyFiber dummy task which is safe to execute
-	 *                  False: task bundle is a ReadyFiber dummy task which is not safe to execute
+	 * @return    The index of the fiber, or kInvalidIndex if no fibers are ready
 	 */
-	bool TaskIsReadyToExecute(TaskBundle *bundle) const;
+	unsigned GetNextReadyFiber();
 
 	/**
 	 * Gets the index of the next available fiber in the pool
+	 * Tries the thread's fiber cache, then the global free list, then grows the pool. If all of those fail, it waits
+	 * for another thread to release a fiber
 	 *
 	 * @return    The index of the next available fiber in the pool
 	 */
-	unsigned GetNextFreeFiberIndex() const;
+	unsigned GetNextFreeFiberIndex();
+	/**
+	 * Returns a fiber to the pool
+	 *
+	 * @param fiberIndex    The fiber to release
+	 */
+	void ReleaseFiber(unsigned fiberIndex);
+	/**
+	 * Moves the fibers in the current thread's cache to the global free list
+	 *
+	 * @param count    The number of fibers to move. Taken from the bottom of the cache
+	 */
+	void FlushFiberCache(unsigned count);
+	/**
+	 * Pushes a linked list of fibers onto the global free list
+	 * The fibers must already be linked together through m_freeFiberNext, from first to last
+	 *
+	 * @param first    The first fiber in the list
+	 * @param last     The last fiber in the list
+	 * @param count    The number of fibers in the list
+	 */
+	void PushFreeFibers(unsigned first, unsigned last, unsigned count);
+	/**
+	 * Pops a fiber from the global free list
+	 *
+	 * @return    The index of the fiber, or kInvalidIndex if the list is empty
+	 */
+	unsigned PopFreeFiber();
+	/**
+	 * Pops up to maxCount fibers from the global free list, with a single CAS
+	 *
+	 * @param maxCount    The most fibers to pop
+	 * @param fibers      Filled with the indices of the popped fibers. Must have room for maxCount
+	 * @return            The number of fibers popped. 0 if the list is empty
+	 */
+	unsigned PopFreeFibers(unsigned maxCount, unsigned *fibers);
+	/**
+	 * Creates a new fiber, if the pool hasn't reached its maximum size
+	 *
+	 * @return    The index of the new fiber, or kInvalidIndex if the pool is full
+	 */
+	unsigned GrowFiberPool();
 	/**
 	 * If necessary, moves the old fiber to the fiber pool or the waiting list
 	 * The old fiber is the last fiber to run on the thread before the current fiber
 	 */
 	void CleanUpOldFiber();
 
+	/**
+	 * Telemetry hooks. See WorkerTelemetry. These compile to nothing if FTL_TELEMETRY is disabled
+	 * All of them, except MarkFiberReady(), must be called from the thread that owns tls
+	 */
+	static void RecordTaskRun(ThreadLocalStorage &tls, TaskPriority priority);
+	static void RecordStealAttempt(ThreadLocalStorage &tls);
+	static void RecordFailedPop(ThreadLocalStorage &tls);
+	static void RecordFiberSwitch(ThreadLocalStorage &tls);
+	static void RecordQueueDepth(ThreadLocalStorage &tls, TaskPriority priority, size_t queueDepth);
+	static void MarkFiberReady(ReadyFiberBundle *bundle);
+	static void RecordReadyFiberResumed(ThreadLocalStorage &tls, ReadyFiberBundle const &bundle);
+
 	void WaitForCounterInternal(BaseCounter *counter, unsigned value, bool pinToCurrentThread);
+	/**
+	 * WaitForCounter() for threads the scheduler doesn't own. Blocks the thread until counter == value
+	 *
+	 * @param counter    The counter to wait for
+	 * @param value      The value to wait for
+	 */
+	void BlockCurrentThread(BaseCounter *counter, unsigned value);
 
 	/**
-	 * Add a fiber to the "ready list". Fibers in the ready list will be resumed the next time a fiber goes searching
-	 * for a new task
+	 * Signals that the counter a fiber was waiting on reached its target value. Once the fiber has also been switched
+	 * away from, it's added to the "ready list". Fibers in the ready list will be resumed the next time a fiber goes
+	 * searching for a new task
 	 *
 	 * @param pinnedThreadIndex    The index of the thread this fiber is pinned to. If not pinned, this will equal kNoThreadPinning
 	 * @param bundle               The fiber bundle to add
 	 * up"
 	 */
 	void AddReadyFiber(unsigned pinnedThreadIndex, ReadyFiberBundle *bundle);
+	/**
+	 * Called by BaseCounter when the counter a continuation was waiting on reached its target value. Pushes the
+	 * continuation's task to the current thread's queue, and frees the continuation
+	 *
+	 * @param node    The waiting list node of a ContinuationBundle
+	 */
+	void ReadyContinuation(BaseCounter::WaitingFiberBundle *node);
+	/**
+	 * Called by BaseCounter when the counter a thread was blocked on reached its target value. Wakes the thread
+	 *
+	 * @param node    The waiting list node of a BlockedThreadBundle
+	 */
+	static void WakeBlockedThread(BaseCounter::WaitingFiberBundle *node);
+	/**
+	 * Satisfies one of the two conditions a waiting fiber needs to resume. See ReadyFiberBundle::ResumeConditions
+	 * If this was the last one, pushes the fiber to a ready fiber queue, and wakes a thread to run it
+	 *
+	 * @param bundle    The fiber bundle
+	 */
+	void SatisfyResumeCondition(ReadyFiberBundle *bundle);
+
+	/**
+	 * Puts the current thread to sleep until another thread wakes it. Before sleeping, the thread registers itself
+	 * as idle and checks for work one last time, so work added concurrently is never missed
+	 *
+	 * @param threadIndex    The index of the current thread
+	 */
+	void ParkCurrentThread(unsigned threadIndex);
+	/**
+	 * Checks if there might be work for a thread to do. Used to re-check after a thread registers itself as idle
+	 *
+	 * @param threadIndex    The index of the thread that wants to sleep
+	 * @return               True if any queue is non-empty, the thread has pinned ready fibers, or the scheduler is quitting
+	 */
+	bool HasPendingWork(unsigned threadIndex);
+	/**
+	 * Removes a thread from the idle registry
+	 *
+	 * @param threadIndex    The index of the thread
+	 * @return               True if this call removed the thread. False if it wasn't registered, or another caller claimed it first
+	 */
+	bool TryClaimIdleThread(unsigned threadIndex);
+	/**
+	 * Wakes a thread that was claimed with TryClaimIdleThread()
+	 *
+	 * @param threadIndex    The index of the thread
+	 */
+	void SignalThread(unsigned threadIndex);
+	/**
+	 * Wakes up to count sleeping threads. Does nothing if no threads are asleep
+	 *
+	 * @param count    The maximum number of threads to wake. Usually the amount of new work
+	 */
+	void WakeIdleThreads(unsigned count);
+	/**
+	 * Wakes a specific thread, if it's asleep. Used when work is pinned to that thread
+	 *
+	 * @param threadIndex    The index of the thread
+	 */
+	void WakeThread(unsigned threadIndex);
 
 	/**
 	 * The threadProc function for all worker threads
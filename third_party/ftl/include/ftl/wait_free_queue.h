@@ -32,8 +32,8 @@
 
 #include "ftl/assert.h"
 
+#include <algorithm>
 #include <atomic>
-#include <memory>
 #include <stddef.h>
 #include <stdint.h>
 #include <vector>
@@ -48,9 +48,11 @@ private:
 public:
 	WaitFreeQueue()
 	        : m_top(1),    // m_top and m_bottom must start at 1
+	          m_activeStealers(0),
 	          m_bottom(1), // Otherwise, the first Pop on an empty queue will underflow m_bottom
 	          m_array(new CircularArray(kStartingCircularArraySize)) {
 		FTL_VALGRIND_HG_DISABLE_CHECKING(&m_top, sizeof(m_top));
+		FTL_VALGRIND_HG_DISABLE_CHECKING(&m_activeStealers, sizeof(m_activeStealers));
 		FTL_VALGRIND_HG_DISABLE_CHECKING(&m_bottom, sizeof(m_bottom));
 		FTL_VALGRIND_HG_DISABLE_CHECKING(&m_array, sizeof(m_array));
 	}
@@ -60,6 +62,7 @@ public:
 	WaitFreeQueue &operator=(WaitFreeQueue const &) = delete;
 	WaitFreeQueue &operator=(WaitFreeQueue &&) noexcept = delete;
 	~WaitFreeQueue() {
+		FreeRetiredArrays();
 		delete m_array.load(std::memory_order_relaxed);
 	}
 
@@ -73,9 +76,11 @@ private:
 
 	private:
 		std::vector<T> m_items;
-		std::unique_ptr<CircularArray> m_previous;
 
 	public:
+		/* The next array in WaitFreeQueue::m_retiredArrays */
+		CircularArray *NextRetired{nullptr};
+
 		size_t Size() const {
 			return m_items.size();
 		}
@@ -88,12 +93,15 @@ private:
 			m_items[index & (Size() - 1)] = x;
 		}
 
-		// Growing the array returns a new circular_array object and keeps a
-		// linked list of all previous arrays. This is done because other threads
-		// could still be accessing elements from the smaller arrays.
-		CircularArray *Grow(size_t const top, size_t const bottom) {
-			auto *const newArray = new CircularArray(Size() * 2);
-			newArray->m_previous.reset(this);
+		// Growing the array returns a new circular_array object. The old array can't be freed
+		// right away, because other threads could still be accessing elements from it. See RetireArray()
+		CircularArray *Grow(size_t const top, size_t const bottom, uint64_t const minSize) {
+			size_t newSize = Size() * 2;
+			while (newSize < minSize) {
+				newSize *= 2;
+			}
+
+			auto *const newArray = new CircularArray(newSize);
 			for (size_t i = top; i != bottom; i++) {
 				newArray->Put(i, Get(i));
 			}
@@ -104,20 +112,35 @@ private:
 #pragma warning(push)
 #pragma warning(disable : 4324) // MSVC warning C4324: structure was padded due to alignment specifier
 	alignas(kCacheLineSize) std::atomic<uint64_t> m_top;
+	/**
+	 * The number of thieves that might be reading from m_array. Old arrays can only be freed while this is zero
+	 * It gets its own cache line, so announcing a steal doesn't contend with the CAS on m_top. The owner only reads
+	 * it while it has retired arrays to free
+	 */
+	alignas(kCacheLineSize) std::atomic<unsigned> m_activeStealers;
 	alignas(kCacheLineSize) std::atomic<uint64_t> m_bottom;
+	/* Arrays that were replaced by Grow(), but may still be read by thieves. Only accessed by the owner */
+	CircularArray *m_retiredArrays{nullptr};
 	alignas(kCacheLineSize) std::atomic<CircularArray *> m_array;
 #pragma warning(pop)
 
 public:
-	void Push(T value) {
+	/**
+	 * Pushes a value. Can only be called by the owning thread
+	 *
+	 * @param value    The value to push
+	 * @return         The number of items in the queue after the push. Concurrent steals can make this an overestimate
+	 */
+	size_t Push(T value) {
 		uint64_t b = m_bottom.load(std::memory_order_relaxed);
 		uint64_t t = m_top.load(std::memory_order_acquire);
 		CircularArray *array = m_array.load(std::memory_order_relaxed);
 
 		if (b - t > array->Size() - 1) {
 			/* Full queue. */
-			array = array->Grow(t, b);
-			m_array.store(array, std::memory_order_release);
+			array = GrowArray(array, t, b, 1);
+		} else if (m_retiredArrays != nullptr) {
+			TryFreeRetiredArrays();
 		}
 		array->Put(b, value);
 
@@ -128,6 +151,47 @@ public:
 #endif
 
 		m_bottom.store(b + 1, std::memory_order_relaxed);
+		return b + 1 - t;
+	}
+
+	/**
+	 * Pushes multiple values, making them all visible to thieves at once. This is much cheaper than calling
+	 * Push() count times, since there is only one fence, and at most one Grow()
+	 *
+	 * Can only be called by the owning thread, just like Push()
+	 *
+	 * @param count        The number of values to push
+	 * @param generator    A callable with the signature T(size_t index), called once for each index in [0, count), in order
+	 * @return             The number of items in the queue after the push, or 0 if count is 0. See Push()
+	 */
+	template <typename Generator>
+	size_t PushBatch(size_t const count, Generator generator) {
+		if (count == 0) {
+			return 0;
+		}
+
+		uint64_t b = m_bottom.load(std::memory_order_relaxed);
+		uint64_t t = m_top.load(std::memory_order_acquire);
+		CircularArray *array = m_array.load(std::memory_order_relaxed);
+
+		if (b - t + count > array->Size()) {
+			/* Not enough room. */
+			array = GrowArray(array, t, b, b - t + count);
+		} else if (m_retiredArrays != nullptr) {
+			TryFreeRetiredArrays();
+		}
+		for (size_t i = 0; i < count; ++i) {
+			array->Put(b + i, generator(i));
+		}
+
+#if defined(FTL_STRONG_MEMORY_MODEL)
+		std::atomic_signal_fence(std::memory_order_release);
+#else
+		std::atomic_thread_fence(std::memory_order_release);
+#endif
+
+		m_bottom.store(b + count, std::memory_order_relaxed);
+		return b + count - t;
 	}
 
 	bool Pop(T *value) {
@@ -160,6 +224,76 @@ public:
 	}
 
 	bool Steal(T *const value) {
+		return StealOne(value, true);
+	}
+
+	/**
+	 * Steals up to half the items in this queue, up to maxCount. The first item is returned in value, and the rest
+	 * are pushed to destination in a single PushBatch()
+	 *
+	 * NOTE: Each item is still claimed with its own CAS on m_top. The owner pops from the other end without a CAS
+	 * while it sees more than one item, so claiming a whole range with one CAS could hand the same item to both
+	 * the owner and the thief
+	 *
+	 * @param destination    The queue to put the extra items in. Must be owned by the calling thread
+	 * @param value          Filled with the first stolen item
+	 * @param maxCount       The maximum number of items to steal, including value. Must be > 0
+	 * @param buffer         Scratch space for at least maxCount - 1 items
+	 * @return               The number of items stolen, including value. 0 if nothing was stolen
+	 */
+	size_t StealBatch(WaitFreeQueue *const destination, T *const value, size_t const maxCount, T *const buffer) {
+		if (IsEmpty()) {
+			return 0;
+		}
+
+		// Announce ourselves once for the whole batch, instead of once per item
+		m_activeStealers.fetch_add(1, std::memory_order_seq_cst);
+		if (!StealOne(value, false)) {
+			m_activeStealers.fetch_sub(1, std::memory_order_release);
+			return 0;
+		}
+
+		// Take half of what's left, rounded down, so the owner keeps the rest
+		uint64_t const t = m_top.load(std::memory_order_acquire);
+		uint64_t const b = m_bottom.load(std::memory_order_acquire);
+		uint64_t const remaining = t < b ? b - t : 0;
+		size_t const wanted = std::min<uint64_t>(maxCount - 1, remaining / 2);
+
+		size_t stolen = 0;
+		while (stolen < wanted && StealOne(&buffer[stolen], false)) {
+			++stolen;
+		}
+		m_activeStealers.fetch_sub(1, std::memory_order_release);
+
+		destination->PushBatch(stolen, [buffer](size_t const i) {
+			return buffer[i];
+		});
+
+		return stolen + 1;
+	}
+
+	/**
+	 * Checks if the queue looks empty. This can be called from any thread, but it's only a hint, since
+	 * other threads may push or steal concurrently
+	 *
+	 * @return    True if the queue had no items when it was checked
+	 */
+	bool IsEmpty() const {
+		uint64_t const t = m_top.load(std::memory_order_acquire);
+		uint64_t const b = m_bottom.load(std::memory_order_acquire);
+		return b <= t;
+	}
+
+private:
+	/**
+	 * Steals a single item
+	 *
+	 * @param value       Filled with the stolen item
+	 * @param announce    If false, the caller must already be counted in m_activeStealers, so the array can't be freed
+	 *                    while it's read
+	 * @return            True if an item was stolen
+	 */
+	bool StealOne(T *const value, bool const announce) {
 		uint64_t t = m_top.load(std::memory_order_acquire);
 
 #if defined(FTL_STRONG_MEMORY_MODEL)
@@ -171,13 +305,49 @@ public:
 		uint64_t const b = m_bottom.load(std::memory_order_acquire);
 		if (t < b) {
 			/* Non-empty queue. */
-			CircularArray *const array = m_array.load(std::memory_order_consume);
+			// Announce ourselves before loading the array, so the owner won't free it while we read from it
+			if (announce) {
+				m_activeStealers.fetch_add(1, std::memory_order_seq_cst);
+			}
+			CircularArray *const array = m_array.load(std::memory_order_seq_cst);
 			*value = array->Get(t);
+			if (announce) {
+				m_activeStealers.fetch_sub(1, std::memory_order_release);
+			}
+
 			return std::atomic_compare_exchange_strong_explicit(&m_top, &t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
 		}
 
 		return false;
 	}
+
+	CircularArray *GrowArray(CircularArray *const array, uint64_t const t, uint64_t const b, uint64_t const minSize) {
+		CircularArray *const newArray = array->Grow(t, b, minSize);
+		// seq_cst, so any thief that announces itself after TryFreeRetiredArrays() checks m_activeStealers
+		// is guaranteed to load the new array
+		m_array.store(newArray, std::memory_order_seq_cst);
+
+		array->NextRetired = m_retiredArrays;
+		m_retiredArrays = array;
+		TryFreeRetiredArrays();
+
+		return newArray;
+	}
+
+	void TryFreeRetiredArrays() {
+		if (m_activeStealers.load(std::memory_order_seq_cst) == 0) {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			FreeRetiredArrays();
+		}
+	}
+
+	void FreeRetiredArrays() {
+		while (m_retiredArrays != nullptr) {
+			CircularArray *const next = m_retiredArrays->NextRetired;
+			delete m_retiredArrays;
+			m_retiredArrays = next;
+		}
+	}
 };
 
 } // End of namespace ftl
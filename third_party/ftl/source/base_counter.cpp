@@ -24,6 +24,7 @@
 
 #include "ftl/base_counter.h"
 
+#include "ftl/config.h"
 #include "ftl/ftl_valgrind.h"
 #include "ftl/task_scheduler.h"
 
@@ -31,31 +32,13 @@
 
 namespace ftl {
 
-BaseCounter::BaseCounter(TaskScheduler *const taskScheduler, unsigned initialValue, unsigned fiberSlots)
+BaseCounter::BaseCounter(TaskScheduler *const taskScheduler, unsigned initialValue, unsigned /*fiberSlots*/)
         : m_taskScheduler(taskScheduler), m_value(initialValue), m_lock(0),
-          m_freeSlots(m_freeSlotsStorage), m_freeSlotsStorage(),
-          m_waitingFibers(m_waitingFibersStorage),
-          m_fiberSlots(fiberSlots) {
-	// Small Vector Optimization
-	if (fiberSlots > NUM_WAITING_FIBER_SLOTS) {
-		m_freeSlots = new std::atomic<bool>[fiberSlots];
-		m_waitingFibers = new WaitingFiberBundle[fiberSlots];
-	}
-
+          m_waitingFibers(nullptr) {
 	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_value, sizeof(m_value));
 	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_lock, sizeof(m_lock));
-	FTL_VALGRIND_HG_DISABLE_CHECKING(m_freeSlots, sizeof(m_freeSlots[0]) * fiberSlots);
-	FTL_VALGRIND_HG_DISABLE_CHECKING(m_waitingFibers, sizeof(m_waitingFibers[0]) * fiberSlots);
-
-	for (unsigned i = 0; i < fiberSlots; ++i) {
-		m_freeSlots[i].store(true);
-
-		// We initialize InUse to true to prevent CheckWaitingFibers() from checking garbage
-		// data when we are adding a new fiber to the wait list in AddFiberToWaitingList()
-		// For this same reason, when we set a slot to be free (ie. m_freeSlots[i] = true), we
-		// keep InUse == true
-		m_waitingFibers[i].InUse.store(true);
-	}
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_waitingFibers, sizeof(m_waitingFibers));
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_waitingFibersLock, sizeof(m_waitingFibersLock));
 }
 
 BaseCounter::~BaseCounter() {
@@ -63,94 +46,101 @@ BaseCounter::~BaseCounter() {
 	while (m_lock.load(std::memory_order_relaxed) > 0) {
 		std::this_thread::yield();
 	}
-
-	if (m_fiberSlots > NUM_WAITING_FIBER_SLOTS) {
-		delete[] m_freeSlots;
-		delete[] m_waitingFibers;
-	}
 }
 
-BaseCounter::WaitingFiberBundle::WaitingFiberBundle()
-        : InUse(true), PinnedThreadIndex(std::numeric_limits<unsigned>::max()) {
-	FTL_VALGRIND_HG_DISABLE_CHECKING(&InUse, sizeof(InUse));
+bool BaseCounter::AddFiberToWaitingList(WaitingFiberBundle *waitingFiber, void *fiberBundle, unsigned targetValue, unsigned const pinnedThreadIndex) {
+	waitingFiber->FiberBundle = fiberBundle;
+	waitingFiber->TargetValue = targetValue;
+	waitingFiber->PinnedThreadIndex = pinnedThreadIndex;
+
+	return AddToWaitingList(waitingFiber);
 }
 
-bool BaseCounter::AddFiberToWaitingList(void *fiberBundle, unsigned targetValue, unsigned const pinnedThreadIndex) {
-	for (unsigned i = 0; i < m_fiberSlots; ++i) {
-		bool expected = true;
-		// Try to acquire the slot
-		if (!std::atomic_compare_exchange_strong_explicit(&m_freeSlots[i], &expected, false, std::memory_order_seq_cst, std::memory_order_relaxed)) {
-			// Failed the race or the slot was already full
-			continue;
-		}
+bool BaseCounter::AddToWaitingList(WaitingFiberBundle *const node) {
+	unsigned const targetValue = node->TargetValue;
 
-		// We found a free slot
-		m_waitingFibers[i].FiberBundle = fiberBundle;
-		m_waitingFibers[i].TargetValue = targetValue;
-		m_waitingFibers[i].PinnedThreadIndex = pinnedThreadIndex;
-		// We have to use memory_order_seq_cst here instead of memory_order_acquire to prevent
-		// later loads from being re-ordered before this store
-		m_waitingFibers[i].InUse.store(false, std::memory_order_seq_cst);
-
-		// Events are now being tracked
-
-		// Now we do a check of the waiting fiber, to see if we reached the target value while we were storing
-		// everything
-		unsigned const value = m_value.load(std::memory_order_relaxed);
-		if (m_waitingFibers[i].InUse.load(std::memory_order_acquire)) {
-			return false;
-		}
+	m_waitingFibersLock.lock();
+	node->Next = m_waitingFibers.load(std::memory_order_relaxed);
+	// We have to use memory_order_seq_cst here to prevent the load of m_value below from being re-ordered
+	// before this store. Callers of CheckWaitingFibers() do the opposite. They modify m_value, and then load
+	// m_waitingFibers. So either they see us in the list, or we see the new value
+	m_waitingFibers.store(node, std::memory_order_seq_cst);
+	m_waitingFibersLock.unlock();
 
-		if (m_waitingFibers[i].TargetValue == value) {
-			expected = false;
-			// Try to acquire InUse
-			if (!std::atomic_compare_exchange_strong_explicit(&m_waitingFibers[i].InUse, &expected, true, std::memory_order_seq_cst, std::memory_order_relaxed)) {
-				// Failed the race. Another thread got to it first.
-				return false;
-			}
-			// Signal that the slot is now free
-			// Leave IneUse == true
-			m_freeSlots[i].store(true, std::memory_order_release);
-
-			return true;
-		}
+	// Events are now being tracked
 
+	// Now we do a check of the value, to see if we reached the target value while we were adding ourselves
+	if (m_value.load(std::memory_order_seq_cst) != targetValue) {
 		return false;
 	}
 
-	// BARF. We ran out of slots
-	// ReSharper disable once CppUnreachableCode
-	FTL_ASSERT("All the waiting fiber slots are full. Not able to add another wait.\n"
-	           "Increase the value of fiberSlots in the constructor or modify your algorithm to use less waits on the same counter",
-	           false);
-	return false;
+	// Try to take ourselves back out of the list
+	// If we're not in it anymore, CheckWaitingFibers() got to us first, and it has (or will) ready the fiber
+	bool removed = false;
+	m_waitingFibersLock.lock();
+	WaitingFiberBundle *prev = nullptr;
+	for (WaitingFiberBundle *iter = m_waitingFibers.load(std::memory_order_relaxed); iter != nullptr; prev = iter, iter = iter->Next) {
+		if (iter == node) {
+			if (prev == nullptr) {
+				m_waitingFibers.store(iter->Next, std::memory_order_relaxed);
+			} else {
+				prev->Next = iter->Next;
+			}
+			removed = true;
+			break;
+		}
+	}
+	m_waitingFibersLock.unlock();
+
+	return removed;
 }
 
 void BaseCounter::CheckWaitingFibers(unsigned const value) {
-	for (unsigned i = 0; i < m_fiberSlots; ++i) {
-		// Check if the slot is full
-		if (m_freeSlots[i].load(std::memory_order_acquire)) {
-			continue;
-		}
-		// Check if the slot is being modified by another thread
-		if (m_waitingFibers[i].InUse.load(std::memory_order_acquire)) {
-			continue;
-		}
+	// Fast out. Nobody is waiting
+	if (m_waitingFibers.load(std::memory_order_seq_cst) == nullptr) {
+		return;
+	}
 
-		// Do the actual value check
-		if (m_waitingFibers[i].TargetValue == value) {
-			bool expected = false;
-			// Try to acquire InUse
-			if (!std::atomic_compare_exchange_strong_explicit(&m_waitingFibers[i].InUse, &expected, true, std::memory_order_seq_cst, std::memory_order_relaxed)) {
-				// Failed the race. Another thread got to it first
-				continue;
+	// Unlink all the fibers waiting for this value
+	// Whoever unlinks a node is the only one who can see it afterwards, so that's what decides which thread
+	// readies the fiber
+	WaitingFiberBundle *readyFibers = nullptr;
+	m_waitingFibersLock.lock();
+	WaitingFiberBundle *prev = nullptr;
+	WaitingFiberBundle *node = m_waitingFibers.load(std::memory_order_relaxed);
+	while (node != nullptr) {
+		WaitingFiberBundle *const next = node->Next;
+		if (node->TargetValue == value) {
+			if (prev == nullptr) {
+				m_waitingFibers.store(next, std::memory_order_relaxed);
+			} else {
+				prev->Next = next;
 			}
-
-			m_taskScheduler->AddReadyFiber(m_waitingFibers[i].PinnedThreadIndex, reinterpret_cast<TaskScheduler::ReadyFiberBundle *>(m_waitingFibers[i].FiberBundle));
-			// Signal that the slot is free
-			// Leave InUse == true
-			m_freeSlots[i].store(true, std::memory_order_release);
+			node->Next = readyFibers;
+			readyFibers = node;
+		} else {
+			prev = node;
+		}
+		node = next;
+	}
+	m_waitingFibersLock.unlock();
+
+	// Ready the fibers outside the lock. AddReadyFiber() can take other locks, and wake threads
+	while (readyFibers != nullptr) {
+		// Read everything we need first. Once the fiber is ready, it can resume and re-use the node
+		// A continuation's node is freed as soon as its task is queued, and a blocked thread's as soon as it wakes
+		WaitingFiberBundle *const next = readyFibers->Next;
+		unsigned const pinnedThreadIndex = readyFibers->PinnedThreadIndex;
+		void *const fiberBundle = readyFibers->FiberBundle;
+
+		if (readyFibers->BlocksThread) {
+			m_taskScheduler->WakeBlockedThread(readyFibers);
+		} else if (fiberBundle == nullptr) {
+			m_taskScheduler->ReadyContinuation(readyFibers);
+		} else {
+			m_taskScheduler->AddReadyFiber(pinnedThreadIndex, reinterpret_cast<TaskScheduler::ReadyFiberBundle *>(fiberBundle));
 		}
+		readyFibers = next;
 	}
 }
 
@@ -0,0 +1,283 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/cpu_topology.h"
+
+#include "ftl/config.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#if defined(FTL_OS_LINUX)
+#	include <dirent.h>
+#	include <sched.h>
+#	include <string.h>
+#endif
+
+namespace ftl {
+
+#if defined(FTL_OS_LINUX)
+
+// Reads the first line of a sysfs file, without the newline
+static bool ReadSysfsLine(std::string const &path, std::string *line) {
+	FILE *file = fopen(path.c_str(), "r");
+	if (file == nullptr) {
+		return false;
+	}
+
+	char buffer[4096];
+	bool const success = fgets(buffer, sizeof(buffer), file) != nullptr;
+	fclose(file);
+	if (!success) {
+		return false;
+	}
+
+	*line = buffer;
+	while (!line->empty() && (line->back() == '\n' || line->back() == '\r')) {
+		line->pop_back();
+	}
+	return true;
+}
+
+static bool ReadSysfsUnsigned(std::string const &path, unsigned *value) {
+	std::string line;
+	if (!ReadSysfsLine(path, &line) || line.empty()) {
+		return false;
+	}
+
+	*value = static_cast<unsigned>(strtoul(line.c_str(), nullptr, 10));
+	return true;
+}
+
+// Parses a sysfs cpu list. For example, "0-3,8,10-11"
+static bool ParseCpuList(std::string const &list, std::vector<unsigned> *cpus) {
+	char const *current = list.c_str();
+	while (*current != '\0') {
+		char *end;
+		unsigned long const first = strtoul(current, &end, 10);
+		if (end == current) {
+			return false;
+		}
+		unsigned long last = first;
+		current = end;
+
+		if (*current == '-') {
+			++current;
+			last = strtoul(current, &end, 10);
+			if (end == current || last < first) {
+				return false;
+			}
+			current = end;
+		}
+
+		for (unsigned long cpu = first; cpu <= last; ++cpu) {
+			cpus->push_back(static_cast<unsigned>(cpu));
+		}
+
+		if (*current == ',') {
+			++current;
+		} else if (*current != '\0') {
+			return false;
+		}
+	}
+
+	return !cpus->empty();
+}
+
+// Reads a cpu list file, and returns the lowest CPU in it. This gives every group of CPUs a stable id
+static bool ReadLowestCpuInList(std::string const &path, unsigned *lowest) {
+	std::string line;
+	std::vector<unsigned> cpus;
+	if (!ReadSysfsLine(path, &line) || !ParseCpuList(line, &cpus)) {
+		return false;
+	}
+
+	*lowest = *std::min_element(cpus.begin(), cpus.end());
+	return true;
+}
+
+// The last level cache is the highest level cache that isn't an instruction cache
+static unsigned ReadLastLevelCacheId(std::string const &cpuPath, unsigned const cpu) {
+	unsigned bestLevel = 0;
+	unsigned cacheId = cpu;
+
+	for (unsigned index = 0;; ++index) {
+		std::string const indexPath = cpuPath + "/cache/index" + std::to_string(index);
+
+		unsigned level;
+		if (!ReadSysfsUnsigned(indexPath + "/level", &level)) {
+			break;
+		}
+
+		std::string type;
+		if (ReadSysfsLine(indexPath + "/type", &type) && type == "Instruction") {
+			continue;
+		}
+
+		unsigned sharedId;
+		if (level > bestLevel && ReadLowestCpuInList(indexPath + "/shared_cpu_list", &sharedId)) {
+			bestLevel = level;
+			cacheId = sharedId;
+		}
+	}
+
+	return cacheId;
+}
+
+// sysfs has a "nodeN" link in the cpu directory for the NUMA node the CPU belongs to
+static unsigned ReadNumaNode(std::string const &cpuPath) {
+	DIR *dir = opendir(cpuPath.c_str());
+	if (dir == nullptr) {
+		return 0;
+	}
+
+	unsigned node = 0;
+	while (dirent const *entry = readdir(dir)) {
+		char const *name = entry->d_name;
+		if (strncmp(name, "node", 4) == 0 && name[4] >= '0' && name[4] <= '9') {
+			node = static_cast<unsigned>(strtoul(name + 4, nullptr, 10));
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+bool ReadCpuTopology(std::vector<LogicalCpu> *cpus, char const *sysfsRoot) {
+	cpus->clear();
+
+	std::string const root = sysfsRoot;
+	std::string online;
+	std::vector<unsigned> onlineCpus;
+	if (!ReadSysfsLine(root + "/online", &online) || !ParseCpuList(online, &onlineCpus)) {
+		return false;
+	}
+	std::sort(onlineCpus.begin(), onlineCpus.end());
+
+	for (unsigned const id : onlineCpus) {
+		std::string const cpuPath = root + "/cpu" + std::to_string(id);
+
+		LogicalCpu cpu{};
+		cpu.Id = id;
+		// Newer kernels call it core_cpus_list. Without either, assume the CPU has no SMT siblings
+		if (!ReadLowestCpuInList(cpuPath + "/topology/core_cpus_list", &cpu.CoreId) &&
+		    !ReadLowestCpuInList(cpuPath + "/topology/thread_siblings_list", &cpu.CoreId)) {
+			cpu.CoreId = id;
+		}
+		cpu.CacheId = ReadLastLevelCacheId(cpuPath, id);
+		cpu.NumaNode = ReadNumaNode(cpuPath);
+
+		cpus->push_back(cpu);
+	}
+
+	return true;
+}
+
+void RemoveDisallowedCpus(std::vector<LogicalCpu> *cpus) {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return;
+	}
+
+	cpus->erase(std::remove_if(cpus->begin(), cpus->end(),
+	                           [&allowed](LogicalCpu const &cpu) {
+		                           return cpu.Id >= CPU_SETSIZE || !CPU_ISSET(cpu.Id, &allowed);
+	                           }),
+	            cpus->end());
+}
+
+#else
+
+bool ReadCpuTopology(std::vector<LogicalCpu> *cpus, char const *sysfsRoot) {
+	(void)sysfsRoot;
+
+	cpus->clear();
+	return false;
+}
+
+void RemoveDisallowedCpus(std::vector<LogicalCpu> *cpus) {
+	(void)cpus;
+}
+
+#endif
+
+std::vector<unsigned> OrderCpusForPinning(std::vector<LogicalCpu> const &cpus, bool const physicalCoresFirst) {
+	std::vector<unsigned> order(cpus.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = static_cast<unsigned>(i);
+	}
+
+	// Group by node, then cache, then core
+	std::sort(order.begin(), order.end(), [&cpus](unsigned const a, unsigned const b) {
+		LogicalCpu const &cpuA = cpus[a];
+		LogicalCpu const &cpuB = cpus[b];
+		if (cpuA.NumaNode != cpuB.NumaNode) {
+			return cpuA.NumaNode < cpuB.NumaNode;
+		}
+		if (cpuA.CacheId != cpuB.CacheId) {
+			return cpuA.CacheId < cpuB.CacheId;
+		}
+		if (cpuA.CoreId != cpuB.CoreId) {
+			return cpuA.CoreId < cpuB.CoreId;
+		}
+		return cpuA.Id < cpuB.Id;
+	});
+
+	if (!physicalCoresFirst) {
+		return order;
+	}
+
+	// Give each CPU its rank within its core, then order by rank. So the first sibling of every core comes first,
+	// then the second sibling of every core, etc. stable_sort keeps the grouping within each rank
+	std::vector<unsigned> rank(cpus.size(), 0);
+	for (size_t i = 1; i < order.size(); ++i) {
+		if (cpus[order[i]].CoreId == cpus[order[i - 1]].CoreId) {
+			rank[order[i]] = rank[order[i - 1]] + 1;
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&rank](unsigned const a, unsigned const b) {
+		return rank[a] < rank[b];
+	});
+
+	return order;
+}
+
+StealLevel GetStealLevel(LogicalCpu const &a, LogicalCpu const &b) {
+	if (a.CoreId == b.CoreId) {
+		return StealLevel::Core;
+	}
+	if (a.CacheId == b.CacheId) {
+		return StealLevel::Cache;
+	}
+	if (a.NumaNode == b.NumaNode) {
+		return StealLevel::NumaNode;
+	}
+	return StealLevel::Remote;
+}
+
+} // End of namespace ftl
@@ -0,0 +1,86 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/fiber_semaphore.h"
+
+#include "ftl/task_scheduler.h"
+
+#include <mutex>
+
+namespace ftl {
+
+FiberSemaphore::FiberSemaphore(TaskScheduler *taskScheduler, unsigned const initialCount)
+        : m_taskScheduler(taskScheduler), m_spinner(taskScheduler->GetThreadCount() > 1), m_count(initialCount) {
+}
+
+void FiberSemaphore::acquire(bool const pinToThread, unsigned const maxSpinIterations) {
+	if (m_spinner.Spin(maxSpinIterations, [this]() { return try_acquire(); })) {
+		return;
+	}
+
+	SyncWaiter waiter(m_taskScheduler);
+	{
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		if (m_count != 0 && m_waiters.IsEmpty()) {
+			--m_count;
+			return;
+		}
+		m_waiters.Push(&waiter);
+	}
+
+	// release() gives us a unit before waking us
+	waiter.Wait(pinToThread);
+}
+
+bool FiberSemaphore::try_acquire() {
+	std::lock_guard<SyncSpinLock> guard(m_stateLock);
+	if (m_count == 0 || !m_waiters.IsEmpty()) {
+		return false;
+	}
+
+	--m_count;
+	return true;
+}
+
+void FiberSemaphore::release(unsigned count) {
+	SyncWaiter *wake = nullptr;
+	SyncWaiter **tail = &wake;
+	{
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		for (; count != 0 && !m_waiters.IsEmpty(); --count) {
+			*tail = m_waiters.Pop();
+			tail = &(*tail)->Next;
+		}
+		m_count += count;
+	}
+
+	WakeAll(wake);
+}
+
+unsigned FiberSemaphore::GetCount() {
+	std::lock_guard<SyncSpinLock> guard(m_stateLock);
+	return m_count;
+}
+
+} // End of namespace ftl
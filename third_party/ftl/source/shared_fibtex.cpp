@@ -0,0 +1,142 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/shared_fibtex.h"
+
+#include "ftl/task_scheduler.h"
+
+#include <mutex>
+
+namespace ftl {
+
+SharedFibtex::SharedFibtex(TaskScheduler *taskScheduler)
+        : m_taskScheduler(taskScheduler), m_spinner(taskScheduler->GetThreadCount() > 1) {
+}
+
+void SharedFibtex::lock(bool const pinToThread, unsigned const maxSpinIterations) {
+	if (m_spinner.Spin(maxSpinIterations, [this]() { return try_lock(); })) {
+		return;
+	}
+
+	SyncWaiter waiter(m_taskScheduler, kExclusiveRequest);
+	{
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		if (!m_writer && m_readers == 0 && m_waiters.IsEmpty()) {
+			m_writer = true;
+			return;
+		}
+		m_waiters.Push(&waiter);
+	}
+
+	// Whoever releases the lock gives it to us. See HandOff()
+	waiter.Wait(pinToThread);
+}
+
+bool SharedFibtex::try_lock() {
+	std::lock_guard<SyncSpinLock> guard(m_stateLock);
+	if (m_writer || m_readers != 0 || !m_waiters.IsEmpty()) {
+		return false;
+	}
+
+	m_writer = true;
+	return true;
+}
+
+void SharedFibtex::unlock() {
+	SyncWaiter *wake;
+	{
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		FTL_ASSERT("SharedFibtex was unlocked without being locked exclusively", m_writer);
+		m_writer = false;
+		wake = HandOff();
+	}
+
+	WakeAll(wake);
+}
+
+void SharedFibtex::lock_shared(bool const pinToThread, unsigned const maxSpinIterations) {
+	if (m_spinner.Spin(maxSpinIterations, [this]() { return try_lock_shared(); })) {
+		return;
+	}
+
+	SyncWaiter waiter(m_taskScheduler, kSharedRequest);
+	{
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		// Queue behind any waiting writer, even if the lock is currently shared. Otherwise writers could starve
+		if (!m_writer && m_waiters.IsEmpty()) {
+			++m_readers;
+			return;
+		}
+		m_waiters.Push(&waiter);
+	}
+
+	waiter.Wait(pinToThread);
+}
+
+bool SharedFibtex::try_lock_shared() {
+	std::lock_guard<SyncSpinLock> guard(m_stateLock);
+	if (m_writer || !m_waiters.IsEmpty()) {
+		return false;
+	}
+
+	++m_readers;
+	return true;
+}
+
+void SharedFibtex::unlock_shared() {
+	SyncWaiter *wake = nullptr;
+	{
+		std::lock_guard<SyncSpinLock> guard(m_stateLock);
+		FTL_ASSERT("SharedFibtex was unlocked without being locked shared", m_readers > 0);
+		if (--m_readers == 0) {
+			wake = HandOff();
+		}
+	}
+
+	WakeAll(wake);
+}
+
+SyncWaiter *SharedFibtex::HandOff() {
+	SyncWaiter *wake = nullptr;
+	SyncWaiter **tail = &wake;
+	while (!m_waiters.IsEmpty() && !m_writer) {
+		SyncWaiter *const front = m_waiters.Front();
+		if (front->Request == kExclusiveRequest) {
+			if (m_readers != 0) {
+				break;
+			}
+			m_writer = true;
+		} else {
+			++m_readers;
+		}
+
+		// Keep FIFO order, so the readers resume in the order they arrived
+		*tail = m_waiters.Pop();
+		tail = &(*tail)->Next;
+	}
+
+	return wake;
+}
+
+} // End of namespace ftl
@@ -0,0 +1,54 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ftl/sync_spin_lock.h"
+
+#include "ftl/config.h"
+
+#include <thread>
+
+namespace ftl {
+
+constexpr static unsigned kSyncSpinLockSpins = 64;
+
+void SyncSpinLock::LockSlow() {
+	while (true) {
+		// Spin on a plain load, so we don't bounce the cache line between the waiting threads
+		// The lock is only held for a few instructions. But if the holder was preempted, get out of its way
+		for (unsigned spins = 0; m_locked.load(std::memory_order_relaxed); ++spins) {
+			if (spins < kSyncSpinLockSpins) {
+				FTL_PAUSE();
+			} else {
+				std::this_thread::yield();
+			}
+		}
+
+		if (!m_locked.exchange(true, std::memory_order_acquire)) {
+			return;
+		}
+	}
+}
+
+} // End of namespace ftl
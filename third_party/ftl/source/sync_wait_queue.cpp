@@ -0,0 +1,43 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/sync_wait_queue.h"
+
+#include "ftl/task_scheduler.h"
+
+namespace ftl {
+
+void SyncWaiter::Wait(bool const pinToThread) {
+	Scheduler->WaitForCounter(&Flag, pinToThread);
+
+	// WaitForCounter() can return after a relaxed load of the flag. Pair with the release in Wake(), so we see
+	// everything the waker did
+	std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+void SyncWaiter::Wake() {
+	Flag.Clear(std::memory_order_release);
+}
+
+} // End of namespace ftl
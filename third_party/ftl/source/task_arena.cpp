@@ -0,0 +1,163 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/task_arena.h"
+
+#include <new>
+
+namespace ftl {
+
+TaskArena::~TaskArena() {
+	// Tasks that never ran (e.g. still queued when the scheduler was destroyed) are freed along with their blocks
+	Block *block = m_allBlocks;
+	while (block != nullptr) {
+		Block *const next = block->NextAllocated;
+		block->~Block();
+		::operator delete(block);
+		block = next;
+	}
+}
+
+// Gets the offset in the payload of the next allocation. Every allocation is preceded by a pointer to its block, so
+// Free() can find it
+static size_t NextAllocationOffset(unsigned char *const payload, size_t const used, size_t const alignment) {
+	auto const start = reinterpret_cast<uintptr_t>(payload) + used + sizeof(void *);
+	uintptr_t const aligned = (start + alignment - 1) & ~(alignment - 1);
+	return aligned - reinterpret_cast<uintptr_t>(payload);
+}
+
+void *TaskArena::Allocate(size_t const size, size_t const alignment) {
+	FTL_ASSERT("Alignment must be a power of 2", alignment != 0 && (alignment & (alignment - 1)) == 0);
+	m_allocations.store(m_allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	size_t const headerAlignment = alignment < alignof(Block *) ? alignof(Block *) : alignment;
+	size_t const worstCaseSize = size + sizeof(Block *) + headerAlignment;
+
+	Block *block;
+	if (worstCaseSize > kBlockSize / 2) {
+		block = NewBlock(worstCaseSize, true);
+	} else {
+		block = m_current;
+		if (block != nullptr && block->State.load(std::memory_order_acquire) == 0) {
+			// Everything in the block has been freed. Start over from the beginning, while it's still in the cache
+			block->Used = 0;
+		}
+		if (block == nullptr || NextAllocationOffset(block->Payload(), block->Used, headerAlignment) + size > block->Size) {
+			RetireCurrentBlock();
+			block = AcquireBlock();
+			m_current = block;
+		}
+	}
+
+	size_t const offset = NextAllocationOffset(block->Payload(), block->Used, headerAlignment);
+	block->Used = offset + size;
+	block->State.fetch_add(1, std::memory_order_relaxed);
+
+	unsigned char *const allocation = block->Payload() + offset;
+	*reinterpret_cast<Block **>(allocation - sizeof(Block *)) = block;
+	return allocation;
+}
+
+void TaskArena::Free(void *const allocation) {
+	Block *const block = *reinterpret_cast<Block **>(static_cast<unsigned char *>(allocation) - sizeof(Block *));
+
+	// acq_rel, so whoever reuses the block sees everything done with the allocation
+	uint64_t const previous = block->State.fetch_sub(1, std::memory_order_acq_rel);
+	if (previous != (kRetiredBit | 1)) {
+		// Either the block is still live, or it's the owner's current block, which the owner rewinds itself
+		return;
+	}
+
+	// We freed the last allocation in a retired block
+	if (block->Dedicated) {
+		block->~Block();
+		::operator delete(block);
+	} else {
+		block->Owner->PushFreeBlock(block);
+	}
+}
+
+TaskArena::Block *TaskArena::NewBlock(size_t const size, bool const dedicated) {
+	m_heapAllocations.store(m_heapAllocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	void *const memory = ::operator new(sizeof(Block) + size);
+	auto *const block = new (memory) Block();
+	block->Owner = this;
+	block->NextAllocated = nullptr;
+	block->NextFree = nullptr;
+	block->Size = size;
+	block->Used = 0;
+	// Dedicated blocks are retired from the start, so the single Free() deletes them
+	block->State.store(dedicated ? kRetiredBit : 0, std::memory_order_relaxed);
+	block->Dedicated = dedicated;
+
+	if (!dedicated) {
+		block->NextAllocated = m_allBlocks;
+		m_allBlocks = block;
+	}
+
+	return block;
+}
+
+TaskArena::Block *TaskArena::AcquireBlock() {
+	if (m_spareBlocks == nullptr) {
+		m_spareBlocks = m_freeBlocks.exchange(nullptr, std::memory_order_acquire);
+	}
+
+	if (m_spareBlocks == nullptr) {
+		return NewBlock(kBlockSize, false);
+	}
+
+	Block *const block = m_spareBlocks;
+	m_spareBlocks = block->NextFree;
+
+	block->NextFree = nullptr;
+	block->Used = 0;
+	block->State.store(0, std::memory_order_relaxed);
+	return block;
+}
+
+void TaskArena::RetireCurrentBlock() {
+	Block *const block = m_current;
+	if (block == nullptr) {
+		return;
+	}
+	m_current = nullptr;
+
+	// From now on, the last Free() recycles the block. If there are no live allocations, that's us
+	uint64_t const previous = block->State.fetch_or(kRetiredBit, std::memory_order_acq_rel);
+	if (previous == 0) {
+		block->NextFree = m_spareBlocks;
+		m_spareBlocks = block;
+	}
+}
+
+void TaskArena::PushFreeBlock(Block *const block) {
+	Block *head = m_freeBlocks.load(std::memory_order_relaxed);
+	do {
+		block->NextFree = head;
+	} while (!m_freeBlocks.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+}
+
+} // End of namespace ftl
@@ -0,0 +1,103 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/task_graph.h"
+
+#include "ftl/assert.h"
+#include "ftl/task_scheduler.h"
+
+namespace ftl {
+
+TaskGraph::TaskGraph(TaskScheduler *taskScheduler)
+        : m_taskScheduler(taskScheduler) {
+}
+
+unsigned TaskGraph::AddNode(Task const task, TaskPriority const priority) {
+	FTL_ASSERT("Task given to TaskGraph::AddNode has a nullptr Function", task.Function != nullptr);
+
+	m_nodes.emplace_back(m_taskScheduler, task, priority);
+	m_rootsDirty = true;
+
+	return static_cast<unsigned>(m_nodes.size() - 1);
+}
+
+void TaskGraph::AddDependency(unsigned const before, unsigned const after) {
+	FTL_ASSERT("TaskGraph node index out of range", before < m_nodes.size() && after < m_nodes.size());
+	FTL_ASSERT("A TaskGraph node can't depend on itself", before != after);
+
+	m_nodes[before].Successors.push_back(&m_nodes[after]);
+	++m_nodes[after].PredecessorCount;
+	m_rootsDirty = true;
+}
+
+void TaskGraph::Submit(TaskCounter *const counter) {
+	if (m_rootsDirty) {
+		m_hiPriRoots.clear();
+		m_loPriRoots.clear();
+		for (Node &node : m_nodes) {
+			if (node.PredecessorCount == 0) {
+				Task const task = {NodeEntry, &node};
+				if (node.Priority == TaskPriority::High) {
+					m_hiPriRoots.push_back(task);
+				} else {
+					m_loPriRoots.push_back(task);
+				}
+			}
+		}
+		m_rootsDirty = false;
+	}
+
+	// Every non-root node has to be waiting before any node can finish, and decrement its successors
+	for (Node &node : m_nodes) {
+		if (node.PredecessorCount != 0) {
+			node.UnfinishedPredecessors.Add(node.PredecessorCount);
+			m_taskScheduler->AddContinuation(&node.UnfinishedPredecessors, {NodeEntry, &node}, node.Priority, counter);
+		}
+	}
+
+	if (!m_hiPriRoots.empty()) {
+		m_taskScheduler->AddTasks(static_cast<unsigned>(m_hiPriRoots.size()), m_hiPriRoots.data(), TaskPriority::High, counter);
+	}
+	if (!m_loPriRoots.empty()) {
+		m_taskScheduler->AddTasks(static_cast<unsigned>(m_loPriRoots.size()), m_loPriRoots.data(), TaskPriority::Low, counter);
+	}
+}
+
+void TaskGraph::Run(bool const pinToCurrentThread) {
+	TaskCounter counter(m_taskScheduler);
+	Submit(&counter);
+	m_taskScheduler->WaitForCounter(&counter, pinToCurrentThread);
+}
+
+void TaskGraph::NodeEntry(TaskScheduler *taskScheduler, void *arg) {
+	auto *const node = static_cast<Node *>(arg);
+	node->TaskToExecute.Function(taskScheduler, node->TaskToExecute.ArgData);
+
+	// The last predecessor to finish queues the successor, from inside TaskCounter::Decrement()
+	for (Node *const successor : node->Successors) {
+		successor->UnfinishedPredecessors.Decrement();
+	}
+}
+
+} // End of namespace ftl
@@ -29,6 +29,11 @@
 #include "ftl/task_counter.h"
 #include "ftl/thread_abstraction.h"
 
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+#include <new>
+
 #if defined(FTL_WIN32_THREADS)
 #	ifndef WIN32_LEAN_AND_MEAN
 #		define WIN32_LEAN_AND_MEAN
@@ -44,6 +49,10 @@
 namespace ftl {
 
 constexpr static unsigned kFailedPopAttemptsHeuristic = 5;
+/* The fiber cache is sized so at most 1 / kFiberCacheShare of the pool can sit in thread caches */
+constexpr static unsigned kFiberCacheShare = 4;
+/* How many times to retry acquiring a fiber before warning about a possible deadlock */
+constexpr static unsigned kFiberStallWarningRetries = 1000000;
 constexpr static int kInitErrorDoubleCall = -30;
 constexpr static int kInitErrorFailedToCreateWorkerThread = -60;
 
@@ -52,6 +61,16 @@ struct ThreadStartArgs {
 	unsigned ThreadIndex;
 };
 
+/**
+ * The scheduler that owns the current thread, and the index of the thread within it
+ * Set by BindCurrentThread() when a worker thread starts, or when Init() binds the main thread
+ */
+struct CurrentThreadBinding {
+	TaskScheduler const *Scheduler;
+	unsigned Index;
+};
+static thread_local CurrentThreadBinding tl_currentThread{nullptr, std::numeric_limits<unsigned>::max()};
+
 FTL_THREAD_FUNC_RETURN_TYPE TaskScheduler::ThreadStartFunc(void *const arg) {
 	auto *const threadArgs = reinterpret_cast<ThreadStartArgs *>(arg);
 	TaskScheduler *taskScheduler = threadArgs->Scheduler;
@@ -60,6 +79,8 @@ FTL_THREAD_FUNC_RETURN_TYPE TaskScheduler::ThreadStartFunc(void *const arg) {
 	// Clean up
 	delete threadArgs;
 
+	taskScheduler->BindCurrentThread(index);
+
 	// Spin wait until everything is initialized
 	while (!taskScheduler->m_initialized.load(std::memory_order_acquire)) {
 		// Spin
@@ -92,14 +113,6 @@ FTL_THREAD_FUNC_RETURN_TYPE TaskScheduler::ThreadStartFunc(void *const arg) {
 	FTL_THREAD_FUNC_END;
 }
 
-// This Task is never used directly
-// However, a function pointer to it is the signal that the task is a Ready fiber, not a "real" task
-// See @FiberStartFunc() for more details
-static void ReadyFiberDummyTask(TaskScheduler *taskScheduler, void *arg) {
-	(void)taskScheduler;
-	(void)arg;
-}
-
 void TaskScheduler::FiberStartFunc(void *const arg) {
 	TaskScheduler *taskScheduler = reinterpret_cast<TaskScheduler *>(arg);
 
@@ -110,51 +123,22 @@ void TaskScheduler::FiberStartFunc(void *const arg) {
 	// If we just started from the pool, we may need to clean up from another fiber
 	taskScheduler->CleanUpOldFiber();
 
-	std::vector<TaskBundle> taskBuffer;
-
 	// Process tasks infinitely, until quit
 	while (!taskScheduler->m_quit.load(std::memory_order_acquire)) {
 		unsigned waitingFiberIndex = kInvalidIndex;
 		ThreadLocalStorage *tls = &taskScheduler->m_tls[taskScheduler->GetCurrentThreadIndex()];
 
-		bool readyWaitingFibers = false;
-
-		// Check if there is a ready pinned waiting fiber
-		{
-			std::lock_guard<std::mutex> guard(tls->PinnedReadyFibersLock);
-
-			for (auto bundle = tls->PinnedReadyFibers.begin(); bundle != tls->PinnedReadyFibers.end(); ++bundle) {
-				readyWaitingFibers = true;
-
-				if (!(*bundle)->FiberIsSwitched.load(std::memory_order_acquire)) {
-					// The wait condition is ready, but the "source" thread hasn't switched away from the fiber yet
-					// Skip this fiber until the next round
-					continue;
-				}
-
-				waitingFiberIndex = (*bundle)->FiberIndex;
-				tls->PinnedReadyFibers.erase(bundle);
-				break;
-			}
+		// If another thread ran out of fibers, give back the ones we're hoarding
+		if (taskScheduler->m_fiberPoolStarvedThreads.load(std::memory_order_relaxed) != 0) {
+			taskScheduler->FlushFiberCache(tls->FiberCacheCount.load(std::memory_order_relaxed));
 		}
 
-		TaskBundle nextTask{};
-		bool foundTask = false;
-
-		// If nothing was found, check if there is a high priority task to run
-		if (waitingFiberIndex == kInvalidIndex) {
-			foundTask = taskScheduler->GetNextHiPriTask(&nextTask, &taskBuffer);
-
-			// Check if the found task is a ReadyFiber dummy task
-			if (foundTask && nextTask.TaskToExecute.Function == ReadyFiberDummyTask) {
-				// Get the waiting fiber index
-				ReadyFiberBundle *readyFiberBundle = reinterpret_cast<ReadyFiberBundle *>(nextTask.TaskToExecute.ArgData);
-				waitingFiberIndex = readyFiberBundle->FiberIndex;
-			}
-		}
+		// Waiting fibers that are ready to resume take priority over new tasks
+		waitingFiberIndex = taskScheduler->GetNextReadyFiber();
 
 		if (waitingFiberIndex != kInvalidIndex) {
 			// Found a waiting task that is ready to continue
+			RecordReadyFiberResumed(*tls, taskScheduler->m_readyFiberBundles[waitingFiberIndex]);
 
 			tls->OldFiberIndex = tls->CurrentFiberIndex;
 			tls->CurrentFiberIndex = waitingFiberIndex;
@@ -180,10 +164,16 @@ void TaskScheduler::FiberStartFunc(void *const arg) {
 
 			if (taskScheduler->m_emptyQueueBehavior.load(std::memory_order::memory_order_relaxed) == EmptyQueueBehavior::Sleep) {
 				tls->FailedQueuePopAttempts = 0;
+				tls->WokenWithoutWork = false;
 			}
 		} else {
+			TaskBundle nextTask{};
+			TaskPriority foundPriority = TaskPriority::High;
+			bool foundTask = taskScheduler->GetNextHiPriTask(&nextTask);
+
 			// If we didn't find a high priority task, look for a low priority task
 			if (!foundTask) {
+				foundPriority = TaskPriority::Low;
 				foundTask = taskScheduler->GetNextLoPriTask(&nextTask);
 			}
 
@@ -192,14 +182,30 @@ void TaskScheduler::FiberStartFunc(void *const arg) {
 			if (foundTask) {
 				if (behavior == EmptyQueueBehavior::Sleep) {
 					tls->FailedQueuePopAttempts = 0;
+					tls->WokenWithoutWork = false;
+				}
+
+				RecordTaskRun(*tls, foundPriority);
+
+				const EventCallbacks &callbacks = taskScheduler->m_callbacks;
+				if (callbacks.OnTaskStateChanged != nullptr) {
+					callbacks.OnTaskStateChanged(callbacks.Context, tls->CurrentFiberIndex, nextTask.TaskToExecute.Function, nextTask.Counter, TaskState::Started);
 				}
 
-				nextTask.TaskToExecute.Function(taskScheduler, nextTask.TaskToExecute.ArgData);
+				void *const taskArg = nextTask.HasInlineArgs ? static_cast<void *>(nextTask.InlineArgs) : nextTask.TaskToExecute.ArgData;
+				nextTask.TaskToExecute.Function(taskScheduler, taskArg);
+
+				// The task may have waited, and been resumed on another thread
+				if (callbacks.OnTaskStateChanged != nullptr) {
+					callbacks.OnTaskStateChanged(callbacks.Context, taskScheduler->GetCurrentFiberIndex(), nextTask.TaskToExecute.Function, nextTask.Counter, TaskState::Finished);
+				}
 				if (nextTask.Counter != nullptr) {
 					nextTask.Counter->Decrement();
 				}
 			} else {
 				// We failed to find a Task from any of the queues
+				RecordFailedPop(*tls);
+
 				// What we do now depends on m_emptyQueueBehavior, which we loaded above
 				switch (behavior) {
 				case EmptyQueueBehavior::Yield:
@@ -207,24 +213,11 @@ void TaskScheduler::FiberStartFunc(void *const arg) {
 					break;
 
 				case EmptyQueueBehavior::Sleep: {
-					// If we have a ready waiting fiber, prevent sleep
-					if (!readyWaitingFibers) {
-						++tls->FailedQueuePopAttempts;
-						// Go to sleep if we've failed to find a task kFailedPopAttemptsHeuristic times
-						if (tls->FailedQueuePopAttempts >= kFailedPopAttemptsHeuristic) {
-							std::unique_lock<std::mutex> lock(taskScheduler->ThreadSleepLock);
-							// Acquire the pinned ready fibers lock here and check if there are any pinned fibers ready
-							// Acquiring the lock here prevents a race between readying a pinned fiber (on another thread) and going to sleep
-							// Either this thread wins, then notify_*() will wake it
-							// Or the other thread wins, then this thread will observe the pinned fiber, and will not go to sleep
-							std::unique_lock<std::mutex> readyfiberslock(tls->PinnedReadyFibersLock);
-							if (tls->PinnedReadyFibers.empty()) {
-								// Unlock before going to sleep (the other lock is released by the CV wait)
-								readyfiberslock.unlock();
-								taskScheduler->ThreadSleepCV.wait(lock);
-							}
-							tls->FailedQueuePopAttempts = 0;
-						}
+					++tls->FailedQueuePopAttempts;
+					// Go to sleep if we've failed to find a task kFailedPopAttemptsHeuristic times
+					if (tls->FailedQueuePopAttempts >= kFailedPopAttemptsHeuristic) {
+						taskScheduler->ParkCurrentThread(taskScheduler->GetCurrentThreadIndex());
+						tls->FailedQueuePopAttempts = 0;
 					}
 
 					break;
@@ -278,6 +271,7 @@ TaskScheduler::TaskScheduler() {
 	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_initialized, sizeof(m_initialized));
 	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_quit, sizeof(m_quit));
 	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_quitCount, sizeof(m_quitCount));
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_idleThreadCount, sizeof(m_idleThreadCount));
 }
 
 int TaskScheduler::Init(TaskSchedulerInitOptions options) {
@@ -299,18 +293,40 @@ int TaskScheduler::Init(TaskSchedulerInitOptions options) {
 	}
 
 	// Create and populate the fiber pool
-	m_fiberPoolSize = options.FiberPoolSize;
-	m_fibers = new Fiber[options.FiberPoolSize];
-	m_freeFibers = new std::atomic<bool>[options.FiberPoolSize];
-	FTL_VALGRIND_HG_DISABLE_CHECKING(m_freeFibers, sizeof(std::atomic<bool>) * m_fiberPoolSize);
-	m_readyFiberBundles = new ReadyFiberBundle[options.FiberPoolSize];
+	// We allocate the arrays for the maximum size up front, so growing the pool never moves a fiber
+	m_fiberPoolSize = std::max(options.FiberPoolSize, options.FiberPoolMaxSize);
+	m_fiberStackSize = options.FiberStackSize;
+	m_fiberStackAllocation = options.StackAllocation;
+	m_trackFiberStackUsage = options.TrackFiberStackUsage;
+	m_fibers = new Fiber[m_fiberPoolSize];
+	m_fiberCreated = new std::atomic<bool>[m_fiberPoolSize];
+	FTL_VALGRIND_HG_DISABLE_CHECKING(m_fiberCreated, sizeof(std::atomic<bool>) * m_fiberPoolSize);
+	m_freeFiberNext = new std::atomic<unsigned>[m_fiberPoolSize];
+	FTL_VALGRIND_HG_DISABLE_CHECKING(m_freeFiberNext, sizeof(std::atomic<unsigned>) * m_fiberPoolSize);
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_freeFiberHead, sizeof(m_freeFiberHead));
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_freeFiberCount, sizeof(m_freeFiberCount));
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&m_allocatedFibers, sizeof(m_allocatedFibers));
+	m_readyFiberBundles = new ReadyFiberBundle[m_fiberPoolSize];
 
 	// Leave the first slot for the bound main thread
 	for (unsigned i = 1; i < options.FiberPoolSize; ++i) {
-		m_fibers[i] = Fiber(524288, FiberStartFunc, this);
-		m_freeFibers[i].store(true, std::memory_order_release);
+		m_fibers[i] = Fiber(m_fiberStackSize, FiberStartFunc, this, m_fiberStackAllocation, m_trackFiberStackUsage);
+	}
+	for (unsigned i = 0; i < m_fiberPoolSize; ++i) {
+		m_fiberCreated[i].store(i < options.FiberPoolSize, std::memory_order_relaxed);
+	}
+	m_allocatedFibers.store(options.FiberPoolSize, std::memory_order_release);
+
+	// Link all the free fibers into the global list, so that the lowest indices are popped first
+	m_freeFiberHead.store(kInvalidIndex, std::memory_order_relaxed);
+	if (options.FiberPoolSize > 1) {
+		for (unsigned i = 1; i < options.FiberPoolSize - 1; ++i) {
+			m_freeFiberNext[i].store(i + 1, std::memory_order_relaxed);
+		}
+		m_freeFiberNext[options.FiberPoolSize - 1].store(kInvalidIndex, std::memory_order_relaxed);
+		m_freeFiberHead.store(1, std::memory_order_release);
+		m_freeFiberCount.store(options.FiberPoolSize - 1, std::memory_order_release);
 	}
-	m_freeFibers[0].store(false, std::memory_order_release);
 
 	// Initialize threads and TLS
 	m_threads = new ThreadType[m_numThreads];
@@ -323,6 +339,17 @@ int TaskScheduler::Init(TaskSchedulerInitOptions options) {
 #	pragma warning(pop)
 #endif // _MSC_VER
 
+	// The idle thread registry. One bit per thread
+	m_idleThreadMaskWords = (m_numThreads + 63) / 64;
+	m_idleThreadMask = new std::atomic<uint64_t>[m_idleThreadMaskWords];
+	for (unsigned i = 0; i < m_idleThreadMaskWords; ++i) {
+		m_idleThreadMask[i].store(0, std::memory_order_relaxed);
+	}
+	FTL_VALGRIND_HG_DISABLE_CHECKING(m_idleThreadMask, sizeof(std::atomic<uint64_t>) * m_idleThreadMaskWords);
+
+	// Size the caches so a handful of threads can't hoard the whole pool
+	m_fiberCacheSize = std::min(kMaxFiberCacheSize, options.FiberPoolSize / (m_numThreads * kFiberCacheShare));
+
 #if defined(FTL_WIN32_THREADS)
 	// Temporarily set the main thread ID to -1, so when the worker threads start up, they don't accidentally use it
 	// I don't know if Windows thread id's can ever be 0, but just in case.
@@ -333,11 +360,13 @@ int TaskScheduler::Init(TaskSchedulerInitOptions options) {
 		m_callbacks.OnThreadsCreated(m_callbacks.Context, m_numThreads);
 	}
 	if (m_callbacks.OnFibersCreated != nullptr) {
-		m_callbacks.OnFibersCreated(m_callbacks.Context, options.FiberPoolSize);
+		m_callbacks.OnFibersCreated(m_callbacks.Context, m_fiberPoolSize);
 	}
 
+	InitThreadPinning(options.Pinning);
+
 	// Set the properties for the current thread
-	SetCurrentThreadAffinity(0);
+	SetCurrentThreadAffinity(m_threadCpus[0] != kInvalidIndex ? m_threadCpus[0] : 0);
 	m_threads[0] = GetCurrentThread();
 #if defined(FTL_WIN32_THREADS)
 	// Set the thread handle to INVALID_HANDLE_VALUE
@@ -348,6 +377,7 @@ int TaskScheduler::Init(TaskSchedulerInitOptions options) {
 	// Reported by @rtj
 	m_threads[0].Handle = INVALID_HANDLE_VALUE;
 #endif
+	BindCurrentThread(0);
 
 	// Set the fiber index
 	m_tls[0].CurrentFiberIndex = 0;
@@ -361,7 +391,9 @@ int TaskScheduler::Init(TaskSchedulerInitOptions options) {
 		char threadName[256];
 		snprintf(threadName, sizeof(threadName), "FTL Worker Thread %u", i);
 
-		if (!CreateThread(524288, ThreadStartFunc, threadArgs, threadName, &m_threads[i])) {
+		bool const created = m_threadCpus[i] != kInvalidIndex ? CreateThread(524288, ThreadStartFunc, threadArgs, threadName, m_threadCpus[i], &m_threads[i])
+		                                                      : CreateThread(524288, ThreadStartFunc, threadArgs, threadName, &m_threads[i]);
+		if (!created) {
 			return kInitErrorFailedToCreateWorkerThread;
 		}
 	}
@@ -388,9 +420,7 @@ TaskScheduler::~TaskScheduler() {
 	m_quit.store(true, std::memory_order_release);
 
 	// Signal any waiting threads so they can finish
-	if (m_emptyQueueBehavior.load(std::memory_order_relaxed) == EmptyQueueBehavior::Sleep) {
-		ThreadSleepCV.notify_all();
-	}
+	WakeIdleThreads(m_numThreads);
 
 	// Jump to the quit fiber
 	// Create a scope so index isn't used after we come back from the switch. It will be wrong if we started on a non-main thread
@@ -411,13 +441,31 @@ TaskScheduler::~TaskScheduler() {
 	}
 
 	// Cleanup
+	// Tasks injected after the workers stopped looking. They never ran, like anything left in the worker queues
+	for (std::atomic<InjectedTaskBatch *> *head : {&m_injectedHiPriTasks, &m_injectedLoPriTasks}) {
+		InjectedTaskBatch *batch = head->exchange(nullptr, std::memory_order_acquire);
+		while (batch != nullptr) {
+			InjectedTaskBatch *const next = batch->Next;
+			InjectedTaskBatch::Destroy(batch);
+			batch = next;
+		}
+	}
+
 	delete[] m_tls;
 	delete[] m_threads;
 	delete[] m_readyFiberBundles;
-	delete[] m_freeFibers;
+	delete[] m_freeFiberNext;
+	delete[] m_fiberCreated;
 	delete[] m_fibers;
+	delete[] m_idleThreadMask;
 
 	delete[] m_quitFibers;
+
+	// Unbind the main thread, in case another TaskScheduler is later created at the same address
+	if (tl_currentThread.Scheduler == this) {
+		tl_currentThread.Scheduler = nullptr;
+		tl_currentThread.Index = kInvalidIndex;
+	}
 }
 
 void TaskScheduler::AddTask(Task const task, TaskPriority priority, TaskCounter *const counter) {
@@ -426,18 +474,30 @@ void TaskScheduler::AddTask(Task const task, TaskPriority priority, TaskCounter
 	if (counter != nullptr) {
 		counter->Add(1);
 	}
+	if (m_callbacks.OnTasksAdded != nullptr) {
+		m_callbacks.OnTasksAdded(m_callbacks.Context, GetCurrentFiberIndex(), counter, 1);
+	}
 
-	const TaskBundle bundle = {task, counter};
+	const TaskBundle bundle = {task, counter, false, {}};
+	unsigned const threadIndex = GetCurrentThreadIndex();
+	if (threadIndex == kInvalidIndex) {
+		InjectedTaskBatch *const batch = InjectedTaskBatch::Create(1);
+		batch->Tasks()[0] = bundle;
+		InjectTasks(batch, priority);
+		return;
+	}
+
+	ThreadLocalStorage &tls = m_tls[threadIndex];
 	if (priority == TaskPriority::High) {
-		m_tls[GetCurrentThreadIndex()].HiPriTaskQueue.Push(bundle);
+		RecordQueueDepth(tls, priority, tls.HiPriTaskQueue.Push(bundle));
 	} else if (priority == TaskPriority::Low) {
-		m_tls[GetCurrentThreadIndex()].LoPriTaskQueue.Push(bundle);
+		RecordQueueDepth(tls, priority, tls.LoPriTaskQueue.Push(bundle));
 	}
 
 	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
 	if (behavior == EmptyQueueBehavior::Sleep) {
 		// Wake a sleeping thread
-		ThreadSleepCV.notify_one();
+		WakeIdleThreads(1);
 	}
 }
 
@@ -445,32 +505,274 @@ void TaskScheduler::AddTasks(unsigned const numTasks, Task const *const tasks, T
 	if (counter != nullptr) {
 		counter->Add(numTasks);
 	}
+	if (m_callbacks.OnTasksAdded != nullptr) {
+		m_callbacks.OnTasksAdded(m_callbacks.Context, GetCurrentFiberIndex(), counter, numTasks);
+	}
 
+	unsigned const threadIndex = GetCurrentThreadIndex();
+	if (threadIndex == kInvalidIndex) {
+		InjectedTaskBatch *const batch = InjectedTaskBatch::Create(numTasks);
+		for (unsigned i = 0; i < numTasks; ++i) {
+			FTL_ASSERT("Task given to TaskScheduler:AddTasks has a nullptr Function", tasks[i].Function != nullptr);
+			batch->Tasks()[i] = TaskBundle{tasks[i], counter, false, {}};
+		}
+		InjectTasks(batch, priority);
+		return;
+	}
+
+	ThreadLocalStorage &tls = m_tls[threadIndex];
 	WaitFreeQueue<TaskBundle> *queue = nullptr;
 	if (priority == TaskPriority::High) {
-		queue = &m_tls[GetCurrentThreadIndex()].HiPriTaskQueue;
+		queue = &tls.HiPriTaskQueue;
 	} else if (priority == TaskPriority::Low) {
-		queue = &m_tls[GetCurrentThreadIndex()].LoPriTaskQueue;
+		queue = &tls.LoPriTaskQueue;
 	} else {
 		FTL_ASSERT("Unknown task priority", false);
 		return;
 	}
-	for (unsigned i = 0; i < numTasks; ++i) {
+	// Publish all the tasks at once
+	size_t const queueDepth = queue->PushBatch(numTasks, [tasks, counter](size_t const i) {
 		FTL_ASSERT("Task given to TaskScheduler:AddTasks has a nullptr Function", tasks[i].Function != nullptr);
-		const TaskBundle bundle = {tasks[i], counter};
-		queue->Push(bundle);
+		return TaskBundle{tasks[i], counter, false, {}};
+	});
+	RecordQueueDepth(tls, priority, queueDepth);
+
+	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+	if (behavior == EmptyQueueBehavior::Sleep) {
+		// Wake one sleeping thread per task. The rest can stay asleep
+		WakeIdleThreads(numTasks);
+	}
+}
+
+TaskScheduler::ThreadLocalStorage *TaskScheduler::BeginAddTasks(unsigned const numTasks, TaskCounter *const counter) {
+	if (counter != nullptr) {
+		counter->Add(numTasks);
 	}
+	if (m_callbacks.OnTasksAdded != nullptr) {
+		m_callbacks.OnTasksAdded(m_callbacks.Context, GetCurrentFiberIndex(), counter, numTasks);
+	}
+
+	unsigned const threadIndex = GetCurrentThreadIndex();
+	return threadIndex == kInvalidIndex ? nullptr : &m_tls[threadIndex];
+}
+
+void TaskScheduler::EndAddTasks(ThreadLocalStorage &tls, unsigned const numTasks, TaskPriority const priority, size_t const queueDepth) {
+	RecordQueueDepth(tls, priority, queueDepth);
 
 	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
 	if (behavior == EmptyQueueBehavior::Sleep) {
-		// Wake all the threads
-		ThreadSleepCV.notify_all();
+		WakeIdleThreads(numTasks);
 	}
 }
 
-#if defined(FTL_WIN32_THREADS)
+TaskScheduler::InjectedTaskBatch *TaskScheduler::InjectedTaskBatch::Create(unsigned const numTasks) {
+	FTL_ASSERT("An injected batch needs at least one task", numTasks > 0);
+
+	void *const memory = ::operator new(sizeof(InjectedTaskBatch) + sizeof(TaskBundle) * numTasks);
+	auto *const batch = new (memory) InjectedTaskBatch();
+	batch->Next = nullptr;
+	batch->NumTasks = numTasks;
+	for (unsigned i = 0; i < numTasks; ++i) {
+		new (&batch->Tasks()[i]) TaskBundle;
+	}
+
+	return batch;
+}
+
+void TaskScheduler::InjectedTaskBatch::Destroy(InjectedTaskBatch *const batch) {
+	// The header and the tasks are trivially destructible
+	::operator delete(batch);
+}
+
+void TaskScheduler::InjectTasks(InjectedTaskBatch *const batch, TaskPriority const priority) {
+	FTL_ASSERT("Unknown task priority", priority == TaskPriority::High || priority == TaskPriority::Low);
+
+	// Read this first. A worker can take the batch, and free it, as soon as it's pushed
+	unsigned const numTasks = batch->NumTasks;
+
+	std::atomic<InjectedTaskBatch *> &head = priority == TaskPriority::High ? m_injectedHiPriTasks : m_injectedLoPriTasks;
+	InjectedTaskBatch *next = head.load(std::memory_order_relaxed);
+	do {
+		batch->Next = next;
+	} while (!head.compare_exchange_weak(next, batch, std::memory_order_release, std::memory_order_relaxed));
+
+	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+	if (behavior == EmptyQueueBehavior::Sleep) {
+		WakeIdleThreads(numTasks);
+	}
+}
+
+bool TaskScheduler::TakeInjectedTasks(ThreadLocalStorage &tls, TaskPriority const priority, TaskBundle *nextTask) {
+	std::atomic<InjectedTaskBatch *> &head = priority == TaskPriority::High ? m_injectedHiPriTasks : m_injectedLoPriTasks;
+	// Check before the exchange, so idle workers don't fight over the cache line when there's nothing there
+	if (head.load(std::memory_order_relaxed) == nullptr) {
+		return false;
+	}
+	InjectedTaskBatch *batch = head.exchange(nullptr, std::memory_order_acquire);
+	if (batch == nullptr) {
+		return false;
+	}
+
+	// Publish everything to our own queue. The other threads can steal from there
+	WaitFreeQueue<TaskBundle> &queue = priority == TaskPriority::High ? tls.HiPriTaskQueue : tls.LoPriTaskQueue;
+	unsigned numTasks = 0;
+	size_t queueDepth = 0;
+	while (batch != nullptr) {
+		InjectedTaskBatch *const next = batch->Next;
+		TaskBundle *const tasks = batch->Tasks();
+		queueDepth = queue.PushBatch(batch->NumTasks, [tasks](size_t const i) {
+			return tasks[i];
+		});
+		numTasks += batch->NumTasks;
+		InjectedTaskBatch::Destroy(batch);
+		batch = next;
+	}
+	RecordQueueDepth(tls, priority, queueDepth);
+
+	// InjectTasks() woke enough threads for all the tasks. But they may have gone back to sleep before we got here
+	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+	if (behavior == EmptyQueueBehavior::Sleep && numTasks > 1) {
+		WakeIdleThreads(numTasks - 1);
+	}
+
+	return queue.Pop(nextTask);
+}
+
+bool TaskScheduler::TakeInjectedReadyFibers(ThreadLocalStorage &tls) {
+	if (m_injectedReadyFibers.load(std::memory_order_relaxed) == nullptr) {
+		return false;
+	}
+	ReadyFiberBundle *bundle = m_injectedReadyFibers.exchange(nullptr, std::memory_order_acquire);
+	if (bundle == nullptr) {
+		return false;
+	}
+
+	unsigned numFibers = 0;
+	while (bundle != nullptr) {
+		// Read the link first. Once the fiber is in our queue, it can be stolen, resumed, and wait again
+		ReadyFiberBundle *const next = bundle->NextInjected;
+		tls.ReadyFibers.Push(bundle->FiberIndex);
+		++numFibers;
+		bundle = next;
+	}
+
+	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+	if (behavior == EmptyQueueBehavior::Sleep && numFibers > 1) {
+		WakeIdleThreads(numFibers - 1);
+	}
+
+	return true;
+}
+
+void TaskScheduler::AddContinuation(TaskCounter *const counter, Task const task, TaskPriority const priority, TaskCounter *const continuationCounter) {
+	FTL_ASSERT("Task given to TaskScheduler:AddContinuation has a nullptr Function", task.Function != nullptr);
+
+	ContinuationBundle *const continuation = BeginAddContinuation(priority, continuationCounter);
+	continuation->Bundle = {task, continuationCounter, false, {}};
+	EndAddContinuation(counter, continuation);
+}
+
+void TaskScheduler::AddContinuation(FullAtomicCounter *const counter, unsigned const value, Task const task, TaskPriority const priority, TaskCounter *const continuationCounter) {
+	FTL_ASSERT("Task given to TaskScheduler:AddContinuation has a nullptr Function", task.Function != nullptr);
+
+	ContinuationBundle *const continuation = BeginAddContinuation(priority, continuationCounter);
+	continuation->Bundle = {task, continuationCounter, false, {}};
+	EndAddContinuation(counter, value, continuation);
+}
+
+TaskScheduler::ContinuationBundle *TaskScheduler::BeginAddContinuation(TaskPriority const priority, TaskCounter *const continuationCounter) {
+	// Count the continuation before it's visible to anyone. Otherwise, waiting on continuationCounter could return
+	// before the continuation has even been queued
+	if (continuationCounter != nullptr) {
+		continuationCounter->Add(1);
+	}
+
+	TaskArena *const arena = GetCurrentThreadArena();
+	ContinuationBundle *continuation;
+	if (arena == nullptr) {
+		continuation = new ContinuationBundle();
+		continuation->OnHeap = true;
+	} else {
+		void *const memory = arena->Allocate(sizeof(ContinuationBundle), alignof(ContinuationBundle));
+		continuation = new (memory) ContinuationBundle();
+	}
+	continuation->Priority = priority;
+
+	return continuation;
+}
+
+void TaskScheduler::EndAddContinuation(TaskCounter *const counter, ContinuationBundle *const continuation) {
+	EndAddContinuationInternal(counter, 0, continuation);
+}
+
+void TaskScheduler::EndAddContinuation(FullAtomicCounter *const counter, unsigned const value, ContinuationBundle *const continuation) {
+	EndAddContinuationInternal(counter, value, continuation);
+}
+
+void TaskScheduler::EndAddContinuationInternal(BaseCounter *const counter, unsigned const value, ContinuationBundle *const continuation) {
+	// A nullptr FiberBundle is what marks the node as a continuation
+	continuation->FiberBundle = nullptr;
+	continuation->TargetValue = value;
+
+	if (counter->AddToWaitingList(continuation)) {
+		// The counter was already at the target value
+		ReadyContinuation(continuation);
+	}
+}
+
+void TaskScheduler::ReadyContinuation(BaseCounter::WaitingFiberBundle *const node) {
+	auto *const continuation = static_cast<ContinuationBundle *>(node);
+	TaskBundle const bundle = continuation->Bundle;
+	TaskPriority const priority = continuation->Priority;
+
+	if (continuation->OnHeap) {
+		delete continuation;
+	} else {
+		continuation->~ContinuationBundle();
+		TaskArena::Free(continuation);
+	}
+
+	if (m_callbacks.OnTasksAdded != nullptr) {
+		m_callbacks.OnTasksAdded(m_callbacks.Context, GetCurrentFiberIndex(), bundle.Counter, 1);
+	}
+
+	// A thread we don't own brought the counter to the target value. It has no queue to push to
+	unsigned const threadIndex = GetCurrentThreadIndex();
+	if (threadIndex == kInvalidIndex) {
+		InjectedTaskBatch *const batch = InjectedTaskBatch::Create(1);
+		batch->Tasks()[0] = bundle;
+		InjectTasks(batch, priority);
+		return;
+	}
+
+	ThreadLocalStorage &tls = m_tls[threadIndex];
+	if (priority == TaskPriority::High) {
+		RecordQueueDepth(tls, priority, tls.HiPriTaskQueue.Push(bundle));
+	} else {
+		RecordQueueDepth(tls, priority, tls.LoPriTaskQueue.Push(bundle));
+	}
+
+	const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+	if (behavior == EmptyQueueBehavior::Sleep) {
+		WakeIdleThreads(1);
+	}
+}
 
 FTL_NOINLINE unsigned TaskScheduler::GetCurrentThreadIndex() const {
+	// Fast path. Worker threads, and the thread that called Init(), cache their index
+	// This *must* be re-read on every call, since a fiber may have migrated to another thread since the last call
+	// The FTL_NOINLINE guarantees that
+	if (tl_currentThread.Scheduler == this) {
+		return tl_currentThread.Index;
+	}
+
+	// Slow path. This thread is either not owned by this scheduler, or it's owned by another TaskScheduler instance
+	return FindCurrentThreadIndex();
+}
+
+#if defined(FTL_WIN32_THREADS)
+
+unsigned TaskScheduler::FindCurrentThreadIndex() const {
 	DWORD const threadId = ::GetCurrentThreadId();
 	for (unsigned i = 0; i < m_numThreads; ++i) {
 		if (m_threads[i].Id == threadId) {
@@ -483,7 +785,7 @@ FTL_NOINLINE unsigned TaskScheduler::GetCurrentThreadIndex() const {
 
 #elif defined(FTL_POSIX_THREADS)
 
-FTL_NOINLINE unsigned TaskScheduler::GetCurrentThreadIndex() const {
+unsigned TaskScheduler::FindCurrentThreadIndex() const {
 	pthread_t const currentThread = pthread_self();
 	for (unsigned i = 0; i < m_numThreads; ++i) {
 		if (pthread_equal(currentThread, m_threads[i]) != 0) {
@@ -496,141 +798,416 @@ FTL_NOINLINE unsigned TaskScheduler::GetCurrentThreadIndex() const {
 
 #endif
 
+void TaskScheduler::BindCurrentThread(unsigned const threadIndex) {
+	tl_currentThread.Scheduler = this;
+	tl_currentThread.Index = threadIndex;
+}
+
 unsigned TaskScheduler::GetCurrentFiberIndex() const {
-	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+	unsigned const threadIndex = GetCurrentThreadIndex();
+	if (threadIndex == kInvalidIndex) {
+		return kInvalidIndex;
+	}
+
+	ThreadLocalStorage &tls = m_tls[threadIndex];
 	return tls.CurrentFiberIndex;
 }
 
-inline bool TaskScheduler::TaskIsReadyToExecute(TaskBundle *bundle) const {
-	// "Real" tasks are always ready to execute
-	if (bundle->TaskToExecute.Function != ReadyFiberDummyTask) {
-		return true;
+TaskArena *TaskScheduler::GetCurrentThreadArena() const {
+	unsigned const threadIndex = GetCurrentThreadIndex();
+	return threadIndex == kInvalidIndex ? nullptr : &m_tls[threadIndex].Arena;
+}
+
+// Per-thread stats are only written by the owning thread, so they don't need a RMW
+static void IncrementStat(std::atomic<uint64_t> *stat, uint64_t const value = 1) {
+	stat->store(stat->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static int64_t SteadyClockNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if FTL_TELEMETRY
+static void UpdateMaxStat(std::atomic<uint64_t> *stat, uint64_t const value) {
+	if (value > stat->load(std::memory_order_relaxed)) {
+		stat->store(value, std::memory_order_relaxed);
 	}
+}
+#endif
 
-	// If it's a ready fiber task, the arg is a ReadyFiberBundle
-	ReadyFiberBundle *readyFiberBundle = reinterpret_cast<ReadyFiberBundle *>(bundle->TaskToExecute.ArgData);
-	return readyFiberBundle->FiberIsSwitched.load(std::memory_order_acquire);
+void TaskScheduler::RecordTaskRun(ThreadLocalStorage &tls, TaskPriority const priority) {
+#if FTL_TELEMETRY
+	IncrementStat(priority == TaskPriority::High ? &tls.Telemetry.HiPriTasksRun : &tls.Telemetry.LoPriTasksRun);
+#else
+	(void)tls;
+	(void)priority;
+#endif
 }
 
-bool TaskScheduler::GetNextHiPriTask(TaskBundle *nextTask, std::vector<TaskBundle> *taskBuffer) {
-	unsigned const currentThreadIndex = GetCurrentThreadIndex();
-	ThreadLocalStorage &tls = m_tls[currentThreadIndex];
+void TaskScheduler::RecordStealAttempt(ThreadLocalStorage &tls) {
+#if FTL_TELEMETRY
+	IncrementStat(&tls.Telemetry.StealAttempts);
+#else
+	(void)tls;
+#endif
+}
+
+void TaskScheduler::RecordFailedPop(ThreadLocalStorage &tls) {
+#if FTL_TELEMETRY
+	IncrementStat(&tls.Telemetry.FailedPops);
+#else
+	(void)tls;
+#endif
+}
 
-	bool result = false;
+void TaskScheduler::RecordFiberSwitch(ThreadLocalStorage &tls) {
+#if FTL_TELEMETRY
+	IncrementStat(&tls.Telemetry.FiberSwitches);
+#else
+	(void)tls;
+#endif
+}
 
-	// Try to pop from our own queue
-	while (tls.HiPriTaskQueue.Pop(nextTask)) {
-		if (TaskIsReadyToExecute(nextTask)) {
-			result = true;
-			// Break to cleanup
-			goto cleanup; // NOLINT(cppcoreguidelines-avoid-goto)
+void TaskScheduler::RecordQueueDepth(ThreadLocalStorage &tls, TaskPriority const priority, size_t const queueDepth) {
+#if FTL_TELEMETRY
+	UpdateMaxStat(priority == TaskPriority::High ? &tls.Telemetry.HiPriQueueHighWater : &tls.Telemetry.LoPriQueueHighWater, queueDepth);
+#else
+	(void)tls;
+	(void)priority;
+	(void)queueDepth;
+#endif
+}
+
+void TaskScheduler::MarkFiberReady(ReadyFiberBundle *const bundle) {
+#if FTL_TELEMETRY
+	// Published to the resuming thread by the queue push that follows
+	bundle->ReadyTimeNs = SteadyClockNs();
+#else
+	(void)bundle;
+#endif
+}
+
+void TaskScheduler::RecordReadyFiberResumed(ThreadLocalStorage &tls, ReadyFiberBundle const &bundle) {
+#if FTL_TELEMETRY
+	int64_t const waitNs = std::max<int64_t>(SteadyClockNs() - bundle.ReadyTimeNs, 0);
+	IncrementStat(&tls.Telemetry.ReadyFibersResumed);
+	IncrementStat(&tls.Telemetry.ReadyFiberWaitTotalNs, static_cast<uint64_t>(waitNs));
+	UpdateMaxStat(&tls.Telemetry.ReadyFiberWaitMaxNs, static_cast<uint64_t>(waitNs));
+#else
+	(void)tls;
+	(void)bundle;
+#endif
+}
+
+template <typename StealFunction>
+bool TaskScheduler::StealFromOtherThreads(ThreadLocalStorage &tls, unsigned *lastSuccessfulSteal, StealFunction steal) {
+	unsigned levelBegin = 0;
+	for (unsigned level = 0; level < kNumStealLevels; ++level) {
+		unsigned const levelEnd = tls.StealLevelEnd[level];
+		unsigned const levelSize = levelEnd - levelBegin;
+
+		// Go back to where we last succeeded, if it's in this level
+		unsigned const start = *lastSuccessfulSteal >= levelBegin && *lastSuccessfulSteal < levelEnd ? *lastSuccessfulSteal - levelBegin : 0;
+		for (unsigned i = 0; i < levelSize; ++i) {
+			unsigned const position = levelBegin + (start + i) % levelSize;
+			RecordStealAttempt(tls);
+			if (steal(m_tls[tls.StealOrder[position]])) {
+				*lastSuccessfulSteal = position;
+				IncrementStat(&tls.StealStats.Steals[level]);
+				return true;
+			}
 		}
 
-		// It's a ReadyTask whose fiber hasn't switched away yet
-		// Add it to the buffer
-		taskBuffer->emplace_back(*nextTask);
+		levelBegin = levelEnd;
 	}
 
-	// Force a scope so the `goto cleanup` above doesn't skip initialization
-	{
-		// Ours is empty, try to steal from the others'
-		const unsigned threadIndex = tls.HiPriLastSuccessfulSteal;
-		for (unsigned i = 0; i < m_numThreads; ++i) {
-			const unsigned threadIndexToStealFrom = (threadIndex + i) % m_numThreads;
-			if (threadIndexToStealFrom == currentThreadIndex) {
-				continue;
-			}
-			ThreadLocalStorage &otherTLS = m_tls[threadIndexToStealFrom];
+	IncrementStat(&tls.StealStats.FailedRounds);
+	return false;
+}
 
-			while (otherTLS.HiPriTaskQueue.Steal(nextTask)) {
-				tls.HiPriLastSuccessfulSteal = threadIndexToStealFrom;
+unsigned TaskScheduler::GetNextReadyFiber() {
+	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
 
-				if (TaskIsReadyToExecute(nextTask)) {
-					result = true;
-					// Break to cleanup
-					goto cleanup;
-				}
+	// Pinned fibers can only run here, so check them first
+	// Only the owner removes entries, so a non-zero count means the list can't be empty once we hold the lock
+	if (tls.PinnedReadyFiberCount.load(std::memory_order_acquire) != 0) {
+		std::lock_guard<std::mutex> guard(tls.PinnedReadyFibersLock);
+		ReadyFiberBundle *const bundle = tls.PinnedReadyFibers.front();
+		tls.PinnedReadyFibers.erase(tls.PinnedReadyFibers.begin());
+		tls.PinnedReadyFiberCount.fetch_sub(1, std::memory_order_relaxed);
+		return bundle->FiberIndex;
+	}
 
-				// It's a ReadyTask whose fiber hasn't switched away yet
-				// Add it to the buffer
-				taskBuffer->emplace_back(*nextTask);
-			}
-		}
+	// Ready fibers are rare compared to tasks, so check for emptiness before paying for the fences in Pop() and Steal()
+	unsigned fiberIndex;
+	if (!tls.ReadyFibers.IsEmpty() && tls.ReadyFibers.Pop(&fiberIndex)) {
+		return fiberIndex;
 	}
 
-cleanup:
-	if (!taskBuffer->empty()) {
-		// Re-push all the tasks we found that we're ready to execute
-		// We (or another thread) will get them next round
-		do {
-			// Push them in the opposite order we popped them, to restore the order
-			tls.HiPriTaskQueue.Push(taskBuffer->back());
-			taskBuffer->pop_back();
-		} while (!taskBuffer->empty());
+	// Then the fibers readied by threads we don't own
+	if (TakeInjectedReadyFibers(tls) && tls.ReadyFibers.Pop(&fiberIndex)) {
+		return fiberIndex;
+	}
 
-		// If we're using Sleep mode, we need to wake up the other threads
-		// They may have looked for tasks while we had them all in our temp buffer and thus not
-		// found anything and gone to sleep.
-		EmptyQueueBehavior const behavior = m_emptyQueueBehavior.load(std::memory_order::memory_order_relaxed);
-		if (behavior == EmptyQueueBehavior::Sleep) {
-			// Wake all the threads
-			ThreadSleepCV.notify_all();
-		}
+	// Ours is empty, try to steal from the others'
+	bool const stolen = StealFromOtherThreads(tls, &tls.ReadyFiberLastSuccessfulSteal, [&fiberIndex](ThreadLocalStorage &otherTLS) {
+		return !otherTLS.ReadyFibers.IsEmpty() && otherTLS.ReadyFibers.Steal(&fiberIndex);
+	});
+
+	return stolen ? fiberIndex : kInvalidIndex;
+}
+
+bool TaskScheduler::GetNextHiPriTask(TaskBundle *nextTask) {
+	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+
+	// Try to pop from our own queue
+	if (tls.HiPriTaskQueue.Pop(nextTask)) {
+		return true;
+	}
+
+	// Then the tasks added by threads we don't own
+	if (TakeInjectedTasks(tls, TaskPriority::High, nextTask)) {
+		return true;
 	}
 
-	return result;
+	// Ours is empty, try to steal from the others'
+	return StealFromOtherThreads(tls, &tls.HiPriLastSuccessfulSteal, [nextTask](ThreadLocalStorage &otherTLS) {
+		return otherTLS.HiPriTaskQueue.Steal(nextTask);
+	});
 }
 
 bool TaskScheduler::GetNextLoPriTask(TaskBundle *nextTask) {
-	unsigned const currentThreadIndex = GetCurrentThreadIndex();
-	ThreadLocalStorage &tls = m_tls[currentThreadIndex];
+	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
 
 	// Try to pop from our own queue
 	if (tls.LoPriTaskQueue.Pop(nextTask)) {
 		return true;
 	}
 
+	if (TakeInjectedTasks(tls, TaskPriority::Low, nextTask)) {
+		return true;
+	}
+
 	// Ours is empty, try to steal from the others'
-	const unsigned threadIndex = tls.LoPriLastSuccessfulSteal;
-	for (unsigned i = 0; i < m_numThreads; ++i) {
-		const unsigned threadIndexToStealFrom = (threadIndex + i) % m_numThreads;
-		if (threadIndexToStealFrom == currentThreadIndex) {
-			continue;
-		}
-		ThreadLocalStorage &otherTLS = m_tls[threadIndexToStealFrom];
-		if (otherTLS.LoPriTaskQueue.Steal(nextTask)) {
-			tls.LoPriLastSuccessfulSteal = threadIndexToStealFrom;
-			return true;
+	// Take a chunk of their tasks, so we (and the other thieves) don't have to come back for every single one
+	return StealFromOtherThreads(tls, &tls.LoPriLastSuccessfulSteal, [&tls, nextTask](ThreadLocalStorage &otherTLS) {
+		return otherTLS.LoPriTaskQueue.StealBatch(&tls.LoPriTaskQueue, nextTask, kMaxStealBatchSize, tls.StealBuffer) != 0;
+	});
+}
+
+static uint64_t PackFreeFiberHead(unsigned const index, unsigned const tag) {
+	return (static_cast<uint64_t>(tag) << 32) | index;
+}
+
+unsigned TaskScheduler::GetNextFreeFiberIndex() {
+	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+	IncrementStat(&tls.FiberPoolStats.Acquires);
+
+	// Fast path. Take a fiber from our own cache
+	unsigned const cacheCount = tls.FiberCacheCount.load(std::memory_order_relaxed);
+	if (cacheCount > 0) {
+		IncrementStat(&tls.FiberPoolStats.CacheHits);
+		tls.FiberCacheCount.store(cacheCount - 1, std::memory_order_relaxed);
+		return tls.FiberCache[cacheCount - 1];
+	}
+
+	auto const start = std::chrono::steady_clock::now();
+
+	// Refill half the cache with a single CAS, so the next few acquires are cache hits
+	// Unless another thread is starved for fibers. Then just take the one we need
+	unsigned const refillCount = m_fiberPoolStarvedThreads.load(std::memory_order_relaxed) != 0 ? 1 : std::max(1U, m_fiberCacheSize / 2);
+	unsigned fiberIndex = kInvalidIndex;
+	unsigned const popped = PopFreeFibers(refillCount, tls.FiberCache);
+	if (popped != 0) {
+		// Hand out the list head and stack the rest so they come back out in list order
+		fiberIndex = tls.FiberCache[0];
+		std::reverse(tls.FiberCache, tls.FiberCache + popped);
+		tls.FiberCacheCount.store(popped - 1, std::memory_order_relaxed);
+	} else {
+		fiberIndex = GrowFiberPool();
+		if (fiberIndex != kInvalidIndex) {
+			IncrementStat(&tls.FiberPoolStats.Grows);
 		}
 	}
 
-	return false;
-}
+	if (fiberIndex == kInvalidIndex) {
+		// The pool is empty. Ask the other threads to give back their cached fibers, and wait for one to be released
+		IncrementStat(&tls.FiberPoolStats.Stalls);
+		m_fiberPoolStarvedThreads.fetch_add(1, std::memory_order_seq_cst);
 
-unsigned TaskScheduler::GetNextFreeFiberIndex() const {
-	for (unsigned j = 0;; ++j) {
-		for (unsigned i = 0; i < m_fiberPoolSize; ++i) {
-			// Double lock
-			if (!m_freeFibers[i].load(std::memory_order_relaxed)) {
-				continue;
+		for (unsigned i = 1;; ++i) {
+			fiberIndex = PopFreeFiber();
+			if (fiberIndex != kInvalidIndex) {
+				break;
 			}
 
-			if (!m_freeFibers[i].load(std::memory_order_acquire)) {
-				continue;
+			if (i == kFiberStallWarningRetries) {
+				printf("No free fibers in the pool. Possible deadlock\n");
 			}
+			FTL_PAUSE();
+		}
 
-			bool expected = true;
-			if (std::atomic_compare_exchange_weak_explicit(&m_freeFibers[i], &expected, false, std::memory_order_release, std::memory_order_relaxed)) {
-				return i;
-			}
+		m_fiberPoolStarvedThreads.fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	auto const elapsedNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	IncrementStat(&tls.FiberPoolStats.SlowAcquireTotalNs, elapsedNs);
+	if (elapsedNs > tls.FiberPoolStats.SlowAcquireMaxNs.load(std::memory_order_relaxed)) {
+		tls.FiberPoolStats.SlowAcquireMaxNs.store(elapsedNs, std::memory_order_relaxed);
+	}
+
+	return fiberIndex;
+}
+
+void TaskScheduler::ReleaseFiber(unsigned const fiberIndex) {
+	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+
+	// If another thread is waiting on a fiber, give it straight to the global list
+	if (m_fiberCacheSize == 0 || m_fiberPoolStarvedThreads.load(std::memory_order_relaxed) != 0) {
+		PushFreeFibers(fiberIndex, fiberIndex, 1);
+		return;
+	}
+
+	unsigned cacheCount = tls.FiberCacheCount.load(std::memory_order_relaxed);
+	if (cacheCount == m_fiberCacheSize) {
+		// Give half back, so we don't bounce between full and empty
+		unsigned const flushCount = std::max(1U, cacheCount / 2);
+		FlushFiberCache(flushCount);
+		cacheCount -= flushCount;
+	}
+
+	tls.FiberCache[cacheCount] = fiberIndex;
+	tls.FiberCacheCount.store(cacheCount + 1, std::memory_order_relaxed);
+}
+
+void TaskScheduler::FlushFiberCache(unsigned const count) {
+	if (count == 0) {
+		return;
+	}
+
+	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+	unsigned const cacheCount = tls.FiberCacheCount.load(std::memory_order_relaxed);
+
+	// Link the bottom 'count' fibers together and push them all with a single CAS
+	for (unsigned i = 0; i + 1 < count; ++i) {
+		m_freeFiberNext[tls.FiberCache[i]].store(tls.FiberCache[i + 1], std::memory_order_relaxed);
+	}
+	m_freeFiberNext[tls.FiberCache[count - 1]].store(kInvalidIndex, std::memory_order_relaxed);
+	PushFreeFibers(tls.FiberCache[0], tls.FiberCache[count - 1], count);
+
+	// Shift the rest down
+	for (unsigned i = count; i < cacheCount; ++i) {
+		tls.FiberCache[i - count] = tls.FiberCache[i];
+	}
+	tls.FiberCacheCount.store(cacheCount - count, std::memory_order_relaxed);
+}
+
+void TaskScheduler::PushFreeFibers(unsigned const first, unsigned const last, unsigned const count) {
+	// Count before pushing, so the count can over-estimate, but never underflow
+	m_freeFiberCount.fetch_add(count, std::memory_order_relaxed);
+
+	uint64_t head = m_freeFiberHead.load(std::memory_order_relaxed);
+	while (true) {
+		m_freeFiberNext[last].store(static_cast<unsigned>(head), std::memory_order_relaxed);
+
+		uint64_t const newHead = PackFreeFiberHead(first, static_cast<unsigned>(head >> 32) + 1);
+		if (m_freeFiberHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) {
+			break;
+		}
+	}
+}
+
+unsigned TaskScheduler::PopFreeFiber() {
+	unsigned index;
+	return PopFreeFibers(1, &index) != 0 ? index : kInvalidIndex;
+}
+
+unsigned TaskScheduler::PopFreeFibers(unsigned const maxCount, unsigned *const fibers) {
+	uint64_t head = m_freeFiberHead.load(std::memory_order_acquire);
+	while (true) {
+		unsigned index = static_cast<unsigned>(head);
+		if (index == kInvalidIndex) {
+			return 0;
 		}
 
-		if (j > 10) {
-			printf("No free fibers in the pool. Possible deadlock");
+		// Walk the first maxCount fibers. m_freeFiberNext is never freed while the scheduler is alive, so reading a stale
+		// entry is harmless. Every push and pop bumps the tag, so the CAS fails if the list changed while we walked it
+		unsigned count = 0;
+		while (count < maxCount && index != kInvalidIndex) {
+			fibers[count++] = index;
+			index = m_freeFiberNext[index].load(std::memory_order_relaxed);
+		}
+
+		uint64_t const newHead = PackFreeFiberHead(index, static_cast<unsigned>(head >> 32) + 1);
+		if (m_freeFiberHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire)) {
+			m_freeFiberCount.fetch_sub(count, std::memory_order_relaxed);
+			return count;
 		}
 	}
 }
 
+unsigned TaskScheduler::GrowFiberPool() {
+	unsigned index = m_allocatedFibers.load(std::memory_order_relaxed);
+	while (true) {
+		if (index >= m_fiberPoolSize) {
+			return kInvalidIndex;
+		}
+
+		if (m_allocatedFibers.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {
+			break;
+		}
+	}
+
+	// We own this slot. No other thread can use it until we return it
+	m_fibers[index] = Fiber(m_fiberStackSize, FiberStartFunc, this, m_fiberStackAllocation, m_trackFiberStackUsage);
+	// But GetFiberStackUsage() can look at it as soon as it's published
+	m_fiberCreated[index].store(true, std::memory_order_release);
+	return index;
+}
+
+FiberPoolStats TaskScheduler::GetFiberPoolStats() const {
+	FiberPoolStats stats{};
+	stats.Capacity = m_fiberPoolSize;
+	stats.Allocated = std::min(m_allocatedFibers.load(std::memory_order_relaxed), m_fiberPoolSize);
+
+	unsigned freeFibers = m_freeFiberCount.load(std::memory_order_relaxed);
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		FiberPoolThreadStats const &threadStats = m_tls[i].FiberPoolStats;
+
+		freeFibers += m_tls[i].FiberCacheCount.load(std::memory_order_relaxed);
+		stats.Acquires += threadStats.Acquires.load(std::memory_order_relaxed);
+		stats.CacheHits += threadStats.CacheHits.load(std::memory_order_relaxed);
+		stats.Grows += threadStats.Grows.load(std::memory_order_relaxed);
+		stats.Stalls += threadStats.Stalls.load(std::memory_order_relaxed);
+		stats.SlowAcquireTotalNs += threadStats.SlowAcquireTotalNs.load(std::memory_order_relaxed);
+		stats.SlowAcquireMaxNs = std::max(stats.SlowAcquireMaxNs, threadStats.SlowAcquireMaxNs.load(std::memory_order_relaxed));
+	}
+	// The counts are read at different times, so clamp
+	stats.InUse = stats.Allocated > freeFibers ? stats.Allocated - freeFibers : 0;
+
+	return stats;
+}
+
+size_t TaskScheduler::GetFiberStackUsage(unsigned const fiberIndex) const {
+	FTL_ASSERT("Fiber index out of bounds", fiberIndex < m_fiberPoolSize);
+
+	// Pairs with the release in GrowFiberPool(). A fiber that's still being created isn't read at all
+	if (!m_trackFiberStackUsage || !m_fiberCreated[fiberIndex].load(std::memory_order_acquire)) {
+		return 0;
+	}
+
+	return m_fibers[fiberIndex].GetStackUsage();
+}
+
+size_t TaskScheduler::GetMaxFiberStackUsage() const {
+	size_t maxUsage = 0;
+	for (unsigned i = 0; i < m_fiberPoolSize; ++i) {
+		maxUsage = std::max(maxUsage, GetFiberStackUsage(i));
+	}
+
+	return maxUsage;
+}
+
 void TaskScheduler::CleanUpOldFiber() {
 	// Clean up from the last Fiber to run on this thread
 	//
@@ -675,47 +1252,66 @@ void TaskScheduler::CleanUpOldFiber() {
 	// QED
 
 	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+	RecordFiberSwitch(tls);
+
 	switch (tls.OldFiberDestination) {
 	case FiberDestination::ToPool:
-		// In this specific implementation, the fiber pool is a flat array signaled by atomics
-		// So in order to "Push" the fiber to the fiber pool, we just set its corresponding atomic to true
-		m_freeFibers[tls.OldFiberIndex].store(true, std::memory_order_release);
+		ReleaseFiber(tls.OldFiberIndex);
 		tls.OldFiberDestination = FiberDestination::None;
 		tls.OldFiberIndex = kInvalidIndex;
 		break;
-	case FiberDestination::ToWaiting:
+	case FiberDestination::ToWaiting: {
 		// The waiting fibers are stored directly in their counters
-		// They have an atomic<bool> that signals whether the waiting fiber can be consumed if it's ready
-		// We just have to set it to true
-		tls.OldFiberStoredFlag->store(true, std::memory_order_release);
+		// Now that we've switched away, the fiber can be resumed as soon as the counter is ready. If the counter
+		// is already ready, this will queue the fiber
+		ReadyFiberBundle *const bundle = tls.OldFiberBundle;
+		tls.OldFiberBundle = nullptr;
 		tls.OldFiberDestination = FiberDestination::None;
 		tls.OldFiberIndex = kInvalidIndex;
+
+		SatisfyResumeCondition(bundle);
 		break;
+	}
 	case FiberDestination::None:
 	default:
 		break;
 	}
 }
 
-void TaskScheduler::AddReadyFiber(unsigned const pinnedThreadIndex, ReadyFiberBundle *bundle) {
-	if (pinnedThreadIndex == kNoThreadPinning) {
-		ThreadLocalStorage *tls = &m_tls[GetCurrentThreadIndex()];
+void TaskScheduler::AddReadyFiber(unsigned const /*pinnedThreadIndex*/, ReadyFiberBundle *bundle) {
+	// The pinned thread index is also stored in the bundle, since CleanUpOldFiber() needs it too
+	SatisfyResumeCondition(bundle);
+}
 
-		// Push a dummy task to the high priority queue
-		Task task{};
-		task.Function = ReadyFiberDummyTask;
-		task.ArgData = bundle;
-		TaskBundle taskBundle{};
-		taskBundle.TaskToExecute = task;
-		taskBundle.Counter = nullptr;
+void TaskScheduler::SatisfyResumeCondition(ReadyFiberBundle *bundle) {
+	// acq_rel, so whoever satisfies the last condition sees everything the other side did. In particular, that the
+	// fiber's context was fully saved when it was switched away from
+	if (bundle->ResumeConditions.fetch_add(1, std::memory_order_acq_rel) != 1) {
+		// The other condition hasn't happened yet. Whoever does it will queue the fiber
+		return;
+	}
 
-		tls->HiPriTaskQueue.Push(taskBundle);
+	MarkFiberReady(bundle);
+
+	unsigned const pinnedThreadIndex = bundle->PinnedThreadIndex;
+	EmptyQueueBehavior const behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+	if (pinnedThreadIndex == kNoThreadPinning) {
+		unsigned const threadIndex = GetCurrentThreadIndex();
+		if (threadIndex == kInvalidIndex) {
+			// We don't own this thread, so it has no queue. Hand the fiber to the workers instead
+			ReadyFiberBundle *next = m_injectedReadyFibers.load(std::memory_order_relaxed);
+			do {
+				bundle->NextInjected = next;
+			} while (!m_injectedReadyFibers.compare_exchange_weak(next, bundle, std::memory_order_release, std::memory_order_relaxed));
+		} else {
+			// Push to our own queue. Any thread can steal it from there
+			m_tls[threadIndex].ReadyFibers.Push(bundle->FiberIndex);
+		}
 
 		// If we're using EmptyQueueBehavior::Sleep, the other threads could be sleeping
-		// Therefore, we need to kick a thread awake to ensure that the readied task is taken
-		const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order_relaxed);
+		// Therefore, we need to kick a thread awake to ensure that the readied fiber is taken
 		if (behavior == EmptyQueueBehavior::Sleep) {
-			ThreadSleepCV.notify_one();
+			WakeIdleThreads(1);
 		}
 	} else {
 		ThreadLocalStorage *tls = &m_tls[pinnedThreadIndex];
@@ -723,25 +1319,289 @@ void TaskScheduler::AddReadyFiber(unsigned const pinnedThreadIndex, ReadyFiberBu
 		{
 			std::lock_guard<std::mutex> guard(tls->PinnedReadyFibersLock);
 			tls->PinnedReadyFibers.emplace_back(bundle);
+			tls->PinnedReadyFiberCount.fetch_add(1, std::memory_order_release);
 		}
 
-		// If the Task is pinned, we add the Task to the pinned thread's PinnedReadyFibers queue
+		// If the fiber is pinned, we add it to the pinned thread's PinnedReadyFibers queue
 		// Normally, this works fine; the other thread will pick it up next time it
 		// searches for a Task to run.
 		//
 		// However, if we're using EmptyQueueBehavior::Sleep, the other thread could be sleeping
-		// Therefore, we need to kick all the threads so that the pinned-to thread can take it
-		const EmptyQueueBehavior behavior = m_emptyQueueBehavior.load(std::memory_order::memory_order_relaxed);
+		// Therefore, we need to wake the pinned-to thread. No other thread can run the fiber, so we leave them be
 		if (behavior == EmptyQueueBehavior::Sleep) {
 			if (GetCurrentThreadIndex() != pinnedThreadIndex) {
-				std::unique_lock<std::mutex> lock(ThreadSleepLock);
-				// Kick all threads
-				ThreadSleepCV.notify_all();
+				WakeThread(pinnedThreadIndex);
 			}
 		}
 	}
 }
 
+void TaskScheduler::ParkCurrentThread(unsigned const threadIndex) {
+	ThreadLocalStorage &tls = m_tls[threadIndex];
+	ParkingThreadStats &stats = tls.ParkingStats;
+
+	// We were woken last time, but never found anything to do
+	if (tls.WokenWithoutWork) {
+		IncrementStat(&stats.SpuriousWakes);
+		tls.WokenWithoutWork = false;
+	}
+
+	// Register as idle *before* the final check for work
+	// Wakers add their work, and then check the registry. So either we see their work below, or they see us
+	// The count is incremented first, so a waker that claims our bit can never underflow it
+	m_idleThreadCount.fetch_add(1, std::memory_order_seq_cst);
+	m_idleThreadMask[threadIndex / 64].fetch_or(uint64_t(1) << (threadIndex % 64), std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (HasPendingWork(threadIndex)) {
+		if (TryClaimIdleThread(threadIndex)) {
+			IncrementStat(&stats.AbortedParks);
+			return;
+		}
+
+		// A waker claimed us first, and is about to signal the slot
+		// Fall through and consume the signal, so it doesn't leak into the next park
+	}
+
+	ParkingSlot &slot = tls.Parking;
+	auto const sleepStart = std::chrono::steady_clock::now();
+	{
+		std::unique_lock<std::mutex> lock(slot.Lock);
+		slot.CV.wait(lock, [&slot] { return slot.Signaled; });
+		slot.Signaled = false;
+	}
+	auto const wakeTime = std::chrono::steady_clock::now();
+
+	auto const sleptNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(wakeTime - sleepStart).count());
+	int64_t const latencyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeTime.time_since_epoch()).count() - slot.SignalTimeNs.load(std::memory_order_relaxed);
+	uint64_t const clampedLatencyNs = latencyNs > 0 ? static_cast<uint64_t>(latencyNs) : 0;
+
+	IncrementStat(&stats.Parks);
+	IncrementStat(&stats.Wakes);
+	IncrementStat(&stats.SleepTotalNs, sleptNs);
+	IncrementStat(&stats.WakeLatencyTotalNs, clampedLatencyNs);
+	if (clampedLatencyNs > stats.WakeLatencyMaxNs.load(std::memory_order_relaxed)) {
+		stats.WakeLatencyMaxNs.store(clampedLatencyNs, std::memory_order_relaxed);
+	}
+
+	tls.WokenWithoutWork = true;
+}
+
+bool TaskScheduler::HasPendingWork(unsigned const threadIndex) {
+	if (m_quit.load(std::memory_order_acquire) || m_emptyQueueBehavior.load(std::memory_order_relaxed) != EmptyQueueBehavior::Sleep) {
+		return true;
+	}
+
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		if (!m_tls[i].ReadyFibers.IsEmpty() || !m_tls[i].HiPriTaskQueue.IsEmpty() || !m_tls[i].LoPriTaskQueue.IsEmpty()) {
+			return true;
+		}
+	}
+
+	if (m_injectedReadyFibers.load(std::memory_order_relaxed) != nullptr || m_injectedHiPriTasks.load(std::memory_order_relaxed) != nullptr ||
+	    m_injectedLoPriTasks.load(std::memory_order_relaxed) != nullptr) {
+		return true;
+	}
+
+	// AddReadyFiber() pushes pinned fibers under this lock, and then checks the registry
+	ThreadLocalStorage &tls = m_tls[threadIndex];
+	std::lock_guard<std::mutex> guard(tls.PinnedReadyFibersLock);
+	return !tls.PinnedReadyFibers.empty();
+}
+
+bool TaskScheduler::TryClaimIdleThread(unsigned const threadIndex) {
+	uint64_t const bit = uint64_t(1) << (threadIndex % 64);
+	uint64_t const previous = m_idleThreadMask[threadIndex / 64].fetch_and(~bit, std::memory_order_seq_cst);
+	if ((previous & bit) == 0) {
+		return false;
+	}
+
+	m_idleThreadCount.fetch_sub(1, std::memory_order_seq_cst);
+	return true;
+}
+
+void TaskScheduler::SignalThread(unsigned const threadIndex) {
+	ParkingSlot &slot = m_tls[threadIndex].Parking;
+	slot.SignalTimeNs.store(SteadyClockNs(), std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> guard(slot.Lock);
+		slot.Signaled = true;
+	}
+	slot.CV.notify_one();
+}
+
+void TaskScheduler::WakeIdleThreads(unsigned count) {
+	// Pairs with the fence in ParkCurrentThread(). Our caller's work must be visible before we read the registry
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (count == 0 || m_idleThreadCount.load(std::memory_order_relaxed) == 0) {
+		return;
+	}
+
+	// Start searching after the current thread, so wakes are spread out instead of always hitting the lowest indices
+	unsigned const currentThreadIndex = GetCurrentThreadIndex();
+	unsigned const start = currentThreadIndex == kInvalidIndex ? 0 : currentThreadIndex + 1;
+	for (unsigned i = 0; i < m_numThreads && count > 0; ++i) {
+		unsigned const threadIndex = (start + i) % m_numThreads;
+		if ((m_idleThreadMask[threadIndex / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (threadIndex % 64))) == 0) {
+			continue;
+		}
+
+		if (TryClaimIdleThread(threadIndex)) {
+			SignalThread(threadIndex);
+			--count;
+		}
+	}
+}
+
+void TaskScheduler::WakeThread(unsigned const threadIndex) {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (TryClaimIdleThread(threadIndex)) {
+		SignalThread(threadIndex);
+	}
+}
+
+void TaskScheduler::SetEmptyQueueBehavior(EmptyQueueBehavior const behavior) {
+	m_emptyQueueBehavior.store(behavior, std::memory_order_relaxed);
+
+	// Threads only sleep in Sleep mode. Wake any that are asleep, so they can start spinning / yielding
+	if (behavior != EmptyQueueBehavior::Sleep) {
+		WakeIdleThreads(m_numThreads);
+	}
+}
+
+ParkingStats TaskScheduler::GetParkingStats() const {
+	ParkingStats stats{};
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		ParkingThreadStats const &threadStats = m_tls[i].ParkingStats;
+
+		stats.Parks += threadStats.Parks.load(std::memory_order_relaxed);
+		stats.AbortedParks += threadStats.AbortedParks.load(std::memory_order_relaxed);
+		stats.Wakes += threadStats.Wakes.load(std::memory_order_relaxed);
+		stats.SpuriousWakes += threadStats.SpuriousWakes.load(std::memory_order_relaxed);
+		stats.WakeLatencyTotalNs += threadStats.WakeLatencyTotalNs.load(std::memory_order_relaxed);
+		stats.WakeLatencyMaxNs = std::max(stats.WakeLatencyMaxNs, threadStats.WakeLatencyMaxNs.load(std::memory_order_relaxed));
+		stats.SleepTotalNs += threadStats.SleepTotalNs.load(std::memory_order_relaxed);
+	}
+
+	return stats;
+}
+
+TaskArenaStats TaskScheduler::GetTaskArenaStats() const {
+	TaskArenaStats stats{};
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		stats.Allocations += m_tls[i].Arena.GetAllocationCount();
+		stats.HeapAllocations += m_tls[i].Arena.GetHeapAllocationCount();
+	}
+
+	return stats;
+}
+
+WorkerTelemetry TaskScheduler::GetWorkerTelemetry(unsigned const threadIndex) const {
+	FTL_ASSERT("Thread index out of range", threadIndex < m_numThreads);
+	ThreadLocalStorage const &tls = m_tls[threadIndex];
+
+	WorkerTelemetry telemetry{};
+	for (unsigned level = 0; level < kNumStealLevels; ++level) {
+		telemetry.Steals += tls.StealStats.Steals[level].load(std::memory_order_relaxed);
+	}
+	telemetry.SleepNs = tls.ParkingStats.SleepTotalNs.load(std::memory_order_relaxed);
+
+#if FTL_TELEMETRY
+	TelemetryThreadCounters const &counters = tls.Telemetry;
+	telemetry.HiPriTasksRun = counters.HiPriTasksRun.load(std::memory_order_relaxed);
+	telemetry.LoPriTasksRun = counters.LoPriTasksRun.load(std::memory_order_relaxed);
+	telemetry.StealAttempts = counters.StealAttempts.load(std::memory_order_relaxed);
+	telemetry.FailedPops = counters.FailedPops.load(std::memory_order_relaxed);
+	telemetry.FiberSwitches = counters.FiberSwitches.load(std::memory_order_relaxed);
+	telemetry.HiPriQueueHighWater = counters.HiPriQueueHighWater.load(std::memory_order_relaxed);
+	telemetry.LoPriQueueHighWater = counters.LoPriQueueHighWater.load(std::memory_order_relaxed);
+	telemetry.ReadyFibersResumed = counters.ReadyFibersResumed.load(std::memory_order_relaxed);
+	telemetry.ReadyFiberWaitTotalNs = counters.ReadyFiberWaitTotalNs.load(std::memory_order_relaxed);
+	telemetry.ReadyFiberWaitMaxNs = counters.ReadyFiberWaitMaxNs.load(std::memory_order_relaxed);
+#endif
+
+	return telemetry;
+}
+
+StealStats TaskScheduler::GetStealStats() const {
+	StealStats stats{};
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		StealThreadStats const &threadStats = m_tls[i].StealStats;
+
+		for (unsigned level = 0; level < kNumStealLevels; ++level) {
+			stats.Steals[level] += threadStats.Steals[level].load(std::memory_order_relaxed);
+		}
+		stats.FailedRounds += threadStats.FailedRounds.load(std::memory_order_relaxed);
+	}
+
+	return stats;
+}
+
+unsigned TaskScheduler::GetThreadCpu(unsigned const threadIndex) const {
+	FTL_ASSERT("Thread index out of range", threadIndex < m_numThreads);
+	return m_threadCpus[threadIndex];
+}
+
+void TaskScheduler::InitThreadPinning(ThreadPinning const pinning) {
+	m_threadCpus.assign(m_numThreads, kInvalidIndex);
+
+	std::vector<LogicalCpu> cpus;
+	if (pinning != ThreadPinning::None) {
+		if (ReadCpuTopology(&cpus)) {
+			RemoveDisallowedCpus(&cpus);
+		}
+
+		if (!cpus.empty()) {
+			// If there are more threads than CPUs, wrap around. Each CPU gets the same number of threads, give or take one
+			std::vector<unsigned> const order = OrderCpusForPinning(cpus, pinning == ThreadPinning::PhysicalCores);
+			for (unsigned i = 0; i < m_numThreads; ++i) {
+				m_threadCpus[i] = cpus[order[i % order.size()]].Id;
+			}
+		} else {
+			// We don't know the topology. Pin to consecutive CPUs, and steal round-robin like unpinned threads
+			unsigned const numCpus = GetNumHardwareThreads();
+			for (unsigned i = 0; i < m_numThreads; ++i) {
+				m_threadCpus[i] = i % numCpus;
+			}
+		}
+	}
+
+	// Find each thread's CPU in the topology, if we have one
+	std::vector<LogicalCpu const *> threadTopology(m_numThreads, nullptr);
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		for (LogicalCpu const &cpu : cpus) {
+			if (cpu.Id == m_threadCpus[i]) {
+				threadTopology[i] = &cpu;
+				break;
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < m_numThreads; ++i) {
+		ThreadLocalStorage &tls = m_tls[i];
+		tls.StealOrder.clear();
+
+		// Bucket the other threads by distance. Within a level, start after ourselves, so threads that share a
+		// level don't all hammer the same victim first
+		for (unsigned level = 0; level < kNumStealLevels; ++level) {
+			for (unsigned offset = 1; offset < m_numThreads; ++offset) {
+				unsigned const other = (i + offset) % m_numThreads;
+
+				StealLevel otherLevel = StealLevel::Remote;
+				if (threadTopology[i] != nullptr && threadTopology[other] != nullptr) {
+					otherLevel = GetStealLevel(*threadTopology[i], *threadTopology[other]);
+				}
+
+				if (static_cast<unsigned>(otherLevel) == level) {
+					tls.StealOrder.push_back(other);
+				}
+			}
+
+			tls.StealLevelEnd[level] = static_cast<unsigned>(tls.StealOrder.size());
+		}
+	}
+}
+
 void TaskScheduler::WaitForCounter(TaskCounter *counter, bool pinToCurrentThread) {
 	WaitForCounterInternal(counter, 0, pinToCurrentThread);
 }
@@ -760,15 +1620,25 @@ void TaskScheduler::WaitForCounterInternal(BaseCounter *counter, unsigned value,
 		// wait for threads to drain from counter logic, otherwise we might continue too early
 		while (counter->m_lock.load() > 0) {
 		}
+
+		if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+			m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, GetCurrentFiberIndex(), counter, value, CounterWaitState::Satisfied);
+		}
 		return;
 	}
 
-	ThreadLocalStorage &tls = m_tls[GetCurrentThreadIndex()];
+	unsigned const currentThreadIndex = GetCurrentThreadIndex();
+	if (currentThreadIndex == kInvalidIndex) {
+		BlockCurrentThread(counter, value);
+		return;
+	}
+
+	ThreadLocalStorage &tls = m_tls[currentThreadIndex];
 	unsigned const currentFiberIndex = tls.CurrentFiberIndex;
 
 	unsigned pinnedThreadIndex;
 	if (pinToCurrentThread) {
-		pinnedThreadIndex = GetCurrentThreadIndex();
+		pinnedThreadIndex = currentThreadIndex;
 	} else {
 		pinnedThreadIndex = kNoThreadPinning;
 	}
@@ -776,13 +1646,17 @@ void TaskScheduler::WaitForCounterInternal(BaseCounter *counter, unsigned value,
 	// Create the ready fiber bundle and attempt to add it to the waiting list
 	ReadyFiberBundle *readyFiberBundle = &m_readyFiberBundles[currentFiberIndex];
 	readyFiberBundle->FiberIndex = currentFiberIndex;
-	readyFiberBundle->FiberIsSwitched.store(false);
+	readyFiberBundle->PinnedThreadIndex = pinnedThreadIndex;
+	readyFiberBundle->ResumeConditions.store(0, std::memory_order_relaxed);
 
-	bool const alreadyDone = counter->AddFiberToWaitingList(readyFiberBundle, value, pinnedThreadIndex);
+	bool const alreadyDone = counter->AddFiberToWaitingList(&readyFiberBundle->WaitingFiber, readyFiberBundle, value, pinnedThreadIndex);
 
 	// The counter finished while we were trying to put it in the waiting list
 	// Just trivially return
 	if (alreadyDone) {
+		if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+			m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, currentFiberIndex, counter, value, CounterWaitState::Satisfied);
+		}
 		return;
 	}
 
@@ -793,8 +1667,11 @@ void TaskScheduler::WaitForCounterInternal(BaseCounter *counter, unsigned value,
 	tls.OldFiberIndex = currentFiberIndex;
 	tls.CurrentFiberIndex = freeFiberIndex;
 	tls.OldFiberDestination = FiberDestination::ToWaiting;
-	tls.OldFiberStoredFlag = &readyFiberBundle->FiberIsSwitched;
+	tls.OldFiberBundle = readyFiberBundle;
 
+	if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+		m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, currentFiberIndex, counter, value, CounterWaitState::Waiting);
+	}
 	if (m_callbacks.OnFiberStateChanged != nullptr) {
 		m_callbacks.OnFiberStateChanged(m_callbacks.Context, currentFiberIndex, FiberState::Detached);
 	}
@@ -808,6 +1685,46 @@ void TaskScheduler::WaitForCounterInternal(BaseCounter *counter, unsigned value,
 
 	// And we're back
 	CleanUpOldFiber();
+
+	if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+		m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, currentFiberIndex, counter, value, CounterWaitState::Resumed);
+	}
+}
+
+void TaskScheduler::BlockCurrentThread(BaseCounter *const counter, unsigned const value) {
+	BlockedThreadBundle blocked;
+	blocked.FiberBundle = nullptr;
+	blocked.TargetValue = value;
+	blocked.BlocksThread = true;
+
+	if (counter->AddToWaitingList(&blocked)) {
+		if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+			m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, kInvalidIndex, counter, value, CounterWaitState::Satisfied);
+		}
+		return;
+	}
+
+	if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+		m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, kInvalidIndex, counter, value, CounterWaitState::Waiting);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(blocked.Lock);
+		blocked.CV.wait(lock, [&blocked] { return blocked.Signaled; });
+	}
+
+	if (m_callbacks.OnCounterWaitStateChanged != nullptr) {
+		m_callbacks.OnCounterWaitStateChanged(m_callbacks.Context, kInvalidIndex, counter, value, CounterWaitState::Resumed);
+	}
+}
+
+void TaskScheduler::WakeBlockedThread(BaseCounter::WaitingFiberBundle *const node) {
+	auto *const blocked = static_cast<BlockedThreadBundle *>(node);
+
+	// Notify with the lock held. The bundle is on the blocked thread's stack, and is gone as soon as it sees Signaled
+	std::lock_guard<std::mutex> guard(blocked->Lock);
+	blocked->Signaled = true;
+	blocked->CV.notify_one();
 }
 
 } // End of namespace ftl
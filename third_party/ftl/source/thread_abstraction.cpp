@@ -86,8 +86,8 @@ bool CreateThread(size_t stackSize, ThreadStartRoutine startRoutine, void *arg,
 	}
 
 	DWORD_PTR mask = 1ull << coreAffinity;
-	::SetThreadAffinityMask(returnThread, mask);
-	::ResumeThread(returnThread);
+	::SetThreadAffinityMask(returnThread->Handle, mask);
+	::ResumeThread(returnThread->Handle);
 
 	return true;
 }
@@ -134,6 +134,7 @@ void YieldThread() {
 #		include <features.h>
 #	endif
 #	include <pthread.h>
+#	include <sched.h>
 #	include <string.h>
 #	include <unistd.h>
 
@@ -224,9 +225,7 @@ void SleepThread(int msDuration) {
 }
 
 void YieldThread() {
-#	if defined(FTL_OS_LINUX)
-	pthread_yield();
-#	endif
+	sched_yield();
 }
 
 } // End of namespace ftl
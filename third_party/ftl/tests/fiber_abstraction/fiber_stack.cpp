@@ -0,0 +1,84 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/fiber.h"
+
+#include "catch2/catch.hpp"
+
+constexpr size_t kStackUsageBytes = 65536;
+
+struct StackUsageArg {
+	ftl::Fiber MainFiber;
+	ftl::Fiber OtherFiber;
+};
+
+void StackUsageStart(void *arg) {
+	auto *stackUsageArg = reinterpret_cast<StackUsageArg *>(arg);
+
+	// Touch every page of a large local buffer, so it can't be optimized out
+	volatile char buffer[kStackUsageBytes];
+	for (size_t i = 0; i < kStackUsageBytes; i += 256) {
+		buffer[i] = static_cast<char>(i);
+	}
+	REQUIRE(buffer[256] == static_cast<char>(256));
+
+	stackUsageArg->OtherFiber.SwitchToFiber(&stackUsageArg->MainFiber);
+
+	// We should never get here
+	FAIL();
+}
+
+static void TestStackUsage(ftl::FiberStackAllocation const allocation) {
+	constexpr size_t kHalfMebibyte = 524288;
+
+	StackUsageArg stackUsageArg;
+	stackUsageArg.OtherFiber = ftl::Fiber(kHalfMebibyte, StackUsageStart, &stackUsageArg, allocation, true);
+	REQUIRE(stackUsageArg.OtherFiber.GetStackSize() >= kHalfMebibyte);
+	// make_fcontext() writes a little at the top of the stack. But nothing should have touched the rest
+	REQUIRE(stackUsageArg.OtherFiber.GetStackUsage() < kStackUsageBytes);
+
+	stackUsageArg.MainFiber.SwitchToFiber(&stackUsageArg.OtherFiber);
+
+	size_t const usage = stackUsageArg.OtherFiber.GetStackUsage();
+	REQUIRE(usage >= kStackUsageBytes);
+	REQUIRE(usage < stackUsageArg.OtherFiber.GetStackSize());
+}
+
+TEST_CASE("Heap Fiber Stack Usage", "[fiber]") {
+	TestStackUsage(ftl::FiberStackAllocation::Heap);
+}
+
+TEST_CASE("Demand Paged Fiber Stack Usage", "[fiber]") {
+	TestStackUsage(ftl::FiberStackAllocation::DemandPaged);
+}
+
+TEST_CASE("Untracked Fiber Stack Usage", "[fiber]") {
+	constexpr size_t kHalfMebibyte = 524288;
+
+	StackUsageArg stackUsageArg;
+	stackUsageArg.OtherFiber = ftl::Fiber(kHalfMebibyte, StackUsageStart, &stackUsageArg, ftl::FiberStackAllocation::DemandPaged);
+	stackUsageArg.MainFiber.SwitchToFiber(&stackUsageArg.OtherFiber);
+
+	REQUIRE(stackUsageArg.OtherFiber.GetStackUsage() == 0);
+}
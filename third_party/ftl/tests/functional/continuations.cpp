@@ -0,0 +1,251 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/atomic_counter.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_graph.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+constexpr static unsigned kContinuationChainLength = 2000;
+constexpr static unsigned kContinuationGraphWidth = 64;
+constexpr static unsigned kContinuationGraphLayers = 8;
+
+struct ChainLinkArgs {
+	unsigned Index;
+	std::atomic<unsigned> *Next;
+	std::atomic<bool> *OutOfOrder;
+};
+
+void ChainLinkTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	auto *args = static_cast<ChainLinkArgs *>(arg);
+
+	unsigned expected = args->Index;
+	if (!args->Next->compare_exchange_strong(expected, args->Index + 1, std::memory_order_seq_cst)) {
+		args->OutOfOrder->store(true, std::memory_order_seq_cst);
+	}
+}
+
+TEST_CASE("Continuation Chain", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	// Far fewer fibers than links. With WaitForCounter() this chain would need one fiber per link
+	options.FiberPoolSize = 8;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> next(0);
+	std::atomic<bool> outOfOrder(false);
+	std::vector<ChainLinkArgs> args(kContinuationChainLength);
+
+	ftl::TaskGraph graph(&taskScheduler);
+	for (unsigned i = 0; i < kContinuationChainLength; ++i) {
+		args[i] = {i, &next, &outOfOrder};
+		REQUIRE(graph.AddNode({ChainLinkTask, &args[i]}) == i);
+		if (i > 0) {
+			graph.AddDependency(i - 1, i);
+		}
+	}
+
+	uint64_t const acquiresBefore = taskScheduler.GetFiberPoolStats().Acquires;
+	for (unsigned round = 0; round < 5; ++round) {
+		next.store(0, std::memory_order_seq_cst);
+		graph.Run();
+
+		REQUIRE(next.load() == kContinuationChainLength);
+	}
+	REQUIRE_FALSE(outOfOrder.load());
+
+	// Only the main fiber's waits need a fiber. The links themselves never wait
+	uint64_t const acquires = taskScheduler.GetFiberPoolStats().Acquires - acquiresBefore;
+	REQUIRE(acquires <= 5 * options.ThreadPoolSize);
+}
+
+TEST_CASE("Continuation On Finished Counter", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> ran(0);
+	std::atomic<unsigned> *const ranPtr = &ran;
+
+	// Nothing was ever added to the counter, so the continuation is queued right away
+	ftl::TaskCounter finished(&taskScheduler);
+	ftl::TaskCounter continuationCounter(&taskScheduler);
+	taskScheduler.AddContinuation(
+	    &finished, [ranPtr](ftl::TaskScheduler *) { ranPtr->fetch_add(1); }, ftl::TaskPriority::High, &continuationCounter);
+	taskScheduler.WaitForCounter(&continuationCounter);
+
+	REQUIRE(ran.load() == 1);
+
+	// Too big to be stored inline, so the callable lives in the arena until the continuation has run
+	std::array<uint64_t, 16> values;
+	for (unsigned i = 0; i < values.size(); ++i) {
+		values[i] = i + 1;
+	}
+	std::atomic<uint64_t> sum(0);
+	std::atomic<uint64_t> *const sumPtr = &sum;
+
+	ftl::TaskCounter work(&taskScheduler);
+	taskScheduler.AddTasks(
+	    64, [](unsigned) { return [](ftl::TaskScheduler *) {}; }, ftl::TaskPriority::Low, &work);
+	taskScheduler.AddContinuation(
+	    &work, [values, sumPtr](ftl::TaskScheduler *) {
+		    for (uint64_t const value : values) {
+			    sumPtr->fetch_add(value);
+		    }
+	    },
+	    ftl::TaskPriority::Low, &continuationCounter);
+	taskScheduler.WaitForCounter(&continuationCounter);
+
+	REQUIRE(sum.load() == 16 * 17 / 2);
+}
+
+struct TargetContinuationArgs {
+	ftl::FullAtomicCounter *Counter;
+	unsigned Target;
+	std::atomic<unsigned> *Early;
+};
+
+void TargetContinuationTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	auto *args = static_cast<TargetContinuationArgs *>(arg);
+	if (args->Counter->Load() < args->Target) {
+		args->Early->fetch_add(1, std::memory_order_seq_cst);
+	}
+}
+
+void IncrementTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	static_cast<ftl::FullAtomicCounter *>(arg)->FetchAdd(1);
+}
+
+TEST_CASE("Full Atomic Counter Continuations", "[functional]") {
+	constexpr unsigned kTargets = 32;
+
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	for (unsigned round = 0; round < 10; ++round) {
+		ftl::FullAtomicCounter counter(&taskScheduler, 0);
+		std::atomic<unsigned> early(0);
+
+		std::vector<TargetContinuationArgs> args(kTargets);
+		ftl::TaskCounter continuationCounter(&taskScheduler);
+		for (unsigned i = 0; i < kTargets; ++i) {
+			args[i] = {&counter, i + 1, &early};
+			taskScheduler.AddContinuation(&counter, i + 1, {TargetContinuationTask, &args[i]}, ftl::TaskPriority::High, &continuationCounter);
+		}
+
+		ftl::TaskCounter incrementCounter(&taskScheduler);
+		std::vector<ftl::Task> increments(kTargets, ftl::Task{IncrementTask, &counter});
+		taskScheduler.AddTasks(kTargets, increments.data(), ftl::TaskPriority::Low, &incrementCounter);
+
+		taskScheduler.WaitForCounter(&continuationCounter);
+		taskScheduler.WaitForCounter(&incrementCounter);
+
+		REQUIRE(counter.Load() == kTargets);
+		REQUIRE(early.load() == 0);
+	}
+}
+
+struct LayerNodeArgs {
+	unsigned Layer;
+	std::atomic<unsigned> *Finished;
+	std::atomic<unsigned> *Violations;
+};
+
+// Checks that every node of the previous layer finished before this one started
+void LayerNodeTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	auto *args = static_cast<LayerNodeArgs *>(arg);
+	if (args->Layer > 0 && args->Finished[args->Layer - 1].load(std::memory_order_seq_cst) != kContinuationGraphWidth) {
+		args->Violations->fetch_add(1, std::memory_order_seq_cst);
+	}
+
+	args->Finished[args->Layer].fetch_add(1, std::memory_order_seq_cst);
+}
+
+void RunLayeredGraph(ftl::EmptyQueueBehavior const behavior) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.FiberPoolSize = 8;
+	options.Behavior = behavior;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> finished[kContinuationGraphLayers];
+	std::atomic<unsigned> violations(0);
+	std::vector<LayerNodeArgs> args;
+	args.reserve(kContinuationGraphLayers * kContinuationGraphWidth);
+
+	// Every node depends on every node of the previous layer, so each layer is a full fan-in and fan-out
+	ftl::TaskGraph graph(&taskScheduler);
+	for (unsigned layer = 0; layer < kContinuationGraphLayers; ++layer) {
+		for (unsigned i = 0; i < kContinuationGraphWidth; ++i) {
+			args.push_back({layer, finished, &violations});
+			unsigned const node = graph.AddNode({LayerNodeTask, &args.back()}, (i & 1) == 0 ? ftl::TaskPriority::High : ftl::TaskPriority::Low);
+
+			if (layer > 0) {
+				unsigned const previousLayerStart = (layer - 1) * kContinuationGraphWidth;
+				for (unsigned j = 0; j < kContinuationGraphWidth; ++j) {
+					graph.AddDependency(previousLayerStart + j, node);
+				}
+			}
+		}
+	}
+
+	for (unsigned round = 0; round < 10; ++round) {
+		for (auto &layerFinished : finished) {
+			layerFinished.store(0, std::memory_order_seq_cst);
+		}
+
+		ftl::TaskCounter counter(&taskScheduler);
+		graph.Submit(&counter);
+		taskScheduler.WaitForCounter(&counter);
+
+		for (auto &layerFinished : finished) {
+			REQUIRE(layerFinished.load() == kContinuationGraphWidth);
+		}
+	}
+
+	REQUIRE(violations.load() == 0);
+	REQUIRE(taskScheduler.GetFiberPoolStats().Grows == 0);
+}
+
+TEST_CASE("Task Graph Layers", "[functional]") {
+	SECTION("Yield") {
+		RunLayeredGraph(ftl::EmptyQueueBehavior::Yield);
+	}
+	SECTION("Sleep") {
+		RunLayeredGraph(ftl::EmptyQueueBehavior::Sleep);
+	}
+}
@@ -0,0 +1,140 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/atomic_counter.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr static unsigned kNumExternalThreads = 4;
+constexpr static unsigned kExternalRounds = 50;
+constexpr static unsigned kExternalTasksPerRound = 32;
+constexpr static unsigned kNumGatedWaiters = 16;
+
+void ExternalCountTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	auto *count = static_cast<std::atomic<unsigned> *>(arg);
+	count->fetch_add(1, std::memory_order_relaxed);
+}
+
+struct GateArgs {
+	ftl::FullAtomicCounter *Gate;
+	std::atomic<unsigned> *Count;
+};
+
+void GatedWaitTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *args = static_cast<GateArgs *>(arg);
+	taskScheduler->WaitForCounter(args->Gate, 1);
+	args->Count->fetch_add(1, std::memory_order_relaxed);
+}
+
+TEST_CASE("External Thread Task Submission", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> count(0);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < kNumExternalThreads; ++i) {
+		threads.emplace_back([&taskScheduler, &count, i]() {
+			ftl::Task tasks[kExternalTasksPerRound];
+			for (auto &task : tasks) {
+				task = {ExternalCountTask, &count};
+			}
+			// Not trivially copyable, so it can't be stored inline
+			std::string const label = "external thread " + std::to_string(i);
+
+			for (unsigned round = 0; round < kExternalRounds; ++round) {
+				ftl::TaskCounter counter(&taskScheduler);
+				ftl::TaskPriority const priority = round % 2 == 0 ? ftl::TaskPriority::High : ftl::TaskPriority::Low;
+
+				taskScheduler.AddTasks(kExternalTasksPerRound, tasks, priority, &counter);
+				taskScheduler.AddTask({ExternalCountTask, &count}, priority, &counter);
+				taskScheduler.AddTask([&count](ftl::TaskScheduler *) { count.fetch_add(1, std::memory_order_relaxed); }, priority, &counter);
+				taskScheduler.AddTasks(
+				        2,
+				        [&count, &label](unsigned) {
+					        // Only counts if the callable survived the trip intact
+					        return [&count, label](ftl::TaskScheduler *) { count.fetch_add(label.empty() ? 0 : 1, std::memory_order_relaxed); };
+				        },
+				        priority, &counter);
+
+				taskScheduler.WaitForCounter(&counter);
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	REQUIRE(count.load() == kNumExternalThreads * kExternalRounds * (kExternalTasksPerRound + 4));
+}
+
+TEST_CASE("External Thread Readies Waiters", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	ftl::FullAtomicCounter gate(&taskScheduler, 0);
+	std::atomic<unsigned> count(0);
+	GateArgs args{&gate, &count};
+
+	// Fibers, and a continuation, waiting on the gate
+	ftl::TaskCounter counter(&taskScheduler);
+	ftl::Task tasks[kNumGatedWaiters];
+	for (auto &task : tasks) {
+		task = {GatedWaitTask, &args};
+	}
+	taskScheduler.AddTasks(kNumGatedWaiters, tasks, ftl::TaskPriority::Low, &counter);
+	taskScheduler.AddContinuation(&gate, 1, {ExternalCountTask, &count}, ftl::TaskPriority::High, &counter);
+
+	// A thread blocked on the gate, which also adds a continuation from outside the scheduler
+	std::thread waiter([&taskScheduler, &gate, &count, &counter]() {
+		taskScheduler.AddContinuation(
+		        &gate, 1, [&count](ftl::TaskScheduler *) { count.fetch_add(1, std::memory_order_relaxed); }, ftl::TaskPriority::Low, &counter);
+		taskScheduler.WaitForCounter(&gate, 1);
+		count.fetch_add(1, std::memory_order_relaxed);
+	});
+
+	// Open the gate from a thread the scheduler doesn't own. It has to hand everything it readies to the workers
+	std::thread opener([&gate]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		gate.Store(1);
+	});
+
+	taskScheduler.WaitForCounter(&counter);
+	waiter.join();
+	opener.join();
+
+	REQUIRE(count.load() == kNumGatedWaiters + 3);
+}
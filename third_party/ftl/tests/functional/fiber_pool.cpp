@@ -0,0 +1,133 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+constexpr static unsigned kChainDepth = 50;
+
+struct ChainArgs {
+	unsigned Depth;
+	std::atomic<unsigned> *Leaves;
+};
+
+// Each link waits on the next one, so the whole chain needs kChainDepth fibers at the same time
+void WaitingChainTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *args = static_cast<ChainArgs *>(arg);
+	if (args->Depth == 0) {
+		args->Leaves->fetch_add(1, std::memory_order_seq_cst);
+		return;
+	}
+
+	ChainArgs childArgs{args->Depth - 1, args->Leaves};
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTask({WaitingChainTask, &childArgs}, ftl::TaskPriority::Low, &counter);
+
+	taskScheduler->WaitForCounter(&counter);
+}
+
+TEST_CASE("Fiber Pool Growth", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.FiberPoolSize = 8;
+	options.FiberPoolMaxSize = 128;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	REQUIRE(taskScheduler.GetFiberCount() == 128);
+	REQUIRE(taskScheduler.GetFiberPoolStats().Allocated == 8);
+
+	std::atomic<unsigned> leaves(0);
+	ChainArgs args{kChainDepth, &leaves};
+
+	ftl::TaskCounter counter(&taskScheduler);
+	taskScheduler.AddTask({WaitingChainTask, &args}, ftl::TaskPriority::Low, &counter);
+	taskScheduler.WaitForCounter(&counter);
+
+	REQUIRE(leaves.load() == 1);
+
+	ftl::FiberPoolStats const stats = taskScheduler.GetFiberPoolStats();
+	REQUIRE(stats.Capacity == 128);
+	REQUIRE(stats.Allocated > 8);
+	REQUIRE(stats.Allocated <= 128);
+	REQUIRE(stats.Grows == stats.Allocated - 8);
+	REQUIRE(stats.Acquires >= kChainDepth);
+	REQUIRE(stats.InUse <= stats.Allocated);
+}
+
+TEST_CASE("Fiber Pool Reuse", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.FiberPoolSize = 64;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> leaves(0);
+	ChainArgs args{kChainDepth / 2, &leaves};
+
+	// Run the chain repeatedly. The pool can't grow, so this only passes if the fibers are returned to the pool
+	for (unsigned i = 0; i < 20; ++i) {
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTask({WaitingChainTask, &args}, ftl::TaskPriority::Low, &counter);
+		taskScheduler.WaitForCounter(&counter);
+	}
+
+	REQUIRE(leaves.load() == 20);
+
+	ftl::FiberPoolStats const stats = taskScheduler.GetFiberPoolStats();
+	REQUIRE(stats.Allocated == 64);
+	REQUIRE(stats.Grows == 0);
+	REQUIRE(stats.CacheHits > 0);
+}
+
+TEST_CASE("Demand Paged Fiber Pool", "[functional]") {
+	constexpr size_t kFourMebibytes = 4 * 1024 * 1024;
+
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.FiberPoolSize = 256;
+	// 1 GiB of reserved stack. Only the pages the fibers touch should be committed
+	options.FiberStackSize = kFourMebibytes;
+	options.StackAllocation = ftl::FiberStackAllocation::DemandPaged;
+	options.TrackFiberStackUsage = true;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> leaves(0);
+	ChainArgs args{kChainDepth, &leaves};
+
+	ftl::TaskCounter counter(&taskScheduler);
+	taskScheduler.AddTask({WaitingChainTask, &args}, ftl::TaskPriority::Low, &counter);
+	taskScheduler.WaitForCounter(&counter);
+
+	REQUIRE(leaves.load() == 1);
+
+	size_t const maxUsage = taskScheduler.GetMaxFiberStackUsage();
+	REQUIRE(maxUsage > 0);
+	REQUIRE(maxUsage < kFourMebibytes);
+}
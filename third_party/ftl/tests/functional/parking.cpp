@@ -0,0 +1,127 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+constexpr static unsigned kParkingRounds = 10;
+constexpr static unsigned kParkingTasksPerRound = 64;
+
+void ParkingCountTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	auto *count = static_cast<std::atomic<unsigned> *>(arg);
+	count->fetch_add(1, std::memory_order_seq_cst);
+}
+
+void PinnedWaitTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *count = static_cast<std::atomic<unsigned> *>(arg);
+
+	ftl::Task tasks[kParkingTasksPerRound];
+	for (auto &task : tasks) {
+		task = {ParkingCountTask, count};
+	}
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(kParkingTasksPerRound, tasks, ftl::TaskPriority::Low, &counter);
+
+	// Only this thread can resume us, so it has to be woken directly if it falls asleep
+	taskScheduler->WaitForCounter(&counter, true);
+}
+
+TEST_CASE("Sleep Mode Wakes Parked Threads", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> count(0);
+	ftl::Task tasks[kParkingTasksPerRound];
+	for (auto &task : tasks) {
+		task = {ParkingCountTask, &count};
+	}
+
+	for (unsigned i = 0; i < kParkingRounds; ++i) {
+		// Give the workers time to run out of work and fall asleep
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(kParkingTasksPerRound, tasks, ftl::TaskPriority::Low, &counter);
+		taskScheduler.WaitForCounter(&counter);
+	}
+
+	REQUIRE(count.load() == kParkingRounds * kParkingTasksPerRound);
+
+	ftl::ParkingStats const stats = taskScheduler.GetParkingStats();
+	REQUIRE(stats.Parks > 0);
+	REQUIRE(stats.Wakes == stats.Parks);
+	REQUIRE(stats.WakeLatencyMaxNs * stats.Wakes >= stats.WakeLatencyTotalNs);
+}
+
+TEST_CASE("Sleep Mode Pinned Wake", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> count(0);
+	for (unsigned i = 0; i < kParkingRounds; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTask({PinnedWaitTask, &count}, ftl::TaskPriority::Low, &counter);
+		taskScheduler.WaitForCounter(&counter, true);
+	}
+
+	REQUIRE(count.load() == kParkingRounds * kParkingTasksPerRound);
+}
+
+TEST_CASE("Leaving Sleep Mode Wakes Parked Threads", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	taskScheduler.SetEmptyQueueBehavior(ftl::EmptyQueueBehavior::Yield);
+
+	std::atomic<unsigned> count(0);
+	ftl::Task tasks[kParkingTasksPerRound];
+	for (auto &task : tasks) {
+		task = {ParkingCountTask, &count};
+	}
+
+	ftl::TaskCounter counter(&taskScheduler);
+	taskScheduler.AddTasks(kParkingTasksPerRound, tasks, ftl::TaskPriority::Low, &counter);
+	taskScheduler.WaitForCounter(&counter);
+
+	REQUIRE(count.load() == kParkingTasksPerRound);
+}
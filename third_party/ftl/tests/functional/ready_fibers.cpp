@@ -0,0 +1,123 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+
+constexpr static unsigned kReadyFiberWaiters = 96;
+constexpr static unsigned kReadyFiberRounds = 20;
+
+struct ReadyFiberArgs {
+	ftl::TaskCounter *Gate;
+	std::atomic<unsigned> *Resumed;
+};
+
+void TrivialTask(ftl::TaskScheduler * /*taskScheduler*/, void * /*arg*/) {
+}
+
+// Waits on a counter that finishes almost immediately, so the counter is often ready before we've switched away
+void ShortWaitTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *resumed = static_cast<std::atomic<unsigned> *>(arg);
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTask({TrivialTask, nullptr}, ftl::TaskPriority::High, &counter);
+	taskScheduler->WaitForCounter(&counter);
+
+	resumed->fetch_add(1, std::memory_order_seq_cst);
+}
+
+// Half of the waiters are pinned, so both the pinned list and the stealable ready queues get exercised
+void GateWaitTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *args = static_cast<ReadyFiberArgs *>(arg);
+
+	bool const pinToCurrentThread = (taskScheduler->GetCurrentThreadIndex() & 1) == 0;
+	taskScheduler->WaitForCounter(args->Gate, pinToCurrentThread);
+
+	args->Resumed->fetch_add(1, std::memory_order_seq_cst);
+}
+
+void RunShortWaits(ftl::EmptyQueueBehavior const behavior) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = behavior;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> resumed(0);
+	ftl::Task tasks[kReadyFiberWaiters];
+	for (auto &task : tasks) {
+		task = {ShortWaitTask, &resumed};
+	}
+
+	for (unsigned i = 0; i < kReadyFiberRounds; ++i) {
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(kReadyFiberWaiters, tasks, ftl::TaskPriority::Low, &counter);
+		taskScheduler.WaitForCounter(&counter);
+	}
+
+	REQUIRE(resumed.load() == kReadyFiberWaiters * kReadyFiberRounds);
+}
+
+void RunGateWaits(ftl::EmptyQueueBehavior const behavior) {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.FiberPoolSize = kReadyFiberWaiters + 32;
+	options.Behavior = behavior;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	for (unsigned i = 0; i < kReadyFiberRounds; ++i) {
+		std::atomic<unsigned> resumed(0);
+		ftl::TaskCounter gate(&taskScheduler);
+		gate.Add(1);
+
+		ReadyFiberArgs args{&gate, &resumed};
+		ftl::Task tasks[kReadyFiberWaiters];
+		for (auto &task : tasks) {
+			task = {GateWaitTask, &args};
+		}
+
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(kReadyFiberWaiters, tasks, ftl::TaskPriority::Low, &counter);
+
+		// Open the gate. Every waiter becomes ready at once
+		gate.Decrement();
+		taskScheduler.WaitForCounter(&counter);
+
+		REQUIRE(resumed.load() == kReadyFiberWaiters);
+	}
+}
+
+TEST_CASE("Ready Fibers Resume After Short Waits", "[functional]") {
+	RunShortWaits(ftl::EmptyQueueBehavior::Yield);
+	RunShortWaits(ftl::EmptyQueueBehavior::Sleep);
+}
+
+TEST_CASE("Ready Fibers Fan In", "[functional]") {
+	RunGateWaits(ftl::EmptyQueueBehavior::Yield);
+	RunGateWaits(ftl::EmptyQueueBehavior::Sleep);
+}
@@ -0,0 +1,206 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/parallel_for.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+constexpr static unsigned kNumTypedTasks = 1000;
+
+struct DestructorCounter {
+	explicit DestructorCounter(std::atomic<unsigned> *destroyed)
+	        : Destroyed(destroyed) {
+	}
+	DestructorCounter(DestructorCounter const &other)
+	        : Destroyed(other.Destroyed) {
+	}
+	DestructorCounter &operator=(DestructorCounter const &) = delete;
+	~DestructorCounter() {
+		Destroyed->fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::atomic<unsigned> *Destroyed;
+};
+
+TEST_CASE("Typed Tasks", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<uint64_t> sum(0);
+
+	// Small captures are stored inline, so they never touch the arena
+	{
+		ftl::TaskCounter counter(&taskScheduler);
+		for (unsigned i = 0; i < kNumTypedTasks; ++i) {
+			taskScheduler.AddTask([&sum, i](ftl::TaskScheduler *) { sum.fetch_add(i, std::memory_order_relaxed); }, ftl::TaskPriority::Low, &counter);
+		}
+		taskScheduler.WaitForCounter(&counter);
+
+		REQUIRE(sum.load() == uint64_t(kNumTypedTasks) * (kNumTypedTasks - 1) / 2);
+		REQUIRE(taskScheduler.GetTaskArenaStats().Allocations == 0);
+	}
+
+	// Big captures go to the arena
+	sum.store(0);
+	{
+		uint64_t values[16];
+		for (unsigned i = 0; i < 16; ++i) {
+			values[i] = i;
+		}
+
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(
+		        kNumTypedTasks,
+		        [&sum, values](unsigned) {
+			        return [&sum, values](ftl::TaskScheduler *) {
+				        for (uint64_t const value : values) {
+					        sum.fetch_add(value, std::memory_order_relaxed);
+				        }
+			        };
+		        },
+		        ftl::TaskPriority::High, &counter);
+		taskScheduler.WaitForCounter(&counter);
+
+		REQUIRE(sum.load() == uint64_t(kNumTypedTasks) * 120);
+		REQUIRE(taskScheduler.GetTaskArenaStats().Allocations == kNumTypedTasks);
+	}
+
+	// Non-trivial captures also go to the arena, and are destroyed exactly once, after they run
+	{
+		std::atomic<unsigned> destroyed(0);
+		std::atomic<unsigned> ran(0);
+		{
+			DestructorCounter const destructorCounter(&destroyed);
+
+			ftl::TaskCounter counter(&taskScheduler);
+			for (unsigned i = 0; i < kNumTypedTasks; ++i) {
+				taskScheduler.AddTask([destructorCounter, &ran](ftl::TaskScheduler *) { ran.fetch_add(1, std::memory_order_relaxed); }, ftl::TaskPriority::Low,
+				                      &counter);
+			}
+			taskScheduler.WaitForCounter(&counter);
+
+			// The temporary lambdas passed to AddTask have been destroyed too
+			REQUIRE(ran.load() == kNumTypedTasks);
+			REQUIRE(destroyed.load() == 2 * kNumTypedTasks);
+		}
+	}
+}
+
+TEST_CASE("Typed Tasks Reach Steady State", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::atomic<unsigned> ran(0);
+	unsigned char padding[256] = {};
+	auto const runBatch = [&taskScheduler, &ran, &padding]() {
+		ftl::TaskCounter counter(&taskScheduler);
+		taskScheduler.AddTasks(
+		        kNumTypedTasks,
+		        [&ran, &padding](unsigned) {
+			        return [&ran, padding](ftl::TaskScheduler *) { ran.fetch_add(padding[0] + 1u, std::memory_order_relaxed); };
+		        },
+		        ftl::TaskPriority::Low, &counter);
+
+		// Each thread has its own arena. Pin, so we keep allocating from the same one
+		taskScheduler.WaitForCounter(&counter, true);
+	};
+
+	for (unsigned i = 0; i < 10; ++i) {
+		runBatch();
+	}
+	uint64_t const heapAllocations = taskScheduler.GetTaskArenaStats().HeapAllocations;
+
+	// Once the arena has grown to fit a batch, it's reused
+	for (unsigned i = 0; i < 50; ++i) {
+		runBatch();
+	}
+
+	REQUIRE(ran.load() == 60 * kNumTypedTasks);
+	REQUIRE(taskScheduler.GetTaskArenaStats().HeapAllocations == heapAllocations);
+}
+
+TEST_CASE("Parallel For", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	constexpr size_t kNumElements = 100000;
+	std::vector<std::atomic<unsigned>> visits(kNumElements);
+
+	size_t const grainSizes[] = {1, 16, 1000, kNumElements * 2};
+	for (size_t const grainSize : grainSizes) {
+		for (auto &visit : visits) {
+			visit.store(0, std::memory_order_relaxed);
+		}
+
+		ftl::ParallelFor(
+		        &taskScheduler, 10, kNumElements, [&visits](size_t const i) { visits[i].fetch_add(1, std::memory_order_relaxed); }, grainSize);
+
+		for (size_t i = 0; i < kNumElements; ++i) {
+			REQUIRE(visits[i].load() == (i < 10 ? 0u : 1u));
+		}
+	}
+
+	// Empty range
+	ftl::ParallelFor(&taskScheduler, 5, 5, [](size_t) { FAIL("Empty range ran an iteration"); });
+
+	uint64_t const sum = ftl::ParallelReduce(
+	        &taskScheduler, 0, kNumElements, uint64_t(0), [](uint64_t const partial, size_t const i) { return partial + i; },
+	        [](uint64_t const a, uint64_t const b) { return a + b; }, 64);
+	REQUIRE(sum == uint64_t(kNumElements) * (kNumElements - 1) / 2);
+}
+
+TEST_CASE("Nested Parallel For", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	constexpr size_t kOuter = 64;
+	constexpr size_t kInner = 1000;
+
+	std::atomic<uint64_t> total(0);
+	ftl::ParallelFor(&taskScheduler, 0, kOuter, [&taskScheduler, &total](size_t) {
+		uint64_t const inner = ftl::ParallelReduce(
+		        &taskScheduler, 0, kInner, uint64_t(0), [](uint64_t const partial, size_t) { return partial + 1; },
+		        [](uint64_t const a, uint64_t const b) { return a + b; });
+		total.fetch_add(inner, std::memory_order_relaxed);
+	});
+
+	REQUIRE(total.load() == kOuter * kInner);
+}
@@ -0,0 +1,126 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/atomic_counter.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <thread>
+
+constexpr static unsigned kNumWaiters = 128;
+
+struct WaitingListArgs {
+	ftl::BaseCounter *Gate;
+	unsigned TargetValue;
+	std::atomic<unsigned> *Arrived;
+	std::atomic<unsigned> *Resumed;
+};
+
+void WaitOnTaskCounter(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *args = static_cast<WaitingListArgs *>(arg);
+
+	args->Arrived->fetch_add(1, std::memory_order_seq_cst);
+	taskScheduler->WaitForCounter(static_cast<ftl::TaskCounter *>(args->Gate));
+	args->Resumed->fetch_add(1, std::memory_order_seq_cst);
+}
+
+void WaitOnFullAtomicCounter(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *args = static_cast<WaitingListArgs *>(arg);
+
+	args->Arrived->fetch_add(1, std::memory_order_seq_cst);
+	taskScheduler->WaitForCounter(static_cast<ftl::FullAtomicCounter *>(args->Gate), args->TargetValue);
+	args->Resumed->fetch_add(1, std::memory_order_seq_cst);
+}
+
+static void WaitForArrivals(std::atomic<unsigned> const &arrived, unsigned const count) {
+	while (arrived.load(std::memory_order_seq_cst) != count) {
+		std::this_thread::yield();
+	}
+}
+
+TEST_CASE("Many Fibers Waiting On One Counter", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	// Far more waiters than the old fixed number of slots
+	ftl::TaskCounter gate(&taskScheduler);
+	gate.Add(1);
+
+	std::atomic<unsigned> arrived(0);
+	std::atomic<unsigned> resumed(0);
+	WaitingListArgs args{&gate, 0, &arrived, &resumed};
+
+	ftl::TaskCounter done(&taskScheduler);
+	for (unsigned i = 0; i < kNumWaiters; ++i) {
+		taskScheduler.AddTask({WaitOnTaskCounter, &args}, ftl::TaskPriority::Low, &done);
+	}
+
+	WaitForArrivals(arrived, kNumWaiters);
+	gate.Decrement();
+	taskScheduler.WaitForCounter(&done);
+
+	REQUIRE(resumed.load() == kNumWaiters);
+}
+
+TEST_CASE("Waiting For Different Values", "[functional]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	ftl::FullAtomicCounter gate(&taskScheduler);
+
+	std::atomic<unsigned> firstArrived(0);
+	std::atomic<unsigned> firstResumed(0);
+	WaitingListArgs firstArgs{&gate, 1, &firstArrived, &firstResumed};
+	std::atomic<unsigned> secondArrived(0);
+	std::atomic<unsigned> secondResumed(0);
+	WaitingListArgs secondArgs{&gate, 2, &secondArrived, &secondResumed};
+
+	ftl::TaskCounter firstDone(&taskScheduler);
+	ftl::TaskCounter secondDone(&taskScheduler);
+	for (unsigned i = 0; i < kNumWaiters / 2; ++i) {
+		taskScheduler.AddTask({WaitOnFullAtomicCounter, &firstArgs}, ftl::TaskPriority::Low, &firstDone);
+		taskScheduler.AddTask({WaitOnFullAtomicCounter, &secondArgs}, ftl::TaskPriority::Low, &secondDone);
+	}
+	WaitForArrivals(firstArrived, kNumWaiters / 2);
+	WaitForArrivals(secondArrived, kNumWaiters / 2);
+
+	// Only the fibers waiting for 1 should resume
+	gate.Store(1);
+	taskScheduler.WaitForCounter(&firstDone);
+	REQUIRE(firstResumed.load() == kNumWaiters / 2);
+	REQUIRE(secondResumed.load() == 0);
+
+	gate.Store(2);
+	taskScheduler.WaitForCounter(&secondDone);
+	REQUIRE(secondResumed.load() == kNumWaiters / 2);
+}
@@ -0,0 +1,116 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/channel.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+
+constexpr static unsigned kChannelProducers = 8;
+constexpr static unsigned kChannelConsumers = 4;
+constexpr static unsigned kValuesPerProducer = 2000;
+
+struct ChannelData {
+	explicit ChannelData(ftl::TaskScheduler *scheduler)
+	        : Values(scheduler, 4) {
+	}
+
+	ftl::Channel<uint64_t> Values;
+	std::atomic<uint64_t> Sum{0};
+	std::atomic<unsigned> Received{0};
+	std::atomic<unsigned> FailedSends{0};
+};
+
+static void ChannelProducer(ftl::TaskScheduler * /*scheduler*/, void *arg) {
+	auto *data = static_cast<ChannelData *>(arg);
+
+	for (uint64_t i = 1; i <= kValuesPerProducer; ++i) {
+		if (!data->Values.Send(i)) {
+			data->FailedSends.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+static void ChannelConsumer(ftl::TaskScheduler * /*scheduler*/, void *arg) {
+	auto *data = static_cast<ChannelData *>(arg);
+
+	uint64_t value;
+	while (data->Values.Receive(&value)) {
+		data->Sum.fetch_add(value, std::memory_order_relaxed);
+		data->Received.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+TEST_CASE("Channel Producers And Consumers", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	ChannelData data(&taskScheduler);
+
+	ftl::TaskCounter consumers(&taskScheduler);
+	for (unsigned i = 0; i < kChannelConsumers; ++i) {
+		taskScheduler.AddTask({ChannelConsumer, &data}, ftl::TaskPriority::Low, &consumers);
+	}
+	ftl::TaskCounter producers(&taskScheduler);
+	for (unsigned i = 0; i < kChannelProducers; ++i) {
+		taskScheduler.AddTask({ChannelProducer, &data}, ftl::TaskPriority::Low, &producers);
+	}
+
+	taskScheduler.WaitForCounter(&producers);
+	data.Values.Close();
+	taskScheduler.WaitForCounter(&consumers);
+
+	constexpr uint64_t kSumPerProducer = static_cast<uint64_t>(kValuesPerProducer) * (kValuesPerProducer + 1) / 2;
+	REQUIRE(data.FailedSends.load() == 0);
+	REQUIRE(data.Received.load() == kChannelProducers * kValuesPerProducer);
+	REQUIRE(data.Sum.load() == kChannelProducers * kSumPerProducer);
+	REQUIRE(data.Values.GetSize() == 0);
+}
+
+TEST_CASE("Channel Close", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	REQUIRE(taskScheduler.Init() == 0);
+
+	ftl::Channel<int> channel(&taskScheduler, 2);
+	REQUIRE(channel.TrySend(1));
+	REQUIRE(channel.TrySend(2));
+	REQUIRE_FALSE(channel.TrySend(3));
+
+	channel.Close();
+	REQUIRE(channel.IsClosed());
+	REQUIRE_FALSE(channel.Send(4));
+
+	// Values sent before the close can still be received
+	int value = 0;
+	REQUIRE(channel.Receive(&value));
+	REQUIRE(value == 1);
+	REQUIRE(channel.TryReceive(&value));
+	REQUIRE(value == 2);
+	REQUIRE_FALSE(channel.Receive(&value));
+}
@@ -0,0 +1,186 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/cpu_topology.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <limits>
+#include <string>
+
+#if defined(FTL_OS_LINUX)
+#	include <stdio.h>
+#	include <stdlib.h>
+#	include <ftw.h>
+#	include <sys/stat.h>
+
+static void MakeDirectory(std::string const &path) {
+	mkdir(path.c_str(), 0755);
+}
+
+static void WriteFile(std::string const &path, std::string const &contents) {
+	FILE *file = fopen(path.c_str(), "w");
+	REQUIRE(file != nullptr);
+	fputs(contents.c_str(), file);
+	fputc('\n', file);
+	fclose(file);
+}
+
+static int RemoveEntry(char const *path, struct stat const * /*stat*/, int /*type*/, struct FTW * /*ftw*/) {
+	return remove(path);
+}
+
+static void RemoveTree(std::string const &path) {
+	nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static std::string CpuRange(unsigned const first, unsigned const count) {
+	return std::to_string(first) + "-" + std::to_string(first + count - 1);
+}
+
+// 2 NUMA nodes, each with 2 last level caches, each with 2 cores, each with 2 SMT siblings
+// Like Linux, the siblings are numbered (core, core + 8)
+static std::string MakeFakeSysfs() {
+	char rootTemplate[] = "/tmp/ftl_sysfs_XXXXXX";
+	REQUIRE(mkdtemp(rootTemplate) != nullptr);
+	std::string const root = rootTemplate;
+
+	WriteFile(root + "/online", "0-15");
+	for (unsigned cpu = 0; cpu < 16; ++cpu) {
+		unsigned const core = cpu % 8;
+		unsigned const cache = core / 2;
+		unsigned const node = core / 4;
+
+		std::string const cpuPath = root + "/cpu" + std::to_string(cpu);
+		MakeDirectory(cpuPath);
+		MakeDirectory(cpuPath + "/node" + std::to_string(node));
+		MakeDirectory(cpuPath + "/topology");
+		WriteFile(cpuPath + "/topology/thread_siblings_list", std::to_string(core) + "," + std::to_string(core + 8));
+
+		MakeDirectory(cpuPath + "/cache");
+		char const *types[] = {"Data", "Instruction", "Unified", "Unified"};
+		unsigned const levels[] = {1, 1, 2, 3};
+		for (unsigned index = 0; index < 4; ++index) {
+			std::string const indexPath = cpuPath + "/cache/index" + std::to_string(index);
+			MakeDirectory(indexPath);
+			WriteFile(indexPath + "/level", std::to_string(levels[index]));
+			WriteFile(indexPath + "/type", types[index]);
+			if (levels[index] < 3) {
+				WriteFile(indexPath + "/shared_cpu_list", std::to_string(core) + "," + std::to_string(core + 8));
+			} else {
+				WriteFile(indexPath + "/shared_cpu_list", CpuRange(cache * 2, 2) + "," + CpuRange(cache * 2 + 8, 2));
+			}
+		}
+	}
+
+	return root;
+}
+
+TEST_CASE("Read CPU Topology", "[utility]") {
+	std::string const root = MakeFakeSysfs();
+
+	std::vector<ftl::LogicalCpu> cpus;
+	REQUIRE(ftl::ReadCpuTopology(&cpus, root.c_str()));
+	REQUIRE(cpus.size() == 16);
+
+	for (unsigned i = 0; i < 16; ++i) {
+		unsigned const core = i % 8;
+		REQUIRE(cpus[i].Id == i);
+		REQUIRE(cpus[i].CoreId == core);
+		REQUIRE(cpus[i].CacheId == (core / 2) * 2);
+		REQUIRE(cpus[i].NumaNode == core / 4);
+	}
+
+	REQUIRE(ftl::GetStealLevel(cpus[1], cpus[9]) == ftl::StealLevel::Core);
+	REQUIRE(ftl::GetStealLevel(cpus[0], cpus[9]) == ftl::StealLevel::Cache);
+	REQUIRE(ftl::GetStealLevel(cpus[0], cpus[3]) == ftl::StealLevel::NumaNode);
+	REQUIRE(ftl::GetStealLevel(cpus[0], cpus[12]) == ftl::StealLevel::Remote);
+
+	// Physical cores first: one sibling of each core, grouped by node and cache, then the other siblings
+	std::vector<unsigned> const spread = ftl::OrderCpusForPinning(cpus, true);
+	std::vector<unsigned> const expectedSpread = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+	REQUIRE(spread == expectedSpread);
+
+	// SMT siblings: both siblings of a core are next to each other
+	std::vector<unsigned> const compact = ftl::OrderCpusForPinning(cpus, false);
+	std::vector<unsigned> const expectedCompact = {0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15};
+	REQUIRE(compact == expectedCompact);
+
+	REQUIRE_FALSE(ftl::ReadCpuTopology(&cpus, (root + "/missing").c_str()));
+	REQUIRE(cpus.empty());
+
+	RemoveTree(root);
+}
+
+#endif
+
+void TopologyEmptyTask(ftl::TaskScheduler * /*taskScheduler*/, void * /*arg*/) {
+}
+
+void RunStealTasks(ftl::TaskScheduler *taskScheduler) {
+	std::vector<ftl::Task> tasks(10000, ftl::Task{TopologyEmptyTask, nullptr});
+
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTasks(static_cast<unsigned>(tasks.size()), tasks.data(), ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+}
+
+TEST_CASE("Unpinned Threads Steal Round Robin", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	for (unsigned i = 0; i < taskScheduler.GetThreadCount(); ++i) {
+		REQUIRE(taskScheduler.GetThreadCpu(i) == std::numeric_limits<unsigned>::max());
+	}
+
+	RunStealTasks(&taskScheduler);
+
+	// Without pinning, the distance to the other threads is unknown
+	ftl::StealStats const stats = taskScheduler.GetStealStats();
+	REQUIRE(stats.Steals[static_cast<unsigned>(ftl::StealLevel::Core)] == 0);
+	REQUIRE(stats.Steals[static_cast<unsigned>(ftl::StealLevel::Cache)] == 0);
+	REQUIRE(stats.Steals[static_cast<unsigned>(ftl::StealLevel::NumaNode)] == 0);
+}
+
+TEST_CASE("Pinned Threads", "[utility]") {
+	ftl::ThreadPinning const pinnings[] = {ftl::ThreadPinning::PhysicalCores, ftl::ThreadPinning::SmtSiblings};
+	for (ftl::ThreadPinning const pinning : pinnings) {
+		ftl::TaskScheduler taskScheduler;
+		ftl::TaskSchedulerInitOptions options;
+		options.ThreadPoolSize = 4;
+		options.Behavior = ftl::EmptyQueueBehavior::Yield;
+		options.Pinning = pinning;
+		REQUIRE(taskScheduler.Init(options) == 0);
+
+		for (unsigned i = 0; i < taskScheduler.GetThreadCount(); ++i) {
+			REQUIRE(taskScheduler.GetThreadCpu(i) != std::numeric_limits<unsigned>::max());
+		}
+
+		RunStealTasks(&taskScheduler);
+	}
+}
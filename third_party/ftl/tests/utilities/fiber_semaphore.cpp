@@ -0,0 +1,97 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/fiber_semaphore.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+
+constexpr static unsigned kSemaphoreUnits = 3;
+
+struct SemaphoreData {
+	explicit SemaphoreData(ftl::TaskScheduler *scheduler)
+	        : Semaphore(scheduler, kSemaphoreUnits) {
+	}
+
+	ftl::FiberSemaphore Semaphore;
+	std::atomic<unsigned> Active{0};
+	std::atomic<unsigned> MaxActive{0};
+	std::atomic<unsigned> Finished{0};
+};
+
+static void SemaphoreTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *data = static_cast<SemaphoreData *>(arg);
+
+	data->Semaphore.acquire();
+	unsigned const active = data->Active.fetch_add(1) + 1;
+	unsigned previousMax = data->MaxActive.load();
+	while (active > previousMax && !data->MaxActive.compare_exchange_weak(previousMax, active)) {
+	}
+
+	// Hold the unit across a wait, so other fibers have to park on the semaphore
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTask({[](ftl::TaskScheduler *, void *) {}, nullptr}, ftl::TaskPriority::High, &counter);
+	taskScheduler->WaitForCounter(&counter);
+
+	data->Active.fetch_sub(1);
+	data->Finished.fetch_add(1);
+	data->Semaphore.release();
+}
+
+TEST_CASE("FiberSemaphore Limits Concurrency", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	SemaphoreData data(&taskScheduler);
+
+	constexpr unsigned kTasks = 1000;
+	ftl::TaskCounter counter(&taskScheduler);
+	for (unsigned i = 0; i < kTasks; ++i) {
+		taskScheduler.AddTask({SemaphoreTask, &data}, ftl::TaskPriority::Low, &counter);
+	}
+	taskScheduler.WaitForCounter(&counter);
+
+	REQUIRE(data.Finished.load() == kTasks);
+	REQUIRE(data.MaxActive.load() >= 1);
+	REQUIRE(data.MaxActive.load() <= kSemaphoreUnits);
+	REQUIRE(data.Semaphore.GetCount() == kSemaphoreUnits);
+}
+
+TEST_CASE("FiberSemaphore Try Acquire", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	REQUIRE(taskScheduler.Init() == 0);
+
+	ftl::FiberSemaphore semaphore(&taskScheduler, 2);
+	REQUIRE(semaphore.try_acquire());
+	REQUIRE(semaphore.try_acquire());
+	REQUIRE_FALSE(semaphore.try_acquire());
+
+	semaphore.release(2);
+	REQUIRE(semaphore.GetCount() == 2);
+}
@@ -0,0 +1,117 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/shared_fibtex.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
+struct SharedFibtexData {
+	explicit SharedFibtexData(ftl::TaskScheduler *scheduler)
+	        : Lock(scheduler) {
+	}
+
+	ftl::SharedFibtex Lock;
+	// Writers keep these equal. Readers check that they never see them differ
+	unsigned First = 0;
+	unsigned Second = 0;
+	std::atomic<unsigned> TornReads{0};
+	std::atomic<unsigned> Reads{0};
+};
+
+static void SharedFibtexWriter(ftl::TaskScheduler *taskScheduler, void *arg) {
+	auto *data = static_cast<SharedFibtexData *>(arg);
+
+	std::lock_guard<ftl::SharedFibtex> guard(data->Lock);
+	++data->First;
+	// Give other fibers a chance to run in the middle of the update
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTask({[](ftl::TaskScheduler *, void *) {}, nullptr}, ftl::TaskPriority::High, &counter);
+	taskScheduler->WaitForCounter(&counter);
+	++data->Second;
+}
+
+static void SharedFibtexReader(ftl::TaskScheduler * /*scheduler*/, void *arg) {
+	auto *data = static_cast<SharedFibtexData *>(arg);
+
+	ftl::SharedFibtex &lock = data->Lock;
+	lock.lock_shared();
+	if (data->First != data->Second) {
+		data->TornReads.fetch_add(1, std::memory_order_relaxed);
+	}
+	data->Reads.fetch_add(1, std::memory_order_relaxed);
+	lock.unlock_shared();
+}
+
+TEST_CASE("SharedFibtex Readers And Writers", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.Behavior = ftl::EmptyQueueBehavior::Yield;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	SharedFibtexData data(&taskScheduler);
+
+	constexpr unsigned kWriters = 200;
+	constexpr unsigned kReadersPerWriter = 8;
+	ftl::TaskCounter counter(&taskScheduler);
+	for (unsigned i = 0; i < kWriters; ++i) {
+		taskScheduler.AddTask({SharedFibtexWriter, &data}, ftl::TaskPriority::Low, &counter);
+		for (unsigned j = 0; j < kReadersPerWriter; ++j) {
+			taskScheduler.AddTask({SharedFibtexReader, &data}, ftl::TaskPriority::Low, &counter);
+		}
+	}
+	taskScheduler.WaitForCounter(&counter);
+
+	REQUIRE(data.First == kWriters);
+	REQUIRE(data.Second == kWriters);
+	REQUIRE(data.Reads.load() == kWriters * kReadersPerWriter);
+	REQUIRE(data.TornReads.load() == 0);
+}
+
+TEST_CASE("SharedFibtex Try Lock", "[utility]") {
+	ftl::TaskScheduler taskScheduler;
+	REQUIRE(taskScheduler.Init() == 0);
+
+	ftl::SharedFibtex lock(&taskScheduler);
+
+	REQUIRE(lock.try_lock_shared());
+	REQUIRE(lock.try_lock_shared());
+	REQUIRE_FALSE(lock.try_lock());
+	lock.unlock_shared();
+	lock.unlock_shared();
+
+	{
+		std::unique_lock<ftl::SharedFibtex> exclusive(lock);
+		REQUIRE_FALSE(lock.try_lock());
+		REQUIRE_FALSE(lock.try_lock_shared());
+	}
+
+	REQUIRE(lock.try_lock());
+	lock.unlock();
+}
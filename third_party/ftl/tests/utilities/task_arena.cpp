@@ -0,0 +1,113 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/task_arena.h"
+
+#include "catch2/catch.hpp"
+
+#include <cstddef>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Task Arena Alignment", "[utility]") {
+	ftl::TaskArena arena;
+
+	std::vector<void *> allocations;
+	for (size_t size = 1; size < 200; size += 7) {
+		for (size_t alignment = 1; alignment <= alignof(std::max_align_t); alignment *= 2) {
+			void *const allocation = arena.Allocate(size, alignment);
+			REQUIRE(reinterpret_cast<uintptr_t>(allocation) % alignment == 0);
+			allocations.push_back(allocation);
+		}
+	}
+
+	for (void *const allocation : allocations) {
+		ftl::TaskArena::Free(allocation);
+	}
+
+	REQUIRE(arena.GetAllocationCount() == allocations.size());
+}
+
+TEST_CASE("Task Arena Reuse", "[utility]") {
+	ftl::TaskArena arena;
+
+	// Fill several blocks, free everything, and do it again. The second round shouldn't need any new blocks
+	constexpr size_t kAllocationSize = 1024;
+	constexpr size_t kNumAllocations = 4 * ftl::TaskArena::kBlockSize / kAllocationSize;
+
+	std::vector<void *> allocations;
+	for (unsigned round = 0; round < 4; ++round) {
+		for (size_t i = 0; i < kNumAllocations; ++i) {
+			allocations.push_back(arena.Allocate(kAllocationSize, 8));
+		}
+		for (void *const allocation : allocations) {
+			ftl::TaskArena::Free(allocation);
+		}
+		allocations.clear();
+	}
+
+	// One extra block, because the current block is retired before the first freed block comes back
+	REQUIRE(arena.GetHeapAllocationCount() <= 6);
+
+	// Oversized allocations go straight to the heap
+	uint64_t const heapAllocations = arena.GetHeapAllocationCount();
+	void *const big = arena.Allocate(ftl::TaskArena::kBlockSize, 8);
+	REQUIRE(arena.GetHeapAllocationCount() == heapAllocations + 1);
+	ftl::TaskArena::Free(big);
+}
+
+TEST_CASE("Task Arena Cross Thread Free", "[utility]") {
+	ftl::TaskArena arena;
+
+	constexpr size_t kNumAllocations = 100000;
+	std::vector<void *> allocations(kNumAllocations);
+	for (auto &allocation : allocations) {
+		allocation = arena.Allocate(64, 8);
+	}
+
+	// Free from other threads, while the owner keeps allocating
+	std::thread freer1([&allocations]() {
+		for (size_t i = 0; i < kNumAllocations; i += 2) {
+			ftl::TaskArena::Free(allocations[i]);
+		}
+	});
+	std::thread freer2([&allocations]() {
+		for (size_t i = 1; i < kNumAllocations; i += 2) {
+			ftl::TaskArena::Free(allocations[i]);
+		}
+	});
+
+	std::vector<void *> more;
+	for (size_t i = 0; i < kNumAllocations; ++i) {
+		more.push_back(arena.Allocate(64, 8));
+	}
+
+	freer1.join();
+	freer2.join();
+	for (void *const allocation : more) {
+		ftl::TaskArena::Free(allocation);
+	}
+
+	REQUIRE(arena.GetAllocationCount() == 2 * kNumAllocations);
+}
@@ -0,0 +1,169 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "ftl/atomic_counter.h"
+#include "ftl/task_counter.h"
+#include "ftl/task_scheduler.h"
+
+#include "catch2/catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr static unsigned kNumTelemetryTasks = 500;
+
+struct CallbackLog {
+	std::mutex Lock;
+	std::vector<unsigned> RunningFibers;
+	unsigned TasksStarted = 0;
+	unsigned TasksFinished = 0;
+	unsigned TasksAdded = 0;
+	unsigned TasksWithoutCounter = 0;
+	unsigned Waits = 0;
+	unsigned Resumes = 0;
+	unsigned SatisfiedWaits = 0;
+	bool Mismatched = false;
+	std::atomic<unsigned> WaitEvents{0};
+};
+
+static void EmptyTelemetryTask(ftl::TaskScheduler * /*taskScheduler*/, void * /*arg*/) {
+}
+
+// Doesn't finish until someone has started waiting. So the wait in WaitingTelemetryTask always suspends
+static void BlockedTelemetryTask(ftl::TaskScheduler * /*taskScheduler*/, void *arg) {
+	auto *log = static_cast<CallbackLog *>(arg);
+	while (log->WaitEvents.load(std::memory_order_acquire) == 0) {
+		std::this_thread::yield();
+	}
+}
+
+static void WaitingTelemetryTask(ftl::TaskScheduler *taskScheduler, void *arg) {
+	ftl::TaskCounter counter(taskScheduler);
+	taskScheduler->AddTask({BlockedTelemetryTask, arg}, ftl::TaskPriority::Low, &counter);
+	taskScheduler->WaitForCounter(&counter);
+}
+
+TEST_CASE("Worker Telemetry", "[utility]") {
+	ftl::TaskSchedulerInitOptions options;
+	options.ThreadPoolSize = 4;
+	options.FiberPoolSize = 64;
+	options.Behavior = ftl::EmptyQueueBehavior::Sleep;
+
+	CallbackLog log;
+	options.Callbacks.Context = &log;
+	options.Callbacks.OnTaskStateChanged = [](void *context, unsigned fiberIndex, ftl::TaskFunction function, void const *counter, ftl::TaskState newState) {
+		REQUIRE(function != nullptr);
+		auto *values = static_cast<CallbackLog *>(context);
+
+		std::lock_guard<std::mutex> guard(values->Lock);
+		if (newState == ftl::TaskState::Started) {
+			++values->TasksStarted;
+			if (counter == nullptr) {
+				++values->TasksWithoutCounter;
+			}
+			values->RunningFibers.push_back(fiberIndex);
+			return;
+		}
+
+		++values->TasksFinished;
+		auto const iter = std::find(values->RunningFibers.begin(), values->RunningFibers.end(), fiberIndex);
+		if (iter == values->RunningFibers.end()) {
+			values->Mismatched = true;
+		} else {
+			values->RunningFibers.erase(iter);
+		}
+	};
+	options.Callbacks.OnTasksAdded = [](void *context, unsigned /*fiberIndex*/, void const *counter, unsigned taskCount) {
+		REQUIRE(counter != nullptr);
+		auto *values = static_cast<CallbackLog *>(context);
+
+		std::lock_guard<std::mutex> guard(values->Lock);
+		values->TasksAdded += taskCount;
+	};
+	options.Callbacks.OnCounterWaitStateChanged = [](void *context, unsigned /*fiberIndex*/, void const *counter, unsigned /*targetValue*/, ftl::CounterWaitState newState) {
+		REQUIRE(counter != nullptr);
+		auto *values = static_cast<CallbackLog *>(context);
+
+		std::lock_guard<std::mutex> guard(values->Lock);
+		if (newState == ftl::CounterWaitState::Waiting) {
+			++values->Waits;
+			values->WaitEvents.fetch_add(1, std::memory_order_release);
+		} else if (newState == ftl::CounterWaitState::Resumed) {
+			++values->Resumes;
+		} else {
+			++values->SatisfiedWaits;
+		}
+	};
+
+	ftl::TaskScheduler taskScheduler;
+	REQUIRE(taskScheduler.Init(options) == 0);
+
+	std::vector<ftl::Task> tasks(kNumTelemetryTasks, ftl::Task{EmptyTelemetryTask, nullptr});
+	ftl::TaskCounter counter(&taskScheduler);
+	taskScheduler.AddTasks(kNumTelemetryTasks, tasks.data(), ftl::TaskPriority::High, &counter);
+	taskScheduler.AddTask({WaitingTelemetryTask, &log}, ftl::TaskPriority::Low, &counter);
+	taskScheduler.WaitForCounter(&counter);
+
+	{
+		std::lock_guard<std::mutex> guard(log.Lock);
+		// Every task, plus the child of WaitingTelemetryTask
+		REQUIRE(log.TasksStarted == kNumTelemetryTasks + 2);
+		REQUIRE(log.TasksFinished == log.TasksStarted);
+		REQUIRE(log.TasksAdded == log.TasksStarted);
+		REQUIRE(log.TasksWithoutCounter == 0);
+		REQUIRE(log.RunningFibers.empty());
+		REQUIRE_FALSE(log.Mismatched);
+		REQUIRE(log.Waits >= 1);
+		REQUIRE(log.Resumes == log.Waits);
+		// The main fiber's wait, and WaitingTelemetryTask's
+		REQUIRE(log.Waits + log.SatisfiedWaits == 2);
+	}
+
+#if FTL_TELEMETRY
+	ftl::WorkerTelemetry total{};
+	for (unsigned i = 0; i < taskScheduler.GetThreadCount(); ++i) {
+		ftl::WorkerTelemetry const telemetry = taskScheduler.GetWorkerTelemetry(i);
+		total.HiPriTasksRun += telemetry.HiPriTasksRun;
+		total.LoPriTasksRun += telemetry.LoPriTasksRun;
+		total.StealAttempts += telemetry.StealAttempts;
+		total.Steals += telemetry.Steals;
+		total.FiberSwitches += telemetry.FiberSwitches;
+		total.HiPriQueueHighWater = std::max(total.HiPriQueueHighWater, telemetry.HiPriQueueHighWater);
+		total.ReadyFibersResumed += telemetry.ReadyFibersResumed;
+	}
+
+	REQUIRE(total.HiPriTasksRun == kNumTelemetryTasks);
+	REQUIRE(total.LoPriTasksRun == 2);
+	REQUIRE(total.HiPriQueueHighWater >= kNumTelemetryTasks);
+	REQUIRE(total.StealAttempts >= total.Steals);
+	REQUIRE(total.FiberSwitches > 0);
+	REQUIRE(total.ReadyFibersResumed >= 1);
+#else
+	ftl::WorkerTelemetry const telemetry = taskScheduler.GetWorkerTelemetry(0);
+	REQUIRE(telemetry.HiPriTasksRun == 0);
+	REQUIRE(telemetry.FiberSwitches == 0);
+#endif
+}
@@ -0,0 +1,151 @@
+/**
+ * FiberTaskingLib - A tasking library that uses fibers for efficient task switching
+ *
+ * This library was created as a proof of concept of the ideas presented by
+ * Christian Gyrling in his 2015 GDC Talk 'Parallelizing the Naughty Dog Engine Using Fibers'
+ *
+ * http://gdcvault.com/play/1022186/Parallelizing-the-Naughty-Dog-Engine
+ *
+ * FiberTaskingLib is the legal property of Adrian Astley
+ * Copyright Adrian Astley 2015 - 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ftl/config.h"
+#include "ftl/ftl_valgrind.h"
+#include "ftl/wait_free_queue.h"
+
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_CASE("WaitFreeQueue PushBatch", "[utility]") {
+	ftl::WaitFreeQueue<unsigned> queue;
+
+	// Big enough to force a few grows in one batch
+	constexpr unsigned kBatchSize = 1000;
+	queue.PushBatch(kBatchSize, [](size_t const i) {
+		return static_cast<unsigned>(i);
+	});
+
+	// Pop is LIFO
+	unsigned value;
+	for (unsigned i = kBatchSize; i > 0; --i) {
+		REQUIRE(queue.Pop(&value));
+		REQUIRE(value == i - 1);
+	}
+	REQUIRE_FALSE(queue.Pop(&value));
+	REQUIRE(queue.IsEmpty());
+}
+
+TEST_CASE("WaitFreeQueue StealBatch", "[utility]") {
+	ftl::WaitFreeQueue<unsigned> victim;
+	ftl::WaitFreeQueue<unsigned> thief;
+
+	constexpr unsigned kNumItems = 40;
+	victim.PushBatch(kNumItems, [](size_t const i) {
+		return static_cast<unsigned>(i);
+	});
+
+	unsigned buffer[63];
+	unsigned value;
+	// Steal is FIFO. We get the oldest item, plus half of the rest
+	REQUIRE(victim.StealBatch(&thief, &value, 64, buffer) == 1 + (kNumItems - 1) / 2);
+	REQUIRE(value == 0);
+
+	// The rest of the stolen items are in the thief's queue, in the same order
+	unsigned stolen = 0;
+	while (thief.Pop(&value)) {
+		REQUIRE(value == (kNumItems - 1) / 2 - stolen);
+		++stolen;
+	}
+	REQUIRE(stolen == (kNumItems - 1) / 2);
+
+	// maxCount is respected
+	REQUIRE(victim.StealBatch(&thief, &value, 4, buffer) == 4);
+
+	// And nothing gets stolen from an empty queue
+	ftl::WaitFreeQueue<unsigned> empty;
+	REQUIRE(empty.StealBatch(&thief, &value, 64, buffer) == 0);
+}
+
+TEST_CASE("WaitFreeQueue Concurrent Steals", "[utility]") {
+	constexpr unsigned kNumItems = 200000;
+	constexpr unsigned kNumThieves = 3;
+
+	ftl::WaitFreeQueue<unsigned> victim;
+	std::vector<std::atomic<unsigned>> taken(kNumItems);
+	for (auto &count : taken) {
+		count.store(0);
+	}
+	std::atomic<unsigned> totalTaken(0);
+	FTL_VALGRIND_HG_DISABLE_CHECKING(&totalTaken, sizeof(totalTaken));
+
+	std::vector<std::thread> thieves;
+	for (unsigned i = 0; i < kNumThieves; ++i) {
+		thieves.emplace_back([&victim, &taken, &totalTaken] {
+			ftl::WaitFreeQueue<unsigned> local;
+			unsigned buffer[15];
+			unsigned value;
+			while (totalTaken.load(std::memory_order_relaxed) < kNumItems) {
+				if (victim.StealBatch(&local, &value, 16, buffer) == 0) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				do {
+					taken[value].fetch_add(1);
+					totalTaken.fetch_add(1);
+				} while (local.Pop(&value));
+			}
+		});
+	}
+
+	// The owner pushes in small batches, which grows the queue while the thieves are reading from it,
+	// and pops some items back itself
+	unsigned next = 0;
+	unsigned value;
+	while (next < kNumItems) {
+		unsigned const count = std::min(7U, kNumItems - next);
+		victim.PushBatch(count, [next](size_t const i) {
+			return next + static_cast<unsigned>(i);
+		});
+		next += count;
+
+		if (next % 3 == 0 && victim.Pop(&value)) {
+			taken[value].fetch_add(1);
+			totalTaken.fetch_add(1);
+		}
+	}
+	while (victim.Pop(&value)) {
+		taken[value].fetch_add(1);
+		totalTaken.fetch_add(1);
+	}
+
+	for (auto &thief : thieves) {
+		thief.join();
+	}
+
+	// Every item was taken exactly once
+	REQUIRE(totalTaken.load() == kNumItems);
+	unsigned wrongCount = 0;
+	for (auto &count : taken) {
+		if (count.load() != 1) {
+			++wrongCount;
+		}
+	}
+	REQUIRE(wrongCount == 0);
+}